@@ -0,0 +1,208 @@
+// three stage load / proc / save pipeline over a batch of images
+
+#include "batch_pipeline.h"
+#include "realcugan.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+BatchQueue::BatchQueue(int _capacity)
+{
+    capacity = _capacity > 0 ? _capacity : 1;
+    closed = false;
+}
+
+void BatchQueue::put(const BatchTask& task)
+{
+    std::unique_lock<std::mutex> lk(lock);
+
+    while (tasks.size() >= capacity)
+        not_full.wait(lk);
+
+    tasks.push_back(task);
+
+    not_empty.notify_one();
+}
+
+bool BatchQueue::get(BatchTask& task)
+{
+    std::unique_lock<std::mutex> lk(lock);
+
+    while (tasks.empty() && !closed)
+        not_empty.wait(lk);
+
+    if (tasks.empty())
+        return false;
+
+    task = tasks.front();
+    tasks.pop_front();
+
+    not_full.notify_one();
+
+    return true;
+}
+
+void BatchQueue::close()
+{
+    std::lock_guard<std::mutex> lg(lock);
+
+    closed = true;
+
+    not_empty.notify_all();
+}
+
+BatchPipeline::BatchPipeline()
+{
+    load_threads = 1;
+    proc_threads = 1;
+    save_threads = 1;
+    queue_size = 2;
+    trace = 0;
+
+    stats.succeeded = 0;
+    stats.failed = 0;
+    stats.load_ms = 0;
+    stats.proc_ms = 0;
+    stats.save_ms = 0;
+    stats.wall_ms = 0;
+}
+
+int BatchPipeline::run(int count, const StageFunc& load, const StageFunc& proc, const StageFunc& save, std::vector<int>& status)
+{
+    typedef std::chrono::steady_clock clock;
+
+    status.assign(count > 0 ? count : 0, -1);
+
+    stats.succeeded = 0;
+    stats.failed = 0;
+    stats.load_ms = 0;
+    stats.proc_ms = 0;
+    stats.save_ms = 0;
+    stats.wall_ms = 0;
+
+    if (count <= 0)
+        return 0;
+
+    BatchQueue toproc(queue_size);
+    BatchQueue tosave(queue_size);
+
+    std::mutex stats_lock;
+    std::atomic<int> next_index(0);
+    std::atomic<int> loaders_left(std::max(load_threads, 1));
+    std::atomic<int> procs_left(std::max(proc_threads, 1));
+
+    // run one stage on task, a failure ends the journey of the task
+    auto timed = [&](const StageFunc& func, BatchTask& task, double& busy_ms, const char* name) {
+        clock::time_point t0 = clock::now();
+        int ret = func(task);
+        clock::time_point t1 = clock::now();
+
+        if (trace)
+            trace->record(name, std::chrono::duration_cast<std::chrono::nanoseconds>(t0.time_since_epoch()).count(), std::chrono::duration_cast<std::chrono::nanoseconds>(t1.time_since_epoch()).count());
+
+        std::lock_guard<std::mutex> lg(stats_lock);
+        busy_ms += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        if (ret != 0)
+        {
+            status[task.index] = ret;
+            stats.failed++;
+        }
+        return ret;
+    };
+
+    auto load_loop = [&]() {
+        if (trace)
+            trace->set_thread_name("load");
+
+        for (;;)
+        {
+            BatchTask task;
+            task.index = next_index++;
+            if (task.index >= count)
+                break;
+
+            if (timed(load, task, stats.load_ms, "decode") == 0)
+                toproc.put(task);
+        }
+
+        // the last loader out lets the proc stage drain
+        if (--loaders_left == 0)
+            toproc.close();
+    };
+
+    auto proc_loop = [&]() {
+        if (trace)
+            trace->set_thread_name("proc");
+
+        BatchTask task;
+        while (toproc.get(task))
+        {
+            if (timed(proc, task, stats.proc_ms, "proc") != 0)
+                continue;
+
+            // the decoded input is no longer needed
+            task.inimage.release();
+            tosave.put(task);
+        }
+
+        if (--procs_left == 0)
+            tosave.close();
+    };
+
+    auto save_loop = [&]() {
+        if (trace)
+            trace->set_thread_name("save");
+
+        BatchTask task;
+        while (tosave.get(task))
+        {
+            if (timed(save, task, stats.save_ms, "encode") != 0)
+                continue;
+
+            std::lock_guard<std::mutex> lg(stats_lock);
+            status[task.index] = 0;
+            stats.succeeded++;
+        }
+    };
+
+    clock::time_point t0 = clock::now();
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < std::max(load_threads, 1); i++)
+        threads.push_back(std::thread(load_loop));
+    for (int i = 0; i < std::max(proc_threads, 1); i++)
+        threads.push_back(std::thread(proc_loop));
+    for (int i = 0; i < std::max(save_threads, 1); i++)
+        threads.push_back(std::thread(save_loop));
+
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+
+    stats.wall_ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+
+    return stats.failed == 0 ? 0 : -1;
+}
+
+BatchPipeline::StageFunc BatchPipeline::process_stage(const RealCUGAN& realcugan, const RealCUGANCancel* cancel)
+{
+    const RealCUGAN* r = &realcugan;
+
+    return [r, cancel](BatchTask& task) {
+        const ncnn::Mat& in = task.inimage;
+
+        if (cancel && cancel->check() != 0)
+            return cancel->check();
+
+        task.outimage.create(in.w * r->scale, in.h * r->scale, (size_t)in.elempack, in.elempack);
+        if (task.outimage.empty())
+            return -100;
+
+        if (cancel)
+            return r->process(in, task.outimage, *cancel);
+
+        return r->process(in, task.outimage);
+    };
+}
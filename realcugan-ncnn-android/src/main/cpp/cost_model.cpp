@@ -0,0 +1,385 @@
+// analytic cost of one inference of a loaded ncnn graph
+
+#include "cost_model.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+int read_param_layers(const char* text, std::vector<ParamLayer>& layers)
+{
+    layers.clear();
+
+    int magic = 0;
+    int n = 0;
+    if (sscanf(text, "%d%n", &magic, &n) != 1 || magic != 7767517)
+    {
+        fprintf(stderr, "param is too old or not a text param\n");
+        return -1;
+    }
+    text += n;
+
+    int layer_count = 0;
+    int blob_count = 0;
+    if (sscanf(text, "%d %d%n", &layer_count, &blob_count, &n) != 2 || layer_count <= 0)
+        return -1;
+    text += n;
+
+    for (int i = 0; i < layer_count; i++)
+    {
+        char type[256];
+        char name[256];
+        int bottom_count = 0;
+        int top_count = 0;
+        if (sscanf(text, "%255s %255s %d %d%n", type, name, &bottom_count, &top_count, &n) != 4)
+            return -1;
+        text += n;
+
+        for (int j = 0; j < bottom_count + top_count; j++)
+        {
+            char blob[256];
+            if (sscanf(text, "%255s%n", blob, &n) != 1)
+                return -1;
+            text += n;
+        }
+
+        ParamLayer layer;
+        layer.type = type;
+        layer.name = name;
+        layer.num_output = 0;
+        layer.weight_data_size = 0;
+        layer.int8_scale_term = 0;
+
+        // the rest of the line is id=value pairs, arrays have ids below -23300
+        const char* eol = strchr(text, '\n');
+        const std::string line = eol ? std::string(text, eol) : std::string(text);
+        text = eol ? eol + 1 : text + line.size();
+
+        size_t pos = 0;
+        while (pos < line.size())
+        {
+            while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t' || line[pos] == '\r'))
+                pos++;
+
+            const size_t end = std::min(line.find_first_of(" \t\r", pos), line.size());
+            const std::string token = line.substr(pos, end - pos);
+            pos = end;
+
+            const size_t eq = token.find('=');
+            if (eq == std::string::npos)
+                continue;
+
+            const int id = atoi(token.substr(0, eq).c_str());
+            if (id == 0)
+                layer.num_output = atoi(token.c_str() + eq + 1);
+            if (id == 6)
+                layer.weight_data_size = atoi(token.c_str() + eq + 1);
+            if (id == 8 && layer.type == "Convolution")
+                layer.int8_scale_term = atoi(token.c_str() + eq + 1);
+        }
+
+        layers.push_back(layer);
+    }
+
+    return 0;
+}
+
+int BlobShape::width(int in_w) const
+{
+    return std::max((int)(ratio_w * in_w + 0.5f) - shrink_w, 1);
+}
+
+int BlobShape::height(int in_h) const
+{
+    return std::max((int)(ratio_h * in_h + 0.5f) - shrink_h, 1);
+}
+
+// channels, width and height of a probed blob, packed elements unpacked
+static void probe_shape(const ncnn::Mat& m, int& c, int& w, int& h)
+{
+    c = 0;
+    w = 0;
+    h = 0;
+
+    if (m.empty())
+        return;
+
+    if (m.dims == 1)
+    {
+        c = 1;
+        w = m.w * m.elempack;
+        h = 1;
+    }
+    else if (m.dims == 2)
+    {
+        c = 1;
+        w = m.w;
+        h = m.h * m.elempack;
+    }
+    else
+    {
+        c = m.c * m.elempack * (m.dims == 4 ? m.d : 1);
+        w = m.w;
+        h = m.h;
+    }
+}
+
+CostModel::CostModel()
+{
+    weights = 0;
+}
+
+void CostModel::clear()
+{
+    layers.clear();
+    blobs.clear();
+    weights = 0;
+}
+
+bool CostModel::empty() const
+{
+    return layers.empty();
+}
+
+int CostModel::build(const ncnn::Net& net, const std::vector<ParamLayer>& params, int size0)
+{
+    clear();
+
+    const std::vector<ncnn::Layer*>& netlayers = net.layers();
+    const std::vector<ncnn::Blob>& netblobs = net.blobs();
+
+    if (params.size() != netlayers.size())
+    {
+        fprintf(stderr, "param has %d layers but the net %d\n", (int)params.size(), (int)netlayers.size());
+        return -1;
+    }
+
+    // every blob of two blank inputs, sides are linear in the input side as all convs are unpadded
+    const int size1 = size0 + 8;
+
+    std::vector<ncnn::Mat> probes[2];
+    for (int t = 0; t < 2; t++)
+    {
+        const int size = t == 0 ? size0 : size1;
+
+        ncnn::Mat in(size, size, 3);
+        in.fill(0.f);
+
+        ncnn::Extractor ex = net.create_extractor();
+        ex.set_light_mode(false);
+
+        ex.input("in0", in);
+
+        probes[t].resize(netblobs.size());
+        for (size_t b = 0; b < netblobs.size(); b++)
+        {
+            // blobs the output does not depend on stay empty
+            if (netblobs[b].producer >= 0 && netlayers[netblobs[b].producer]->type != "Input")
+                ex.extract((int)b, probes[t][b]);
+            else if (netblobs[b].name == "in0")
+                probes[t][b] = in;
+        }
+    }
+
+    blobs.resize(netblobs.size());
+    for (size_t b = 0; b < netblobs.size(); b++)
+    {
+        int c0, w0, h0;
+        int c1, w1, h1;
+        probe_shape(probes[0][b], c0, w0, h0);
+        probe_shape(probes[1][b], c1, w1, h1);
+
+        BlobShape& s = blobs[b];
+        s.c = c0;
+        s.ratio_w = (float)(w1 - w0) / (size1 - size0);
+        s.shrink_w = (int)(s.ratio_w * size0 + 0.5f) - w0;
+        s.ratio_h = (float)(h1 - h0) / (size1 - size0);
+        s.shrink_h = (int)(s.ratio_h * size0 + 0.5f) - h0;
+        s.alias = -1;
+    }
+
+    layers.resize(netlayers.size());
+    for (size_t i = 0; i < netlayers.size(); i++)
+    {
+        const ncnn::Layer* layer = netlayers[i];
+        const ParamLayer& param = params[i];
+
+        LayerCost& l = layers[i];
+        l.type = layer->type;
+        l.name = layer->name;
+        l.bottoms = layer->bottoms;
+        l.tops = layer->tops;
+        l.flops_per_pixel = 0;
+        l.pixel_blob = -1;
+        l.flops_fixed = 0;
+        l.weights = param.weight_data_size;
+
+        weights += l.weights;
+
+        // a multiply and an add per weight and output pixel, deconvolutions per input pixel
+        if (l.type == "Convolution" || l.type == "ConvolutionDepthWise")
+        {
+            l.flops_per_pixel = 2.0 * param.weight_data_size;
+            l.pixel_blob = l.tops[0];
+        }
+        else if (l.type == "Deconvolution" || l.type == "DeconvolutionDepthWise")
+        {
+            l.flops_per_pixel = 2.0 * param.weight_data_size;
+            l.pixel_blob = l.bottoms[0];
+        }
+        else if (l.type == "InnerProduct")
+        {
+            l.flops_fixed = 2.0 * param.weight_data_size;
+        }
+        else if (l.type == "Pooling")
+        {
+            l.flops_per_pixel = blobs[l.bottoms[0]].c;
+            l.pixel_blob = l.bottoms[0];
+        }
+        else if (l.type == "CuganSE")
+        {
+            // both inner products, then a multiply per element and a sum as well when the layer pools itself
+            // the top is the bottom scaled in place
+            l.flops_fixed = 2.0 * param.weight_data_size;
+            l.flops_per_pixel = (l.bottoms.size() == 1 ? 2.0 : 1.0) * blobs[l.bottoms[0]].c;
+            l.pixel_blob = l.bottoms[0];
+            blobs[l.tops[0]].alias = l.bottoms[0];
+        }
+        else if (l.type == "Split")
+        {
+            for (size_t j = 0; j < l.tops.size(); j++)
+                blobs[l.tops[j]].alias = l.bottoms[0];
+        }
+        else if (l.type != "Input" && l.type != "Crop" && !l.tops.empty())
+        {
+            // elementwise
+            l.flops_per_pixel = blobs[l.tops[0]].c;
+            l.pixel_blob = l.tops[0];
+        }
+    }
+
+    return 0;
+}
+
+double CostModel::layer_flops(int i, int in_w, int in_h) const
+{
+    const LayerCost& l = layers[i];
+
+    double flops = l.flops_fixed;
+    if (l.pixel_blob >= 0)
+    {
+        const BlobShape& s = blobs[l.pixel_blob];
+        flops += l.flops_per_pixel * s.width(in_w) * s.height(in_h);
+    }
+
+    return flops;
+}
+
+double CostModel::flops(int in_w, int in_h, int blob) const
+{
+    std::vector<char> needed(layers.size(), blob < 0 ? 1 : 0);
+
+    if (blob >= 0)
+    {
+        std::vector<int> producer(blobs.size(), -1);
+        for (size_t i = 0; i < layers.size(); i++)
+        {
+            for (size_t j = 0; j < layers[i].tops.size(); j++)
+                producer[layers[i].tops[j]] = (int)i;
+        }
+
+        std::vector<int> pending(1, blob);
+        while (!pending.empty())
+        {
+            const int b = pending.back();
+            pending.pop_back();
+
+            const int p = producer[b];
+            if (p < 0 || needed[p])
+                continue;
+
+            needed[p] = 1;
+            pending.insert(pending.end(), layers[p].bottoms.begin(), layers[p].bottoms.end());
+        }
+    }
+
+    double sum = 0;
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        if (needed[i])
+            sum += layer_flops((int)i, in_w, in_h);
+    }
+
+    return sum;
+}
+
+size_t CostModel::blob_bytes(int blob, int in_w, int in_h, size_t elemsize) const
+{
+    const BlobShape& s = blobs[blob];
+
+    return (size_t)s.width(in_w) * s.height(in_h) * s.c * elemsize;
+}
+
+size_t CostModel::peak_blob_bytes(int in_w, int in_h, size_t elemsize) const
+{
+    // aliases live as long as the last consumer of any of them
+    std::vector<int> last(blobs.size(), -1);
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        for (size_t j = 0; j < layers[i].bottoms.size(); j++)
+        {
+            int b = layers[i].bottoms[j];
+            while (blobs[b].alias >= 0)
+                b = blobs[b].alias;
+
+            last[b] = std::max(last[b], (int)i);
+        }
+    }
+
+    size_t live = 0;
+    size_t peak = 0;
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        for (size_t j = 0; j < layers[i].tops.size(); j++)
+        {
+            const int t = layers[i].tops[j];
+            if (blobs[t].alias < 0)
+                live += blob_bytes(t, in_w, in_h, elemsize);
+        }
+
+        peak = std::max(peak, live);
+
+        for (size_t j = 0; j < layers[i].bottoms.size(); j++)
+        {
+            int b = layers[i].bottoms[j];
+            while (blobs[b].alias >= 0)
+                b = blobs[b].alias;
+
+            if (last[b] == (int)i)
+            {
+                live -= blob_bytes(b, in_w, in_h, elemsize);
+                last[b] = -1;
+            }
+        }
+    }
+
+    return peak;
+}
+
+double CostModel::traffic_bytes(int in_w, int in_h, size_t elemsize) const
+{
+    double bytes = (double)weights * elemsize;
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        // the tops of Split share the data of its bottom
+        if (layers[i].type == "Split")
+            continue;
+
+        for (size_t j = 0; j < layers[i].bottoms.size(); j++)
+            bytes += blob_bytes(layers[i].bottoms[j], in_w, in_h, elemsize);
+        for (size_t j = 0; j < layers[i].tops.size(); j++)
+            bytes += blob_bytes(layers[i].tops[j], in_w, in_h, elemsize);
+    }
+
+    return bytes;
+}
@@ -0,0 +1,707 @@
+// fused squeeze-excitation layer and the .param rewrite that puts it in
+
+#include "cugan_se.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#if __ARM_NEON
+#include <arm_neon.h>
+#endif
+#if __SSE2__
+#include <emmintrin.h>
+#endif
+#if __AVX__
+#include <immintrin.h>
+#endif
+
+// ncnn
+#include "gpu.h"
+
+#include "cugan_se_mean.comp.hex.h"
+#include "cugan_se_excite.comp.hex.h"
+#include "cugan_se_scale.comp.hex.h"
+
+CuganSE::CuganSE()
+{
+    one_blob_only = true;
+    support_inplace = true;
+    support_packing = true;
+    support_vulkan = true;
+
+    channels = 0;
+    hidden = 0;
+    gap_input = 0;
+
+#if NCNN_VULKAN
+    pipeline_mean = 0;
+    pipeline_excite = 0;
+    pipeline_scale = 0;
+#endif
+}
+
+int CuganSE::load_param(const ncnn::ParamDict& pd)
+{
+    channels = pd.get(0, 0);
+    hidden = pd.get(1, 0);
+    gap_input = pd.get(2, 0);
+
+    one_blob_only = !gap_input;
+
+    // the excite shader keeps the hidden layer in 64 shared floats
+    if (channels <= 0 || hidden <= 0 || hidden > 64)
+    {
+        fprintf(stderr, "CuganSE with %d channels and %d hidden is not supported\n", channels, hidden);
+        return -1;
+    }
+
+    return 0;
+}
+
+int CuganSE::load_model(const ncnn::ModelBin& mb)
+{
+    // the two InnerProduct layers as exported, weights in their stored precision and fp32 bias
+    weight1 = mb.load(hidden * channels, 0);
+    bias1 = mb.load(hidden, 1);
+    weight2 = mb.load(channels * hidden, 0);
+    bias2 = mb.load(channels, 1);
+
+    if (weight1.empty() || bias1.empty() || weight2.empty() || bias2.empty())
+        return -100;
+
+    // inner products of int8 models keep fp16 weights, anything else is not what fuse_se_param saw
+    if (weight1.elemsize != 4 || weight2.elemsize != 4)
+    {
+        fprintf(stderr, "CuganSE expects fp32 or fp16 weights\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int CuganSE::create_pipeline(const ncnn::Option& opt)
+{
+#if NCNN_VULKAN
+    if (!opt.use_vulkan_compute || !vkdev)
+        return 0;
+
+    std::vector<uint32_t> spirv;
+    std::vector<ncnn::vk_specialization_type> specializations;
+
+    compile_spirv_module(cugan_se_mean_comp_data, sizeof(cugan_se_mean_comp_data), opt, spirv);
+    pipeline_mean = new ncnn::Pipeline(vkdev);
+    pipeline_mean->set_local_size_xyz(64, 1, 1);
+    pipeline_mean->create(spirv.data(), spirv.size() * 4, specializations);
+
+    specializations.resize(1);
+    specializations[0].i = gap_input;
+
+    spirv.clear();
+    compile_spirv_module(cugan_se_excite_comp_data, sizeof(cugan_se_excite_comp_data), opt, spirv);
+    pipeline_excite = new ncnn::Pipeline(vkdev);
+    pipeline_excite->set_local_size_xyz(64, 1, 1);
+    pipeline_excite->create(spirv.data(), spirv.size() * 4, specializations);
+
+    specializations.clear();
+
+    spirv.clear();
+    compile_spirv_module(cugan_se_scale_comp_data, sizeof(cugan_se_scale_comp_data), opt, spirv);
+    pipeline_scale = new ncnn::Pipeline(vkdev);
+    pipeline_scale->set_local_size_xyz(64, 1, 1);
+    pipeline_scale->create(spirv.data(), spirv.size() * 4, specializations);
+#else
+    (void)opt;
+#endif // NCNN_VULKAN
+
+    return 0;
+}
+
+int CuganSE::destroy_pipeline(const ncnn::Option& /*opt*/)
+{
+#if NCNN_VULKAN
+    delete pipeline_mean;
+    pipeline_mean = 0;
+
+    delete pipeline_excite;
+    pipeline_excite = 0;
+
+    delete pipeline_scale;
+    pipeline_scale = 0;
+#endif // NCNN_VULKAN
+
+    return 0;
+}
+
+void CuganSE::excite(const float* gap, float* scales) const
+{
+    const float* w1 = weight1;
+    const float* b1 = bias1;
+    const float* w2 = weight2;
+    const float* b2 = bias2;
+
+    float h[64];
+    for (int j = 0; j < hidden; j++)
+    {
+        const float* w = w1 + j * channels;
+
+        float sum = b1[j];
+        for (int q = 0; q < channels; q++)
+            sum += w[q] * gap[q];
+
+        h[j] = std::max(sum, 0.f);
+    }
+
+    for (int q = 0; q < channels; q++)
+    {
+        const float* w = w2 + q * hidden;
+
+        float sum = b2[q];
+        for (int j = 0; j < hidden; j++)
+            sum += w[j] * h[j];
+
+        scales[q] = 1.f / (1.f + expf(-sum));
+    }
+}
+
+// mean of every unpacked channel, the lanes of a packed channel are consecutive channels
+static void mean_channels(const ncnn::Mat& m, float* mean, const ncnn::Option& opt)
+{
+    const int size = m.w * m.h * m.d;
+    const int elempack = m.elempack;
+    const float inv_size = 1.f / size;
+
+    #pragma omp parallel for num_threads(opt.num_threads)
+    for (int q = 0; q < m.c; q++)
+    {
+        const float* ptr = m.channel(q);
+        float* outptr = mean + q * elempack;
+
+#if __ARM_NEON
+        if (elempack == 4)
+        {
+            float32x4_t _sum = vdupq_n_f32(0.f);
+            for (int i = 0; i < size; i++)
+            {
+                _sum = vaddq_f32(_sum, vld1q_f32(ptr));
+                ptr += 4;
+            }
+            vst1q_f32(outptr, vmulq_n_f32(_sum, inv_size));
+            continue;
+        }
+#endif // __ARM_NEON
+#if __AVX__
+        if (elempack == 8)
+        {
+            __m256 _sum = _mm256_setzero_ps();
+            for (int i = 0; i < size; i++)
+            {
+                _sum = _mm256_add_ps(_sum, _mm256_loadu_ps(ptr));
+                ptr += 8;
+            }
+            _mm256_storeu_ps(outptr, _mm256_mul_ps(_sum, _mm256_set1_ps(inv_size)));
+            continue;
+        }
+#endif // __AVX__
+#if __SSE2__
+        if (elempack == 4)
+        {
+            __m128 _sum = _mm_setzero_ps();
+            for (int i = 0; i < size; i++)
+            {
+                _sum = _mm_add_ps(_sum, _mm_loadu_ps(ptr));
+                ptr += 4;
+            }
+            _mm_storeu_ps(outptr, _mm_mul_ps(_sum, _mm_set1_ps(inv_size)));
+            continue;
+        }
+#endif // __SSE2__
+
+        if (elempack == 1)
+        {
+            // four partial sums keep the adds independent
+            float sum0 = 0.f;
+            float sum1 = 0.f;
+            float sum2 = 0.f;
+            float sum3 = 0.f;
+            int i = 0;
+            for (; i + 3 < size; i += 4)
+            {
+                sum0 += ptr[i];
+                sum1 += ptr[i + 1];
+                sum2 += ptr[i + 2];
+                sum3 += ptr[i + 3];
+            }
+            for (; i < size; i++)
+                sum0 += ptr[i];
+
+            outptr[0] = (sum0 + sum1 + sum2 + sum3) * inv_size;
+            continue;
+        }
+
+        for (int k = 0; k < elempack; k++)
+        {
+            float sum = 0.f;
+            for (int i = 0; i < size; i++)
+                sum += ptr[i * elempack + k];
+
+            outptr[k] = sum * inv_size;
+        }
+    }
+}
+
+static void scale_channels(ncnn::Mat& m, const float* scales, const ncnn::Option& opt)
+{
+    const int size = m.w * m.h * m.d;
+    const int elempack = m.elempack;
+
+    #pragma omp parallel for num_threads(opt.num_threads)
+    for (int q = 0; q < m.c; q++)
+    {
+        float* ptr = m.channel(q);
+        const float* s = scales + q * elempack;
+
+#if __ARM_NEON
+        if (elempack == 4)
+        {
+            float32x4_t _s = vld1q_f32(s);
+            for (int i = 0; i < size; i++)
+            {
+                vst1q_f32(ptr, vmulq_f32(vld1q_f32(ptr), _s));
+                ptr += 4;
+            }
+            continue;
+        }
+        if (elempack == 1)
+        {
+            float32x4_t _s = vdupq_n_f32(s[0]);
+            int i = 0;
+            for (; i + 3 < size; i += 4)
+            {
+                vst1q_f32(ptr, vmulq_f32(vld1q_f32(ptr), _s));
+                ptr += 4;
+            }
+            for (; i < size; i++)
+                *ptr++ *= s[0];
+            continue;
+        }
+#endif // __ARM_NEON
+#if __AVX__
+        if (elempack == 8)
+        {
+            __m256 _s = _mm256_loadu_ps(s);
+            for (int i = 0; i < size; i++)
+            {
+                _mm256_storeu_ps(ptr, _mm256_mul_ps(_mm256_loadu_ps(ptr), _s));
+                ptr += 8;
+            }
+            continue;
+        }
+#endif // __AVX__
+#if __SSE2__
+        if (elempack == 4)
+        {
+            __m128 _s = _mm_loadu_ps(s);
+            for (int i = 0; i < size; i++)
+            {
+                _mm_storeu_ps(ptr, _mm_mul_ps(_mm_loadu_ps(ptr), _s));
+                ptr += 4;
+            }
+            continue;
+        }
+        if (elempack == 1)
+        {
+            __m128 _s = _mm_set1_ps(s[0]);
+            int i = 0;
+            for (; i + 3 < size; i += 4)
+            {
+                _mm_storeu_ps(ptr, _mm_mul_ps(_mm_loadu_ps(ptr), _s));
+                ptr += 4;
+            }
+            for (; i < size; i++)
+                *ptr++ *= s[0];
+            continue;
+        }
+#endif // __SSE2__
+
+        for (int i = 0; i < size; i++)
+        {
+            for (int k = 0; k < elempack; k++)
+                ptr[k] *= s[k];
+            ptr += elempack;
+        }
+    }
+}
+
+int CuganSE::forward_inplace(std::vector<ncnn::Mat>& bottom_top_blobs, const ncnn::Option& opt) const
+{
+    ncnn::Mat& feat = bottom_top_blobs[0];
+    const ncnn::Mat& gap = bottom_top_blobs[1];
+
+    // pooled or injected means, 1d and possibly packed, either way channels floats in order
+    if (feat.c * feat.elempack != channels || (int)gap.total() * gap.elempack != channels || gap.elemsize / gap.elempack != 4)
+    {
+        fprintf(stderr, "CuganSE got %d channels and a gap of %d for %d channels\n", feat.c * feat.elempack, (int)gap.total() * gap.elempack, channels);
+        return -1;
+    }
+
+    std::vector<float> scales(channels);
+    excite(gap, scales.data());
+    scale_channels(feat, scales.data(), opt);
+
+    return 0;
+}
+
+int CuganSE::forward_inplace(ncnn::Mat& bottom_top_blob, const ncnn::Option& opt) const
+{
+    if (bottom_top_blob.c * bottom_top_blob.elempack != channels)
+    {
+        fprintf(stderr, "CuganSE got %d channels for %d\n", bottom_top_blob.c * bottom_top_blob.elempack, channels);
+        return -1;
+    }
+
+    std::vector<float> mean(channels);
+    mean_channels(bottom_top_blob, mean.data(), opt);
+
+    std::vector<float> scales(channels);
+    excite(mean.data(), scales.data());
+    scale_channels(bottom_top_blob, scales.data(), opt);
+
+    return 0;
+}
+
+#if NCNN_VULKAN
+int CuganSE::upload_model(ncnn::VkTransfer& cmd, const ncnn::Option& opt)
+{
+    // a few thousand floats, kept in fp32 whatever the blob storage
+    ncnn::Mat weight_data(hidden * channels * 2 + hidden + channels);
+    float* ptr = weight_data;
+    ptr = std::copy((const float*)weight1, (const float*)weight1 + hidden * channels, ptr);
+    ptr = std::copy((const float*)bias1, (const float*)bias1 + hidden, ptr);
+    ptr = std::copy((const float*)weight2, (const float*)weight2 + channels * hidden, ptr);
+    std::copy((const float*)bias2, (const float*)bias2 + channels, ptr);
+
+    ncnn::Option opt_fp32 = opt;
+    opt_fp32.use_fp16_packed = false;
+    opt_fp32.use_fp16_storage = false;
+
+    cmd.record_upload(weight_data, weight_data_gpu, opt_fp32);
+
+    // the cpu copies stay, excite() serves the per slot scales of the atlas path
+    return 0;
+}
+
+int CuganSE::forward_gpu(ncnn::VkMat& feat, const ncnn::VkMat* gap, ncnn::VkCompute& cmd, const ncnn::Option& opt) const
+{
+    const int elempack = feat.elempack;
+    if (elempack != 1 && elempack != 4)
+    {
+        fprintf(stderr, "CuganSE has no shader for elempack %d\n", elempack);
+        return -1;
+    }
+    if (feat.c * elempack != channels)
+    {
+        fprintf(stderr, "CuganSE got %d channels for %d\n", feat.c * elempack, channels);
+        return -1;
+    }
+
+    const int size = feat.w * feat.h * feat.d;
+
+    ncnn::VkMat mean;
+    if (!gap)
+    {
+        mean.create(channels, (size_t)4u, 1, opt.workspace_vkallocator);
+        if (mean.empty())
+            return -100;
+
+        std::vector<ncnn::VkMat> bindings(2);
+        bindings[0] = feat;
+        bindings[1] = mean;
+
+        std::vector<ncnn::vk_constant_type> constants(4);
+        constants[0].i = size;
+        constants[1].i = (int)feat.cstep;
+        constants[2].i = feat.c;
+        constants[3].i = elempack;
+
+        // one workgroup per packed channel
+        ncnn::VkMat dispatcher;
+        dispatcher.w = 64;
+        dispatcher.h = 1;
+        dispatcher.c = feat.c;
+
+        cmd.record_pipeline(pipeline_mean, bindings, constants, dispatcher);
+    }
+
+    ncnn::VkMat scales;
+    scales.create(channels, (size_t)4u, 1, opt.workspace_vkallocator);
+    if (scales.empty())
+        return -100;
+
+    {
+        std::vector<ncnn::VkMat> bindings(4);
+        // the binding the specialization does not read still needs a buffer
+        bindings[0] = gap ? *gap : mean;
+        bindings[1] = gap ? *gap : mean;
+        bindings[2] = weight_data_gpu;
+        bindings[3] = scales;
+
+        std::vector<ncnn::vk_constant_type> constants(3);
+        constants[0].i = channels;
+        constants[1].i = hidden;
+        constants[2].i = gap ? gap->elempack : 1;
+
+        ncnn::VkMat dispatcher;
+        dispatcher.w = 64;
+        dispatcher.h = 1;
+        dispatcher.c = 1;
+
+        cmd.record_pipeline(pipeline_excite, bindings, constants, dispatcher);
+    }
+
+    {
+        std::vector<ncnn::VkMat> bindings(2);
+        bindings[0] = feat;
+        bindings[1] = scales;
+
+        std::vector<ncnn::vk_constant_type> constants(4);
+        constants[0].i = size;
+        constants[1].i = (int)feat.cstep;
+        constants[2].i = feat.c;
+        constants[3].i = elempack;
+
+        ncnn::VkMat dispatcher;
+        dispatcher.w = size;
+        dispatcher.h = 1;
+        dispatcher.c = feat.c;
+
+        cmd.record_pipeline(pipeline_scale, bindings, constants, dispatcher);
+    }
+
+    return 0;
+}
+
+int CuganSE::forward_inplace(std::vector<ncnn::VkMat>& bottom_top_blobs, ncnn::VkCompute& cmd, const ncnn::Option& opt) const
+{
+    const ncnn::VkMat& gap = bottom_top_blobs[1];
+    if ((int)gap.total() * gap.elempack != channels)
+    {
+        fprintf(stderr, "CuganSE got a gap of %d for %d channels\n", (int)gap.total() * gap.elempack, channels);
+        return -1;
+    }
+
+    return forward_gpu(bottom_top_blobs[0], &gap, cmd, opt);
+}
+
+int CuganSE::forward_inplace(ncnn::VkMat& bottom_top_blob, ncnn::VkCompute& cmd, const ncnn::Option& opt) const
+{
+    return forward_gpu(bottom_top_blob, 0, cmd, opt);
+}
+#endif // NCNN_VULKAN
+
+DEFINE_LAYER_CREATOR(CuganSE)
+
+// one layer line of a text .param
+struct GraphLayer
+{
+    std::string type;
+    std::string name;
+    std::vector<std::string> bottoms;
+    std::vector<std::string> tops;
+    // id=value pairs as written
+    std::vector<std::string> params;
+    std::string line;
+    bool removed;
+};
+
+static int graph_param(const GraphLayer& l, int id, int def)
+{
+    for (size_t i = 0; i < l.params.size(); i++)
+    {
+        const std::string& p = l.params[i];
+        const size_t eq = p.find('=');
+        if (eq != std::string::npos && atoi(p.substr(0, eq).c_str()) == id)
+            return atoi(p.c_str() + eq + 1);
+    }
+
+    return def;
+}
+
+static std::vector<std::string> split_tokens(const std::string& line)
+{
+    std::vector<std::string> tokens;
+
+    size_t pos = 0;
+    while (pos < line.size())
+    {
+        while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t' || line[pos] == '\r'))
+            pos++;
+        if (pos == line.size())
+            break;
+
+        const size_t end = std::min(line.find_first_of(" \t\r", pos), line.size());
+        tokens.push_back(line.substr(pos, end - pos));
+        pos = end;
+    }
+
+    return tokens;
+}
+
+// the single consumer of blob, -1 unless there is exactly one
+static int only_consumer(const std::map<std::string, std::vector<int> >& consumers, const std::string& blob)
+{
+    std::map<std::string, std::vector<int> >::const_iterator it = consumers.find(blob);
+    return it != consumers.end() && it->second.size() == 1 ? it->second[0] : -1;
+}
+
+// layers the cugan graphs use that carry no weights, anything else may read from the .bin
+static bool weightless(const std::string& type)
+{
+    return type == "Input" || type == "Split" || type == "Crop" || type == "BinaryOp" || type == "Pooling" || type == "Eltwise" || type == "Concat" || type == "ReLU" || type == "Sigmoid" || type == "Interp" || type == "PixelShuffle";
+}
+
+int fuse_se_param(const std::string& param, bool keep_gap, std::string& fused)
+{
+    fused.clear();
+
+    std::vector<std::string> lines;
+    {
+        size_t pos = 0;
+        while (pos < param.size())
+        {
+            const size_t end = std::min(param.find('\n', pos), param.size());
+            const std::vector<std::string> tokens = split_tokens(param.substr(pos, end - pos));
+            if (!tokens.empty())
+                lines.push_back(param.substr(pos, end - pos));
+            pos = end + 1;
+        }
+    }
+
+    if (lines.size() < 2 || split_tokens(lines[0])[0] != "7767517")
+        return 0;
+
+    std::vector<GraphLayer> layers;
+    for (size_t i = 2; i < lines.size(); i++)
+    {
+        const std::vector<std::string> tokens = split_tokens(lines[i]);
+        if (tokens.size() < 4)
+            return 0;
+
+        GraphLayer l;
+        l.type = tokens[0];
+        l.name = tokens[1];
+        const int bottom_count = atoi(tokens[2].c_str());
+        const int top_count = atoi(tokens[3].c_str());
+        if (bottom_count < 0 || top_count < 0 || tokens.size() < (size_t)(4 + bottom_count + top_count))
+            return 0;
+
+        l.bottoms.assign(tokens.begin() + 4, tokens.begin() + 4 + bottom_count);
+        l.tops.assign(tokens.begin() + 4 + bottom_count, tokens.begin() + 4 + bottom_count + top_count);
+        l.params.assign(tokens.begin() + 4 + bottom_count + top_count, tokens.end());
+        l.line = lines[i];
+        l.removed = false;
+        layers.push_back(l);
+    }
+
+    std::map<std::string, int> producer;
+    std::map<std::string, std::vector<int> > consumers;
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        for (size_t j = 0; j < layers[i].tops.size(); j++)
+            producer[layers[i].tops[j]] = (int)i;
+        for (size_t j = 0; j < layers[i].bottoms.size(); j++)
+            consumers[layers[i].bottoms[j]].push_back((int)i);
+    }
+
+    int blocks = 0;
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        const GraphLayer& pool = layers[i];
+
+        // global average pooling
+        if (pool.type != "Pooling" || pool.bottoms.size() != 1 || pool.tops.size() != 1 || graph_param(pool, 0, 0) != 1 || graph_param(pool, 4, 0) != 1)
+            continue;
+
+        const int ip1 = only_consumer(consumers, pool.tops[0]);
+        if (ip1 < 0 || layers[ip1].type != "InnerProduct" || layers[ip1].tops.size() != 1 || graph_param(layers[ip1], 1, 0) != 1 || graph_param(layers[ip1], 9, 0) != 1)
+            continue;
+
+        const int ip2 = only_consumer(consumers, layers[ip1].tops[0]);
+        if (ip2 < 0 || layers[ip2].type != "InnerProduct" || layers[ip2].tops.size() != 1 || graph_param(layers[ip2], 1, 0) != 1 || graph_param(layers[ip2], 9, 0) != 4)
+            continue;
+
+        const int mul = only_consumer(consumers, layers[ip2].tops[0]);
+        if (mul < 0 || layers[mul].type != "BinaryOp" || layers[mul].bottoms.size() != 2 || layers[mul].tops.size() != 1 || graph_param(layers[mul], 0, 0) != 2 || graph_param(layers[mul], 1, 0) != 0)
+            continue;
+
+        const std::string& feat = layers[mul].bottoms[0] == layers[ip2].tops[0] ? layers[mul].bottoms[1] : layers[mul].bottoms[0];
+
+        // feat and the pooled blob are the two tops of one Split
+        std::map<std::string, int>::const_iterator sp = producer.find(feat);
+        if (sp == producer.end() || layers[sp->second].type != "Split" || layers[sp->second].tops.size() != 2)
+            continue;
+        const int split = sp->second;
+        if (producer[pool.bottoms[0]] != split || only_consumer(consumers, feat) != mul || only_consumer(consumers, pool.bottoms[0]) != (int)i)
+            continue;
+
+        const int hidden = graph_param(layers[ip1], 0, 0);
+        const int channels = graph_param(layers[ip2], 0, 0);
+        if (hidden <= 0 || hidden > 64 || channels <= 0 || graph_param(layers[ip1], 2, 0) != hidden * channels || graph_param(layers[ip2], 2, 0) != channels * hidden)
+            continue;
+
+        // CuganSE reads both weight sets where the first InnerProduct read its own
+        bool contiguous = ip1 < ip2;
+        for (int j = ip1 + 1; j < ip2 && contiguous; j++)
+            contiguous = weightless(layers[j].type);
+        if (!contiguous)
+            continue;
+
+        char line[256];
+        if (keep_gap)
+        {
+            sprintf(line, "%-24s cuganse_%-16d 2 1 %s %s %s 0=%d 1=%d 2=1 6=%d", "CuganSE", blocks, feat.c_str(), pool.tops[0].c_str(), layers[mul].tops[0].c_str(), channels, hidden, hidden * channels * 2);
+        }
+        else
+        {
+            sprintf(line, "%-24s cuganse_%-16d 1 1 %s %s 0=%d 1=%d 6=%d", "CuganSE", blocks, layers[split].bottoms[0].c_str(), layers[mul].tops[0].c_str(), channels, hidden, hidden * channels * 2);
+            layers[split].removed = true;
+            layers[i].removed = true;
+        }
+
+        layers[ip1].line = line;
+        layers[ip1].tops = layers[mul].tops;
+        layers[ip2].removed = true;
+        layers[mul].removed = true;
+
+        blocks++;
+    }
+
+    if (blocks == 0)
+        return 0;
+
+    // every blob is the top of exactly one layer
+    int layer_count = 0;
+    int blob_count = 0;
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        if (layers[i].removed)
+            continue;
+
+        layer_count++;
+        blob_count += (int)layers[i].tops.size();
+    }
+
+    char header[64];
+    sprintf(header, "7767517\n%d %d\n", layer_count, blob_count);
+    fused = header;
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        if (!layers[i].removed)
+            fused += layers[i].line + "\n";
+    }
+
+    return blocks;
+}
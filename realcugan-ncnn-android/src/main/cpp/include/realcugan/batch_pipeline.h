@@ -0,0 +1,88 @@
+#ifndef BATCH_PIPELINE_H
+#define BATCH_PIPELINE_H
+
+// three stage load / proc / save pipeline over a batch of images, as in the desktop realcugan-ncnn-vulkan
+// every stage has its own threads and hands tasks over through bounded queues,
+// so loading image n+1 and saving image n-1 overlap with the inference of image n
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// ncnn
+#include "mat.h"
+
+class RealCUGAN;
+class RealCUGANCancel;
+class TraceBuffer;
+
+struct BatchTask
+{
+    int index;
+    ncnn::Mat inimage;
+    ncnn::Mat outimage;
+};
+
+struct BatchStats
+{
+    int succeeded;
+    int failed;
+    // busy time summed over the threads of each stage
+    double load_ms;
+    double proc_ms;
+    double save_ms;
+    double wall_ms;
+};
+
+// blocking fifo of at most capacity tasks, get() fails once closed and drained
+class BatchQueue
+{
+public:
+    BatchQueue(int capacity);
+
+    void put(const BatchTask& task);
+    bool get(BatchTask& task);
+    void close();
+
+private:
+    std::mutex lock;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<BatchTask> tasks;
+    size_t capacity;
+    bool closed;
+};
+
+class BatchPipeline
+{
+public:
+    // a stage returns 0 on success, the task is dropped otherwise
+    typedef std::function<int(BatchTask& task)> StageFunc;
+
+    BatchPipeline();
+
+    // load fills task.inimage of task.index, proc fills task.outimage, save consumes it
+    // status[i] is 0 or the failing stage result of task i
+    int run(int count, const StageFunc& load, const StageFunc& proc, const StageFunc& save, std::vector<int>& status);
+
+    // proc stage upscaling inimage into a newly allocated outimage
+    // once cancel is stopped the running task ends within a tile and the remaining ones fail at once
+    static StageFunc process_stage(const RealCUGAN& realcugan, const RealCUGANCancel* cancel = 0);
+
+public:
+    int load_threads;
+    int proc_threads;
+    int save_threads;
+
+    // tasks waiting between two stages, bounds the decoded images held in memory
+    int queue_size;
+
+    // accounting of the last run
+    BatchStats stats;
+
+    // optional timeline of the load / proc / save steps of every task, not owned
+    TraceBuffer* trace;
+};
+
+#endif // BATCH_PIPELINE_H
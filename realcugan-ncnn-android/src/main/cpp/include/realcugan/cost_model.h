@@ -0,0 +1,92 @@
+#ifndef COST_MODEL_H
+#define COST_MODEL_H
+
+// analytic cost of one inference of a loaded ncnn graph, flops and blob memory as a function of the input size
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// ncnn
+#include "net.h"
+
+// the weight count of a layer is only in the .param text, loaded layers do not expose it
+struct ParamLayer
+{
+    std::string type;
+    std::string name;
+    // param 0 and 6, 0 when absent
+    int num_output;
+    int weight_data_size;
+    // param 8 of Convolution, nonzero when realcugan-quantize stored its weights as int8
+    int int8_scale_term;
+};
+
+// parse the contents of a text .param, returns 0 on success
+int read_param_layers(const char* text, std::vector<ParamLayer>& layers);
+
+// blob side = ratio * input side - shrink on each axis, ratio 0 for blobs whose size does not follow the input
+struct BlobShape
+{
+    int c;
+    float ratio_w;
+    int shrink_w;
+    float ratio_h;
+    int shrink_h;
+    // shares the data of this blob, the tops of Split and the in place top of CuganSE
+    int alias;
+
+    int width(int in_w) const;
+    int height(int in_h) const;
+};
+
+struct LayerCost
+{
+    std::string type;
+    std::string name;
+    std::vector<int> bottoms;
+    std::vector<int> tops;
+    // flops = flops_per_pixel * pixels of pixel_blob + flops_fixed
+    double flops_per_pixel;
+    int pixel_blob;
+    double flops_fixed;
+    // weights and bias count
+    size_t weights;
+};
+
+class CostModel
+{
+public:
+    CostModel();
+
+    // probe the blob shapes of net with blank inputs of side size0 and size0 + 8
+    // params from read_param_layers of the same .param, in the order of net.layers()
+    int build(const ncnn::Net& net, const std::vector<ParamLayer>& params, int size0);
+
+    void clear();
+
+    bool empty() const;
+
+    // flops of layer i for an in_w x in_h input
+    double layer_flops(int i, int in_w, int in_h) const;
+
+    // flops of one inference, only of the layers blob depends on when blob >= 0
+    double flops(int in_w, int in_h, int blob = -1) const;
+
+    size_t blob_bytes(int blob, int in_w, int in_h, size_t elemsize) const;
+
+    // peak bytes of the blobs alive at once, every blob freed after its last consumer as in light mode
+    size_t peak_blob_bytes(int in_w, int in_h, size_t elemsize) const;
+
+    // bytes read and written by one inference, the weights and every bottom and top blob moved once
+    double traffic_bytes(int in_w, int in_h, size_t elemsize) const;
+
+public:
+    std::vector<LayerCost> layers;
+    std::vector<BlobShape> blobs;
+
+    // summed over all layers
+    size_t weights;
+};
+
+#endif // COST_MODEL_H
@@ -0,0 +1,72 @@
+#ifndef CUGAN_SE_H
+#define CUGAN_SE_H
+
+// fused squeeze-excitation block of the cugan models, registered with ncnn as CuganSE
+// the exported graphs spell every block as Split, Pooling(mean), InnerProduct(relu), InnerProduct(sigmoid), BinaryOp(mul)
+// which costs five dispatches and a second copy of the feature map, CuganSE scales the feature in place
+#include <string>
+
+// ncnn
+#include "layer.h"
+
+class CuganSE : public ncnn::Layer
+{
+public:
+    CuganSE();
+
+    virtual int load_param(const ncnn::ParamDict& pd);
+
+    virtual int load_model(const ncnn::ModelBin& mb);
+
+    virtual int create_pipeline(const ncnn::Option& opt);
+    virtual int destroy_pipeline(const ncnn::Option& opt);
+
+    using ncnn::Layer::forward_inplace;
+
+    // bottom 0 is the feature, bottom 1 the gap vector when gap_input
+    virtual int forward_inplace(std::vector<ncnn::Mat>& bottom_top_blobs, const ncnn::Option& opt) const;
+    virtual int forward_inplace(ncnn::Mat& bottom_top_blob, const ncnn::Option& opt) const;
+
+#if NCNN_VULKAN
+    virtual int upload_model(ncnn::VkTransfer& cmd, const ncnn::Option& opt);
+
+    virtual int forward_inplace(std::vector<ncnn::VkMat>& bottom_top_blobs, ncnn::VkCompute& cmd, const ncnn::Option& opt) const;
+    virtual int forward_inplace(ncnn::VkMat& bottom_top_blob, ncnn::VkCompute& cmd, const ncnn::Option& opt) const;
+#endif // NCNN_VULKAN
+
+    // channel scales of one gap vector, the two inner products of the block
+    void excite(const float* gap, float* scales) const;
+
+public:
+    // param 0 and 1
+    int channels;
+    int hidden;
+    // param 2, the channel means come in as bottom 1 instead of being pooled here
+    // that blob is where the SE tiling modes extract the gap of a tile and inject the synced one
+    int gap_input;
+
+    ncnn::Mat weight1;
+    ncnn::Mat bias1;
+    ncnn::Mat weight2;
+    ncnn::Mat bias2;
+
+#if NCNN_VULKAN
+    ncnn::VkMat weight_data_gpu;
+
+    ncnn::Pipeline* pipeline_mean;
+    ncnn::Pipeline* pipeline_excite;
+    ncnn::Pipeline* pipeline_scale;
+
+private:
+    int forward_gpu(ncnn::VkMat& feat, const ncnn::VkMat* gap, ncnn::VkCompute& cmd, const ncnn::Option& opt) const;
+#endif // NCNN_VULKAN
+};
+
+ncnn::Layer* CuganSE_layer_creator(void* userdata);
+
+// rewrite every SE block of a text .param into one CuganSE layer, returns the number of blocks fused
+// keep_gap keeps the Split and Pooling in front so the gapN blobs stay extractable and injectable
+// the weights stay where the first InnerProduct had them, the .bin loads unchanged
+int fuse_se_param(const std::string& param, bool keep_gap, std::string& fused);
+
+#endif // CUGAN_SE_H
@@ -0,0 +1,128 @@
+#ifndef MAPPED_IMAGE_H
+#define MAPPED_IMAGE_H
+
+// file-backed interleaved 8bit image, used as process() output when the result does not fit in RAM
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// ncnn
+#include "mat.h"
+
+class MappedImage
+{
+public:
+    MappedImage() : fd(-1), data(0), size(0), w(0), h(0), c(0) {}
+
+    ~MappedImage()
+    {
+        close();
+    }
+
+    // create or truncate filepath to w x h x c bytes and map it shared, pages are written back by the kernel
+    // keep_contents leaves the bytes of an existing file in place, for resuming a checkpointed job
+    int create(const std::string& filepath, int _w, int _h, int _c, bool keep_contents = false)
+    {
+        close();
+
+        size_t len = (size_t)_w * _h * _c;
+        if (len == 0)
+            return -1;
+
+        if (sizeof(off_t) < 8 && len > (size_t)INT32_MAX)
+        {
+            fprintf(stderr, "mapped image %d x %d x %d exceeds 32bit file offsets\n", _w, _h, _c);
+            return -1;
+        }
+
+        fd = ::open(filepath.c_str(), O_RDWR | O_CREAT | (keep_contents ? 0 : O_TRUNC), 0644);
+        if (fd < 0)
+        {
+            fprintf(stderr, "open %s failed\n", filepath.c_str());
+            return -1;
+        }
+
+        if (ftruncate(fd, (off_t)len) != 0)
+        {
+            fprintf(stderr, "ftruncate %s to %zu bytes failed\n", filepath.c_str(), len);
+            close();
+            return -1;
+        }
+
+        void* ptr = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED)
+        {
+            fprintf(stderr, "mmap %s failed\n", filepath.c_str());
+            close();
+            return -1;
+        }
+
+        // tiles are written band by band from top to bottom
+        madvise(ptr, len, MADV_SEQUENTIAL);
+
+        data = (unsigned char*)ptr;
+        size = len;
+        w = _w;
+        h = _h;
+        c = _c;
+
+        return 0;
+    }
+
+    // view with the same layout as an in-memory process() output, no copy
+    ncnn::Mat mat() const
+    {
+        return ncnn::Mat(w, h, (void*)data, (size_t)c, c);
+    }
+
+    // write dirty pages back now, the mapping stays
+    int sync()
+    {
+        if (!data)
+            return -1;
+
+        return msync(data, size, MS_SYNC) == 0 ? 0 : -1;
+    }
+
+    int close()
+    {
+        int ret = 0;
+
+        if (data)
+        {
+            if (msync(data, size, MS_SYNC) != 0)
+                ret = -1;
+
+            munmap(data, size);
+            data = 0;
+            size = 0;
+        }
+
+        if (fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+
+        return ret;
+    }
+
+public:
+    int fd;
+    unsigned char* data;
+    size_t size;
+    int w;
+    int h;
+    int c;
+
+private:
+    MappedImage(const MappedImage&);
+    MappedImage& operator=(const MappedImage&);
+};
+
+#endif // MAPPED_IMAGE_H
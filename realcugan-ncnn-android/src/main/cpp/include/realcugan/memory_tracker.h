@@ -0,0 +1,119 @@
+#ifndef MEMORY_TRACKER_H
+#define MEMORY_TRACKER_H
+
+// current and peak bytes of one process call by allocation site, to see where an oom comes from
+// the tracking allocators wrap the ones ncnn would use and report every allocation to a MemoryTracker
+// every process call counts into a tracker of its own, so concurrent calls never mix their figures
+#include <stddef.h>
+#include <mutex>
+
+// ncnn
+#include "allocator.h"
+
+enum MemoryTag
+{
+    // net blobs and workspace on the cpu
+    MEMORY_CPU_BLOB = 0,
+    // input and output tiles of the cpu tile loops
+    MEMORY_CPU_TILE,
+    // net blobs, tiles and cached features on the gpu
+    MEMORY_VK_BLOB,
+    // host visible upload and download buffers
+    MEMORY_VK_STAGING,
+    // the upscaled image
+    MEMORY_OUTPUT,
+    MEMORY_TAG_COUNT
+};
+
+const char* memory_tag_name(int tag);
+
+struct MemoryUsage
+{
+    size_t current;
+    size_t peak;
+    // allocations since the last reset
+    size_t count;
+};
+
+// figures of one finished call
+struct MemoryStats
+{
+    MemoryUsage tags[MEMORY_TAG_COUNT];
+    MemoryUsage total;
+};
+
+class MemoryTracker
+{
+public:
+    MemoryTracker();
+
+    void allocated(int tag, size_t size);
+    void freed(int tag, size_t size);
+
+    MemoryUsage usage(int tag) const;
+
+    // all tags together, its peak is the highest sum seen and not the sum of the peaks
+    MemoryUsage total() const;
+
+    void snapshot(MemoryStats& stats) const;
+
+    // replace everything with the figures of a finished call, how a shared tracker keeps the last call
+    void store(const MemoryStats& stats);
+
+private:
+    mutable std::mutex lock;
+    MemoryUsage tags[MEMORY_TAG_COUNT];
+    MemoryUsage all;
+
+private:
+    MemoryTracker(const MemoryTracker&);
+    MemoryTracker& operator=(const MemoryTracker&);
+};
+
+// allocator reporting to tracker, allocator 0 allocates with ncnn::fastMalloc
+// does nothing but forward when tracker is 0, otherwise the size sits in an aligned header in front of each block
+// allocator should be a pool, ncnn only pools blobs when it gets no allocator of its own
+class TrackingAllocator : public ncnn::Allocator
+{
+public:
+    TrackingAllocator(MemoryTracker* tracker, int tag, ncnn::Allocator* allocator = 0);
+    virtual ~TrackingAllocator();
+
+    virtual void* fastMalloc(size_t size);
+    virtual void fastFree(void* ptr);
+
+private:
+    MemoryTracker* tracker;
+    int tag;
+    ncnn::Allocator* allocator;
+
+private:
+    TrackingAllocator(const TrackingAllocator&);
+    TrackingAllocator& operator=(const TrackingAllocator&);
+};
+
+// vulkan allocator reporting the memory bound to each buffer or image, allocator is not owned
+class TrackingVkAllocator : public ncnn::VkAllocator
+{
+public:
+    TrackingVkAllocator(MemoryTracker* tracker, int tag, ncnn::VkAllocator* allocator);
+
+    virtual ncnn::VkBufferMemory* fastMalloc(size_t size);
+    virtual void fastFree(ncnn::VkBufferMemory* ptr);
+    virtual int flush(ncnn::VkBufferMemory* ptr);
+    virtual int invalidate(ncnn::VkBufferMemory* ptr);
+
+    virtual ncnn::VkImageMemory* fastMalloc(int w, int h, int c, size_t elemsize, int elempack);
+    virtual void fastFree(ncnn::VkImageMemory* ptr);
+
+private:
+    MemoryTracker* tracker;
+    int tag;
+    ncnn::VkAllocator* allocator;
+
+private:
+    TrackingVkAllocator(const TrackingVkAllocator&);
+    TrackingVkAllocator& operator=(const TrackingVkAllocator&);
+};
+
+#endif // MEMORY_TRACKER_H
@@ -0,0 +1,94 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+// process wide counters, gauges and latency histograms, cheap enough to stay on for every call
+// counters and gauges are lock free, a histogram update takes one short lock
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum MetricCounter
+{
+    // process calls, every region of a session or checkpointed job counts once
+    METRIC_IMAGES = 0,
+    METRIC_FAILED,
+    METRIC_CANCELLED,
+    // allocation failures of outputs and tiles
+    METRIC_OOM,
+    METRIC_TILES,
+    // tiles that ran the network
+    METRIC_TILES_COMPUTED,
+    // tiles that ran all 8 tta orientations
+    METRIC_TILES_TTA,
+    METRIC_TILES_DUPLICATE,
+    // tiles served by the tile cache
+    METRIC_TILES_CACHED,
+    METRIC_TILES_BICUBIC,
+    // initialize calls that found the instance already loaded
+    METRIC_INSTANCE_HITS,
+    METRIC_COUNTER_COUNT
+};
+
+enum MetricGauge
+{
+    METRIC_INSTANCES = 0,
+    // process calls running right now
+    METRIC_IN_FLIGHT,
+    METRIC_GAUGE_COUNT
+};
+
+const char* metric_counter_name(int counter);
+const char* metric_gauge_name(int gauge);
+
+// roughly logarithmic buckets from 1 ms to 1 min, the last one takes everything slower
+#define METRIC_LATENCY_BUCKETS 16
+extern const double metric_latency_bounds[METRIC_LATENCY_BUCKETS - 1];
+
+struct LatencyHistogram
+{
+    // model file and processing mode, gpu/syncgap3/tta for instance
+    std::string model;
+    std::string mode;
+    uint64_t count;
+    double sum_ms;
+    double max_ms;
+    uint64_t buckets[METRIC_LATENCY_BUCKETS];
+};
+
+class Metrics
+{
+public:
+    Metrics();
+
+    void add(int counter, uint64_t n = 1);
+    void gauge_add(int gauge, int64_t n);
+
+    void observe(const std::string& model, const std::string& mode, double ms);
+
+    uint64_t counter(int counter) const;
+    int64_t gauge(int gauge) const;
+    void histograms(std::vector<LatencyHistogram>& out) const;
+
+    // counters and histograms restart from 0, gauges keep their value
+    void reset();
+
+    // {"counters":{..},"gauges":{..},"latency_bounds_ms":[..],"latency":[{"model","mode","count","sum_ms","max_ms","buckets"}]}
+    std::string to_json() const;
+
+private:
+    std::atomic<uint64_t> counters[METRIC_COUNTER_COUNT];
+    std::atomic<int64_t> gauges[METRIC_GAUGE_COUNT];
+
+    mutable std::mutex lock;
+    std::map<std::pair<std::string, std::string>, LatencyHistogram> latency;
+
+private:
+    Metrics(const Metrics&);
+    Metrics& operator=(const Metrics&);
+};
+
+#endif // METRICS_H
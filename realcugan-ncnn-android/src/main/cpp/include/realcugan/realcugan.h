@@ -3,16 +3,163 @@
 #ifndef REALCUGAN_H
 #define REALCUGAN_H
 
+#include <stdint.h>
+#include <atomic>
+#include <functional>
 #include <string>
+#include <vector>
 
 // ncnn
 #include "net.h"
 #include "gpu.h"
 #include "layer.h"
 
+#include "cost_model.h"
+
+// rectangle in output image pixels
+struct RealCUGANRect
+{
+    int x;
+    int y;
+    int w;
+    int h;
+};
+
+// tile accounting of one process call, stage2 tiles in SE modes
+struct RealCUGANTileStats
+{
+    int total;
+    // ran the network
+    int computed;
+    // copied from an identical tile of the same image
+    int duplicate;
+    // copied from the tile cache
+    int cached;
+    // single colour tiles, also counted above
+    int uniform;
+    // left in place by RealCUGANSession
+    int unchanged;
+    // computed with all 8 tta orientations
+    int tta;
+    // upscaled with bicubic to meet a time budget
+    int bicubic;
+};
+
+// wall time of the stages of one process() call, in milliseconds
+// with vulkan every stage is submitted and waited for on its own while stats are collected
+struct RealCUGANStageStats
+{
+    // image decode and copy into the java array, filled by the jni layer
+    double decode_ms;
+    double copyout_ms;
+    // from_pixels and to_pixels
+    double pixel_ms;
+    double upload_ms;
+    double preproc_ms;
+    // network inferences
+    double net_ms;
+    // bicubic upscale of the alpha channel
+    double alpha_ms;
+    double postproc_ms;
+    double download_ms;
+    // SE stage0 passes and gap syncs ahead of the output tiles
+    double se_sync_ms;
+    double total_ms;
+    int inferences;
+    uint64_t upload_bytes;
+    uint64_t download_bytes;
+    RealCUGANTileStats tilestats;
+};
+
+// predicted cost of one process() call
+struct RealCUGANEstimate
+{
+    // output tiles, and network inferences over them with the SE stage passes and tta orientations
+    int tiles;
+    int passes;
+    double flops;
+    // 0 until calibrate() measured this instance
+    double time_ms;
+    // peak bytes, host including the input and output images
+    size_t host_bytes;
+    size_t device_bytes;
+    // bytes the network layers read and write in the full passes over every tile, in the storage precision of the blobs
+    double traffic_bytes;
+};
+
+// cpu storage and arithmetic of the network, vulkan always stores fp16 and computes fp32
+enum RealCUGANPrecision
+{
+    REALCUGAN_PRECISION_FP32 = 0,
+    // blobs and weights stored as fp16, computed in fp32 where the cpu has no fp16 fma
+    REALCUGAN_PRECISION_FP16_STORAGE,
+    // fp16 storage and fp16 fma on armv8.2 cores
+    REALCUGAN_PRECISION_FP16_ARITHMETIC,
+    // blobs and weights stored as bf16, dot products in bf16 on avx512-bf16 and armv8.6 cores
+    REALCUGAN_PRECISION_BF16_STORAGE,
+    REALCUGAN_PRECISION_COUNT
+};
+
+const char* realcugan_precision_name(int precision);
+
+// one layer of RealCUGAN::profile_layers()
+struct RealCUGANLayerProfile
+{
+    std::string type;
+    std::string name;
+    // first top blob, channels unpacked
+    int out_w;
+    int out_h;
+    int out_c;
+    double flops;
+    // weights plus every bottom and top blob moved once
+    double bytes;
+    // best of the timed runs, with vulkan the wall time of the submit and wait of this layer alone
+    double time_ms;
+};
+
+// process() results of a call stopped by RealCUGANCancel, outimage is then partially written
+#define REALCUGAN_CANCELLED -2
+#define REALCUGAN_DEADLINE_EXCEEDED -3
+
+// cooperative stop of a running process call, polled before every tile and between SE stages
+// so an interrupted call returns within one tile, cancel() may be called from any thread
+class RealCUGANCancel
+{
+public:
+    RealCUGANCancel();
+
+    void cancel();
+
+    // stop once ms milliseconds from now have passed, 0 clears the deadline
+    void set_deadline(double ms);
+
+    // 0 to go on, REALCUGAN_CANCELLED or REALCUGAN_DEADLINE_EXCEEDED
+    int check() const;
+
+private:
+    std::atomic<bool> cancelled;
+    // steady clock nanoseconds, 0 without deadline
+    std::atomic<int64_t> deadline;
+};
+
 class FeatureCache;
+class ProcessContext;
+class TileCache;
+class TraceBuffer;
+class MemoryTracker;
+struct MemoryStats;
+class Metrics;
+class TileSlot;
+class RealCUGANSession;
+class RealCUGANCheckpoint;
+class RealCUGANBudget;
 class RealCUGAN
 {
+    friend class RealCUGANSession;
+    friend class RealCUGANCheckpoint;
+    friend class RealCUGANBudget;
+
 public:
     RealCUGAN(int gpuid, bool tta_mode = false, int num_threads = 1);
     ~RealCUGAN();
@@ -25,6 +172,17 @@ public:
 
     int process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const;
 
+    int process(const ncnn::Mat& inimage, ncnn::Mat& outimage, RealCUGANTileStats& tilestats) const;
+
+    // slower on gpu as every stage is waited for, stagestats is zeroed first
+    int process(const ncnn::Mat& inimage, ncnn::Mat& outimage, RealCUGANStageStats& stagestats, const RealCUGANCancel* cancel = 0) const;
+
+    // stops between tiles once cancel is cancelled or past its deadline, allocators are released either way
+    int process(const ncnn::Mat& inimage, ncnn::Mat& outimage, const RealCUGANCancel& cancel) const;
+
+    // current, peak and count of the allocations of this call alone, by tag, also while other calls run
+    int process(const ncnn::Mat& inimage, ncnn::Mat& outimage, MemoryStats& memory) const;
+
     int process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const;
 
     int process_se(const ncnn::Mat& inimage, ncnn::Mat& outimage) const;
@@ -39,21 +197,88 @@ public:
 
     int process_cpu_se_very_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage) const;
 
+    // upscale only the tiles covering rect, outimage becomes rect.w x rect.h
+    // output matches the same rect of process() exactly
+    // gapfeats from process_se_gap() on the same image skip the full-image SE passes
+    int process_roi(const ncnn::Mat& inimage, const RealCUGANRect& rect, ncnn::Mat& outimage, const std::vector<ncnn::Mat>* gapfeats = 0) const;
+
+    // synced SE features gap0..gap3 of inimage for the current syncgap mode
+    // empty when the image fits in one tile or syncgap is off
+    int process_se_gap(const ncnn::Mat& inimage, std::vector<ncnn::Mat>& gapfeats) const;
+
+    // upscale a batch of images, those fitting in one tile are packed side by side into shared atlas inferences
+    // every packed image keeps its own border padding and SE statistics, output matches process() up to float rounding
+    // outimages are allocated like the process() output, atlas_size bounds the atlas side before padding, 0 uses tilesize
+    int process_atlas(const std::vector<ncnn::Mat>& inimages, std::vector<ncnn::Mat>& outimages, int atlas_size = 0) const;
+
+    // whether process_atlas() packs at all, false for tta and models without SE blocks
+    // which then run every image through process() and match it bit for bit, so models-nose gets no speedup
+    bool atlas_packs() const;
+
+    // runtime and memory of processing a w x h image with channels 3 or 4, from the tile plan and the layer flops of the model
+    // tta counts all 8 orientations on every tile, adaptive tta only ever runs less
+    RealCUGANEstimate estimate(int w, int h, int channels) const;
+
+    // time inferences of one full and one half tile to fit flops_per_ms and pass_ms
+    int calibrate();
+
+    // time the forward of every layer on its own over an in_size x in_size network input
+    // with vulkan every layer is one submit and wait, the cost of an empty submit is taken off
+    // what remains is wall time with dispatch and sync overhead, there are no device timestamps
+    int profile_layers(int in_size, std::vector<RealCUGANLayerProfile>& profile, int loops = 5) const;
+
 protected:
-    int process_se_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, const ncnn::Option& opt, FeatureCache& cache) const;
-    int process_se_stage2(const ncnn::Mat& inimage, const std::vector<std::string>& names, ncnn::Mat& outimage, const ncnn::Option& opt, FeatureCache& cache) const;
+    int process(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const;
+    int dispatch(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const;
+    int process_gpu(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const;
+    int process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const;
+
+    int process_se(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const;
+    int process_cpu_se(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const;
+    int process_se_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const;
+    int process_cpu_se_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const;
+    int process_se_very_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const;
+    int process_cpu_se_very_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const;
+    int process_se_reuse_gap(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const;
+    int process_cpu_se_reuse_gap(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const;
+
+    int process_se_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, const ncnn::Option& opt, FeatureCache& cache, const ProcessContext& ctx) const;
+    int process_se_stage2(const ncnn::Mat& inimage, const std::vector<std::string>& names, ncnn::Mat& outimage, const ncnn::Option& opt, FeatureCache& cache, ProcessContext& ctx) const;
     int process_se_sync_gap(const ncnn::Mat& inimage, const std::vector<std::string>& names, const ncnn::Option& opt, FeatureCache& cache) const;
 
-    int process_se_very_rough_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, const ncnn::Option& opt, FeatureCache& cache) const;
+    int process_se_very_rough_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, const ncnn::Option& opt, FeatureCache& cache, const ProcessContext& ctx) const;
     int process_se_very_rough_sync_gap(const ncnn::Mat& inimage, const std::vector<std::string>& names, const ncnn::Option& opt, FeatureCache& cache) const;
 
-    int process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, FeatureCache& cache) const;
-    int process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector<std::string>& names, ncnn::Mat& outimage, FeatureCache& cache) const;
+    int process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, FeatureCache& cache, const ProcessContext& ctx) const;
+    int process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector<std::string>& names, ncnn::Mat& outimage, FeatureCache& cache, ProcessContext& ctx) const;
     int process_cpu_se_sync_gap(const ncnn::Mat& inimage, const std::vector<std::string>& names, FeatureCache& cache) const;
 
-    int process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, FeatureCache& cache) const;
+    int process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, FeatureCache& cache, const ProcessContext& ctx) const;
     int process_cpu_se_very_rough_sync_gap(const ncnn::Mat& inimage, const std::vector<std::string>& names, FeatureCache& cache) const;
 
+    // content hash of the padded input tile xi,yi together with everything else its output depends on
+    uint64_t tile_key(const ncnn::Mat& inimage, int xi, int yi, uint64_t gaphash, bool* uniform = 0) const;
+
+    // find the tiles of band yi that need no inference, returns how many do
+    int reuse_band(const ncnn::Mat& inimage, const ncnn::Mat& outimage, int yi, uint64_t gaphash, ProcessContext& ctx) const;
+    // fill the skipped tiles of band yi and remember the computed ones
+    void keep_band(const ncnn::Mat& inimage, ncnn::Mat& outimage, int yi, ProcessContext& ctx) const;
+
+    // whether tile xi,yi is detailed enough for all 8 tta orientations
+    bool tile_tta(const ncnn::Mat& inimage, int xi, int yi) const;
+
+    // bicubic upscale of tile xi,yi into slot.cached, the fallback when a time budget runs out
+    void bicubic_tile(const ncnn::Mat& inimage, int xi, int yi, TileSlot& slot) const;
+
+    // run the 8 preprocessed tta orientations as two side by side inferences
+    void forward_tta_batch(const ncnn::Mat* in_tile, ncnn::Mat* out_tile) const;
+
+    // find the SE blocks of the loaded network and how their feature maps scale with the input
+    void locate_se_blocks();
+
+    // one inference over the packed atlas, SE scales are computed per slot
+    int forward_atlas(const ncnn::Mat& atlas, const std::vector<RealCUGANRect>& slots, ncnn::Mat& out) const;
+
 public:
     // realcugan parameters
     int noise;
@@ -62,16 +287,208 @@ public:
     int prepadding;
     int syncgap;
 
+    // optional finished tile cache, not owned
+    TileCache* tile_cache;
+
+    // optional timeline of every tile and stage, not owned
+    // gpu stages show the time to record them unless stage stats are collected as well
+    TraceBuffer* trace;
+
+    // optional allocation accounting, not owned
+    // every call counts on a tracker of its own and stores its figures here once done, so this holds the last finished call
+    MemoryTracker* memory_tracker;
+
+    // optional process wide counters and latency histograms, not owned
+    Metrics* metrics;
+    // labels the latency histograms, models-se/up2x-no-denoise for instance
+    std::string model_name;
+
+    // compute identical tiles of one image only once, output is unchanged
+    bool tile_dedup;
+
+    // adaptive tta, tiles whose mean luma gradient is below this run a single orientation
+    // 0 runs every tile with all 8 orientations, only used with tta_mode
+    float tta_threshold;
+
+    // tta tiles run the 4 upright and the 4 transposed orientations as 2 packed inferences instead of 8
+    // SE pooling then spans the packed orientations, the output differs slightly from plain tta
+    bool tta_batch;
+
+    // set by load() for models written by realcugan-quantize, those only run on the cpu
+    bool int8_model;
+
+    // reduced cpu precision asked for before load(), ignored with vulkan
+    // load() compares it against fp32 on a probe tile and falls back to fp32 below precision_min_psnr, 0 skips the check
+    int cpu_precision;
+    double precision_min_psnr;
+    // what load() settled on, and the probe psnr, inf when nothing was compared
+    int precision_used;
+    double precision_psnr;
+
+    // load() rewrites the SE blocks into CuganSE layers that scale the feature in place, off by default
+    // the channel means sum in another order and fp16 storage scales in fp32, so the output drifts in the last bits
+    // with syncgap 0 the pooling moves into the layer too, otherwise gap0..gap3 stay blobs for the SE tiling modes
+    bool fuse_se;
+    // SE blocks load() fused, 0 for models without SE or with fuse_se off
+    int se_fused;
+
+    // measured by calibrate(), may be restored from an earlier run instead
+    // network throughput and the fixed cost of one inference including upload, preproc and postproc
+    double flops_per_ms;
+    double pass_ms;
+
 private:
     ncnn::VulkanDevice* vkdev;
     ncnn::Net net;
     ncnn::Pipeline* realcugan_preproc;
     ncnn::Pipeline* realcugan_postproc;
     ncnn::Pipeline* realcugan_4x_postproc;
+    ncnn::Pipeline* realcugan_preproc_single;
+    ncnn::Pipeline* realcugan_postproc_single;
+    ncnn::Pipeline* realcugan_4x_postproc_single;
+    ncnn::Pipeline* realcugan_preproc_tta_batch;
+    ncnn::Pipeline* realcugan_postproc_tta_batch;
+    ncnn::Pipeline* realcugan_4x_postproc_tta_batch;
     ncnn::Layer* bicubic_2x;
     ncnn::Layer* bicubic_3x;
     ncnn::Layer* bicubic_4x;
     bool tta_mode;
+    uint64_t model_hash;
+
+    // layer flops and blob shapes of the loaded graph, .bin size when the param could not be read
+    CostModel cost_model;
+    size_t model_bytes;
+
+    // squeeze-excitation block, global pooling of feat scales it into out
+    // gap is -1 when a CuganSE layer pools by itself, scales -1 whenever CuganSE does the inner products
+    struct SEBlock
+    {
+        int feat;
+        int gap;
+        int scales;
+        int out;
+        // the CuganSE layer in net.layers(), -1 for the exported chain
+        int layer;
+        // feat side = ratio * input side - shrink, ratio 0 when unknown
+        float ratio;
+        int shrink;
+    };
+    std::vector<SEBlock> se_blocks;
+};
+
+// keeps the last input, output and SE gap features of one image
+// and only reruns the tiles whose padded input changed since the previous version
+class RealCUGANSession
+{
+public:
+    RealCUGANSession(const RealCUGAN& realcugan);
+
+    // outimage is a copy of the session buffer and stays valid across later calls
+    int process(const ncnn::Mat& inimage, ncnn::Mat& outimage);
+
+    // forget the previous version, the next call runs in full
+    void reset();
+
+public:
+    // SE modes reuse the synced gap features until the changed pixels
+    // accumulated since the last sync exceed this fraction of the image
+    float resync_threshold;
+
+    // accounting of the last call
+    RealCUGANTileStats tilestats;
+    bool resynced;
+
+private:
+    const RealCUGAN& realcugan;
+    ncnn::Mat previn;
+    ncnn::Mat output;
+    std::vector<ncnn::Mat> gapfeats;
+    int tilesize;
+    size_t pending_changed;
+};
+
+// one long job writing into a persistent outimage, typically a MappedImage
+// finished tile bands and the synced SE gap features are recorded in a checkpoint file
+// and a rerun on the same input with the same settings continues from the first unfinished band
+class RealCUGANCheckpoint
+{
+public:
+    RealCUGANCheckpoint(const RealCUGAN& realcugan, const std::string& path);
+
+    // the checkpoint file is removed once the whole image is done
+    int process(const ncnn::Mat& inimage, ncnn::Mat& outimage);
+
+public:
+    // seconds between two saves, 0 saves after every band
+    double interval;
+
+    // makes the finished rows of outimage durable before they are recorded, MappedImage::sync for example
+    std::function<int()> flush;
+
+    // optional, not owned, a stopped job saves its finished bands before returning
+    const RealCUGANCancel* cancel;
+
+    // accounting of the last call
+    int resumed_band;
+    int saves;
+    double save_ms;
+    RealCUGANTileStats tilestats;
+
+protected:
+    uint64_t job_key(const ncnn::Mat& inimage) const;
+    int load(uint64_t key, std::vector<ncnn::Mat>& gapfeats) const;
+    int save(uint64_t key, int next_band, const std::vector<ncnn::Mat>& gapfeats) const;
+
+private:
+    const RealCUGAN& realcugan;
+    std::string path;
+};
+
+// settings a budgeted call ran with
+struct RealCUGANQuality
+{
+    // syncgap mode of the SE passes, 0 when the image needed none
+    int syncgap;
+    // tiles run with all tta orientations, with one orientation and with bicubic
+    int tta;
+    int single;
+    int bicubic;
+    // estimate for the chosen settings before the run, 0 while nothing was measured yet
+    double predicted_ms;
+    double elapsed_ms;
+};
+
+// upscale within a time budget, whatever the image size
+// the most expensive syncgap mode predicted to fit is picked up front, then every tile is run with tta,
+// with a single orientation or with bicubic, whichever the timings measured so far say still fits
+// a run falling behind downgrades its remaining tiles and never upgrades them again
+// the timings carry over to later calls, keep one per RealCUGAN
+class RealCUGANBudget
+{
+public:
+    RealCUGANBudget(const RealCUGAN& realcugan);
+
+    int process(const ncnn::Mat& inimage, ncnn::Mat& outimage, double budget_ms);
+
+    // predicted milliseconds for tiles full tiles with syncgap_mode, tta as configured or dropped
+    double predict(int syncgap_mode, bool tta, double tiles) const;
+
+public:
+    // milliseconds per full tile, 0 until measured
+    double single_ms;
+    double tta_ms;
+    // SE passes before stage2 per full tile, indexed by syncgap mode
+    double gap_ms[4];
+
+    // optional, not owned
+    const RealCUGANCancel* cancel;
+
+    // accounting of the last call
+    RealCUGANQuality used;
+    RealCUGANTileStats tilestats;
+
+private:
+    const RealCUGAN& realcugan;
 };
 
 #endif // REALCUGAN_H
@@ -0,0 +1,78 @@
+#ifndef REALCUGAN_API_H
+#define REALCUGAN_API_H
+
+// instance registry and entry points behind the JNI functions, usable without a JVM
+// instances are shared by every caller initializing the same config and looked up by handle
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+// ncnn
+#include "mat.h"
+
+#include "realcugan.h"
+
+class MemoryTracker;
+class Metrics;
+
+struct RealCUGANConfig
+{
+    // -1 conservative, 0 no denoise, 1..3 denoise level
+    int noise;
+    int scale;
+    int syncgap;
+    bool tta_mode;
+    float tta_threshold;
+    bool tta_batch;
+    // -1 for the cpu, below -1 for the default gpu
+    int gpuid;
+    // RealCUGANPrecision of the cpu path, checked against fp32 on load and dropped back to fp32 when too far off
+    int cpu_precision;
+    // models-se, models-pro or models-nose
+    std::string model_dir;
+
+    // shared by all instances, not owned, not part of the identity of an instance
+    TileCache* tile_cache;
+    TraceBuffer* trace;
+    MemoryTracker* memory_tracker;
+    Metrics* metrics;
+};
+
+// how often callers found a registry lock held and how long they waited
+struct RealCUGANLockStats
+{
+    const char* name;
+    uint64_t acquisitions;
+    uint64_t contended;
+    double wait_ms;
+};
+
+// handle of the instance for config, loaded from model_root/model_dir on first use, negative on failure
+int64_t realcugan_initialize(const std::string& model_root, const RealCUGANConfig& config);
+
+// empty when handle is unknown or released, keeps the instance alive while the caller holds it
+std::shared_ptr<RealCUGAN> realcugan_find(int64_t handle);
+
+// drops the handle for all callers sharing it, calls already holding the instance finish on it
+// the instance is freed with the last reference and the gpu instance goes with the last instance
+void realcugan_release(int64_t handle);
+
+int realcugan_instance_count();
+
+// next value of the handle counter shared with cancel and session handles
+int64_t realcugan_next_handle();
+
+// allocates outimage from output_allocator and upscales inimage into it
+// stagestats is filled when given, cancel may be 0
+int realcugan_process(const RealCUGAN* inst, const ncnn::Mat& inimage, ncnn::Mat& outimage, ncnn::Allocator* output_allocator, RealCUGANStageStats* stagestats, const RealCUGANCancel* cancel);
+
+// per request info logging, off by default so nothing is formatted for a log nobody reads
+void realcugan_set_verbose_logging(bool enabled);
+bool realcugan_verbose_logging();
+
+// gpu, cache and handle locks
+void realcugan_lock_stats(std::vector<RealCUGANLockStats>& stats);
+void realcugan_reset_lock_stats();
+
+#endif // REALCUGAN_API_H
@@ -0,0 +1,88 @@
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+
+// content-addressed cache of finished output tiles, shared by every RealCUGAN instance
+#include <stddef.h>
+#include <stdint.h>
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// 64bit non-cryptographic hash, chain calls through seed
+uint64_t tile_cache_hash(const void* data, size_t size, uint64_t seed);
+
+struct TileCacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t hit_bytes;
+    uint64_t insertions;
+    uint64_t evictions;
+    uint64_t spills;
+    uint64_t spill_hits;
+    uint64_t memory_bytes;
+    uint64_t spill_bytes;
+    uint64_t entries;
+};
+
+class TileCache
+{
+public:
+    TileCache();
+    ~TileCache();
+
+    // max_memory_bytes 0 disables the cache and drops all entries
+    // entries pushed out of memory go to spill_dir while spill usage stays under max_spill_bytes
+    void configure(size_t max_memory_bytes, const std::string& spill_dir = std::string(), size_t max_spill_bytes = 0);
+
+    bool enabled() const;
+
+    // copy the w x h x c tile stored under key into outptr rows of outstride bytes
+    bool get(uint64_t key, unsigned char* outptr, int w, int h, int c, size_t outstride);
+
+    // store the w x h x c tile at ptr with rows of stride bytes
+    void put(uint64_t key, const unsigned char* ptr, int w, int h, int c, size_t stride);
+
+    void clear();
+
+    TileCacheStats stats() const;
+
+protected:
+    struct Entry
+    {
+        uint64_t key;
+        int w;
+        int h;
+        int c;
+        std::vector<unsigned char> data;
+        // non-empty when the tile lives in spill_dir
+        std::string spillpath;
+    };
+
+    typedef std::list<Entry> EntryList;
+
+    void evict();
+    bool spill(Entry& e);
+    void drop(EntryList::iterator it);
+
+private:
+    mutable std::mutex lock;
+
+    // most recently used first
+    EntryList lru;
+    std::unordered_map<uint64_t, EntryList::iterator> index;
+
+    size_t max_memory_bytes;
+    std::string spill_dir;
+    size_t max_spill_bytes;
+
+    TileCacheStats st;
+
+private:
+    TileCache(const TileCache&);
+    TileCache& operator=(const TileCache&);
+};
+
+#endif // TILE_CACHE_H
@@ -0,0 +1,76 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// tile level execution timeline, written as chrome trace_event json for perfetto or chrome://tracing
+// events go into a fixed ring buffer so tracing can stay on, the oldest events are overwritten
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct TraceEvent
+{
+    // string literal, never copied
+    const char* name;
+    int64_t begin_ns;
+    int64_t end_ns;
+    int tid;
+    // tile column and row, -1 when the event is not about one tile
+    int xi;
+    int yi;
+    // tta orientation 0..7, -1 for all or none
+    int ti;
+};
+
+class TraceBuffer
+{
+public:
+    TraceBuffer();
+
+    // keep the last capacity events, 0 disables tracing and drops all events
+    void configure(size_t capacity);
+
+    bool enabled() const;
+
+    void record(const char* name, int64_t begin_ns, int64_t end_ns, int xi = -1, int yi = -1, int ti = -1);
+
+    // label the calling thread in the viewer
+    void set_thread_name(const char* name);
+
+    void clear();
+
+    // events still in the buffer, and those overwritten since the last clear
+    size_t size() const;
+    uint64_t dropped() const;
+
+    // returns 0 on success
+    int write(FILE* fp) const;
+    int write(const std::string& path) const;
+
+    // steady clock, the timebase of all events
+    static int64_t now_ns();
+
+    // small stable id of the calling thread
+    static int thread_id();
+
+private:
+    mutable std::mutex lock;
+    std::atomic<bool> on;
+
+    std::vector<TraceEvent> ring;
+    // next slot to write and events written since the last clear
+    size_t head;
+    uint64_t count;
+
+    std::map<int, std::string> thread_names;
+
+private:
+    TraceBuffer(const TraceBuffer&);
+    TraceBuffer& operator=(const TraceBuffer&);
+};
+
+#endif // TRACE_H
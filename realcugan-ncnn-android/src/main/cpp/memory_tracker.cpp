@@ -0,0 +1,201 @@
+// allocation accounting by tag
+
+#include "memory_tracker.h"
+
+#include <algorithm>
+
+static const char* const memory_tag_names[MEMORY_TAG_COUNT] = {
+    "cpu blob",
+    "cpu tile",
+    "vk blob",
+    "vk staging",
+    "output"
+};
+
+const char* memory_tag_name(int tag)
+{
+    return tag >= 0 && tag < MEMORY_TAG_COUNT ? memory_tag_names[tag] : "other";
+}
+
+MemoryTracker::MemoryTracker()
+{
+    for (int i = 0; i < MEMORY_TAG_COUNT; i++)
+    {
+        tags[i].current = 0;
+        tags[i].peak = 0;
+        tags[i].count = 0;
+    }
+
+    all.current = 0;
+    all.peak = 0;
+    all.count = 0;
+}
+
+void MemoryTracker::allocated(int tag, size_t size)
+{
+    if (tag < 0 || tag >= MEMORY_TAG_COUNT)
+        return;
+
+    std::lock_guard<std::mutex> lg(lock);
+
+    MemoryUsage& u = tags[tag];
+    u.current += size;
+    u.peak = std::max(u.peak, u.current);
+    u.count++;
+
+    all.current += size;
+    all.peak = std::max(all.peak, all.current);
+    all.count++;
+}
+
+void MemoryTracker::freed(int tag, size_t size)
+{
+    if (tag < 0 || tag >= MEMORY_TAG_COUNT)
+        return;
+
+    std::lock_guard<std::mutex> lg(lock);
+
+    // never go below 0 on a free the tracker did not see allocated
+    MemoryUsage& u = tags[tag];
+    u.current -= std::min(u.current, size);
+    all.current -= std::min(all.current, size);
+}
+
+MemoryUsage MemoryTracker::usage(int tag) const
+{
+    std::lock_guard<std::mutex> lg(lock);
+
+    if (tag < 0 || tag >= MEMORY_TAG_COUNT)
+    {
+        MemoryUsage none = {0, 0, 0};
+        return none;
+    }
+
+    return tags[tag];
+}
+
+MemoryUsage MemoryTracker::total() const
+{
+    std::lock_guard<std::mutex> lg(lock);
+
+    return all;
+}
+
+void MemoryTracker::snapshot(MemoryStats& stats) const
+{
+    std::lock_guard<std::mutex> lg(lock);
+
+    for (int i = 0; i < MEMORY_TAG_COUNT; i++)
+        stats.tags[i] = tags[i];
+
+    stats.total = all;
+}
+
+void MemoryTracker::store(const MemoryStats& stats)
+{
+    std::lock_guard<std::mutex> lg(lock);
+
+    for (int i = 0; i < MEMORY_TAG_COUNT; i++)
+        tags[i] = stats.tags[i];
+
+    all = stats.total;
+}
+
+TrackingAllocator::TrackingAllocator(MemoryTracker* _tracker, int _tag, ncnn::Allocator* _allocator)
+    : tracker(_tracker), tag(_tag), allocator(_allocator)
+{
+}
+
+TrackingAllocator::~TrackingAllocator()
+{
+}
+
+// keeps the block behind it aligned like the one ncnn returned
+static const size_t tracking_header = NCNN_MALLOC_ALIGN;
+
+void* TrackingAllocator::fastMalloc(size_t size)
+{
+    if (!tracker)
+        return allocator ? allocator->fastMalloc(size) : ncnn::fastMalloc(size);
+
+    unsigned char* block = (unsigned char*)(allocator ? allocator->fastMalloc(size + tracking_header) : ncnn::fastMalloc(size + tracking_header));
+    if (!block)
+        return 0;
+
+    *(size_t*)block = size;
+
+    tracker->allocated(tag, size);
+
+    return block + tracking_header;
+}
+
+void TrackingAllocator::fastFree(void* ptr)
+{
+    void* block = ptr;
+    if (ptr && tracker)
+    {
+        block = (unsigned char*)ptr - tracking_header;
+
+        tracker->freed(tag, *(const size_t*)block);
+    }
+
+    if (allocator)
+        allocator->fastFree(block);
+    else
+        ncnn::fastFree(block);
+}
+
+TrackingVkAllocator::TrackingVkAllocator(MemoryTracker* _tracker, int _tag, ncnn::VkAllocator* _allocator)
+    : ncnn::VkAllocator(_allocator->vkdev), tracker(_tracker), tag(_tag), allocator(_allocator)
+{
+    // vkmat and the upload paths look at these to decide how to map
+    buffer_memory_type_index = allocator->buffer_memory_type_index;
+    image_memory_type_index = allocator->image_memory_type_index;
+    reserved_type_index = allocator->reserved_type_index;
+    mappable = allocator->mappable;
+    coherent = allocator->coherent;
+}
+
+ncnn::VkBufferMemory* TrackingVkAllocator::fastMalloc(size_t size)
+{
+    ncnn::VkBufferMemory* ptr = allocator->fastMalloc(size);
+    if (ptr && tracker)
+        tracker->allocated(tag, ptr->capacity);
+
+    return ptr;
+}
+
+void TrackingVkAllocator::fastFree(ncnn::VkBufferMemory* ptr)
+{
+    if (ptr && tracker)
+        tracker->freed(tag, ptr->capacity);
+
+    allocator->fastFree(ptr);
+}
+
+int TrackingVkAllocator::flush(ncnn::VkBufferMemory* ptr)
+{
+    return allocator->flush(ptr);
+}
+
+int TrackingVkAllocator::invalidate(ncnn::VkBufferMemory* ptr)
+{
+    return allocator->invalidate(ptr);
+}
+
+ncnn::VkImageMemory* TrackingVkAllocator::fastMalloc(int w, int h, int c, size_t elemsize, int elempack)
+{
+    ncnn::VkImageMemory* ptr = allocator->fastMalloc(w, h, c, elemsize, elempack);
+    if (ptr && tracker)
+        tracker->allocated(tag, ptr->bind_capacity);
+
+    return ptr;
+}
+
+void TrackingVkAllocator::fastFree(ncnn::VkImageMemory* ptr)
+{
+    if (ptr && tracker)
+        tracker->freed(tag, ptr->bind_capacity);
+
+    allocator->fastFree(ptr);
+}
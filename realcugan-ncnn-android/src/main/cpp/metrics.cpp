@@ -0,0 +1,190 @@
+// process wide runtime metrics
+
+#include "metrics.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+static const char* const metric_counter_names[METRIC_COUNTER_COUNT] = {
+    "images",
+    "failed",
+    "cancelled",
+    "oom",
+    "tiles",
+    "tiles_computed",
+    "tiles_tta",
+    "tiles_duplicate",
+    "tiles_cached",
+    "tiles_bicubic",
+    "instance_hits"
+};
+
+static const char* const metric_gauge_names[METRIC_GAUGE_COUNT] = {
+    "instances",
+    "in_flight"
+};
+
+const double metric_latency_bounds[METRIC_LATENCY_BUCKETS - 1] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 60000
+};
+
+const char* metric_counter_name(int counter)
+{
+    return counter >= 0 && counter < METRIC_COUNTER_COUNT ? metric_counter_names[counter] : "other";
+}
+
+const char* metric_gauge_name(int gauge)
+{
+    return gauge >= 0 && gauge < METRIC_GAUGE_COUNT ? metric_gauge_names[gauge] : "other";
+}
+
+Metrics::Metrics()
+{
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++)
+        counters[i].store(0);
+
+    for (int i = 0; i < METRIC_GAUGE_COUNT; i++)
+        gauges[i].store(0);
+}
+
+void Metrics::add(int counter, uint64_t n)
+{
+    if (counter < 0 || counter >= METRIC_COUNTER_COUNT)
+        return;
+
+    counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+void Metrics::gauge_add(int gauge, int64_t n)
+{
+    if (gauge < 0 || gauge >= METRIC_GAUGE_COUNT)
+        return;
+
+    gauges[gauge].fetch_add(n, std::memory_order_relaxed);
+}
+
+void Metrics::observe(const std::string& model, const std::string& mode, double ms)
+{
+    const int bucket = (int)(std::upper_bound(metric_latency_bounds, metric_latency_bounds + METRIC_LATENCY_BUCKETS - 1, ms) - metric_latency_bounds);
+
+    std::lock_guard<std::mutex> lg(lock);
+
+    std::map<std::pair<std::string, std::string>, LatencyHistogram>::iterator it = latency.find(std::make_pair(model, mode));
+    if (it == latency.end())
+    {
+        LatencyHistogram h;
+        h.model = model;
+        h.mode = mode;
+        h.count = 0;
+        h.sum_ms = 0;
+        h.max_ms = 0;
+        std::fill(h.buckets, h.buckets + METRIC_LATENCY_BUCKETS, (uint64_t)0);
+        it = latency.insert(std::make_pair(std::make_pair(model, mode), h)).first;
+    }
+
+    LatencyHistogram& h = it->second;
+    h.count++;
+    h.sum_ms += ms;
+    h.max_ms = std::max(h.max_ms, ms);
+    h.buckets[bucket]++;
+}
+
+uint64_t Metrics::counter(int counter) const
+{
+    if (counter < 0 || counter >= METRIC_COUNTER_COUNT)
+        return 0;
+
+    return counters[counter].load(std::memory_order_relaxed);
+}
+
+int64_t Metrics::gauge(int gauge) const
+{
+    if (gauge < 0 || gauge >= METRIC_GAUGE_COUNT)
+        return 0;
+
+    return gauges[gauge].load(std::memory_order_relaxed);
+}
+
+void Metrics::histograms(std::vector<LatencyHistogram>& out) const
+{
+    std::lock_guard<std::mutex> lg(lock);
+
+    out.clear();
+    for (std::map<std::pair<std::string, std::string>, LatencyHistogram>::const_iterator it = latency.begin(); it != latency.end(); ++it)
+        out.push_back(it->second);
+}
+
+void Metrics::reset()
+{
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++)
+        counters[i].store(0);
+
+    std::lock_guard<std::mutex> lg(lock);
+    latency.clear();
+}
+
+// model dirs and modes never need more than quotes and backslashes escaped
+static void append_json_string(std::string& json, const std::string& s)
+{
+    json += '"';
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        if (s[i] == '"' || s[i] == '\\')
+            json += '\\';
+        json += s[i];
+    }
+    json += '"';
+}
+
+std::string Metrics::to_json() const
+{
+    char buf[64];
+    std::string json = "{\"counters\":{";
+
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++)
+    {
+        sprintf(buf, "%s\"%s\":%llu", i ? "," : "", metric_counter_names[i], (unsigned long long)counter(i));
+        json += buf;
+    }
+
+    json += "},\"gauges\":{";
+    for (int i = 0; i < METRIC_GAUGE_COUNT; i++)
+    {
+        sprintf(buf, "%s\"%s\":%lld", i ? "," : "", metric_gauge_names[i], (long long)gauge(i));
+        json += buf;
+    }
+
+    json += "},\"latency_bounds_ms\":[";
+    for (int i = 0; i < METRIC_LATENCY_BUCKETS - 1; i++)
+    {
+        sprintf(buf, "%s%g", i ? "," : "", metric_latency_bounds[i]);
+        json += buf;
+    }
+
+    json += "],\"latency\":[";
+
+    std::vector<LatencyHistogram> hists;
+    histograms(hists);
+    for (size_t i = 0; i < hists.size(); i++)
+    {
+        const LatencyHistogram& h = hists[i];
+
+        json += i ? ",{\"model\":" : "{\"model\":";
+        append_json_string(json, h.model);
+        json += ",\"mode\":";
+        append_json_string(json, h.mode);
+
+        sprintf(buf, ",\"count\":%llu,\"sum_ms\":%.3f,\"max_ms\":%.3f,\"buckets\":[", (unsigned long long)h.count, h.sum_ms, h.max_ms);
+        json += buf;
+        for (int j = 0; j < METRIC_LATENCY_BUCKETS; j++)
+        {
+            sprintf(buf, "%s%llu", j ? "," : "", (unsigned long long)h.buckets[j]);
+            json += buf;
+        }
+        json += "]}";
+    }
+
+    json += "]}";
+
+    return json;
+}
@@ -1,8 +1,16 @@
 // realcugan implemented with ncnn library
 
 #include "realcugan.h"
+#include "tile_cache.h"
+#include "memory_tracker.h"
+#include "metrics.h"
+#include "trace.h"
+#include "cugan_se.h"
 
+#include <math.h>
 #include <algorithm>
+#include <chrono>
+#include <functional>
 #include <vector>
 #include <map>
 
@@ -15,6 +23,9 @@
 #include "realcugan_preproc_tta.comp.hex.h"
 #include "realcugan_postproc_tta.comp.hex.h"
 #include "realcugan_4x_postproc_tta.comp.hex.h"
+#include "realcugan_preproc_tta_batch.comp.hex.h"
+#include "realcugan_postproc_tta_batch.comp.hex.h"
+#include "realcugan_4x_postproc_tta_batch.comp.hex.h"
 
 class FeatureCache
 {
@@ -23,6 +34,7 @@ public:
     {
         gpu_cache.clear();
         cpu_cache.clear();
+        gap_cache.clear();
     }
 
     std::string make_key(int yi, int xi, int ti, const std::string& name) const
@@ -50,11 +62,344 @@ public:
         cpu_cache[make_key(yi, xi, ti, name)] = feat;
     }
 
+    // synced global average of name, host side
+    void load_gap(const std::string& name, ncnn::Mat& feat)
+    {
+        feat = gap_cache[name];
+    }
+
+    void save_gap(const std::string& name, const ncnn::Mat& feat)
+    {
+        gap_cache[name] = feat;
+    }
+
 public:
     std::map<std::string, ncnn::VkMat> gpu_cache;
     std::map<std::string, ncnn::Mat> cpu_cache;
+    std::map<std::string, ncnn::Mat> gap_cache;
+};
+
+class TileSlot
+{
+public:
+    TileSlot() : key(0), uniform(false), kept(false), degraded(false), src(0) {}
+
+    // filled without running the network
+    bool skip() const
+    {
+        return kept || src || !cached.empty();
+    }
+
+public:
+    uint64_t key;
+    bool uniform;
+
+    // outimage already holds this tile from the previous version of the image
+    bool kept;
+
+    // cheaper than configured under a time budget, neither cached nor reused
+    bool degraded;
+
+    // identical tile already in outimage
+    const unsigned char* src;
+
+    // tile from the tile cache
+    std::vector<unsigned char> cached;
+};
+
+// tile_policy choices
+enum
+{
+    TILE_FULL = 0,
+    // one orientation in tta mode, SE stage2 tiles keep their orientations
+    TILE_SINGLE = 1,
+    // bicubic instead of the network
+    TILE_BICUBIC = 2
+};
+
+class ProcessContext
+{
+public:
+    ProcessContext(int w, int h, int tilesize)
+    {
+        xi0 = 0;
+        xi1 = (w + tilesize - 1) / tilesize;
+        yi0 = 0;
+        yi1 = (h + tilesize - 1) / tilesize;
+        gapfeats = 0;
+        gapfeats_out = 0;
+        clean = 0;
+        keyed = false;
+        use_tile_cache = false;
+        no_reuse = false;
+        cancel = 0;
+        syncgap = -1;
+        stagestats = 0;
+        memory_tracker = 0;
+        memory = 0;
+        blob_allocator = 0;
+        workspace_allocator = 0;
+        tile_allocator = 0;
+        memset(&tilestats, 0, sizeof(tilestats));
+    }
+
+    // nonzero once the call should stop, polled before every tile
+    int check() const
+    {
+        return cancel ? cancel->check() : 0;
+    }
+
+public:
+    // tile window [xi0, xi1) x [yi0, yi1), outimage holds exactly the output of these tiles
+    int xi0;
+    int xi1;
+    int yi0;
+    int yi1;
+
+    // synced gap0..gap3 to reuse instead of running stage0 and sync
+    const std::vector<ncnn::Mat>* gapfeats;
+
+    // receives the synced gap0..gap3 consumed by stage2
+    std::vector<ncnn::Mat>* gapfeats_out;
+
+    // per tile of the whole image, nonzero when the tile in outimage is still valid
+    const std::vector<unsigned char>* clean;
+
+    // current tile band, see reuse_band()
+    std::vector<TileSlot> slots;
+    bool keyed;
+    bool use_tile_cache;
+
+    // this call neither dedups nor touches the tile cache, whatever the instance says
+    bool no_reuse;
+
+    // first output of every distinct tile key seen so far
+    std::map<uint64_t, const unsigned char*> done;
+
+    // called once band yi of outimage is final
+    std::function<void(int yi)> band_done;
+
+    // optional cooperative stop, not owned
+    const RealCUGANCancel* cancel;
+
+    // syncgap mode for this call, -1 uses RealCUGAN::syncgap
+    int syncgap;
+
+    // optional TILE_* choice for each tile that would run the network
+    std::function<int(int xi, int yi)> tile_policy;
+
+    RealCUGANTileStats tilestats;
+
+    // optional stage timing, not owned
+    RealCUGANStageStats* stagestats;
+
+    // allocation accounting of this call alone, 0 when nobody asked for it
+    MemoryTracker* memory_tracker;
+
+    // optional figures of this call once it is done, not owned
+    MemoryStats* memory;
+
+    // cpu net blobs, workspace and tile mats, 0 for the ncnn default
+    ncnn::Allocator* blob_allocator;
+    ncnn::Allocator* workspace_allocator;
+    ncnn::Allocator* tile_allocator;
+};
+
+static uint64_t mat_hash(const ncnn::Mat& m, uint64_t seed)
+{
+    for (int q = 0; q < m.c; q++)
+    {
+        seed = tile_cache_hash(m.channel(q), (size_t)m.w * m.h * m.d * m.elemsize, seed);
+    }
+
+    return seed;
+}
+
+static void copy_tile(const unsigned char* ptr, size_t stride, unsigned char* outptr, size_t outstride, int w, int h, int channels)
+{
+    for (int y = 0; y < h; y++)
+    {
+        memcpy(outptr + y * outstride, ptr + y * stride, (size_t)w * channels);
+    }
+}
+
+// distance between packed tta orientations, the network is only shift invariant
+// on its downsampling grid, so every orientation starts on a multiple of 4
+// the gap stays zero and only feeds output columns that are thrown away
+static int tta_batch_stride(int w)
+{
+    return (w + 3) / 4 * 4;
+}
+
+static int64_t steady_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// blob and staging allocators of one gpu call, wrapped when memory is tracked
+// declared before any vkmat of the call so that it is reclaimed after all of them
+class VkAllocatorScope
+{
+public:
+    VkAllocatorScope(const ncnn::VulkanDevice* _vkdev, MemoryTracker* tracker)
+        : vkdev(_vkdev), acquired_blob(_vkdev->acquire_blob_allocator()), acquired_staging(_vkdev->acquire_staging_allocator()),
+          tracked_blob(tracker, MEMORY_VK_BLOB, acquired_blob), tracked_staging(tracker, MEMORY_VK_STAGING, acquired_staging)
+    {
+        blob = tracker ? &tracked_blob : acquired_blob;
+        staging = tracker ? &tracked_staging : acquired_staging;
+    }
+
+    ~VkAllocatorScope()
+    {
+        vkdev->reclaim_blob_allocator(acquired_blob);
+        vkdev->reclaim_staging_allocator(acquired_staging);
+    }
+
+public:
+    ncnn::VkAllocator* blob;
+    ncnn::VkAllocator* staging;
+
+private:
+    const ncnn::VulkanDevice* vkdev;
+    ncnn::VkAllocator* acquired_blob;
+    ncnn::VkAllocator* acquired_staging;
+    TrackingVkAllocator tracked_blob;
+    TrackingVkAllocator tracked_staging;
+};
+
+// charges the time between marks to one stage of stats and records it in trace
+// does nothing without stats and with trace off
+class StageTimer
+{
+public:
+    StageTimer(RealCUGANStageStats* _stats, TraceBuffer* _trace) : stats(_stats)
+    {
+        trace = _trace && _trace->enabled() ? _trace : 0;
+        t0 = stats || trace ? steady_now_ns() : 0;
+        xi = -1;
+        yi = -1;
+    }
+
+    // the tile of the following events, xi -1 for a whole band
+    void tile(int _xi, int _yi)
+    {
+        xi = _xi;
+        yi = _yi;
+    }
+
+    // restart without charging the time so far
+    void skip()
+    {
+        if (stats || trace)
+            t0 = steady_now_ns();
+    }
+
+    // name defaults to the stage, ti is the tta orientation of the event
+    void mark(double RealCUGANStageStats::*stage, const char* name = 0, int ti = -1)
+    {
+        if (!stats && !trace)
+            return;
+
+        const int64_t t1 = steady_now_ns();
+        if (stats)
+            stats->*stage += (t1 - t0) / 1e6;
+        if (trace)
+            trace->record(name ? name : stage_name(stage), t0, t1, xi, yi, ti);
+        t0 = t1;
+    }
+
+    // with stats run the commands recorded so far so that their gpu time lands in stage
+    void mark(ncnn::VkCompute& cmd, double RealCUGANStageStats::*stage, const char* name = 0, int ti = -1)
+    {
+        if (stats)
+        {
+            cmd.submit_and_wait();
+            cmd.reset();
+        }
+
+        mark(stage, name, ti);
+    }
+
+    // trace only, charged to no stage
+    void event(const char* name)
+    {
+        if (!stats && !trace)
+            return;
+
+        const int64_t t1 = steady_now_ns();
+        if (trace)
+            trace->record(name, t0, t1, xi, yi, -1);
+        t0 = t1;
+    }
+
+    void bytes(uint64_t RealCUGANStageStats::*counter, size_t size)
+    {
+        if (stats)
+            stats->*counter += size;
+    }
+
+    void inferences(int n)
+    {
+        if (stats)
+            stats->inferences += n;
+    }
+
+private:
+    static const char* stage_name(double RealCUGANStageStats::*stage)
+    {
+        if (stage == &RealCUGANStageStats::pixel_ms)
+            return "pixel";
+        if (stage == &RealCUGANStageStats::upload_ms)
+            return "upload";
+        if (stage == &RealCUGANStageStats::preproc_ms)
+            return "preproc";
+        if (stage == &RealCUGANStageStats::net_ms)
+            return "extract";
+        if (stage == &RealCUGANStageStats::alpha_ms)
+            return "alpha";
+        if (stage == &RealCUGANStageStats::postproc_ms)
+            return "postproc";
+        if (stage == &RealCUGANStageStats::download_ms)
+            return "download";
+        if (stage == &RealCUGANStageStats::se_sync_ms)
+            return "se sync";
+        return "other";
+    }
+
+private:
+    RealCUGANStageStats* stats;
+    TraceBuffer* trace;
+    int64_t t0;
+    int xi;
+    int yi;
 };
 
+RealCUGANCancel::RealCUGANCancel() : cancelled(false), deadline(0)
+{
+}
+
+void RealCUGANCancel::cancel()
+{
+    cancelled = true;
+}
+
+void RealCUGANCancel::set_deadline(double ms)
+{
+    deadline = ms > 0 ? steady_now_ns() + (int64_t)(ms * 1e6) : 0;
+}
+
+int RealCUGANCancel::check() const
+{
+    if (cancelled)
+        return REALCUGAN_CANCELLED;
+
+    const int64_t t = deadline;
+    if (t != 0 && steady_now_ns() >= t)
+        return REALCUGAN_DEADLINE_EXCEEDED;
+
+    return 0;
+}
+
 RealCUGAN::RealCUGAN(int gpuid, bool _tta_mode, int num_threads)
 {
     vkdev = gpuid == -1 ? 0 : ncnn::get_gpu_device(gpuid);
@@ -64,10 +409,34 @@ RealCUGAN::RealCUGAN(int gpuid, bool _tta_mode, int num_threads)
     realcugan_preproc = 0;
     realcugan_postproc = 0;
     realcugan_4x_postproc = 0;
+    realcugan_preproc_single = 0;
+    realcugan_postproc_single = 0;
+    realcugan_4x_postproc_single = 0;
+    realcugan_preproc_tta_batch = 0;
+    realcugan_postproc_tta_batch = 0;
+    realcugan_4x_postproc_tta_batch = 0;
     bicubic_2x = 0;
     bicubic_3x = 0;
     bicubic_4x = 0;
     tta_mode = _tta_mode;
+    tile_cache = 0;
+    trace = 0;
+    memory_tracker = 0;
+    metrics = 0;
+    tile_dedup = true;
+    int8_model = false;
+    cpu_precision = REALCUGAN_PRECISION_FP32;
+    precision_min_psnr = 40.0;
+    precision_used = REALCUGAN_PRECISION_FP32;
+    precision_psnr = INFINITY;
+    fuse_se = false;
+    se_fused = 0;
+    tta_threshold = 0.f;
+    tta_batch = false;
+    flops_per_ms = 0;
+    pass_ms = 0;
+    model_hash = 0;
+    model_bytes = 0;
 }
 
 RealCUGAN::~RealCUGAN()
@@ -76,6 +445,13 @@ RealCUGAN::~RealCUGAN()
     {
         delete realcugan_preproc;
         delete realcugan_postproc;
+        delete realcugan_4x_postproc;
+        delete realcugan_preproc_single;
+        delete realcugan_postproc_single;
+        delete realcugan_4x_postproc_single;
+        delete realcugan_preproc_tta_batch;
+        delete realcugan_postproc_tta_batch;
+        delete realcugan_4x_postproc_tta_batch;
     }
 
     bicubic_2x->destroy_pipeline(net.opt);
@@ -88,193 +464,2028 @@ RealCUGAN::~RealCUGAN()
     delete bicubic_4x;
 }
 
+static const char* const precision_names[REALCUGAN_PRECISION_COUNT] = {
+    "fp32",
+    "fp16 storage",
+    "fp16 arithmetic",
+    "bf16 storage"
+};
+
+const char* realcugan_precision_name(int precision)
+{
+    return precision >= 0 && precision < REALCUGAN_PRECISION_COUNT ? precision_names[precision] : "unknown";
+}
+
+// storage and arithmetic of a cpu net, ncnn takes the fp32 kernels where the cpu lacks the instructions
+static void set_cpu_precision(ncnn::Option& opt, int precision)
+{
+    opt.use_fp16_packed = precision == REALCUGAN_PRECISION_FP16_STORAGE || precision == REALCUGAN_PRECISION_FP16_ARITHMETIC;
+    opt.use_fp16_storage = precision == REALCUGAN_PRECISION_FP16_STORAGE || precision == REALCUGAN_PRECISION_FP16_ARITHMETIC;
+    opt.use_fp16_arithmetic = precision == REALCUGAN_PRECISION_FP16_ARITHMETIC;
+    opt.use_bf16_storage = precision == REALCUGAN_PRECISION_BF16_STORAGE;
+    opt.use_int8_storage = true;
+    // int8 convolutions run the dot product / vnni kernels, the other layers keep the precision above
+    opt.use_int8_inference = true;
+    opt.use_int8_packed = true;
+}
+
+#if _WIN32
+static int read_text(const std::wstring& path, std::string& text)
+#else
+static int read_text(const std::string& path, std::string& text)
+#endif
+{
+#if _WIN32
+    FILE* fp = _wfopen(path.c_str(), L"rb");
+    if (!fp)
+    {
+        fwprintf(stderr, L"_wfopen %ls failed\n", path.c_str());
+        return -1;
+    }
+#else
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "fopen %s failed\n", path.c_str());
+        return -1;
+    }
+#endif
+
+    text.clear();
+
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        text.append(buf, n);
+
+    fclose(fp);
+
+    return 0;
+}
+
+// param as text, possibly rewritten by fuse_se_param, the .bin as stored
+#if _WIN32
+static int load_net(ncnn::Net& net, const std::string& param, const std::wstring& modelpath)
+#else
+static int load_net(ncnn::Net& net, const std::string& param, const std::string& modelpath)
+#endif
+{
+    net.register_custom_layer("CuganSE", CuganSE_layer_creator);
+
+    int ret = net.load_param_mem(param.c_str());
+
+#if _WIN32
+    {
+        FILE* fp = _wfopen(modelpath.c_str(), L"rb");
+        if (!fp)
+        {
+            fwprintf(stderr, L"_wfopen %ls failed\n", modelpath.c_str());
+            return -1;
+        }
+
+        ret |= net.load_model(fp);
+
+        fclose(fp);
+    }
+#else
+    ret |= net.load_model(modelpath.c_str());
+#endif
+
+    return ret;
+}
+
+// psnr of net against the fp32 reference on one tile of gradients, hard edges and noise, as 8 bit output
+static double probe_psnr(const ncnn::Net& net, const ncnn::Net& reference, int prepadding)
+{
+    // 64 keeps the padded input aligned for every scale
+    const int size = prepadding * 2 + 64;
+
+    ncnn::Mat in(size, size, 3);
+    unsigned int seed = 12345;
+    for (int q = 0; q < 3; q++)
+    {
+        float* ptr = in.channel(q);
+        for (int y = 0; y < size; y++)
+        {
+            for (int x = 0; x < size; x++)
+            {
+                seed = seed * 1103515245 + 12345;
+                const float noise = ((seed >> 16) & 255) / 255.f;
+
+                float v;
+                if (y < size / 3)
+                    v = (float)(x + q * 7) / size;
+                else if (y < size * 2 / 3)
+                    v = ((x / 8 + y / 8 + q) & 1) ? 0.95f : 0.05f;
+                else
+                    v = noise;
+
+                *ptr++ = v;
+            }
+        }
+    }
+
+    ncnn::Mat out[2];
+    const ncnn::Net* nets[2] = {&net, &reference};
+    for (int i = 0; i < 2; i++)
+    {
+        ncnn::Extractor ex = nets[i]->create_extractor();
+        ex.input("in0", in);
+        if (ex.extract("out0", out[i]) != 0 || out[i].empty())
+            return 0;
+    }
+
+    if (out[0].w != out[1].w || out[0].h != out[1].h || out[0].c != out[1].c)
+        return 0;
+
+    double sse = 0;
+    size_t count = 0;
+    for (int q = 0; q < out[0].c; q++)
+    {
+        const float* a = out[0].channel(q);
+        const float* b = out[1].channel(q);
+        for (int i = 0; i < out[0].w * out[0].h; i++)
+        {
+            const float va = std::min(std::max(a[i] * 255.f, 0.f), 255.f);
+            const float vb = std::min(std::max(b[i] * 255.f, 0.f), 255.f);
+            sse += (double)(va - vb) * (va - vb);
+            count++;
+        }
+    }
+
+    if (sse == 0)
+        return INFINITY;
+
+    return 10.0 * log10(255.0 * 255.0 * count / sse);
+}
+
 #if _WIN32
 int RealCUGAN::load(const std::wstring& parampath, const std::wstring& modelpath)
 #else
 int RealCUGAN::load(const std::string& parampath, const std::string& modelpath)
 #endif
 {
+    std::string param;
+    if (read_text(parampath, param) != 0)
+        return -1;
+
+    // one CuganSE layer per SE block, the SE tiling modes need the gapN blobs kept
+    se_fused = 0;
+    if (fuse_se)
+    {
+        std::string fused;
+        se_fused = fuse_se_param(param, syncgap != 0, fused);
+        if (se_fused)
+            param.swap(fused);
+    }
+
+    // layer weights for the cost model, the loaded layers keep them private
+    std::vector<ParamLayer> params;
+    const bool params_ok = read_param_layers(param.c_str(), params) == 0;
+
+    // convolutions quantized by realcugan-quantize, there are no int8 vulkan kernels to run them
+    int8_model = false;
+    for (size_t i = 0; i < params.size(); i++)
+    {
+        if (params[i].int8_scale_term)
+            int8_model = true;
+    }
+    if (int8_model && vkdev)
+    {
+        fprintf(stderr, "int8 model needs the cpu, load it with gpuid -1\n");
+        return -1;
+    }
+
     net.opt.use_vulkan_compute = vkdev ? true : false;
-    net.opt.use_fp16_packed = true;
-    net.opt.use_fp16_storage = vkdev ? true : false;
-    net.opt.use_fp16_arithmetic = false;
-    net.opt.use_int8_storage = true;
+    if (vkdev)
+    {
+        net.opt.use_fp16_packed = true;
+        net.opt.use_fp16_storage = true;
+        net.opt.use_fp16_arithmetic = false;
+        net.opt.use_bf16_storage = false;
+        net.opt.use_int8_storage = true;
+    }
+    else
+    {
+        set_cpu_precision(net.opt, cpu_precision);
+    }
 
     net.set_vulkan_device(vkdev);
 
-#if _WIN32
+    if (load_net(net, param, modelpath) != 0)
+        return -1;
+
+    // reduced precision has to stay close to fp32 on this model, otherwise load it again in fp32
+    // without a reference to measure against it is not trusted either
+    precision_used = vkdev ? REALCUGAN_PRECISION_FP32 : cpu_precision;
+    precision_psnr = INFINITY;
+    if (precision_used != REALCUGAN_PRECISION_FP32 && precision_min_psnr > 0)
     {
-        FILE* fp = _wfopen(parampath.c_str(), L"rb");
-        if (!fp)
+        ncnn::Net reference;
+        set_cpu_precision(reference.opt, REALCUGAN_PRECISION_FP32);
+        reference.opt.num_threads = net.opt.num_threads;
+        if (load_net(reference, param, modelpath) == 0)
+        {
+            precision_psnr = probe_psnr(net, reference, prepadding);
+        }
+        else
         {
-            fwprintf(stderr, L"_wfopen %ls failed\n", parampath.c_str());
+            fprintf(stderr, "fp32 reference failed to load\n");
+            precision_psnr = 0;
         }
 
-        net.load_param(fp);
+        if (precision_psnr < precision_min_psnr)
+        {
+            fprintf(stderr, "%s is %.2f dB off fp32 on this model, below %.2f dB, falling back to fp32\n", realcugan_precision_name(precision_used), precision_psnr, precision_min_psnr);
 
-        fclose(fp);
+            net.clear();
+            set_cpu_precision(net.opt, REALCUGAN_PRECISION_FP32);
+            precision_used = REALCUGAN_PRECISION_FP32;
+            if (load_net(net, param, modelpath) != 0)
+                return -1;
+        }
+    }
+
+    model_hash = tile_cache_hash(parampath.data(), parampath.size() * sizeof(parampath[0]), 0);
+    model_hash = tile_cache_hash(modelpath.data(), modelpath.size() * sizeof(modelpath[0]), model_hash);
+    // cached tiles of another precision differ in the last bits
+    model_hash = tile_cache_hash(&precision_used, sizeof(precision_used), model_hash);
+    // and so do those of the fused SE blocks, the channel means sum in another order
+    model_hash = tile_cache_hash(&se_fused, sizeof(se_fused), model_hash);
+
+    locate_se_blocks();
+
+    if (!params_ok || cost_model.build(net, params, (prepadding * 2 + 8 + 3) / 4 * 4) != 0)
+    {
+        fprintf(stderr, "no cost model for this param, estimate() reports no flops\n");
+        cost_model.clear();
     }
     {
+#if _WIN32
         FILE* fp = _wfopen(modelpath.c_str(), L"rb");
-        if (!fp)
+#else
+        FILE* fp = fopen(modelpath.c_str(), "rb");
+#endif
+        model_bytes = 0;
+        if (fp)
+        {
+            fseek(fp, 0, SEEK_END);
+            model_bytes = (size_t)ftell(fp);
+            fclose(fp);
+        }
+    }
+
+    // initialize preprocess and postprocess pipeline
+    if (vkdev)
+    {
+        std::vector<ncnn::vk_specialization_type> specializations(1);
+#if _WIN32
+        specializations[0].i = 1;
+#else
+        specializations[0].i = 0;
+#endif
+
+        // spirv[0] single orientation, spirv[1] tta
+        {
+            static std::vector<uint32_t> spirv[2];
+            static ncnn::Mutex lock;
+            {
+                ncnn::MutexLockGuard guard(lock);
+                if (spirv[0].empty())
+                {
+                    compile_spirv_module(realcugan_preproc_comp_data, sizeof(realcugan_preproc_comp_data), net.opt, spirv[0]);
+                }
+                if (tta_mode && spirv[1].empty())
+                {
+                    compile_spirv_module(realcugan_preproc_tta_comp_data, sizeof(realcugan_preproc_tta_comp_data), net.opt, spirv[1]);
+                }
+            }
+
+            realcugan_preproc = new ncnn::Pipeline(vkdev);
+            realcugan_preproc->set_optimal_local_size_xyz(8, 8, 3);
+            realcugan_preproc->create(spirv[tta_mode ? 1 : 0].data(), spirv[tta_mode ? 1 : 0].size() * 4, specializations);
+
+            // adaptive tta runs low detail tiles through the single orientation shader
+            if (tta_mode)
+            {
+                realcugan_preproc_single = new ncnn::Pipeline(vkdev);
+                realcugan_preproc_single->set_optimal_local_size_xyz(8, 8, 3);
+                realcugan_preproc_single->create(spirv[0].data(), spirv[0].size() * 4, specializations);
+            }
+        }
+
+        {
+            static std::vector<uint32_t> spirv[2];
+            static ncnn::Mutex lock;
+            {
+                ncnn::MutexLockGuard guard(lock);
+                if (spirv[0].empty())
+                {
+                    compile_spirv_module(realcugan_postproc_comp_data, sizeof(realcugan_postproc_comp_data), net.opt, spirv[0]);
+                }
+                if (tta_mode && spirv[1].empty())
+                {
+                    compile_spirv_module(realcugan_postproc_tta_comp_data, sizeof(realcugan_postproc_tta_comp_data), net.opt, spirv[1]);
+                }
+            }
+
+            realcugan_postproc = new ncnn::Pipeline(vkdev);
+            realcugan_postproc->set_optimal_local_size_xyz(8, 8, 3);
+            realcugan_postproc->create(spirv[tta_mode ? 1 : 0].data(), spirv[tta_mode ? 1 : 0].size() * 4, specializations);
+
+            if (tta_mode)
+            {
+                realcugan_postproc_single = new ncnn::Pipeline(vkdev);
+                realcugan_postproc_single->set_optimal_local_size_xyz(8, 8, 3);
+                realcugan_postproc_single->create(spirv[0].data(), spirv[0].size() * 4, specializations);
+            }
+        }
+
+        {
+            static std::vector<uint32_t> spirv[2];
+            static ncnn::Mutex lock;
+            {
+                ncnn::MutexLockGuard guard(lock);
+                if (spirv[0].empty())
+                {
+                    compile_spirv_module(realcugan_4x_postproc_comp_data, sizeof(realcugan_4x_postproc_comp_data), net.opt, spirv[0]);
+                }
+                if (tta_mode && spirv[1].empty())
+                {
+                    compile_spirv_module(realcugan_4x_postproc_tta_comp_data, sizeof(realcugan_4x_postproc_tta_comp_data), net.opt, spirv[1]);
+                }
+            }
+
+            realcugan_4x_postproc = new ncnn::Pipeline(vkdev);
+            realcugan_4x_postproc->set_optimal_local_size_xyz(8, 8, 3);
+            realcugan_4x_postproc->create(spirv[tta_mode ? 1 : 0].data(), spirv[tta_mode ? 1 : 0].size() * 4, specializations);
+
+            if (tta_mode)
+            {
+                realcugan_4x_postproc_single = new ncnn::Pipeline(vkdev);
+                realcugan_4x_postproc_single->set_optimal_local_size_xyz(8, 8, 3);
+                realcugan_4x_postproc_single->create(spirv[0].data(), spirv[0].size() * 4, specializations);
+            }
+        }
+
+        if (tta_mode)
+        {
+            static std::vector<uint32_t> spirv;
+            static ncnn::Mutex lock;
+            {
+                ncnn::MutexLockGuard guard(lock);
+                if (spirv.empty())
+                {
+                    compile_spirv_module(realcugan_preproc_tta_batch_comp_data, sizeof(realcugan_preproc_tta_batch_comp_data), net.opt, spirv);
+                }
+            }
+
+            realcugan_preproc_tta_batch = new ncnn::Pipeline(vkdev);
+            realcugan_preproc_tta_batch->set_optimal_local_size_xyz(8, 8, 3);
+            realcugan_preproc_tta_batch->create(spirv.data(), spirv.size() * 4, specializations);
+        }
+
+        if (tta_mode)
+        {
+            static std::vector<uint32_t> spirv;
+            static ncnn::Mutex lock;
+            {
+                ncnn::MutexLockGuard guard(lock);
+                if (spirv.empty())
+                {
+                    compile_spirv_module(realcugan_postproc_tta_batch_comp_data, sizeof(realcugan_postproc_tta_batch_comp_data), net.opt, spirv);
+                }
+            }
+
+            realcugan_postproc_tta_batch = new ncnn::Pipeline(vkdev);
+            realcugan_postproc_tta_batch->set_optimal_local_size_xyz(8, 8, 3);
+            realcugan_postproc_tta_batch->create(spirv.data(), spirv.size() * 4, specializations);
+        }
+
+        if (tta_mode)
+        {
+            static std::vector<uint32_t> spirv;
+            static ncnn::Mutex lock;
+            {
+                ncnn::MutexLockGuard guard(lock);
+                if (spirv.empty())
+                {
+                    compile_spirv_module(realcugan_4x_postproc_tta_batch_comp_data, sizeof(realcugan_4x_postproc_tta_batch_comp_data), net.opt, spirv);
+                }
+            }
+
+            realcugan_4x_postproc_tta_batch = new ncnn::Pipeline(vkdev);
+            realcugan_4x_postproc_tta_batch->set_optimal_local_size_xyz(8, 8, 3);
+            realcugan_4x_postproc_tta_batch->create(spirv.data(), spirv.size() * 4, specializations);
+        }
+    }
+
+    // bicubic 2x/3x/4x for alpha channel
+    {
+        bicubic_2x = ncnn::create_layer("Interp");
+        bicubic_2x->vkdev = vkdev;
+
+        ncnn::ParamDict pd;
+        pd.set(0, 3);// bicubic
+        pd.set(1, 2.f);
+        pd.set(2, 2.f);
+        bicubic_2x->load_param(pd);
+
+        bicubic_2x->create_pipeline(net.opt);
+    }
+    {
+        bicubic_3x = ncnn::create_layer("Interp");
+        bicubic_3x->vkdev = vkdev;
+
+        ncnn::ParamDict pd;
+        pd.set(0, 3);// bicubic
+        pd.set(1, 3.f);
+        pd.set(2, 3.f);
+        bicubic_3x->load_param(pd);
+
+        bicubic_3x->create_pipeline(net.opt);
+    }
+    {
+        bicubic_4x = ncnn::create_layer("Interp");
+        bicubic_4x->vkdev = vkdev;
+
+        ncnn::ParamDict pd;
+        pd.set(0, 3);// bicubic
+        pd.set(1, 4.f);
+        pd.set(2, 4.f);
+        bicubic_4x->load_param(pd);
+
+        bicubic_4x->create_pipeline(net.opt);
+    }
+
+    return 0;
+}
+
+int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
+{
+    ProcessContext ctx(inimage.w, inimage.h, tilesize);
+
+    return process(inimage, outimage, ctx);
+}
+
+int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage, RealCUGANTileStats& tilestats) const
+{
+    ProcessContext ctx(inimage.w, inimage.h, tilesize);
+
+    int ret = process(inimage, outimage, ctx);
+
+    tilestats = ctx.tilestats;
+
+    return ret;
+}
+
+int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage, RealCUGANStageStats& stagestats, const RealCUGANCancel* cancel) const
+{
+    memset(&stagestats, 0, sizeof(stagestats));
+
+    ProcessContext ctx(inimage.w, inimage.h, tilesize);
+    ctx.cancel = cancel;
+    ctx.stagestats = &stagestats;
+
+    const int64_t t0 = steady_now_ns();
+
+    int ret = process(inimage, outimage, ctx);
+
+    stagestats.total_ms = (steady_now_ns() - t0) / 1e6;
+    stagestats.tilestats = ctx.tilestats;
+
+    return ret;
+}
+
+int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage, const RealCUGANCancel& cancel) const
+{
+    ProcessContext ctx(inimage.w, inimage.h, tilesize);
+    ctx.cancel = &cancel;
+
+    return process(inimage, outimage, ctx);
+}
+
+int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage, MemoryStats& memory) const
+{
+    ProcessContext ctx(inimage.w, inimage.h, tilesize);
+    ctx.memory = &memory;
+
+    return process(inimage, outimage, ctx);
+}
+
+int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const
+{
+    // counted on a tracker of this call, the shared memory_tracker only receives the figures once it is done
+    const bool track_memory = memory_tracker || ctx.memory;
+    MemoryTracker call_memory;
+
+    // ncnn pools blobs and workspace only when the extractor has no allocators, so the tracking wraps pools of the call
+    // every cpu mat of the call is gone before these, gap features escaping through ctx are not allocated from them
+    ncnn::PoolAllocator blob_pool;
+    ncnn::PoolAllocator workspace_pool;
+    blob_pool.set_size_compare_ratio(0.f);
+    workspace_pool.set_size_compare_ratio(0.f);
+    TrackingAllocator blob_allocator(&call_memory, MEMORY_CPU_BLOB, &blob_pool);
+    TrackingAllocator workspace_allocator(&call_memory, MEMORY_CPU_BLOB, &workspace_pool);
+    TrackingAllocator tile_allocator(&call_memory, MEMORY_CPU_TILE);
+    if (track_memory)
+    {
+        ctx.memory_tracker = &call_memory;
+        ctx.blob_allocator = &blob_allocator;
+        ctx.workspace_allocator = &workspace_allocator;
+        ctx.tile_allocator = &tile_allocator;
+
+        // allocated by the caller, alive through the whole call
+        if (!outimage.empty())
+            call_memory.allocated(MEMORY_OUTPUT, outimage.total() * outimage.elemsize);
+    }
+
+    if (metrics)
+        metrics->gauge_add(METRIC_IN_FLIGHT, 1);
+    const int64_t t0 = metrics ? steady_now_ns() : 0;
+
+    int ret = dispatch(inimage, outimage, ctx);
+
+    if (track_memory)
+    {
+        MemoryStats stats;
+        call_memory.snapshot(stats);
+        if (ctx.memory)
+            *ctx.memory = stats;
+        if (memory_tracker)
+            memory_tracker->store(stats);
+    }
+
+    if (!metrics)
+        return ret;
+
+    const double ms = (steady_now_ns() - t0) / 1e6;
+    metrics->gauge_add(METRIC_IN_FLIGHT, -1);
+
+    metrics->add(METRIC_IMAGES);
+    if (ret == REALCUGAN_CANCELLED || ret == REALCUGAN_DEADLINE_EXCEEDED)
+        metrics->add(METRIC_CANCELLED);
+    else if (ret == -100)
+        metrics->add(METRIC_OOM);
+    if (ret != 0)
+        metrics->add(METRIC_FAILED);
+
+    metrics->add(METRIC_TILES, ctx.tilestats.total);
+    metrics->add(METRIC_TILES_COMPUTED, ctx.tilestats.computed);
+    metrics->add(METRIC_TILES_TTA, ctx.tilestats.tta);
+    metrics->add(METRIC_TILES_DUPLICATE, ctx.tilestats.duplicate);
+    metrics->add(METRIC_TILES_CACHED, ctx.tilestats.cached);
+    metrics->add(METRIC_TILES_BICUBIC, ctx.tilestats.bicubic);
+
+    // only finished calls go into the latency histograms
+    if (ret == 0)
+    {
+        const bool syncgap_needed = tilesize < std::max(inimage.w, inimage.h);
+        const int syncgap_mode = syncgap_needed ? (ctx.syncgap >= 0 ? ctx.syncgap : syncgap) : 0;
+
+        char mode[64];
+        sprintf(mode, "%s/syncgap%d%s", vkdev ? "gpu" : "cpu", syncgap_mode, tta_mode ? "/tta" : "");
+        metrics->observe(model_name.empty() ? "model" : model_name, mode, ms);
+    }
+
+    return ret;
+}
+
+int RealCUGAN::dispatch(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const
+{
+    bool syncgap_needed = tilesize < std::max(inimage.w, inimage.h);
+    const int syncgap_mode = ctx.syncgap >= 0 ? ctx.syncgap : syncgap;
+
+    if (!vkdev)
+    {
+        // cpu only
+        if (syncgap_needed && syncgap_mode)
+        {
+            if (ctx.gapfeats)
+                return process_cpu_se_reuse_gap(inimage, outimage, ctx);
+            if (syncgap_mode == 1)
+                return process_cpu_se(inimage, outimage, ctx);
+            if (syncgap_mode == 2)
+                return process_cpu_se_rough(inimage, outimage, ctx);
+            if (syncgap_mode == 3)
+                return process_cpu_se_very_rough(inimage, outimage, ctx);
+        }
+        else
+            return process_cpu(inimage, outimage, ctx);
+    }
+
+    if (noise == -1 && scale == 1)
+    {
+        outimage = inimage;
+        return 0;
+    }
+
+    if (syncgap_needed && syncgap_mode)
+    {
+        if (ctx.gapfeats)
+            return process_se_reuse_gap(inimage, outimage, ctx);
+        if (syncgap_mode == 1)
+            return process_se(inimage, outimage, ctx);
+        if (syncgap_mode == 2)
+            return process_se_rough(inimage, outimage, ctx);
+        if (syncgap_mode == 3)
+            return process_se_very_rough(inimage, outimage, ctx);
+    }
+
+    return process_gpu(inimage, outimage, ctx);
+}
+
+int RealCUGAN::process_roi(const ncnn::Mat& inimage, const RealCUGANRect& rect, ncnn::Mat& outimage, const std::vector<ncnn::Mat>* gapfeats) const
+{
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int channels = inimage.elempack;
+
+    if (rect.x < 0 || rect.y < 0 || rect.w <= 0 || rect.h <= 0 || rect.x + rect.w > w * scale || rect.y + rect.h > h * scale)
+    {
+        fprintf(stderr, "invalid roi %d %d %d %d for %d x %d output\n", rect.x, rect.y, rect.w, rect.h, w * scale, h * scale);
+        return -1;
+    }
+
+    const int TILE_SIZE_X = tilesize;
+    const int TILE_SIZE_Y = tilesize;
+
+    // tiles owning the input pixels behind rect, their prepadding context is read from the full image
+    ProcessContext ctx(w, h, tilesize);
+    ctx.xi0 = rect.x / scale / TILE_SIZE_X;
+    ctx.xi1 = ((rect.x + rect.w + scale - 1) / scale - 1) / TILE_SIZE_X + 1;
+    ctx.yi0 = rect.y / scale / TILE_SIZE_Y;
+    ctx.yi1 = ((rect.y + rect.h + scale - 1) / scale - 1) / TILE_SIZE_Y + 1;
+    ctx.gapfeats = gapfeats && !gapfeats->empty() ? gapfeats : 0;
+
+    const int region_x0 = ctx.xi0 * TILE_SIZE_X * scale;
+    const int region_y0 = ctx.yi0 * TILE_SIZE_Y * scale;
+    const int region_w = std::min(ctx.xi1 * TILE_SIZE_X, w) * scale - region_x0;
+    const int region_h = std::min(ctx.yi1 * TILE_SIZE_Y, h) * scale - region_y0;
+
+    outimage.create(rect.w, rect.h, (size_t)channels, channels);
+    if (outimage.empty())
+        return -100;
+
+    if (rect.x == region_x0 && rect.y == region_y0 && rect.w == region_w && rect.h == region_h)
+    {
+        // rect is tile aligned
+        return process(inimage, outimage, ctx);
+    }
+
+    ncnn::Mat region(region_w, region_h, (size_t)channels, channels);
+    if (region.empty())
+        return -100;
+
+    int ret = process(inimage, region, ctx);
+    if (ret != 0)
+        return ret;
+
+    for (int y = 0; y < rect.h; y++)
+    {
+        const unsigned char* ptr = (const unsigned char*)region.data + ((size_t)(rect.y - region_y0 + y) * region_w + (rect.x - region_x0)) * channels;
+        unsigned char* outptr = (unsigned char*)outimage.data + (size_t)y * rect.w * channels;
+
+        memcpy(outptr, ptr, rect.w * channels);
+    }
+
+    return 0;
+}
+
+int RealCUGAN::process_se_gap(const ncnn::Mat& inimage, std::vector<ncnn::Mat>& gapfeats) const
+{
+    gapfeats.clear();
+
+    bool syncgap_needed = tilesize < std::max(inimage.w, inimage.h);
+    if (!syncgap_needed || !syncgap)
+        return 0;
+
+    // empty tile window, stage2 has nothing to do
+    ProcessContext ctx(inimage.w, inimage.h, tilesize);
+    ctx.xi1 = ctx.xi0;
+    ctx.yi1 = ctx.yi0;
+    ctx.gapfeats_out = &gapfeats;
+
+    ncnn::Mat outimage;
+    return process(inimage, outimage, ctx);
+}
+
+// right or bottom padding of an image that fits in one tile, as process_cpu() pads it
+static int single_tile_tail_padding(int size, int scale, int prepadding)
+{
+    if (scale == 1 || scale == 3)
+        return prepadding + (size + 3) / 4 * 4 - size;
+    if (scale == 2 || scale == 4)
+        return prepadding + (size + 1) / 2 * 2 - size;
+    return prepadding;
+}
+
+bool RealCUGAN::atlas_packs() const
+{
+    // tta orientations would mirror the slot layout, run those images alone
+    if (tta_mode || (noise == -1 && scale == 1))
+        return false;
+
+    // conv kernels tile their output from the blob origin, a slot away from it rounds differently
+    // only SE models differ from process() anyway, the rest must stay bit identical
+    if (se_blocks.empty())
+        return false;
+
+    for (size_t k = 0; k < se_blocks.size(); k++)
+    {
+        if (se_blocks[k].ratio <= 0.f)
+            return false;
+    }
+
+    return true;
+}
+
+int RealCUGAN::process_atlas(const std::vector<ncnn::Mat>& inimages, std::vector<ncnn::Mat>& outimages, int atlas_size) const
+{
+    if (outimages.size() != inimages.size())
+        return -1;
+
+    // padded atlas side, slots start on a multiple of 4 like the tta batch
+    const int atlas_side = ((atlas_size > 0 ? atlas_size : tilesize) + prepadding * 2) / 4 * 4;
+
+    const bool packable = atlas_packs();
+
+    std::vector<int> order;
+    for (size_t i = 0; i < inimages.size(); i++)
+    {
+        const ncnn::Mat& inimage = inimages[i];
+
+        const int padded_w = prepadding + inimage.w + single_tile_tail_padding(inimage.w, scale, prepadding);
+        const int padded_h = prepadding + inimage.h + single_tile_tail_padding(inimage.h, scale, prepadding);
+
+        // reflect padding needs more pixels than the widest border
+        bool fits = inimage.w <= tilesize && inimage.h <= tilesize && std::min(inimage.w, inimage.h) > prepadding + 3
+                    && padded_w <= atlas_side && padded_h <= atlas_side;
+
+        if (packable && fits)
+        {
+            order.push_back((int)i);
+            continue;
+        }
+
+        int ret = process(inimage, outimages[i]);
+        if (ret != 0)
+            return ret;
+    }
+
+    // shelf packing, tallest first
+    std::stable_sort(order.begin(), order.end(), [&inimages](int a, int b) {
+        return inimages[a].h > inimages[b].h;
+    });
+
+    size_t next = 0;
+    while (next < order.size())
+    {
+        std::vector<int> members;
+        std::vector<RealCUGANRect> slots;
+        int atlas_w = 0;
+        int shelf_y = 0;
+        int shelf_h = 0;
+        int x = 0;
+        for (; next < order.size(); next++)
+        {
+            const ncnn::Mat& inimage = inimages[order[next]];
+
+            RealCUGANRect slot;
+            slot.w = prepadding + inimage.w + single_tile_tail_padding(inimage.w, scale, prepadding);
+            slot.h = prepadding + inimage.h + single_tile_tail_padding(inimage.h, scale, prepadding);
+
+            const int slot_w = (slot.w + 3) / 4 * 4;
+            const int slot_h = (slot.h + 3) / 4 * 4;
+
+            if (x + slot_w > atlas_side)
+            {
+                shelf_y += shelf_h;
+                shelf_h = 0;
+                x = 0;
+            }
+            if (shelf_y + slot_h > atlas_side)
+                break;
+
+            slot.x = x;
+            slot.y = shelf_y;
+            slots.push_back(slot);
+            members.push_back(order[next]);
+
+            x += slot_w;
+            shelf_h = std::max(shelf_h, slot_h);
+            atlas_w = std::max(atlas_w, x);
+        }
+        const int atlas_h = shelf_y + shelf_h;
+
+        // nothing to share, the regular path is faster
+        if (members.size() == 1)
+        {
+            int ret = process(inimages[members[0]], outimages[members[0]]);
+            if (ret != 0)
+                return ret;
+            continue;
+        }
+
+        // split alpha, preproc and border padding of every slot
+        ncnn::Mat atlas(atlas_w, atlas_h, 3);
+        atlas.fill(0.f);
+
+        std::vector<ncnn::Mat> in_alpha_tiles(members.size());
+        for (size_t j = 0; j < members.size(); j++)
+        {
+            const ncnn::Mat& inimage = inimages[members[j]];
+            const RealCUGANRect& slot = slots[j];
+            const unsigned char* pixeldata = (const unsigned char*)inimage.data;
+            const int channels = inimage.elempack;
+
+            ncnn::Mat in;
+            if (channels == 3)
+            {
+#if _WIN32
+                in = ncnn::Mat::from_pixels(pixeldata, ncnn::Mat::PIXEL_BGR2RGB, inimage.w, inimage.h);
+#else
+                in = ncnn::Mat::from_pixels(pixeldata, ncnn::Mat::PIXEL_RGB, inimage.w, inimage.h);
+#endif
+            }
+            if (channels == 4)
+            {
+#if _WIN32
+                in = ncnn::Mat::from_pixels(pixeldata, ncnn::Mat::PIXEL_BGRA2RGBA, inimage.w, inimage.h);
+#else
+                in = ncnn::Mat::from_pixels(pixeldata, ncnn::Mat::PIXEL_RGBA, inimage.w, inimage.h);
+#endif
+                in_alpha_tiles[j] = in.channel_range(3, 1).clone();
+            }
+
+            ncnn::Mat in_tile(in.w, in.h, 3);
+            for (int q = 0; q < 3; q++)
+            {
+                const float* ptr = in.channel(q);
+                float* outptr = in_tile.channel(q);
+
+                for (int i = 0; i < in.w * in.h; i++)
+                {
+                    *outptr++ = *ptr++ * (1 / 255.f);
+                }
+            }
+
+            ncnn::Mat in_tile_padded;
+            ncnn::copy_make_border(in_tile, in_tile_padded, prepadding, slot.h - prepadding - in.h, prepadding, slot.w - prepadding - in.w, 2, 0.f, net.opt);
+
+            for (int q = 0; q < 3; q++)
+            {
+                for (int i = 0; i < slot.h; i++)
+                {
+                    memcpy(atlas.channel(q).row(slot.y + i) + slot.x, in_tile_padded.channel(q).row(i), slot.w * sizeof(float));
+                }
+            }
+        }
+
+        // realcugan
+        ncnn::Mat out_atlas;
+        int ret = forward_atlas(atlas, slots, out_atlas);
+        if (ret != 0)
+            return ret;
+
+        // postproc and merge alpha of every slot
+        for (size_t j = 0; j < members.size(); j++)
+        {
+            ncnn::Mat& outimage = outimages[members[j]];
+            const RealCUGANRect& slot = slots[j];
+            const int channels = inimages[members[j]].elempack;
+
+            ncnn::Mat out(inimages[members[j]].w * scale, inimages[members[j]].h * scale, channels);
+            for (int q = 0; q < 3; q++)
+            {
+                float* outptr = out.channel(q);
+
+                for (int i = 0; i < out.h; i++)
+                {
+                    const float* ptr = out_atlas.channel(q).row(slot.y * scale + i) + slot.x * scale;
+
+                    if (scale == 4)
+                    {
+                        const float* inptr = atlas.channel(q).row(slot.y + prepadding + i / 4) + slot.x + prepadding;
+
+                        for (int k = 0; k < out.w; k++)
+                        {
+                            *outptr++ = *ptr++ * 255.f + 0.5f + inptr[k / 4] * 255.f;
+                        }
+                    }
+                    else
+                    {
+                        for (int k = 0; k < out.w; k++)
+                        {
+                            *outptr++ = *ptr++ * 255.f + 0.5f;
+                        }
+                    }
+                }
+            }
+
+            if (channels == 4)
+            {
+                ncnn::Mat out_alpha_tile;
+                if (scale == 1)
+                {
+                    out_alpha_tile = in_alpha_tiles[j];
+                }
+                if (scale == 2)
+                {
+                    bicubic_2x->forward(in_alpha_tiles[j], out_alpha_tile, net.opt);
+                }
+                if (scale == 3)
+                {
+                    bicubic_3x->forward(in_alpha_tiles[j], out_alpha_tile, net.opt);
+                }
+                if (scale == 4)
+                {
+                    bicubic_4x->forward(in_alpha_tiles[j], out_alpha_tile, net.opt);
+                }
+
+                memcpy(out.channel_range(3, 1), out_alpha_tile, out_alpha_tile.total() * sizeof(float));
+            }
+
+            if (channels == 3)
+            {
+#if _WIN32
+                out.to_pixels((unsigned char*)outimage.data, ncnn::Mat::PIXEL_RGB2BGR, outimage.w * channels);
+#else
+                out.to_pixels((unsigned char*)outimage.data, ncnn::Mat::PIXEL_RGB, outimage.w * channels);
+#endif
+            }
+            if (channels == 4)
+            {
+#if _WIN32
+                out.to_pixels((unsigned char*)outimage.data, ncnn::Mat::PIXEL_RGBA2BGRA, outimage.w * channels);
+#else
+                out.to_pixels((unsigned char*)outimage.data, ncnn::Mat::PIXEL_RGBA, outimage.w * channels);
+#endif
+            }
+        }
+    }
+
+    return 0;
+}
+
+RealCUGANEstimate RealCUGAN::estimate(int w, int h, int channels) const
+{
+    RealCUGANEstimate e;
+    memset(&e, 0, sizeof(e));
+
+    if (w <= 0 || h <= 0)
+        return e;
+
+    const int xtiles = (w + tilesize - 1) / tilesize;
+    const int ytiles = (h + tilesize - 1) / tilesize;
+
+    e.tiles = xtiles * ytiles;
+
+    // inferences per tile, tta_batch packs the 8 orientations into 2
+    const int orientations = tta_mode ? 8 : 1;
+    const int tile_passes = tta_mode ? (tta_batch ? 2 : 8) : 1;
+
+    // padded network input of a tile as cropped by process_cpu and process_gpu
+    const int align = scale == 1 || scale == 3 ? 4 : 2;
+    const int mode = tilesize < std::max(w, h) ? syncgap : 0;
+
+    const int nblocks = (int)se_blocks.size();
+    const int last_gap = nblocks ? se_blocks[nblocks - 1].gap : -1;
+
+    // blobs live in fp16 with vulkan and with the reduced cpu precisions
+    const size_t elemsize = net.opt.use_fp16_storage || net.opt.use_bf16_storage ? 2 : 4;
+
+    for (int yi = 0; yi < ytiles; yi++)
+    {
+        const int tile_h = std::min((yi + 1) * tilesize, h) - yi * tilesize;
+        const int in_h = prepadding * 2 + (tile_h + align - 1) / align * align;
+
+        for (int xi = 0; xi < xtiles; xi++)
+        {
+            const int tile_w = std::min((xi + 1) * tilesize, w) - xi * tilesize;
+            const int in_w = prepadding * 2 + (tile_w + align - 1) / align * align;
+
+            double flops = cost_model.flops(in_w, in_h);
+            int passes = 1;
+
+            // the stage0 passes before stage2 run the network up to the pooling of an SE block
+            if (mode == 1)
+            {
+                for (int k = 0; k < 4; k++)
+                    flops += k < nblocks ? cost_model.flops(in_w, in_h, se_blocks[k].gap) : cost_model.flops(in_w, in_h);
+                passes += 4;
+            }
+            if (mode == 2)
+            {
+                flops += last_gap >= 0 ? cost_model.flops(in_w, in_h, last_gap) : cost_model.flops(in_w, in_h);
+                passes += 1;
+            }
+
+            e.flops += flops * orientations;
+            e.passes += passes * tile_passes;
+            if (!cost_model.empty())
+                e.traffic_bytes += cost_model.traffic_bytes(in_w, in_h, elemsize) * orientations;
+        }
+    }
+
+    // very rough syncs the SE blocks on every third of a grid of 32x32 tiles
+    if (mode == 3)
+    {
+        const int samples = ((w + 31) / 32 / 3) * ((h + 31) / 32 / 3);
+        const int in_side = prepadding * 2 + 32;
+
+        const double flops = last_gap >= 0 ? cost_model.flops(in_side, in_side, last_gap) : cost_model.flops(in_side, in_side);
+
+        e.flops += flops * orientations * samples;
+        e.passes += samples * tile_passes;
+    }
+
+    if (flops_per_ms > 0)
+        e.time_ms = e.flops / flops_per_ms + e.passes * pass_ms;
+
+    // the first tile is the largest
+    const int tile_w = std::min(tilesize, w);
+    const int tile_h = std::min(tilesize, h);
+    const int in_w = prepadding * 2 + (tile_w + align - 1) / align * align;
+    const int in_h = prepadding * 2 + (tile_h + align - 1) / align * align;
+
+    const size_t images = (size_t)w * h * channels + (size_t)w * scale * h * scale * channels;
+
+    // preprocessed input and postprocessed output of every orientation are held at once
+    const size_t tile_io = ((size_t)in_w * in_h * 3 + (size_t)tile_w * scale * tile_h * scale * 3) * sizeof(float);
+
+    // the .bin stores fp16 weights, only a fallback without the param
+    const size_t weight_bytes = cost_model.empty() ? model_bytes / 2 * elemsize : cost_model.weights * elemsize;
+
+    if (vkdev)
+    {
+        e.host_bytes = images + tile_io;
+        e.device_bytes = weight_bytes + cost_model.peak_blob_bytes(in_w, in_h, elemsize) + tile_io / (4 / elemsize) * orientations;
+    }
+    else
+    {
+        e.host_bytes = images + weight_bytes + cost_model.peak_blob_bytes(in_w, in_h, elemsize) + tile_io * orientations;
+        e.device_bytes = 0;
+    }
+
+    return e;
+}
+
+int RealCUGAN::calibrate()
+{
+    typedef std::chrono::steady_clock clock;
+
+    // single tile images run no SE stage passes, the fit is ms = flops / flops_per_ms + passes * pass_ms
+    const int sizes[2] = {std::max(tilesize / 2, 32), tilesize};
+    double flops[2];
+    double ms[2];
+    int passes[2];
+
+    uint32_t seed = 0x12345678;
+    int ret = 0;
+    for (int t = 0; t < 2 && ret == 0; t++)
+    {
+        const int size = sizes[t];
+
+        ncnn::Mat in(size, size, (size_t)3, 3);
+        ncnn::Mat out(size * scale, size * scale, (size_t)3, 3);
+        if (in.empty() || out.empty())
+        {
+            ret = -100;
+            break;
+        }
+
+        // noise runs every tta orientation, the first run warms up pipelines and allocators
+        for (int k = 0; k < 2 && ret == 0; k++)
+        {
+            unsigned char* ptr = (unsigned char*)in.data;
+            for (int i = 0; i < size * size * 3; i++)
+            {
+                seed = seed * 1664525 + 1013904223;
+                ptr[i] = (unsigned char)(seed >> 24);
+            }
+
+            // random tiles would only pollute the shared cache, and the instance may be serving other calls
+            ProcessContext ctx(size, size, tilesize);
+            ctx.no_reuse = true;
+
+            clock::time_point t0 = clock::now();
+            ret = process(in, out, ctx);
+            ms[t] = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+        }
+
+        RealCUGANEstimate e = estimate(size, size, 3);
+        flops[t] = e.flops;
+        passes[t] = std::max(e.passes, 1);
+    }
+
+    if (ret != 0)
+        return ret;
+
+    double throughput = flops[1] / std::max(ms[1], 1e-3);
+    if (ms[1] > ms[0] && flops[1] > flops[0])
+        throughput = (flops[1] - flops[0]) / (ms[1] - ms[0]);
+
+    if (throughput <= 0)
+        return -1;
+
+    flops_per_ms = throughput;
+    pass_ms = std::max(ms[1] - flops[1] / throughput, 0.0) / passes[1];
+
+    return 0;
+}
+
+// the bottom layout a layer can consume, the inverse of what ncnn does before every forward
+static void unpack_for_layer(ncnn::Mat& m, const ncnn::Layer* layer, const ncnn::Option& opt)
+{
+    if (m.elembits() == 16 && !layer->support_fp16_storage && !layer->support_bf16_storage)
+    {
+        ncnn::Mat m_fp32;
+        ncnn::cast_float16_to_float32(m, m_fp32, opt);
+        m = m_fp32;
+    }
+
+    if (m.elempack != 1 && !layer->support_packing)
+    {
+        ncnn::Mat m_unpacked;
+        ncnn::convert_packing(m, m_unpacked, 1, opt);
+        m = m_unpacked;
+    }
+}
+
+static void blob_shape(int dims, int w, int h, int c, int elempack, int& out_w, int& out_h, int& out_c)
+{
+    out_w = dims == 1 ? w * elempack : w;
+    out_h = dims == 2 ? h * elempack : h;
+    out_c = dims >= 3 ? c * elempack : 1;
+}
+
+int RealCUGAN::profile_layers(int in_size, std::vector<RealCUGANLayerProfile>& profile, int loops) const
+{
+    typedef std::chrono::steady_clock clock;
+
+    const std::vector<ncnn::Layer*>& layers = net.layers();
+    const std::vector<ncnn::Blob>& blobs = net.blobs();
+
+    profile.clear();
+
+    ncnn::Mat in(in_size, in_size, 3);
+    if (in.empty())
+        return -100;
+
+    uint32_t seed = 0x12345678;
+    for (int q = 0; q < 3; q++)
+    {
+        float* ptr = in.channel(q);
+        for (int i = 0; i < in_size * in_size; i++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            ptr[i] = (seed >> 8) / 16777216.f;
+        }
+    }
+
+    const size_t weight_elemsize = net.opt.use_fp16_storage ? 2u : 4u;
+
+    profile.resize(layers.size());
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        RealCUGANLayerProfile& p = profile[i];
+        p.type = layers[i]->type;
+        p.name = layers[i]->name;
+        p.out_w = 0;
+        p.out_h = 0;
+        p.out_c = 0;
+        p.flops = cost_model.empty() ? 0 : cost_model.layer_flops((int)i, in_size, in_size);
+        p.bytes = cost_model.empty() ? 0 : (double)cost_model.layers[i].weights * weight_elemsize;
+        p.time_ms = 0;
+    }
+
+    int ret = 0;
+    if (!vkdev)
+    {
+        // a layer only ever sees its bottoms as the previous layers produced them, keep them all
+        ncnn::Extractor ex = net.create_extractor();
+        ex.set_light_mode(false);
+
+        ex.input("in0", in);
+
+        std::vector<ncnn::Mat> mats(blobs.size());
+        for (size_t b = 0; b < blobs.size(); b++)
+        {
+            if (blobs[b].producer >= 0 && layers[blobs[b].producer]->type != "Input")
+                ex.extract((int)b, mats[b], 1);
+            else if (blobs[b].name == "in0")
+                mats[b] = in;
+        }
+
+        for (size_t i = 0; i < layers.size(); i++)
+        {
+            const ncnn::Layer* layer = layers[i];
+            if (layer->type == "Input")
+                continue;
+
+            std::vector<ncnn::Mat> bottoms(layer->bottoms.size());
+            for (size_t j = 0; j < bottoms.size(); j++)
+            {
+                bottoms[j] = mats[layer->bottoms[j]];
+                unpack_for_layer(bottoms[j], layer, net.opt);
+                profile[i].bytes += (double)bottoms[j].total() * bottoms[j].elemsize;
+            }
+
+            // the unused branches of a SE model
+            if (bottoms.empty() || bottoms[0].empty())
+                continue;
+
+            double best = 0;
+            std::vector<ncnn::Mat> tops(layer->tops.size());
+            for (int k = 0; k < std::max(loops, 1) + 1; k++)
+            {
+                // inplace layers get a private copy, made outside the timed section
+                std::vector<ncnn::Mat> blobs_inplace;
+                if (layer->support_inplace)
+                {
+                    blobs_inplace.resize(bottoms.size());
+                    for (size_t j = 0; j < bottoms.size(); j++)
+                        blobs_inplace[j] = bottoms[j].clone();
+                }
+
+                clock::time_point t0 = clock::now();
+                if (layer->one_blob_only && layer->support_inplace)
+                    ret = layer->forward_inplace(blobs_inplace[0], net.opt);
+                else if (layer->one_blob_only)
+                    ret = layer->forward(bottoms[0], tops[0], net.opt);
+                else if (layer->support_inplace)
+                    ret = layer->forward_inplace(blobs_inplace, net.opt);
+                else
+                    ret = layer->forward(bottoms, tops, net.opt);
+                const double ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+
+                if (ret != 0)
+                    break;
+
+                if (layer->support_inplace)
+                    tops = blobs_inplace;
+
+                // the first run warms up the allocator
+                if (k == 1 || (k > 1 && ms < best))
+                    best = ms;
+            }
+
+            if (ret != 0)
+            {
+                fprintf(stderr, "layer %s forward failed %d\n", layer->name.c_str(), ret);
+                break;
+            }
+
+            profile[i].time_ms = best;
+            for (size_t j = 0; j < tops.size(); j++)
+                profile[i].bytes += (double)tops[j].total() * tops[j].elemsize;
+            if (!tops.empty())
+                blob_shape(tops[0].dims, tops[0].w, tops[0].h, tops[0].c, tops[0].elempack, profile[i].out_w, profile[i].out_h, profile[i].out_c);
+        }
+
+        return ret;
+    }
+
+    ncnn::VkAllocator* blob_vkallocator = vkdev->acquire_blob_allocator();
+    ncnn::VkAllocator* staging_vkallocator = vkdev->acquire_staging_allocator();
+
+    ncnn::Option opt = net.opt;
+    opt.blob_vkallocator = blob_vkallocator;
+    opt.workspace_vkallocator = blob_vkallocator;
+    opt.staging_vkallocator = staging_vkallocator;
+
+    {
+        ncnn::Extractor ex = net.create_extractor();
+        ex.set_light_mode(false);
+
+        ex.set_blob_vkallocator(blob_vkallocator);
+        ex.set_workspace_vkallocator(blob_vkallocator);
+        ex.set_staging_vkallocator(staging_vkallocator);
+
+        ncnn::VkCompute cmd(vkdev);
+
+        ncnn::VkMat in_gpu;
+        cmd.record_clone(in, in_gpu, opt);
+
+        ex.input("in0", in_gpu);
+
+        std::vector<ncnn::VkMat> mats(blobs.size());
+        for (size_t b = 0; b < blobs.size(); b++)
+        {
+            if (blobs[b].producer >= 0 && layers[blobs[b].producer]->type != "Input")
+                ex.extract((int)b, mats[b], cmd);
+            else if (blobs[b].name == "in0")
+                mats[b] = in_gpu;
+        }
+
+        cmd.submit_and_wait();
+        cmd.reset();
+
+        // fixed cost of a submit, taken off every layer
+        double submit_ms = 0;
+        for (int k = 0; k < std::max(loops, 1) + 1; k++)
+        {
+            clock::time_point t0 = clock::now();
+            cmd.submit_and_wait();
+            const double ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+            cmd.reset();
+
+            if (k == 1 || (k > 1 && ms < submit_ms))
+                submit_ms = ms;
+        }
+
+        for (size_t i = 0; i < layers.size() && ret == 0; i++)
+        {
+            const ncnn::Layer* layer = layers[i];
+            if (layer->type == "Input")
+                continue;
+
+            std::vector<ncnn::VkMat> bottoms(layer->bottoms.size());
+            for (size_t j = 0; j < bottoms.size(); j++)
+            {
+                bottoms[j] = mats[layer->bottoms[j]];
+                profile[i].bytes += (double)bottoms[j].total() * bottoms[j].elemsize;
+            }
+
+            if (bottoms.empty() || bottoms[0].empty())
+                continue;
+
+            double best = 0;
+            std::vector<ncnn::VkMat> tops(layer->tops.size());
+            for (int k = 0; k < std::max(loops, 1) + 1; k++)
+            {
+                std::vector<ncnn::VkMat> blobs_inplace;
+                if (layer->support_inplace)
+                {
+                    blobs_inplace.resize(bottoms.size());
+                    for (size_t j = 0; j < bottoms.size(); j++)
+                        cmd.record_clone(bottoms[j], blobs_inplace[j], opt);
+
+                    cmd.submit_and_wait();
+                    cmd.reset();
+                }
+
+                clock::time_point t0 = clock::now();
+                if (layer->one_blob_only && layer->support_inplace)
+                    ret = layer->forward_inplace(blobs_inplace[0], cmd, opt);
+                else if (layer->one_blob_only)
+                    ret = layer->forward(bottoms[0], tops[0], cmd, opt);
+                else if (layer->support_inplace)
+                    ret = layer->forward_inplace(blobs_inplace, cmd, opt);
+                else
+                    ret = layer->forward(bottoms, tops, cmd, opt);
+                cmd.submit_and_wait();
+                const double ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count() - submit_ms;
+                cmd.reset();
+
+                if (ret != 0)
+                    break;
+
+                if (layer->support_inplace)
+                    tops = blobs_inplace;
+
+                if (k == 1 || (k > 1 && ms < best))
+                    best = ms;
+            }
+
+            if (ret != 0)
+            {
+                fprintf(stderr, "layer %s forward failed %d\n", layer->name.c_str(), ret);
+                break;
+            }
+
+            profile[i].time_ms = std::max(best, 0.0);
+            for (size_t j = 0; j < tops.size(); j++)
+                profile[i].bytes += (double)tops[j].total() * tops[j].elemsize;
+            if (!tops.empty())
+                blob_shape(tops[0].dims, tops[0].w, tops[0].h, tops[0].c, tops[0].elempack, profile[i].out_w, profile[i].out_h, profile[i].out_c);
+        }
+    }
+
+    vkdev->reclaim_blob_allocator(blob_vkallocator);
+    vkdev->reclaim_staging_allocator(staging_vkallocator);
+
+    return ret;
+}
+
+void RealCUGAN::locate_se_blocks()
+{
+    se_blocks.clear();
+
+    const std::vector<ncnn::Layer*>& layers = net.layers();
+    const std::vector<ncnn::Blob>& blobs = net.blobs();
+
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        const ncnn::Layer* layer = layers[i];
+
+        if (layer->type == "Pooling" && layer->tops.size() == 1)
+        {
+            SEBlock b;
+            b.feat = -1;
+            b.gap = layer->tops[0];
+            b.scales = -1;
+            b.out = -1;
+            b.layer = -1;
+            b.ratio = 0.f;
+            b.shrink = 0;
+            se_blocks.push_back(b);
+        }
+
+        // fused block, the keep_gap form follows the Pooling that opened it
+        if (layer->type == "CuganSE" && !layer->bottoms.empty() && layer->tops.size() == 1)
+        {
+            if (se_blocks.empty() || se_blocks.back().out != -1)
+            {
+                SEBlock b;
+                b.gap = -1;
+                b.ratio = 0.f;
+                b.shrink = 0;
+                se_blocks.push_back(b);
+            }
+
+            SEBlock& b = se_blocks.back();
+            b.feat = layer->bottoms[0];
+            b.scales = -1;
+            b.out = layer->tops[0];
+            b.layer = (int)i;
+        }
+
+        // feat multiplied by the inner product chain on gap
+        if (layer->type == "BinaryOp" && layer->bottoms.size() == 2 && !se_blocks.empty() && se_blocks.back().out == -1)
+        {
+            const int producer = blobs[layer->bottoms[1]].producer;
+            if (producer >= 0 && layers[producer]->type == "InnerProduct")
+            {
+                SEBlock& b = se_blocks.back();
+                b.feat = layer->bottoms[0];
+                b.scales = layer->bottoms[1];
+                b.out = layer->tops[0];
+            }
+        }
+    }
+
+    for (size_t k = 0; k < se_blocks.size(); k++)
+    {
+        if (se_blocks[k].out == -1)
+            return;
+    }
+
+    // feature sides of two blank inputs, every conv is unpadded so the relation is linear
+    const int size0 = (prepadding * 2 + 8 + 3) / 4 * 4;
+    const int size1 = size0 + 8;
+
+    std::vector<int> sides0(se_blocks.size());
+    std::vector<int> sides1(se_blocks.size());
+    for (int t = 0; t < 2; t++)
+    {
+        const int size = t == 0 ? size0 : size1;
+        std::vector<int>& sides = t == 0 ? sides0 : sides1;
+
+        ncnn::Mat in(size, size, 3);
+        in.fill(0.f);
+
+        ncnn::Extractor ex = net.create_extractor();
+
+        ex.input("in0", in);
+
+        for (size_t k = 0; k < se_blocks.size(); k++)
+        {
+            ncnn::Mat feat;
+            if (ex.extract(se_blocks[k].feat, feat) != 0 || feat.w != feat.h)
+                return;
+
+            sides[k] = feat.w;
+        }
+    }
+
+    for (size_t k = 0; k < se_blocks.size(); k++)
+    {
+        SEBlock& b = se_blocks[k];
+        b.ratio = (float)(sides1[k] - sides0[k]) / (size1 - size0);
+        b.shrink = (int)(b.ratio * size0 + 0.5f) - sides0[k];
+    }
+}
+
+int RealCUGAN::forward_atlas(const ncnn::Mat& atlas, const std::vector<RealCUGANRect>& slots, ncnn::Mat& out) const
+{
+    const int nslots = (int)slots.size();
+
+    ncnn::Extractor ex = net.create_extractor();
+
+    ex.input("in0", atlas);
+
+    // stop at every SE block and apply the excitation of each slot to its own region
+    for (size_t k = 0; k < se_blocks.size(); k++)
+    {
+        const SEBlock& b = se_blocks[k];
+
+        ncnn::Mat feat;
+        int ret = ex.extract(b.feat, feat);
+        if (ret != 0)
+            return ret;
+
+        std::vector<RealCUGANRect> regions(nslots);
+        ncnn::Mat gap(feat.c, nslots);
+        for (int j = 0; j < nslots; j++)
+        {
+            RealCUGANRect& r = regions[j];
+            r.x = (int)(slots[j].x * b.ratio + 0.5f);
+            r.y = (int)(slots[j].y * b.ratio + 0.5f);
+            r.w = (int)(slots[j].w * b.ratio + 0.5f) - b.shrink;
+            r.h = (int)(slots[j].h * b.ratio + 0.5f) - b.shrink;
+
+            if (r.w <= 0 || r.h <= 0 || r.x + r.w > feat.w || r.y + r.h > feat.h)
+            {
+                fprintf(stderr, "atlas slot %d falls outside feature %d x %d\n", j, feat.w, feat.h);
+                return -1;
+            }
+
+            float* gapptr = gap.row(j);
+            for (int q = 0; q < feat.c; q++)
+            {
+                const ncnn::Mat m = feat.channel(q);
+
+                float sum = 0.f;
+                for (int i = 0; i < r.h; i++)
+                {
+                    const float* ptr = m.row(r.y + i) + r.x;
+                    for (int x = 0; x < r.w; x++)
+                    {
+                        sum += ptr[x];
+                    }
+                }
+
+                gapptr[q] = sum / (r.w * r.h);
+            }
+        }
+
+        // all slots through the inner products as one batch
+        ncnn::Mat scales;
+        if (b.layer >= 0)
+        {
+            const CuganSE* se = (const CuganSE*)net.layers()[b.layer];
+            if (se->channels != feat.c)
+                return -1;
+
+            scales.create(feat.c, nslots);
+            for (int j = 0; j < nslots; j++)
+                se->excite(gap.row(j), scales.row(j));
+        }
+        else
+        {
+            ncnn::Extractor exs = net.create_extractor();
+
+            exs.input(b.gap, gap);
+
+            ret = exs.extract(b.scales, scales);
+            if (ret != 0)
+                return ret;
+        }
+        if (scales.total() != (size_t)feat.c * nslots)
+            return -1;
+
+        ncnn::Mat feat_scaled = feat.clone();
+        for (int j = 0; j < nslots; j++)
+        {
+            const RealCUGANRect& r = regions[j];
+            const float* scaleptr = (const float*)scales.data + j * feat.c;
+
+            for (int q = 0; q < feat.c; q++)
+            {
+                ncnn::Mat m = feat_scaled.channel(q);
+                const float s = scaleptr[q];
+
+                for (int i = 0; i < r.h; i++)
+                {
+                    float* ptr = m.row(r.y + i) + r.x;
+                    for (int x = 0; x < r.w; x++)
+                    {
+                        ptr[x] *= s;
+                    }
+                }
+            }
+        }
+
+        ex.input(b.out, feat_scaled);
+    }
+
+    return ex.extract("out0", out);
+}
+
+uint64_t RealCUGAN::tile_key(const ncnn::Mat& inimage, int xi, int yi, uint64_t gaphash, bool* uniform) const
+{
+    const unsigned char* pixeldata = (const unsigned char*)inimage.data;
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int channels = inimage.elempack;
+
+    const int TILE_SIZE_X = tilesize;
+    const int TILE_SIZE_Y = tilesize;
+
+    const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
+    const int tile_h_nopad = std::min((yi + 1) * TILE_SIZE_Y, h) - yi * TILE_SIZE_Y;
+
+    int prepadding_right = prepadding;
+    int prepadding_bottom = prepadding;
+    if (scale == 1 || scale == 3)
+    {
+        prepadding_right += (tile_w_nopad + 3) / 4 * 4 - tile_w_nopad;
+        prepadding_bottom += (tile_h_nopad + 3) / 4 * 4 - tile_h_nopad;
+    }
+    if (scale == 2 || scale == 4)
+    {
+        prepadding_right += (tile_w_nopad + 1) / 2 * 2 - tile_w_nopad;
+        prepadding_bottom += (tile_h_nopad + 1) / 2 * 2 - tile_h_nopad;
+    }
+
+    int in_tile_x0 = std::max(xi * TILE_SIZE_X - prepadding, 0);
+    int in_tile_x1 = std::min((xi + 1) * TILE_SIZE_X + prepadding_right, w);
+    int in_tile_y0 = std::max(yi * TILE_SIZE_Y - prepadding, 0);
+    int in_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom, h);
+
+    // the output only depends on the cropped pixels, the reflect padding around them and the network
+    // tile position does not matter, so equal tiles anywhere share one key
+    int desc[18];
+    desc[0] = tile_w_nopad;
+    desc[1] = tile_h_nopad;
+    desc[2] = std::max(prepadding - yi * TILE_SIZE_Y, 0);
+    desc[3] = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom - h, prepadding_bottom), 0);
+    desc[4] = std::max(prepadding - xi * TILE_SIZE_X, 0);
+    desc[5] = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding_right - w, prepadding_right), 0);
+    desc[6] = channels;
+    desc[7] = noise;
+    desc[8] = scale;
+    desc[9] = prepadding;
+    desc[10] = tta_mode ? 1 : 0;
+    desc[11] = vkdev ? 1 : 0;
+    desc[12] = net.opt.use_fp16_storage ? 1 : 0;
+    desc[13] = net.opt.use_fp16_arithmetic ? 1 : 0;
+    desc[14] = net.opt.use_int8_storage ? 1 : 0;
+    desc[15] = 0;
+    // adaptive tta picks the orientations from the tile content, so the threshold is enough
+    desc[16] = 0;
+    if (tta_mode)
+        memcpy(&desc[16], &tta_threshold, sizeof(float));
+    desc[17] = tta_mode && tta_batch ? 1 : 0;
+
+    // a single colour tile stays single colour after reflect padding
+    // so only its colour and padded size matter, wherever it sits in the image
+    const unsigned char* color = pixeldata + ((size_t)in_tile_y0 * w + in_tile_x0) * channels;
+    bool is_uniform = true;
+    for (int y = in_tile_y0; y < in_tile_y1 && is_uniform; y++)
+    {
+        const unsigned char* ptr = pixeldata + ((size_t)y * w + in_tile_x0) * channels;
+
+        for (int x = in_tile_x0; x < in_tile_x1; x++)
+        {
+            if (memcmp(ptr, color, channels) != 0)
+            {
+                is_uniform = false;
+                break;
+            }
+
+            ptr += channels;
+        }
+    }
+
+    if (uniform)
+        *uniform = is_uniform;
+
+    if (is_uniform)
+    {
+        desc[2] = 0;
+        desc[3] = 0;
+        desc[4] = 0;
+        desc[5] = 0;
+        desc[15] = 1;
+
+        uint64_t key = tile_cache_hash(desc, sizeof(desc), model_hash ^ gaphash);
+        return tile_cache_hash(color, channels, key);
+    }
+
+    uint64_t key = tile_cache_hash(desc, sizeof(desc), model_hash ^ gaphash);
+
+    for (int y = in_tile_y0; y < in_tile_y1; y++)
+    {
+        key = tile_cache_hash(pixeldata + ((size_t)y * w + in_tile_x0) * channels, (size_t)(in_tile_x1 - in_tile_x0) * channels, key);
+    }
+
+    return key;
+}
+
+int RealCUGAN::reuse_band(const ncnn::Mat& inimage, const ncnn::Mat& outimage, int yi, uint64_t gaphash, ProcessContext& ctx) const
+{
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int channels = inimage.elempack;
+
+    const int TILE_SIZE_X = tilesize;
+    const int TILE_SIZE_Y = tilesize;
+
+    const int tile_h_nopad = std::min((yi + 1) * TILE_SIZE_Y, h) - yi * TILE_SIZE_Y;
+
+    const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
+
+    const bool dedup = tile_dedup && !ctx.no_reuse;
+
+    ctx.use_tile_cache = !ctx.no_reuse && tile_cache && tile_cache->enabled();
+    ctx.keyed = dedup || ctx.use_tile_cache;
+
+    ctx.slots.clear();
+    ctx.slots.resize(ctx.xi1 - ctx.xi0);
+
+    int ncompute = 0;
+    for (int xi = ctx.xi0; xi < ctx.xi1; xi++)
+    {
+        const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
+
+        TileSlot& slot = ctx.slots[xi - ctx.xi0];
+
+        ctx.tilestats.total++;
+
+        if (ctx.clean && (*ctx.clean)[yi * xtiles + xi])
+        {
+            slot.kept = true;
+            ctx.tilestats.unchanged++;
+            continue;
+        }
+
+        if (!ctx.keyed)
+        {
+            ncompute++;
+            continue;
+        }
+
+        slot.key = tile_key(inimage, xi, yi, gaphash, &slot.uniform);
+        if (slot.uniform)
+            ctx.tilestats.uniform++;
+
+        if (dedup)
+        {
+            // identical tile in an earlier band
+            std::map<uint64_t, const unsigned char*>::const_iterator it = ctx.done.find(slot.key);
+            if (it != ctx.done.end())
+            {
+                slot.src = it->second;
+                ctx.tilestats.duplicate++;
+                continue;
+            }
+
+            // identical tile earlier in this band, ready once the band is kept
+            for (int xj = ctx.xi0; xj < xi; xj++)
+            {
+                if (!ctx.slots[xj - ctx.xi0].kept && ctx.slots[xj - ctx.xi0].key == slot.key)
+                {
+                    slot.src = (const unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels + (xj - ctx.xi0) * scale * TILE_SIZE_X * channels;
+                    ctx.tilestats.duplicate++;
+                    break;
+                }
+            }
+
+            if (slot.src)
+                continue;
+        }
+
+        if (ctx.use_tile_cache)
+        {
+            slot.cached.resize((size_t)tile_w_nopad * scale * tile_h_nopad * scale * channels);
+
+            if (tile_cache->get(slot.key, slot.cached.data(), tile_w_nopad * scale, tile_h_nopad * scale, channels, tile_w_nopad * scale * channels))
+            {
+                ctx.tilestats.cached++;
+                continue;
+            }
+
+            std::vector<unsigned char>().swap(slot.cached);
+        }
+
+        ncompute++;
+    }
+
+    if (vkdev && ncompute > 0 && ctx.tilestats.unchanged > 0)
+    {
+        // the gpu path downloads whole bands, keep a copy of the tiles it would overwrite
+        for (int xi = ctx.xi0; xi < ctx.xi1; xi++)
+        {
+            TileSlot& slot = ctx.slots[xi - ctx.xi0];
+            if (!slot.kept)
+                continue;
+
+            const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
+
+            const unsigned char* outtile = (const unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels + (xi - ctx.xi0) * scale * TILE_SIZE_X * channels;
+
+            slot.cached.resize((size_t)tile_w_nopad * scale * tile_h_nopad * scale * channels);
+            copy_tile(outtile, outimage.w * channels, slot.cached.data(), tile_w_nopad * scale * channels, tile_w_nopad * scale, tile_h_nopad * scale, channels);
+        }
+    }
+
+    return ncompute;
+}
+
+void RealCUGAN::keep_band(const ncnn::Mat& inimage, ncnn::Mat& outimage, int yi, ProcessContext& ctx) const
+{
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int channels = inimage.elempack;
+
+    const int TILE_SIZE_X = tilesize;
+    const int TILE_SIZE_Y = tilesize;
+
+    const int tile_h_nopad = std::min((yi + 1) * TILE_SIZE_Y, h) - yi * TILE_SIZE_Y;
+
+    // in raster order, so in-band duplicates copy from an already finished tile
+    for (int xi = ctx.xi0; xi < ctx.xi1; xi++)
+    {
+        const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
+
+        TileSlot& slot = ctx.slots[xi - ctx.xi0];
+
+        unsigned char* outtile = (unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels + (xi - ctx.xi0) * scale * TILE_SIZE_X * channels;
+
+        if (slot.kept)
+        {
+            if (!slot.cached.empty())
+                copy_tile(slot.cached.data(), tile_w_nopad * scale * channels, outtile, outimage.w * channels, tile_w_nopad * scale, tile_h_nopad * scale, channels);
+            continue;
+        }
+
+        if (slot.src)
+        {
+            copy_tile(slot.src, outimage.w * channels, outtile, outimage.w * channels, tile_w_nopad * scale, tile_h_nopad * scale, channels);
+        }
+        else if (!slot.cached.empty())
         {
-            fwprintf(stderr, L"_wfopen %ls failed\n", modelpath.c_str());
+            copy_tile(slot.cached.data(), tile_w_nopad * scale * channels, outtile, outimage.w * channels, tile_w_nopad * scale, tile_h_nopad * scale, channels);
         }
+        else
+        {
+            ctx.tilestats.computed++;
 
-        net.load_model(fp);
+            if (ctx.use_tile_cache && !slot.degraded)
+                tile_cache->put(slot.key, outtile, tile_w_nopad * scale, tile_h_nopad * scale, channels, outimage.w * channels);
+        }
 
-        fclose(fp);
+        if (ctx.keyed && tile_dedup && !ctx.no_reuse && !slot.degraded)
+            ctx.done.insert(std::make_pair(slot.key, (const unsigned char*)outtile));
     }
-#else
-    net.load_param(parampath.c_str());
-    net.load_model(modelpath.c_str());
-#endif
 
-    // initialize preprocess and postprocess pipeline
-    if (vkdev)
+    ctx.slots.clear();
+
+    if (ctx.band_done)
+        ctx.band_done(yi);
+}
+
+void RealCUGAN::bicubic_tile(const ncnn::Mat& inimage, int xi, int yi, TileSlot& slot) const
+{
+    const unsigned char* pixeldata = (const unsigned char*)inimage.data;
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int channels = inimage.elempack;
+
+    const int TILE_SIZE_X = tilesize;
+    const int TILE_SIZE_Y = tilesize;
+
+    const int tile_x0 = xi * TILE_SIZE_X;
+    const int tile_y0 = yi * TILE_SIZE_Y;
+    const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - tile_x0;
+    const int tile_h_nopad = std::min((yi + 1) * TILE_SIZE_Y, h) - tile_y0;
+
+    // bicubic reads 2 pixels around, take them from the neighbours so tile seams stay invisible
+    const int in_x0 = std::max(tile_x0 - 2, 0);
+    const int in_y0 = std::max(tile_y0 - 2, 0);
+    const int in_x1 = std::min(tile_x0 + tile_w_nopad + 2, w);
+    const int in_y1 = std::min(tile_y0 + tile_h_nopad + 2, h);
+
+    // channel order does not matter to an interpolation, keep the bytes as they are
+    const int pixel_type = channels == 4 ? ncnn::Mat::PIXEL_RGBA : ncnn::Mat::PIXEL_RGB;
+    ncnn::Mat in = ncnn::Mat::from_pixels_roi(pixeldata, pixel_type, w, h, in_x0, in_y0, in_x1 - in_x0, in_y1 - in_y0);
+
+    ncnn::Mat out;
+    if (scale == 2)
+        bicubic_2x->forward(in, out, net.opt);
+    else if (scale == 3)
+        bicubic_3x->forward(in, out, net.opt);
+    else if (scale == 4)
+        bicubic_4x->forward(in, out, net.opt);
+    else
+        out = in;
+
+    std::vector<unsigned char> pixels((size_t)out.w * out.h * channels);
+    out.to_pixels(pixels.data(), pixel_type);
+
+    slot.cached.resize((size_t)tile_w_nopad * scale * tile_h_nopad * scale * channels);
+
+    const unsigned char* src = pixels.data() + ((size_t)(tile_y0 - in_y0) * scale * out.w + (tile_x0 - in_x0) * scale) * channels;
+    copy_tile(src, out.w * channels, slot.cached.data(), tile_w_nopad * scale * channels, tile_w_nopad * scale, tile_h_nopad * scale, channels);
+}
+
+void RealCUGAN::forward_tta_batch(const ncnn::Mat* in_tile, ncnn::Mat* out_tile) const
+{
+    // in_tile 0..3 share one shape, 4..7 are transposed
+    for (int bi = 0; bi < 2; bi++)
     {
-        std::vector<ncnn::vk_specialization_type> specializations(1);
-#if _WIN32
-        specializations[0].i = 1;
-#else
-        specializations[0].i = 0;
-#endif
+        const ncnn::Mat* in_views = in_tile + bi * 4;
+        ncnn::Mat* out_views = out_tile + bi * 4;
+
+        const int vw = in_views[0].w;
+        const int vh = in_views[0].h;
+        const int stride = tta_batch_stride(vw);
 
+        ncnn::Mat in_packed(stride * 3 + vw, vh, 3);
+        in_packed.fill(0.f);
+        for (int q = 0; q < 3; q++)
         {
-            static std::vector<uint32_t> spirv;
-            static ncnn::Mutex lock;
+            ncnn::Mat in_packed_q = in_packed.channel(q);
+
+            for (int k = 0; k < 4; k++)
             {
-                ncnn::MutexLockGuard guard(lock);
-                if (spirv.empty())
+                const ncnn::Mat in_view_q = in_views[k].channel(q);
+
+                for (int i = 0; i < vh; i++)
                 {
-                    if (tta_mode)
-                        compile_spirv_module(realcugan_preproc_tta_comp_data, sizeof(realcugan_preproc_tta_comp_data), net.opt, spirv);
-                    else
-                        compile_spirv_module(realcugan_preproc_comp_data, sizeof(realcugan_preproc_comp_data), net.opt, spirv);
+                    memcpy(in_packed_q.row(i) + k * stride, in_view_q.row(i), vw * sizeof(float));
                 }
             }
-
-            realcugan_preproc = new ncnn::Pipeline(vkdev);
-            realcugan_preproc->set_optimal_local_size_xyz(8, 8, 3);
-            realcugan_preproc->create(spirv.data(), spirv.size() * 4, specializations);
         }
 
+        ncnn::Mat out_packed;
         {
-            static std::vector<uint32_t> spirv;
-            static ncnn::Mutex lock;
-            {
-                ncnn::MutexLockGuard guard(lock);
-                if (spirv.empty())
-                {
-                    if (tta_mode)
-                        compile_spirv_module(realcugan_postproc_tta_comp_data, sizeof(realcugan_postproc_tta_comp_data), net.opt, spirv);
-                    else
-                        compile_spirv_module(realcugan_postproc_comp_data, sizeof(realcugan_postproc_comp_data), net.opt, spirv);
-                }
-            }
+            ncnn::Extractor ex = net.create_extractor();
 
-            realcugan_postproc = new ncnn::Pipeline(vkdev);
-            realcugan_postproc->set_optimal_local_size_xyz(8, 8, 3);
-            realcugan_postproc->create(spirv.data(), spirv.size() * 4, specializations);
+            ex.input("in0", in_packed);
+
+            ex.extract("out0", out_packed);
         }
 
+        const int out_stride = stride * scale;
+        const int out_w = out_packed.w - out_stride * 3;
+        const int out_h = out_packed.h;
+
+        for (int k = 0; k < 4; k++)
         {
-            static std::vector<uint32_t> spirv;
-            static ncnn::Mutex lock;
+            out_views[k].create(out_w, out_h, 3);
+
+            for (int q = 0; q < 3; q++)
             {
-                ncnn::MutexLockGuard guard(lock);
-                if (spirv.empty())
+                const ncnn::Mat out_packed_q = out_packed.channel(q);
+                ncnn::Mat out_view_q = out_views[k].channel(q);
+
+                for (int i = 0; i < out_h; i++)
                 {
-                    if (tta_mode)
-                        compile_spirv_module(realcugan_4x_postproc_tta_comp_data, sizeof(realcugan_4x_postproc_tta_comp_data), net.opt, spirv);
-                    else
-                        compile_spirv_module(realcugan_4x_postproc_comp_data, sizeof(realcugan_4x_postproc_comp_data), net.opt, spirv);
+                    memcpy(out_view_q.row(i), out_packed_q.row(i) + k * out_stride, out_w * sizeof(float));
                 }
             }
-
-            realcugan_4x_postproc = new ncnn::Pipeline(vkdev);
-            realcugan_4x_postproc->set_optimal_local_size_xyz(8, 8, 3);
-            realcugan_4x_postproc->create(spirv.data(), spirv.size() * 4, specializations);
         }
     }
+}
 
-    // bicubic 2x/3x/4x for alpha channel
-    {
-        bicubic_2x = ncnn::create_layer("Interp");
-        bicubic_2x->vkdev = vkdev;
-
-        ncnn::ParamDict pd;
-        pd.set(0, 3);// bicubic
-        pd.set(1, 2.f);
-        pd.set(2, 2.f);
-        bicubic_2x->load_param(pd);
+bool RealCUGAN::tile_tta(const ncnn::Mat& inimage, int xi, int yi) const
+{
+    if (tta_threshold <= 0.f)
+        return true;
 
-        bicubic_2x->create_pipeline(net.opt);
-    }
-    {
-        bicubic_3x = ncnn::create_layer("Interp");
-        bicubic_3x->vkdev = vkdev;
+    const unsigned char* pixeldata = (const unsigned char*)inimage.data;
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int channels = inimage.elempack;
 
-        ncnn::ParamDict pd;
-        pd.set(0, 3);// bicubic
-        pd.set(1, 3.f);
-        pd.set(2, 3.f);
-        bicubic_3x->load_param(pd);
+    const int x0 = xi * tilesize;
+    const int x1 = std::min((xi + 1) * tilesize, w);
+    const int y0 = yi * tilesize;
+    const int y1 = std::min((yi + 1) * tilesize, h);
 
-        bicubic_3x->create_pipeline(net.opt);
-    }
+    // mean absolute gradient of (r + 2g + b) / 4 over the unpadded tile
+    // flat fills and smooth gradients score near 0, line art and texture score tens
+    // channel order does not matter, rgb and bgr give the same luma here
+    int64_t energy = 0;
+    for (int y = y0; y < y1; y++)
     {
-        bicubic_4x = ncnn::create_layer("Interp");
-        bicubic_4x->vkdev = vkdev;
-
-        ncnn::ParamDict pd;
-        pd.set(0, 3);// bicubic
-        pd.set(1, 4.f);
-        pd.set(2, 4.f);
-        bicubic_4x->load_param(pd);
+        const unsigned char* ptr = pixeldata + ((size_t)y * w + x0) * channels;
+        const unsigned char* ptr1 = y + 1 < y1 ? ptr + (size_t)w * channels : ptr;
 
-        bicubic_4x->create_pipeline(net.opt);
-    }
-
-    return 0;
-}
+        for (int x = x0; x < x1; x++)
+        {
+            const int l = ptr[0] + 2 * ptr[1] + ptr[2];
+            const int lr = x + 1 < x1 ? ptr[channels] + 2 * ptr[channels + 1] + ptr[channels + 2] : l;
+            const int lb = ptr1[0] + 2 * ptr1[1] + ptr1[2];
 
-int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
-{
-    bool syncgap_needed = tilesize < std::max(inimage.w, inimage.h);
+            energy += abs(lr - l) + abs(lb - l);
 
-    if (!vkdev)
-    {
-        // cpu only
-        if (syncgap_needed && syncgap)
-        {
-            if (syncgap == 1)
-                return process_cpu_se(inimage, outimage);
-            if (syncgap == 2)
-                return process_cpu_se_rough(inimage, outimage);
-            if (syncgap == 3)
-                return process_cpu_se_very_rough(inimage, outimage);
+            ptr += channels;
+            ptr1 += channels;
         }
-        else
-            return process_cpu(inimage, outimage);
     }
 
-    if (noise == -1 && scale == 1)
-    {
-        outimage = inimage;
-        return 0;
-    }
+    const float score = energy / (4.f * (x1 - x0) * (y1 - y0));
 
-    if (syncgap_needed && syncgap)
-    {
-        if (syncgap == 1)
-            return process_se(inimage, outimage);
-        if (syncgap == 2)
-            return process_se_rough(inimage, outimage);
-        if (syncgap == 3)
-            return process_se_very_rough(inimage, outimage);
-    }
+    return score >= tta_threshold;
+}
 
+int RealCUGAN::process_gpu(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const
+{
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
     const int h = inimage.h;
@@ -283,8 +2494,9 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
     const int TILE_SIZE_X = tilesize;
     const int TILE_SIZE_Y = tilesize;
 
-    ncnn::VkAllocator* blob_vkallocator = vkdev->acquire_blob_allocator();
-    ncnn::VkAllocator* staging_vkallocator = vkdev->acquire_staging_allocator();
+    VkAllocatorScope vkallocators(vkdev, ctx.memory_tracker);
+    ncnn::VkAllocator* blob_vkallocator = vkallocators.blob;
+    ncnn::VkAllocator* staging_vkallocator = vkallocators.staging;
 
     ncnn::Option opt = net.opt;
     opt.blob_vkallocator = blob_vkallocator;
@@ -293,12 +2505,15 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 
     // each tile 400x400
     const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
-    const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
 
     const size_t in_out_tile_elemsize = opt.use_fp16_storage ? 2u : 4u;
 
+    StageTimer timer(ctx.stagestats, trace);
+
+    int ret = 0;
+
     //#pragma omp parallel for num_threads(2)
-    for (int yi = 0; yi < ytiles; yi++)
+    for (int yi = ctx.yi0; yi < ctx.yi1; yi++)
     {
         const int tile_h_nopad = std::min((yi + 1) * TILE_SIZE_Y, h) - yi * TILE_SIZE_Y;
 
@@ -315,31 +2530,43 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
         int in_tile_y0 = std::max(yi * TILE_SIZE_Y - prepadding, 0);
         int in_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom, h);
 
+        // tiles produced earlier in this image or by an earlier request
+        if (reuse_band(inimage, outimage, yi, 0, ctx) == 0)
+        {
+            keep_band(inimage, outimage, yi, ctx);
+            continue;
+        }
+
+        timer.tile(-1, yi);
+        timer.skip();
+
         ncnn::Mat in;
         if (opt.use_fp16_storage && opt.use_int8_storage)
         {
-            in = ncnn::Mat(w, (in_tile_y1 - in_tile_y0), (unsigned char*)pixeldata + in_tile_y0 * w * channels, (size_t)channels, 1);
+            in = ncnn::Mat(w, (in_tile_y1 - in_tile_y0), (unsigned char*)pixeldata + (size_t)in_tile_y0 * w * channels, (size_t)channels, 1);
         }
         else
         {
             if (channels == 3)
             {
 #if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, (in_tile_y1 - in_tile_y0));
+                in = ncnn::Mat::from_pixels(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, (in_tile_y1 - in_tile_y0));
 #else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
+                in = ncnn::Mat::from_pixels(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
 #endif
             }
             if (channels == 4)
             {
 #if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, (in_tile_y1 - in_tile_y0));
+                in = ncnn::Mat::from_pixels(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, (in_tile_y1 - in_tile_y0));
 #else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
+                in = ncnn::Mat::from_pixels(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
 #endif
             }
         }
 
+        timer.mark(&RealCUGANStageStats::pixel_ms);
+
         ncnn::VkCompute cmd(vkdev);
 
         // upload
@@ -347,6 +2574,9 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
         {
             cmd.record_clone(in, in_gpu, opt);
 
+            timer.bytes(&RealCUGANStageStats::upload_bytes, in.total() * in.elemsize);
+            timer.mark(cmd, &RealCUGANStageStats::upload_ms);
+
             if (xtiles > 1)
             {
                 cmd.submit_and_wait();
@@ -360,17 +2590,39 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
         ncnn::VkMat out_gpu;
         if (opt.use_fp16_storage && opt.use_int8_storage)
         {
-            out_gpu.create(w * scale, (out_tile_y1 - out_tile_y0) * scale, (size_t)channels, 1, blob_vkallocator);
+            out_gpu.create(outimage.w, (out_tile_y1 - out_tile_y0) * scale, (size_t)channels, 1, blob_vkallocator);
         }
         else
         {
-            out_gpu.create(w * scale, (out_tile_y1 - out_tile_y0) * scale, channels, (size_t)4u, 1, blob_vkallocator);
+            out_gpu.create(outimage.w, (out_tile_y1 - out_tile_y0) * scale, channels, (size_t)4u, 1, blob_vkallocator);
         }
 
-        for (int xi = 0; xi < xtiles; xi++)
+        for (int xi = ctx.xi0; xi < ctx.xi1; xi++)
         {
+            // stop between tiles once cancelled or past the deadline
+            ret = ctx.check();
+            if (ret != 0)
+                break;
+
             const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
 
+            if (ctx.slots[xi - ctx.xi0].skip())
+                continue;
+
+            // a time budget may drop tta or fall back to bicubic for this tile
+            const int tile_mode = ctx.tile_policy ? ctx.tile_policy(xi, yi) : TILE_FULL;
+            if (tile_mode != TILE_FULL)
+                ctx.slots[xi - ctx.xi0].degraded = true;
+            if (tile_mode == TILE_BICUBIC)
+            {
+                bicubic_tile(inimage, xi, yi, ctx.slots[xi - ctx.xi0]);
+                ctx.tilestats.bicubic++;
+                continue;
+            }
+
+            timer.tile(xi, yi);
+            timer.skip();
+
             int prepadding_right = prepadding;
             if (scale == 1 || scale == 3)
             {
@@ -381,7 +2633,192 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                 prepadding_right += (tile_w_nopad + 1) / 2 * 2 - tile_w_nopad;
             }
 
-            if (tta_mode)
+            const bool tile_tta_mode = tta_mode && tile_mode == TILE_FULL && tile_tta(inimage, xi, yi);
+            if (tile_tta_mode)
+            {
+                ctx.tilestats.tta++;
+            }
+
+            if (tile_tta_mode && tta_batch)
+            {
+                // preproc, orientations 0..3 and the transposed 4..7 each packed side by side
+                ncnn::VkMat in_tile_gpu[2];
+                ncnn::VkMat in_alpha_tile_gpu;
+                int stride[2];
+                {
+                    // crop tile
+                    int tile_x0 = xi * TILE_SIZE_X - prepadding;
+                    int tile_x1 = std::min((xi + 1) * TILE_SIZE_X, w) + prepadding_right;
+                    int tile_y0 = yi * TILE_SIZE_Y - prepadding;
+                    int tile_y1 = std::min((yi + 1) * TILE_SIZE_Y, h) + prepadding_bottom;
+
+                    stride[0] = tta_batch_stride(tile_x1 - tile_x0);
+                    stride[1] = tta_batch_stride(tile_y1 - tile_y0);
+
+                    in_tile_gpu[0].create(stride[0] * 3 + tile_x1 - tile_x0, tile_y1 - tile_y0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
+                    in_tile_gpu[1].create(stride[1] * 3 + tile_y1 - tile_y0, tile_x1 - tile_x0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
+
+                    if (channels == 4)
+                    {
+                        in_alpha_tile_gpu.create(tile_w_nopad, tile_h_nopad, 1, in_out_tile_elemsize, 1, blob_vkallocator);
+                    }
+
+                    std::vector<ncnn::VkMat> bindings(4);
+                    bindings[0] = in_gpu;
+                    bindings[1] = in_tile_gpu[0];
+                    bindings[2] = in_tile_gpu[1];
+                    bindings[3] = in_alpha_tile_gpu;
+
+                    std::vector<ncnn::vk_constant_type> constants(18);
+                    constants[0].i = in_gpu.w;
+                    constants[1].i = in_gpu.h;
+                    constants[2].i = in_gpu.cstep;
+                    constants[3].i = tile_x1 - tile_x0;
+                    constants[4].i = tile_y1 - tile_y0;
+                    constants[5].i = prepadding;
+                    constants[6].i = prepadding;
+                    constants[7].i = xi * TILE_SIZE_X;
+                    constants[8].i = std::min(yi * TILE_SIZE_Y, prepadding);
+                    constants[9].i = channels;
+                    constants[10].i = in_alpha_tile_gpu.w;
+                    constants[11].i = in_alpha_tile_gpu.h;
+                    constants[12].i = stride[0];
+                    constants[13].i = in_tile_gpu[0].w;
+                    constants[14].i = in_tile_gpu[0].cstep;
+                    constants[15].i = stride[1];
+                    constants[16].i = in_tile_gpu[1].w;
+                    constants[17].i = in_tile_gpu[1].cstep;
+
+                    ncnn::VkMat dispatcher;
+                    dispatcher.w = std::max(in_tile_gpu[0].w, in_tile_gpu[1].w);
+                    dispatcher.h = std::max(in_tile_gpu[0].h, in_tile_gpu[1].h);
+                    dispatcher.c = channels;
+
+                    cmd.record_pipeline(realcugan_preproc_tta_batch, bindings, constants, dispatcher);
+                }
+
+                timer.mark(cmd, &RealCUGANStageStats::preproc_ms);
+
+                // realcugan
+                ncnn::VkMat out_tile_gpu[2];
+                for (int ti = 0; ti < 2; ti++)
+                {
+                    ncnn::Extractor ex = net.create_extractor();
+
+                    ex.set_blob_vkallocator(blob_vkallocator);
+                    ex.set_workspace_vkallocator(blob_vkallocator);
+                    ex.set_staging_vkallocator(staging_vkallocator);
+
+                    ex.input("in0", in_tile_gpu[ti]);
+
+                    ex.extract("out0", out_tile_gpu[ti], cmd);
+                }
+
+                // output size of a single orientation
+                const int out_tile_w = out_tile_gpu[0].w - stride[0] * scale * 3;
+                const int out_tile_h = out_tile_gpu[0].h;
+
+                timer.mark(cmd, &RealCUGANStageStats::net_ms);
+                timer.inferences(2);
+
+                ncnn::VkMat out_alpha_tile_gpu;
+                if (channels == 4)
+                {
+                    if (scale == 1)
+                    {
+                        out_alpha_tile_gpu = in_alpha_tile_gpu;
+                    }
+                    if (scale == 2)
+                    {
+                        bicubic_2x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, opt);
+                    }
+                    if (scale == 3)
+                    {
+                        bicubic_3x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, opt);
+                    }
+                    if (scale == 4)
+                    {
+                        bicubic_4x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, opt);
+                    }
+                }
+
+                timer.mark(cmd, &RealCUGANStageStats::alpha_ms);
+
+                // postproc
+                if (scale == 4)
+                {
+                    std::vector<ncnn::VkMat> bindings(5);
+                    bindings[0] = in_gpu;
+                    bindings[1] = out_tile_gpu[0];
+                    bindings[2] = out_tile_gpu[1];
+                    bindings[3] = out_alpha_tile_gpu;
+                    bindings[4] = out_gpu;
+
+                    std::vector<ncnn::vk_constant_type> constants(21);
+                    constants[0].i = in_gpu.w;
+                    constants[1].i = in_gpu.h;
+                    constants[2].i = in_gpu.cstep;
+                    constants[3].i = out_tile_w;
+                    constants[4].i = out_tile_h;
+                    constants[5].i = stride[0] * scale;
+                    constants[6].i = out_tile_gpu[0].w;
+                    constants[7].i = out_tile_gpu[0].cstep;
+                    constants[8].i = stride[1] * scale;
+                    constants[9].i = out_tile_gpu[1].w;
+                    constants[10].i = out_tile_gpu[1].cstep;
+                    constants[11].i = out_gpu.w;
+                    constants[12].i = out_gpu.h;
+                    constants[13].i = out_gpu.cstep;
+                    constants[14].i = xi * TILE_SIZE_X;
+                    constants[15].i = std::min(yi * TILE_SIZE_Y, prepadding);
+                    constants[16].i = (xi - ctx.xi0) * TILE_SIZE_X * scale;
+                    constants[17].i = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
+                    constants[18].i = channels;
+                    constants[19].i = out_alpha_tile_gpu.w;
+                    constants[20].i = out_alpha_tile_gpu.h;
+
+                    ncnn::VkMat dispatcher;
+                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
+                    dispatcher.h = out_gpu.h;
+                    dispatcher.c = channels;
+
+                    cmd.record_pipeline(realcugan_4x_postproc_tta_batch, bindings, constants, dispatcher);
+                }
+                else
+                {
+                    std::vector<ncnn::VkMat> bindings(4);
+                    bindings[0] = out_tile_gpu[0];
+                    bindings[1] = out_tile_gpu[1];
+                    bindings[2] = out_alpha_tile_gpu;
+                    bindings[3] = out_gpu;
+
+                    std::vector<ncnn::vk_constant_type> constants(16);
+                    constants[0].i = out_tile_w;
+                    constants[1].i = out_tile_h;
+                    constants[2].i = stride[0] * scale;
+                    constants[3].i = out_tile_gpu[0].w;
+                    constants[4].i = out_tile_gpu[0].cstep;
+                    constants[5].i = stride[1] * scale;
+                    constants[6].i = out_tile_gpu[1].w;
+                    constants[7].i = out_tile_gpu[1].cstep;
+                    constants[8].i = out_gpu.w;
+                    constants[9].i = out_gpu.h;
+                    constants[10].i = out_gpu.cstep;
+                    constants[11].i = (xi - ctx.xi0) * TILE_SIZE_X * scale;
+                    constants[12].i = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
+                    constants[13].i = channels;
+                    constants[14].i = out_alpha_tile_gpu.w;
+                    constants[15].i = out_alpha_tile_gpu.h;
+
+                    ncnn::VkMat dispatcher;
+                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
+                    dispatcher.h = out_gpu.h;
+                    dispatcher.c = channels;
+
+                    cmd.record_pipeline(realcugan_postproc_tta_batch, bindings, constants, dispatcher);
+                }
+            }
+            else if (tile_tta_mode)
             {
                 // preproc
                 ncnn::VkMat in_tile_gpu[8];
@@ -442,6 +2879,8 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                     cmd.record_pipeline(realcugan_preproc, bindings, constants, dispatcher);
                 }
 
+                timer.mark(cmd, &RealCUGANStageStats::preproc_ms);
+
                 // realcugan
                 ncnn::VkMat out_tile_gpu[8];
                 for (int ti = 0; ti < 8; ti++)
@@ -455,8 +2894,12 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                     ex.input("in0", in_tile_gpu[ti]);
 
                     ex.extract("out0", out_tile_gpu[ti], cmd);
+
+                    timer.mark(cmd, &RealCUGANStageStats::net_ms, 0, ti);
                 }
 
+                timer.inferences(8);
+
                 ncnn::VkMat out_alpha_tile_gpu;
                 if (channels == 4)
                 {
@@ -478,6 +2921,8 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                     }
                 }
 
+                timer.mark(cmd, &RealCUGANStageStats::alpha_ms);
+
                 // postproc
                 if (scale == 4)
                 {
@@ -506,14 +2951,14 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                     constants[8].i = out_gpu.cstep;
                     constants[9].i = xi * TILE_SIZE_X;
                     constants[10].i = std::min(yi * TILE_SIZE_Y, prepadding);
-                    constants[11].i = xi * TILE_SIZE_X * scale;
-                    constants[12].i = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    constants[11].i = (xi - ctx.xi0) * TILE_SIZE_X * scale;
+                    constants[12].i = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
                     constants[13].i = channels;
                     constants[14].i = out_alpha_tile_gpu.w;
                     constants[15].i = out_alpha_tile_gpu.h;
 
                     ncnn::VkMat dispatcher;
-                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
                     dispatcher.h = out_gpu.h;
                     dispatcher.c = channels;
 
@@ -540,14 +2985,14 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                     constants[3].i = out_gpu.w;
                     constants[4].i = out_gpu.h;
                     constants[5].i = out_gpu.cstep;
-                    constants[6].i = xi * TILE_SIZE_X * scale;
-                    constants[7].i = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    constants[6].i = (xi - ctx.xi0) * TILE_SIZE_X * scale;
+                    constants[7].i = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
                     constants[8].i = channels;
                     constants[9].i = out_alpha_tile_gpu.w;
                     constants[10].i = out_alpha_tile_gpu.h;
 
                     ncnn::VkMat dispatcher;
-                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
                     dispatcher.h = out_gpu.h;
                     dispatcher.c = channels;
 
@@ -598,9 +3043,11 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                     dispatcher.h = in_tile_gpu.h;
                     dispatcher.c = channels;
 
-                    cmd.record_pipeline(realcugan_preproc, bindings, constants, dispatcher);
+                    cmd.record_pipeline(tta_mode ? realcugan_preproc_single : realcugan_preproc, bindings, constants, dispatcher);
                 }
 
+                timer.mark(cmd, &RealCUGANStageStats::preproc_ms);
+
                 // realcugan
                 ncnn::VkMat out_tile_gpu;
                 {
@@ -615,6 +3062,9 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                     ex.extract("out0", out_tile_gpu, cmd);
                 }
 
+                timer.mark(cmd, &RealCUGANStageStats::net_ms);
+                timer.inferences(1);
+
                 ncnn::VkMat out_alpha_tile_gpu;
                 if (channels == 4)
                 {
@@ -636,6 +3086,8 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                     }
                 }
 
+                timer.mark(cmd, &RealCUGANStageStats::alpha_ms);
+
                 // postproc
                 if (scale == 4)
                 {
@@ -657,18 +3109,18 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                     constants[8].i = out_gpu.cstep;
                     constants[9].i = xi * TILE_SIZE_X;
                     constants[10].i = std::min(yi * TILE_SIZE_Y, prepadding);
-                    constants[11].i = xi * TILE_SIZE_X * scale;
-                    constants[12].i = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    constants[11].i = (xi - ctx.xi0) * TILE_SIZE_X * scale;
+                    constants[12].i = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
                     constants[13].i = channels;
                     constants[14].i = out_alpha_tile_gpu.w;
                     constants[15].i = out_alpha_tile_gpu.h;
 
                     ncnn::VkMat dispatcher;
-                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
                     dispatcher.h = out_gpu.h;
                     dispatcher.c = channels;
 
-                    cmd.record_pipeline(realcugan_4x_postproc, bindings, constants, dispatcher);
+                    cmd.record_pipeline(tta_mode ? realcugan_4x_postproc_single : realcugan_4x_postproc, bindings, constants, dispatcher);
                 }
                 else
                 {
@@ -684,70 +3136,91 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                     constants[3].i = out_gpu.w;
                     constants[4].i = out_gpu.h;
                     constants[5].i = out_gpu.cstep;
-                    constants[6].i = xi * TILE_SIZE_X * scale;
-                    constants[7].i = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    constants[6].i = (xi - ctx.xi0) * TILE_SIZE_X * scale;
+                    constants[7].i = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
                     constants[8].i = channels;
                     constants[9].i = out_alpha_tile_gpu.w;
                     constants[10].i = out_alpha_tile_gpu.h;
 
                     ncnn::VkMat dispatcher;
-                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
                     dispatcher.h = out_gpu.h;
                     dispatcher.c = channels;
 
-                    cmd.record_pipeline(realcugan_postproc, bindings, constants, dispatcher);
+                    cmd.record_pipeline(tta_mode ? realcugan_postproc_single : realcugan_postproc, bindings, constants, dispatcher);
                 }
             }
 
+            timer.mark(cmd, &RealCUGANStageStats::postproc_ms);
+
             if (xtiles > 1)
             {
                 cmd.submit_and_wait();
                 cmd.reset();
             }
+
+            timer.event("gpu wait");
         }
 
+        if (ret != 0)
+            break;
+
         // download
         {
+            timer.tile(-1, yi);
+            timer.skip();
+
             ncnn::Mat out;
 
             if (opt.use_fp16_storage && opt.use_int8_storage)
             {
-                out = ncnn::Mat(out_gpu.w, out_gpu.h, (unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, (size_t)channels, 1);
+                out = ncnn::Mat(out_gpu.w, out_gpu.h, (unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels, (size_t)channels, 1);
             }
 
             cmd.record_clone(out_gpu, out, opt);
 
             cmd.submit_and_wait();
 
+            timer.bytes(&RealCUGANStageStats::download_bytes, out_gpu.total() * out_gpu.elemsize);
+            timer.mark(&RealCUGANStageStats::download_ms);
+
             if (!(opt.use_fp16_storage && opt.use_int8_storage))
             {
                 if (channels == 3)
                 {
 #if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGB2BGR);
+                    out.to_pixels((unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels, ncnn::Mat::PIXEL_RGB2BGR);
 #else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGB);
+                    out.to_pixels((unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels, ncnn::Mat::PIXEL_RGB);
 #endif
                 }
                 if (channels == 4)
                 {
 #if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGBA2BGRA);
+                    out.to_pixels((unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels, ncnn::Mat::PIXEL_RGBA2BGRA);
 #else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGBA);
+                    out.to_pixels((unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels, ncnn::Mat::PIXEL_RGBA);
 #endif
                 }
             }
+
+            timer.mark(&RealCUGANStageStats::pixel_ms);
         }
-    }
 
-    vkdev->reclaim_blob_allocator(blob_vkallocator);
-    vkdev->reclaim_staging_allocator(staging_vkallocator);
+        keep_band(inimage, outimage, yi, ctx);
+    }
 
-    return 0;
+    return ret;
 }
 
 int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
+{
+    ProcessContext ctx(inimage.w, inimage.h, tilesize);
+
+    return process_cpu(inimage, outimage, ctx);
+}
+
+int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const
 {
     if (noise == -1 && scale == 1)
     {
@@ -765,11 +3238,11 @@ int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 
     ncnn::Option opt = net.opt;
 
-    // each tile 400x400
-    const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
-    const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
+    StageTimer timer(ctx.stagestats, trace);
 
-    for (int yi = 0; yi < ytiles; yi++)
+    int ret = 0;
+
+    for (int yi = ctx.yi0; yi < ctx.yi1; yi++)
     {
         const int tile_h_nopad = std::min((yi + 1) * TILE_SIZE_Y, h) - yi * TILE_SIZE_Y;
 
@@ -786,10 +3259,32 @@ int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
         int in_tile_y0 = std::max(yi * TILE_SIZE_Y - prepadding, 0);
         int in_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom, h);
 
-        for (int xi = 0; xi < xtiles; xi++)
+        // tiles produced earlier in this image or by an earlier request
+        reuse_band(inimage, outimage, yi, 0, ctx);
+
+        for (int xi = ctx.xi0; xi < ctx.xi1; xi++)
         {
+            // stop between tiles once cancelled or past the deadline
+            ret = ctx.check();
+            if (ret != 0)
+                break;
+
             const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
 
+            if (ctx.slots[xi - ctx.xi0].skip())
+                continue;
+
+            // a time budget may drop tta or fall back to bicubic for this tile
+            const int tile_mode = ctx.tile_policy ? ctx.tile_policy(xi, yi) : TILE_FULL;
+            if (tile_mode != TILE_FULL)
+                ctx.slots[xi - ctx.xi0].degraded = true;
+            if (tile_mode == TILE_BICUBIC)
+            {
+                bicubic_tile(inimage, xi, yi, ctx.slots[xi - ctx.xi0]);
+                ctx.tilestats.bicubic++;
+                continue;
+            }
+
             int prepadding_right = prepadding;
             if (scale == 1 || scale == 3)
             {
@@ -803,36 +3298,43 @@ int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
             int in_tile_x0 = std::max(xi * TILE_SIZE_X - prepadding, 0);
             int in_tile_x1 = std::min((xi + 1) * TILE_SIZE_X + prepadding_right, w);
 
+            timer.tile(xi, yi);
+            timer.skip();
+
             // crop tile
             ncnn::Mat in;
             {
                 if (channels == 3)
                 {
 #if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGR2RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
+                    in = ncnn::Mat::from_pixels_roi(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, in_tile_y1 - in_tile_y0, in_tile_x0, 0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
 #else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
+                    in = ncnn::Mat::from_pixels_roi(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, in_tile_y1 - in_tile_y0, in_tile_x0, 0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
 #endif
                 }
                 if (channels == 4)
                 {
 #if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGRA2RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
+                    in = ncnn::Mat::from_pixels_roi(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, in_tile_y1 - in_tile_y0, in_tile_x0, 0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
 #else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
+                    in = ncnn::Mat::from_pixels_roi(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, in_tile_y1 - in_tile_y0, in_tile_x0, 0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
 #endif
                 }
             }
 
+            timer.mark(&RealCUGANStageStats::pixel_ms);
+
             ncnn::Mat out;
 
-            if (tta_mode)
+            if (tta_mode && tile_mode == TILE_FULL && tile_tta(inimage, xi, yi))
             {
+                ctx.tilestats.tta++;
+
                 // split alpha and preproc
                 ncnn::Mat in_tile[8];
                 ncnn::Mat in_alpha_tile;
                 {
-                    in_tile[0].create(in.w, in.h, 3);
+                    in_tile[0].create(in.w, in.h, 3, (size_t)4u, ctx.tile_allocator);
                     for (int q = 0; q < 3; q++)
                     {
                         const float* ptr = in.channel(q);
@@ -867,13 +3369,13 @@ int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 
                 // the other 7 directions
                 {
-                    in_tile[1].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[2].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[3].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[4].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[5].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[6].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[7].create(in_tile[0].h, in_tile[0].w, 3);
+                    in_tile[1].create(in_tile[0].w, in_tile[0].h, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[2].create(in_tile[0].w, in_tile[0].h, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[3].create(in_tile[0].w, in_tile[0].h, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[4].create(in_tile[0].h, in_tile[0].w, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[5].create(in_tile[0].h, in_tile[0].w, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[6].create(in_tile[0].h, in_tile[0].w, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[7].create(in_tile[0].h, in_tile[0].w, 3, (size_t)4u, ctx.tile_allocator);
 
                     for (int q = 0; q < 3; q++)
                     {
@@ -914,17 +3416,35 @@ int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                     }
                 }
 
+                timer.mark(&RealCUGANStageStats::preproc_ms);
+
                 // realcugan
                 ncnn::Mat out_tile[8];
-                for (int ti = 0; ti < 8; ti++)
+                if (tta_batch)
                 {
-                    ncnn::Extractor ex = net.create_extractor();
+                    forward_tta_batch(in_tile, out_tile);
 
-                    ex.input("in0", in_tile[ti]);
+                    timer.mark(&RealCUGANStageStats::net_ms);
+                }
+                else
+                {
+                    for (int ti = 0; ti < 8; ti++)
+                    {
+                        ncnn::Extractor ex = net.create_extractor();
 
-                    ex.extract("out0", out_tile[ti]);
+                        ex.set_blob_allocator(ctx.blob_allocator);
+                        ex.set_workspace_allocator(ctx.workspace_allocator);
+
+                        ex.input("in0", in_tile[ti]);
+
+                        ex.extract("out0", out_tile[ti]);
+
+                        timer.mark(&RealCUGANStageStats::net_ms, 0, ti);
+                    }
                 }
 
+                timer.inferences(tta_batch ? 2 : 8);
+
                 ncnn::Mat out_alpha_tile;
                 if (channels == 4)
                 {
@@ -946,9 +3466,11 @@ int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                     }
                 }
 
+                timer.mark(&RealCUGANStageStats::alpha_ms);
+
                 // postproc and merge alpha
                 {
-                    out.create(tile_w_nopad * scale, tile_h_nopad * scale, channels);
+                    out.create(tile_w_nopad * scale, tile_h_nopad * scale, channels, (size_t)4u, ctx.tile_allocator);
                     if (scale == 4)
                     {
                         for (int q = 0; q < 3; q++)
@@ -1033,7 +3555,7 @@ int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                 ncnn::Mat in_tile;
                 ncnn::Mat in_alpha_tile;
                 {
-                    in_tile.create(in.w, in.h, 3);
+                    in_tile.create(in.w, in.h, 3, (size_t)4u, ctx.tile_allocator);
                     for (int q = 0; q < 3; q++)
                     {
                         const float* ptr = in.channel(q);
@@ -1063,16 +3585,24 @@ int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                     in_tile = in_tile_padded;
                 }
 
+                timer.mark(&RealCUGANStageStats::preproc_ms);
+
                 // realcugan
                 ncnn::Mat out_tile;
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    ex.set_blob_allocator(ctx.blob_allocator);
+                    ex.set_workspace_allocator(ctx.workspace_allocator);
+
                     ex.input("in0", in_tile);
 
                     ex.extract("out0", out_tile);
                 }
 
+                timer.mark(&RealCUGANStageStats::net_ms);
+                timer.inferences(1);
+
                 ncnn::Mat out_alpha_tile;
                 if (channels == 4)
                 {
@@ -1094,9 +3624,11 @@ int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                     }
                 }
 
+                timer.mark(&RealCUGANStageStats::alpha_ms);
+
                 // postproc and merge alpha
                 {
-                    out.create(tile_w_nopad * scale, tile_h_nopad * scale, channels);
+                    out.create(tile_w_nopad * scale, tile_h_nopad * scale, channels, (size_t)4u, ctx.tile_allocator);
                     if (scale == 4)
                     {
                         for (int q = 0; q < 3; q++)
@@ -1140,220 +3672,447 @@ int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                 }
             }
 
+            timer.mark(&RealCUGANStageStats::postproc_ms);
+
             {
                 if (channels == 3)
                 {
 #if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGB2BGR, w * scale * channels);
+                    out.to_pixels((unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels + (xi - ctx.xi0) * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGB2BGR, outimage.w * channels);
 #else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGB, w * scale * channels);
+                    out.to_pixels((unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels + (xi - ctx.xi0) * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGB, outimage.w * channels);
 #endif
                 }
                 if (channels == 4)
                 {
 #if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGBA2BGRA, w * scale * channels);
+                    out.to_pixels((unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels + (xi - ctx.xi0) * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGBA2BGRA, outimage.w * channels);
 #else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGBA, w * scale * channels);
+                    out.to_pixels((unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels + (xi - ctx.xi0) * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGBA, outimage.w * channels);
 #endif
                 }
             }
+
+            timer.mark(&RealCUGANStageStats::pixel_ms);
         }
+
+        if (ret != 0)
+            break;
+
+        keep_band(inimage, outimage, yi, ctx);
     }
 
-    return 0;
+    return ret;
 }
 
 int RealCUGAN::process_se(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 {
-    ncnn::VkAllocator* blob_vkallocator = vkdev->acquire_blob_allocator();
-    ncnn::VkAllocator* staging_vkallocator = vkdev->acquire_staging_allocator();
+    ProcessContext ctx(inimage.w, inimage.h, tilesize);
+
+    return process_se(inimage, outimage, ctx);
+}
+
+int RealCUGAN::process_se(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const
+{
+    VkAllocatorScope vkallocators(vkdev, ctx.memory_tracker);
+    ncnn::VkAllocator* blob_vkallocator = vkallocators.blob;
+    ncnn::VkAllocator* staging_vkallocator = vkallocators.staging;
 
     ncnn::Option opt = net.opt;
     opt.blob_vkallocator = blob_vkallocator;
     opt.workspace_vkallocator = blob_vkallocator;
     opt.staging_vkallocator = staging_vkallocator;
 
+    StageTimer timer(ctx.stagestats, trace);
+
     FeatureCache cache;
 
     std::vector<std::string> in0 = {};
     std::vector<std::string> out0 = {"gap0"};
-    process_se_stage0(inimage, in0, out0, opt, cache);
+    int ret = process_se_stage0(inimage, in0, out0, opt, cache, ctx);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se stage0");
 
     std::vector<std::string> gap0 = {"gap0"};
-    process_se_sync_gap(inimage, gap0, opt, cache);
+    if (ret == 0)
+        ret = process_se_sync_gap(inimage, gap0, opt, cache);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se sync");
 
     std::vector<std::string> in1 = {"gap0"};
     std::vector<std::string> out1 = {"gap1"};
-    process_se_stage0(inimage, in1, out1, opt, cache);
+    if (ret == 0)
+        ret = process_se_stage0(inimage, in1, out1, opt, cache, ctx);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se stage0");
 
     std::vector<std::string> gap1 = {"gap1"};
-    process_se_sync_gap(inimage, gap1, opt, cache);
+    if (ret == 0)
+        ret = process_se_sync_gap(inimage, gap1, opt, cache);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se sync");
 
     std::vector<std::string> in2 = {"gap0", "gap1"};
     std::vector<std::string> out2 = {"gap2"};
-    process_se_stage0(inimage, in2, out2, opt, cache);
+    if (ret == 0)
+        ret = process_se_stage0(inimage, in2, out2, opt, cache, ctx);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se stage0");
 
     std::vector<std::string> gap2 = {"gap2"};
-    process_se_sync_gap(inimage, gap2, opt, cache);
+    if (ret == 0)
+        ret = process_se_sync_gap(inimage, gap2, opt, cache);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se sync");
 
     std::vector<std::string> in3 = {"gap0", "gap1", "gap2"};
     std::vector<std::string> out3 = {"gap3"};
-    process_se_stage0(inimage, in3, out3, opt, cache);
+    if (ret == 0)
+        ret = process_se_stage0(inimage, in3, out3, opt, cache, ctx);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se stage0");
 
     std::vector<std::string> gap3 = {"gap3"};
-    process_se_sync_gap(inimage, gap3, opt, cache);
+    if (ret == 0)
+        ret = process_se_sync_gap(inimage, gap3, opt, cache);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se sync");
 
     std::vector<std::string> in4 = {"gap0", "gap1", "gap2", "gap3"};
-    process_se_stage2(inimage, in4, outimage, opt, cache);
+    if (ret == 0)
+        ret = process_se_stage2(inimage, in4, outimage, opt, cache, ctx);
+    timer.event("se stage2");
 
     cache.clear();
 
-    vkdev->reclaim_blob_allocator(blob_vkallocator);
-    vkdev->reclaim_staging_allocator(staging_vkallocator);
-
-    return 0;
+    return ret;
 }
 
 int RealCUGAN::process_se_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 {
-    ncnn::VkAllocator* blob_vkallocator = vkdev->acquire_blob_allocator();
-    ncnn::VkAllocator* staging_vkallocator = vkdev->acquire_staging_allocator();
+    ProcessContext ctx(inimage.w, inimage.h, tilesize);
+
+    return process_se_rough(inimage, outimage, ctx);
+}
+
+int RealCUGAN::process_se_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const
+{
+    VkAllocatorScope vkallocators(vkdev, ctx.memory_tracker);
+    ncnn::VkAllocator* blob_vkallocator = vkallocators.blob;
+    ncnn::VkAllocator* staging_vkallocator = vkallocators.staging;
 
     ncnn::Option opt = net.opt;
     opt.blob_vkallocator = blob_vkallocator;
     opt.workspace_vkallocator = blob_vkallocator;
     opt.staging_vkallocator = staging_vkallocator;
 
+    StageTimer timer(ctx.stagestats, trace);
+
     FeatureCache cache;
 
     std::vector<std::string> in0 = {};
     std::vector<std::string> out0 = {"gap0", "gap1", "gap2", "gap3"};
-    process_se_stage0(inimage, in0, out0, opt, cache);
+    int ret = process_se_stage0(inimage, in0, out0, opt, cache, ctx);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se stage0");
 
     std::vector<std::string> gap0 = {"gap0", "gap1", "gap2", "gap3"};
-    process_se_sync_gap(inimage, gap0, opt, cache);
+    if (ret == 0)
+        ret = process_se_sync_gap(inimage, gap0, opt, cache);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se sync");
 
     std::vector<std::string> in4 = {"gap0", "gap1", "gap2", "gap3"};
-    process_se_stage2(inimage, in4, outimage, opt, cache);
+    if (ret == 0)
+        ret = process_se_stage2(inimage, in4, outimage, opt, cache, ctx);
+    timer.event("se stage2");
 
     cache.clear();
 
-    vkdev->reclaim_blob_allocator(blob_vkallocator);
-    vkdev->reclaim_staging_allocator(staging_vkallocator);
-
-    return 0;
+    return ret;
 }
 
 int RealCUGAN::process_se_very_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 {
-    ncnn::VkAllocator* blob_vkallocator = vkdev->acquire_blob_allocator();
-    ncnn::VkAllocator* staging_vkallocator = vkdev->acquire_staging_allocator();
+    ProcessContext ctx(inimage.w, inimage.h, tilesize);
+
+    return process_se_very_rough(inimage, outimage, ctx);
+}
+
+int RealCUGAN::process_se_very_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const
+{
+    VkAllocatorScope vkallocators(vkdev, ctx.memory_tracker);
+    ncnn::VkAllocator* blob_vkallocator = vkallocators.blob;
+    ncnn::VkAllocator* staging_vkallocator = vkallocators.staging;
 
     ncnn::Option opt = net.opt;
     opt.blob_vkallocator = blob_vkallocator;
     opt.workspace_vkallocator = blob_vkallocator;
     opt.staging_vkallocator = staging_vkallocator;
 
+    StageTimer timer(ctx.stagestats, trace);
+
     FeatureCache cache;
 
     std::vector<std::string> in0 = {};
     std::vector<std::string> out0 = {"gap0", "gap1", "gap2", "gap3"};
-    process_se_very_rough_stage0(inimage, in0, out0, opt, cache);
+    int ret = process_se_very_rough_stage0(inimage, in0, out0, opt, cache, ctx);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se stage0");
 
     std::vector<std::string> gap0 = {"gap0", "gap1", "gap2", "gap3"};
-    process_se_very_rough_sync_gap(inimage, gap0, opt, cache);
+    if (ret == 0)
+        ret = process_se_very_rough_sync_gap(inimage, gap0, opt, cache);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se sync");
 
     std::vector<std::string> in4 = {"gap0", "gap1", "gap2", "gap3"};
-    process_se_stage2(inimage, in4, outimage, opt, cache);
+    if (ret == 0)
+        ret = process_se_stage2(inimage, in4, outimage, opt, cache, ctx);
+    timer.event("se stage2");
 
     cache.clear();
 
-    vkdev->reclaim_blob_allocator(blob_vkallocator);
-    vkdev->reclaim_staging_allocator(staging_vkallocator);
-
-    return 0;
+    return ret;
 }
 
 int RealCUGAN::process_cpu_se(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 {
+    ProcessContext ctx(inimage.w, inimage.h, tilesize);
+
+    return process_cpu_se(inimage, outimage, ctx);
+}
+
+int RealCUGAN::process_cpu_se(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const
+{
+    StageTimer timer(ctx.stagestats, trace);
+
     FeatureCache cache;
 
     std::vector<std::string> in0 = {};
     std::vector<std::string> out0 = {"gap0"};
-    process_cpu_se_stage0(inimage, in0, out0, cache);
+    int ret = process_cpu_se_stage0(inimage, in0, out0, cache, ctx);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se stage0");
 
     std::vector<std::string> gap0 = {"gap0"};
-    process_cpu_se_sync_gap(inimage, gap0, cache);
+    if (ret == 0)
+        ret = process_cpu_se_sync_gap(inimage, gap0, cache);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se sync");
 
     std::vector<std::string> in1 = {"gap0"};
     std::vector<std::string> out1 = {"gap1"};
-    process_cpu_se_stage0(inimage, in1, out1, cache);
+    if (ret == 0)
+        ret = process_cpu_se_stage0(inimage, in1, out1, cache, ctx);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se stage0");
 
     std::vector<std::string> gap1 = {"gap1"};
-    process_cpu_se_sync_gap(inimage, gap1, cache);
+    if (ret == 0)
+        ret = process_cpu_se_sync_gap(inimage, gap1, cache);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se sync");
 
     std::vector<std::string> in2 = {"gap0", "gap1"};
     std::vector<std::string> out2 = {"gap2"};
-    process_cpu_se_stage0(inimage, in2, out2, cache);
+    if (ret == 0)
+        ret = process_cpu_se_stage0(inimage, in2, out2, cache, ctx);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se stage0");
 
     std::vector<std::string> gap2 = {"gap2"};
-    process_cpu_se_sync_gap(inimage, gap2, cache);
+    if (ret == 0)
+        ret = process_cpu_se_sync_gap(inimage, gap2, cache);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se sync");
 
     std::vector<std::string> in3 = {"gap0", "gap1", "gap2"};
     std::vector<std::string> out3 = {"gap3"};
-    process_cpu_se_stage0(inimage, in3, out3, cache);
+    if (ret == 0)
+        ret = process_cpu_se_stage0(inimage, in3, out3, cache, ctx);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se stage0");
 
     std::vector<std::string> gap3 = {"gap3"};
-    process_cpu_se_sync_gap(inimage, gap3, cache);
+    if (ret == 0)
+        ret = process_cpu_se_sync_gap(inimage, gap3, cache);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se sync");
 
     std::vector<std::string> in4 = {"gap0", "gap1", "gap2", "gap3"};
-    process_cpu_se_stage2(inimage, in4, outimage, cache);
+    if (ret == 0)
+        ret = process_cpu_se_stage2(inimage, in4, outimage, cache, ctx);
+    timer.event("se stage2");
 
     cache.clear();
 
-    return 0;
+    return ret;
 }
 
 int RealCUGAN::process_cpu_se_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 {
+    ProcessContext ctx(inimage.w, inimage.h, tilesize);
+
+    return process_cpu_se_rough(inimage, outimage, ctx);
+}
+
+int RealCUGAN::process_cpu_se_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const
+{
+    StageTimer timer(ctx.stagestats, trace);
+
     FeatureCache cache;
 
     std::vector<std::string> in0 = {};
     std::vector<std::string> out0 = {"gap0", "gap1", "gap2", "gap3"};
-    process_cpu_se_stage0(inimage, in0, out0, cache);
+    int ret = process_cpu_se_stage0(inimage, in0, out0, cache, ctx);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se stage0");
 
     std::vector<std::string> gap0 = {"gap0", "gap1", "gap2", "gap3"};
-    process_cpu_se_sync_gap(inimage, gap0, cache);
+    if (ret == 0)
+        ret = process_cpu_se_sync_gap(inimage, gap0, cache);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se sync");
 
     std::vector<std::string> in4 = {"gap0", "gap1", "gap2", "gap3"};
-    process_cpu_se_stage2(inimage, in4, outimage, cache);
+    if (ret == 0)
+        ret = process_cpu_se_stage2(inimage, in4, outimage, cache, ctx);
+    timer.event("se stage2");
 
     cache.clear();
 
-    return 0;
+    return ret;
 }
 
 int RealCUGAN::process_cpu_se_very_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 {
+    ProcessContext ctx(inimage.w, inimage.h, tilesize);
+
+    return process_cpu_se_very_rough(inimage, outimage, ctx);
+}
+
+int RealCUGAN::process_cpu_se_very_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const
+{
+    StageTimer timer(ctx.stagestats, trace);
+
     FeatureCache cache;
 
     std::vector<std::string> in0 = {};
     std::vector<std::string> out0 = {"gap0", "gap1", "gap2", "gap3"};
-    process_cpu_se_very_rough_stage0(inimage, in0, out0, cache);
+    int ret = process_cpu_se_very_rough_stage0(inimage, in0, out0, cache, ctx);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se stage0");
 
     std::vector<std::string> gap0 = {"gap0", "gap1", "gap2", "gap3"};
-    process_cpu_se_very_rough_sync_gap(inimage, gap0, cache);
+    if (ret == 0)
+        ret = process_cpu_se_very_rough_sync_gap(inimage, gap0, cache);
+    timer.mark(&RealCUGANStageStats::se_sync_ms, "se sync");
 
     std::vector<std::string> in4 = {"gap0", "gap1", "gap2", "gap3"};
-    process_cpu_se_stage2(inimage, in4, outimage, cache);
+    if (ret == 0)
+        ret = process_cpu_se_stage2(inimage, in4, outimage, cache, ctx);
+    timer.event("se stage2");
 
     cache.clear();
 
-    return 0;
+    return ret;
+}
+
+int RealCUGAN::process_se_reuse_gap(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const
+{
+    const std::vector<ncnn::Mat>& gapfeats = *ctx.gapfeats;
+    if (gapfeats.size() != 4)
+    {
+        fprintf(stderr, "expect gap0 gap1 gap2 gap3 but got %d gap features\n", (int)gapfeats.size());
+        return -1;
+    }
+
+    VkAllocatorScope vkallocators(vkdev, ctx.memory_tracker);
+    ncnn::VkAllocator* blob_vkallocator = vkallocators.blob;
+    ncnn::VkAllocator* staging_vkallocator = vkallocators.staging;
+
+    ncnn::Option opt = net.opt;
+    opt.blob_vkallocator = blob_vkallocator;
+    opt.workspace_vkallocator = blob_vkallocator;
+    opt.staging_vkallocator = staging_vkallocator;
+
+    FeatureCache cache;
+
+    std::vector<std::string> in4 = {"gap0", "gap1", "gap2", "gap3"};
+
+    // upload once, every tile shares the same global average
+    std::vector<ncnn::VkMat> gapfeats_gpu(in4.size());
+    {
+        ncnn::VkCompute cmd(vkdev);
+
+        for (size_t i = 0; i < in4.size(); i++)
+        {
+            cmd.record_upload(gapfeats[i], gapfeats_gpu[i], opt);
+        }
+
+        cmd.submit_and_wait();
+    }
+
+    for (int yi = ctx.yi0; yi < ctx.yi1; yi++)
+    {
+        for (int xi = ctx.xi0; xi < ctx.xi1; xi++)
+        {
+            for (size_t i = 0; i < in4.size(); i++)
+            {
+                if (tta_mode)
+                {
+                    for (int ti = 0; ti < 8; ti++)
+                    {
+                        cache.save(yi, xi, ti, in4[i], gapfeats_gpu[i]);
+                    }
+                }
+                else
+                {
+                    cache.save(yi, xi, 0, in4[i], gapfeats_gpu[i]);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < in4.size(); i++)
+    {
+        cache.save_gap(in4[i], gapfeats[i]);
+    }
+
+    int ret = process_se_stage2(inimage, in4, outimage, opt, cache, ctx);
+
+    cache.clear();
+
+    return ret;
 }
 
-int RealCUGAN::process_se_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, const ncnn::Option& opt, FeatureCache& cache) const
+int RealCUGAN::process_cpu_se_reuse_gap(const ncnn::Mat& inimage, ncnn::Mat& outimage, ProcessContext& ctx) const
+{
+    const std::vector<ncnn::Mat>& gapfeats = *ctx.gapfeats;
+    if (gapfeats.size() != 4)
+    {
+        fprintf(stderr, "expect gap0 gap1 gap2 gap3 but got %d gap features\n", (int)gapfeats.size());
+        return -1;
+    }
+
+    FeatureCache cache;
+
+    std::vector<std::string> in4 = {"gap0", "gap1", "gap2", "gap3"};
+
+    for (int yi = ctx.yi0; yi < ctx.yi1; yi++)
+    {
+        for (int xi = ctx.xi0; xi < ctx.xi1; xi++)
+        {
+            for (size_t i = 0; i < in4.size(); i++)
+            {
+                ncnn::Mat feat = gapfeats[i];
+
+                if (tta_mode)
+                {
+                    for (int ti = 0; ti < 8; ti++)
+                    {
+                        cache.save(yi, xi, ti, in4[i], feat);
+                    }
+                }
+                else
+                {
+                    cache.save(yi, xi, 0, in4[i], feat);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < in4.size(); i++)
+    {
+        cache.save_gap(in4[i], gapfeats[i]);
+    }
+
+    int ret = process_cpu_se_stage2(inimage, in4, outimage, cache, ctx);
+
+    cache.clear();
+
+    return ret;
+}
+
+int RealCUGAN::process_se_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, const ncnn::Option& opt, FeatureCache& cache, const ProcessContext& ctx) const
 {
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
@@ -1369,6 +4128,8 @@ int RealCUGAN::process_se_stage0(const ncnn::Mat& inimage, const std::vector<std
 
     const size_t in_out_tile_elemsize = opt.use_fp16_storage ? 2u : 4u;
 
+    int ret = 0;
+
     //#pragma omp parallel for num_threads(2)
     for (int yi = 0; yi < ytiles; yi++)
     {
@@ -1390,24 +4151,24 @@ int RealCUGAN::process_se_stage0(const ncnn::Mat& inimage, const std::vector<std
         ncnn::Mat in;
         if (opt.use_fp16_storage && opt.use_int8_storage)
         {
-            in = ncnn::Mat(w, (in_tile_y1 - in_tile_y0), (unsigned char*)pixeldata + in_tile_y0 * w * channels, (size_t)channels, 1);
+            in = ncnn::Mat(w, (in_tile_y1 - in_tile_y0), (unsigned char*)pixeldata + (size_t)in_tile_y0 * w * channels, (size_t)channels, 1);
         }
         else
         {
             if (channels == 3)
             {
 #if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, (in_tile_y1 - in_tile_y0));
+                in = ncnn::Mat::from_pixels(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, (in_tile_y1 - in_tile_y0));
 #else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
+                in = ncnn::Mat::from_pixels(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
 #endif
             }
             if (channels == 4)
             {
 #if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, (in_tile_y1 - in_tile_y0));
+                in = ncnn::Mat::from_pixels(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, (in_tile_y1 - in_tile_y0));
 #else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
+                in = ncnn::Mat::from_pixels(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
 #endif
             }
         }
@@ -1441,6 +4202,11 @@ int RealCUGAN::process_se_stage0(const ncnn::Mat& inimage, const std::vector<std
 
         for (int xi = 0; xi < xtiles; xi++)
         {
+            // stop between tiles once cancelled or past the deadline
+            ret = ctx.check();
+            if (ret != 0)
+                break;
+
             const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
 
             int prepadding_right = prepadding;
@@ -1625,15 +4391,28 @@ int RealCUGAN::process_se_stage0(const ncnn::Mat& inimage, const std::vector<std
             }
         }
 
+        if (ret != 0)
+            break;
+
         cmd.submit_and_wait();
         cmd.reset();
     }
 
-    return 0;
+    return ret;
 }
 
-int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std::string>& names, ncnn::Mat& outimage, const ncnn::Option& opt, FeatureCache& cache) const
+int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std::string>& names, ncnn::Mat& outimage, const ncnn::Option& opt, FeatureCache& cache, ProcessContext& ctx) const
 {
+    if (ctx.gapfeats_out)
+    {
+        // hand out the synced gap features this pass consumes
+        ctx.gapfeats_out->resize(names.size());
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            cache.load_gap(names[i], (*ctx.gapfeats_out)[i]);
+        }
+    }
+
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
     const int h = inimage.h;
@@ -1644,12 +4423,24 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
 
     // each tile 400x400
     const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
-    const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
 
     const size_t in_out_tile_elemsize = opt.use_fp16_storage ? 2u : 4u;
 
+    // SE output also depends on the synced gap features
+    uint64_t gaphash = 0;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        ncnn::Mat feat;
+        cache.load_gap(names[i], feat);
+        gaphash = mat_hash(feat, gaphash);
+    }
+
+    StageTimer timer(ctx.stagestats, trace);
+
+    int ret = 0;
+
     //#pragma omp parallel for num_threads(2)
-    for (int yi = 0; yi < ytiles; yi++)
+    for (int yi = ctx.yi0; yi < ctx.yi1; yi++)
     {
         const int tile_h_nopad = std::min((yi + 1) * TILE_SIZE_Y, h) - yi * TILE_SIZE_Y;
 
@@ -1666,31 +4457,43 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
         int in_tile_y0 = std::max(yi * TILE_SIZE_Y - prepadding, 0);
         int in_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom, h);
 
+        // tiles produced earlier in this image or by an earlier request
+        if (reuse_band(inimage, outimage, yi, gaphash, ctx) == 0)
+        {
+            keep_band(inimage, outimage, yi, ctx);
+            continue;
+        }
+
+        timer.tile(-1, yi);
+        timer.skip();
+
         ncnn::Mat in;
         if (opt.use_fp16_storage && opt.use_int8_storage)
         {
-            in = ncnn::Mat(w, (in_tile_y1 - in_tile_y0), (unsigned char*)pixeldata + in_tile_y0 * w * channels, (size_t)channels, 1);
+            in = ncnn::Mat(w, (in_tile_y1 - in_tile_y0), (unsigned char*)pixeldata + (size_t)in_tile_y0 * w * channels, (size_t)channels, 1);
         }
         else
         {
             if (channels == 3)
             {
 #if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, (in_tile_y1 - in_tile_y0));
+                in = ncnn::Mat::from_pixels(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, (in_tile_y1 - in_tile_y0));
 #else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
+                in = ncnn::Mat::from_pixels(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
 #endif
             }
             if (channels == 4)
             {
 #if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, (in_tile_y1 - in_tile_y0));
+                in = ncnn::Mat::from_pixels(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, (in_tile_y1 - in_tile_y0));
 #else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
+                in = ncnn::Mat::from_pixels(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
 #endif
             }
         }
 
+        timer.mark(&RealCUGANStageStats::pixel_ms);
+
         ncnn::VkCompute cmd(vkdev);
 
         // upload
@@ -1698,6 +4501,9 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
         {
             cmd.record_clone(in, in_gpu, opt);
 
+            timer.bytes(&RealCUGANStageStats::upload_bytes, in.total() * in.elemsize);
+            timer.mark(cmd, &RealCUGANStageStats::upload_ms);
+
             if (xtiles > 1)
             {
                 cmd.submit_and_wait();
@@ -1711,17 +4517,39 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
         ncnn::VkMat out_gpu;
         if (opt.use_fp16_storage && opt.use_int8_storage)
         {
-            out_gpu.create(w * scale, (out_tile_y1 - out_tile_y0) * scale, (size_t)channels, 1, opt.blob_vkallocator);
+            out_gpu.create(outimage.w, (out_tile_y1 - out_tile_y0) * scale, (size_t)channels, 1, opt.blob_vkallocator);
         }
         else
         {
-            out_gpu.create(w * scale, (out_tile_y1 - out_tile_y0) * scale, channels, (size_t)4u, 1, opt.blob_vkallocator);
+            out_gpu.create(outimage.w, (out_tile_y1 - out_tile_y0) * scale, channels, (size_t)4u, 1, opt.blob_vkallocator);
         }
 
-        for (int xi = 0; xi < xtiles; xi++)
+        for (int xi = ctx.xi0; xi < ctx.xi1; xi++)
         {
+            // stop between tiles once cancelled or past the deadline
+            ret = ctx.check();
+            if (ret != 0)
+                break;
+
             const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
 
+            if (ctx.slots[xi - ctx.xi0].skip())
+                continue;
+
+            // a time budget may drop tta or fall back to bicubic for this tile
+            const int tile_mode = ctx.tile_policy ? ctx.tile_policy(xi, yi) : TILE_FULL;
+            if (tile_mode != TILE_FULL)
+                ctx.slots[xi - ctx.xi0].degraded = true;
+            if (tile_mode == TILE_BICUBIC)
+            {
+                bicubic_tile(inimage, xi, yi, ctx.slots[xi - ctx.xi0]);
+                ctx.tilestats.bicubic++;
+                continue;
+            }
+
+            timer.tile(xi, yi);
+            timer.skip();
+
             int prepadding_right = prepadding;
             if (scale == 1 || scale == 3)
             {
@@ -1734,6 +4562,9 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
 
             if (tta_mode)
             {
+                // se features are synced over all 8 orientations, no adaptive tta here
+                ctx.tilestats.tta++;
+
                 // preproc
                 ncnn::VkMat in_tile_gpu[8];
                 ncnn::VkMat in_alpha_tile_gpu;
@@ -1793,6 +4624,8 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
                     cmd.record_pipeline(realcugan_preproc, bindings, constants, dispatcher);
                 }
 
+                timer.mark(cmd, &RealCUGANStageStats::preproc_ms);
+
                 // realcugan
                 ncnn::VkMat out_tile_gpu[8];
                 for (int ti = 0; ti < 8; ti++)
@@ -1814,8 +4647,12 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
                     }
 
                     ex.extract("out0", out_tile_gpu[ti], cmd);
+
+                    timer.mark(cmd, &RealCUGANStageStats::net_ms, 0, ti);
                 }
 
+                timer.inferences(8);
+
                 ncnn::VkMat out_alpha_tile_gpu;
                 if (channels == 4)
                 {
@@ -1837,6 +4674,8 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
                     }
                 }
 
+                timer.mark(cmd, &RealCUGANStageStats::alpha_ms);
+
                 // postproc
                 if (scale == 4)
                 {
@@ -1865,14 +4704,14 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
                     constants[8].i = out_gpu.cstep;
                     constants[9].i = xi * TILE_SIZE_X;
                     constants[10].i = std::min(yi * TILE_SIZE_Y, prepadding);
-                    constants[11].i = xi * TILE_SIZE_X * scale;
-                    constants[12].i = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    constants[11].i = (xi - ctx.xi0) * TILE_SIZE_X * scale;
+                    constants[12].i = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
                     constants[13].i = channels;
                     constants[14].i = out_alpha_tile_gpu.w;
                     constants[15].i = out_alpha_tile_gpu.h;
 
                     ncnn::VkMat dispatcher;
-                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
                     dispatcher.h = out_gpu.h;
                     dispatcher.c = channels;
 
@@ -1899,14 +4738,14 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
                     constants[3].i = out_gpu.w;
                     constants[4].i = out_gpu.h;
                     constants[5].i = out_gpu.cstep;
-                    constants[6].i = xi * TILE_SIZE_X * scale;
-                    constants[7].i = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    constants[6].i = (xi - ctx.xi0) * TILE_SIZE_X * scale;
+                    constants[7].i = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
                     constants[8].i = channels;
                     constants[9].i = out_alpha_tile_gpu.w;
                     constants[10].i = out_alpha_tile_gpu.h;
 
                     ncnn::VkMat dispatcher;
-                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
                     dispatcher.h = out_gpu.h;
                     dispatcher.c = channels;
 
@@ -1960,6 +4799,8 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
                     cmd.record_pipeline(realcugan_preproc, bindings, constants, dispatcher);
                 }
 
+                timer.mark(cmd, &RealCUGANStageStats::preproc_ms);
+
                 // realcugan
                 ncnn::VkMat out_tile_gpu;
                 {
@@ -1982,6 +4823,9 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
                     ex.extract("out0", out_tile_gpu, cmd);
                 }
 
+                timer.mark(cmd, &RealCUGANStageStats::net_ms);
+                timer.inferences(1);
+
                 ncnn::VkMat out_alpha_tile_gpu;
                 if (channels == 4)
                 {
@@ -2003,6 +4847,8 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
                     }
                 }
 
+                timer.mark(cmd, &RealCUGANStageStats::alpha_ms);
+
                 // postproc
                 if (scale == 4)
                 {
@@ -2024,14 +4870,14 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
                     constants[8].i = out_gpu.cstep;
                     constants[9].i = xi * TILE_SIZE_X;
                     constants[10].i = std::min(yi * TILE_SIZE_Y, prepadding);
-                    constants[11].i = xi * TILE_SIZE_X * scale;
-                    constants[12].i = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    constants[11].i = (xi - ctx.xi0) * TILE_SIZE_X * scale;
+                    constants[12].i = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
                     constants[13].i = channels;
                     constants[14].i = out_alpha_tile_gpu.w;
                     constants[15].i = out_alpha_tile_gpu.h;
 
                     ncnn::VkMat dispatcher;
-                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
                     dispatcher.h = out_gpu.h;
                     dispatcher.c = channels;
 
@@ -2051,14 +4897,14 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
                     constants[3].i = out_gpu.w;
                     constants[4].i = out_gpu.h;
                     constants[5].i = out_gpu.cstep;
-                    constants[6].i = xi * TILE_SIZE_X * scale;
-                    constants[7].i = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    constants[6].i = (xi - ctx.xi0) * TILE_SIZE_X * scale;
+                    constants[7].i = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
                     constants[8].i = channels;
                     constants[9].i = out_alpha_tile_gpu.w;
                     constants[10].i = out_alpha_tile_gpu.h;
 
                     ncnn::VkMat dispatcher;
-                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - (xi - ctx.xi0) * TILE_SIZE_X * scale);
                     dispatcher.h = out_gpu.h;
                     dispatcher.c = channels;
 
@@ -2066,49 +4912,66 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
                 }
             }
 
+            timer.mark(cmd, &RealCUGANStageStats::postproc_ms);
+
             if (xtiles > 1)
             {
                 cmd.submit_and_wait();
                 cmd.reset();
             }
+
+            timer.event("gpu wait");
         }
 
+        if (ret != 0)
+            break;
+
         // download
         {
+            timer.tile(-1, yi);
+            timer.skip();
+
             ncnn::Mat out;
 
             if (opt.use_fp16_storage && opt.use_int8_storage)
             {
-                out = ncnn::Mat(out_gpu.w, out_gpu.h, (unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, (size_t)channels, 1);
+                out = ncnn::Mat(out_gpu.w, out_gpu.h, (unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels, (size_t)channels, 1);
             }
 
             cmd.record_clone(out_gpu, out, opt);
 
             cmd.submit_and_wait();
 
+            timer.bytes(&RealCUGANStageStats::download_bytes, out_gpu.total() * out_gpu.elemsize);
+            timer.mark(&RealCUGANStageStats::download_ms);
+
             if (!(opt.use_fp16_storage && opt.use_int8_storage))
             {
                 if (channels == 3)
                 {
 #if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGB2BGR);
+                    out.to_pixels((unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels, ncnn::Mat::PIXEL_RGB2BGR);
 #else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGB);
+                    out.to_pixels((unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels, ncnn::Mat::PIXEL_RGB);
 #endif
                 }
                 if (channels == 4)
                 {
 #if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGBA2BGRA);
+                    out.to_pixels((unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels, ncnn::Mat::PIXEL_RGBA2BGRA);
 #else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGBA);
+                    out.to_pixels((unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels, ncnn::Mat::PIXEL_RGBA);
 #endif
                 }
             }
+
+            timer.mark(&RealCUGANStageStats::pixel_ms);
         }
+
+        keep_band(inimage, outimage, yi, ctx);
     }
 
-    return 0;
+    return ret;
 }
 
 int RealCUGAN::process_se_sync_gap(const ncnn::Mat& inimage, const std::vector<std::string>& names, const ncnn::Option& opt, FeatureCache& cache) const
@@ -2220,6 +5083,8 @@ int RealCUGAN::process_se_sync_gap(const ncnn::Mat& inimage, const std::vector<s
             }
 
             cmd.record_upload(avgfeat, avgfeats[i], opt);
+
+            cache.save_gap(names[i], avgfeat);
         }
     }
 
@@ -2253,7 +5118,7 @@ int RealCUGAN::process_se_sync_gap(const ncnn::Mat& inimage, const std::vector<s
     return 0;
 }
 
-int RealCUGAN::process_se_very_rough_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, const ncnn::Option& opt, FeatureCache& cache) const
+int RealCUGAN::process_se_very_rough_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, const ncnn::Option& opt, FeatureCache& cache, const ProcessContext& ctx) const
 {
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
@@ -2269,6 +5134,8 @@ int RealCUGAN::process_se_very_rough_stage0(const ncnn::Mat& inimage, const std:
 
     const size_t in_out_tile_elemsize = opt.use_fp16_storage ? 2u : 4u;
 
+    int ret = 0;
+
     //#pragma omp parallel for num_threads(2)
     for (int yi = 0; yi + 2 < ytiles; yi += 3)
     {
@@ -2290,24 +5157,24 @@ int RealCUGAN::process_se_very_rough_stage0(const ncnn::Mat& inimage, const std:
         ncnn::Mat in;
         if (opt.use_fp16_storage && opt.use_int8_storage)
         {
-            in = ncnn::Mat(w, (in_tile_y1 - in_tile_y0), (unsigned char*)pixeldata + in_tile_y0 * w * channels, (size_t)channels, 1);
+            in = ncnn::Mat(w, (in_tile_y1 - in_tile_y0), (unsigned char*)pixeldata + (size_t)in_tile_y0 * w * channels, (size_t)channels, 1);
         }
         else
         {
             if (channels == 3)
             {
 #if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, (in_tile_y1 - in_tile_y0));
+                in = ncnn::Mat::from_pixels(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, (in_tile_y1 - in_tile_y0));
 #else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
+                in = ncnn::Mat::from_pixels(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
 #endif
             }
             if (channels == 4)
             {
 #if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, (in_tile_y1 - in_tile_y0));
+                in = ncnn::Mat::from_pixels(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, (in_tile_y1 - in_tile_y0));
 #else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
+                in = ncnn::Mat::from_pixels(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
 #endif
             }
         }
@@ -2341,6 +5208,11 @@ int RealCUGAN::process_se_very_rough_stage0(const ncnn::Mat& inimage, const std:
 
         for (int xi = 0; xi + 2 < xtiles; xi += 3)
         {
+            // stop between tiles once cancelled or past the deadline
+            ret = ctx.check();
+            if (ret != 0)
+                break;
+
             const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
 
             int prepadding_right = prepadding;
@@ -2525,11 +5397,14 @@ int RealCUGAN::process_se_very_rough_stage0(const ncnn::Mat& inimage, const std:
             }
         }
 
+        if (ret != 0)
+            break;
+
         cmd.submit_and_wait();
         cmd.reset();
     }
 
-    return 0;
+    return ret;
 }
 
 int RealCUGAN::process_se_very_rough_sync_gap(const ncnn::Mat& inimage, const std::vector<std::string>& names, const ncnn::Option& opt, FeatureCache& cache) const
@@ -2641,6 +5516,8 @@ int RealCUGAN::process_se_very_rough_sync_gap(const ncnn::Mat& inimage, const st
             }
 
             cmd.record_upload(avgfeat, avgfeats[i], opt);
+
+            cache.save_gap(names[i], avgfeat);
         }
     }
 
@@ -2690,7 +5567,7 @@ int RealCUGAN::process_se_very_rough_sync_gap(const ncnn::Mat& inimage, const st
     return 0;
 }
 
-int RealCUGAN::process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, FeatureCache& cache) const
+int RealCUGAN::process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, FeatureCache& cache, const ProcessContext& ctx) const
 {
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
@@ -2706,6 +5583,8 @@ int RealCUGAN::process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector
     const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
     const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
 
+    int ret = 0;
+
     for (int yi = 0; yi < ytiles; yi++)
     {
         const int tile_h_nopad = std::min((yi + 1) * TILE_SIZE_Y, h) - yi * TILE_SIZE_Y;
@@ -2725,6 +5604,11 @@ int RealCUGAN::process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector
 
         for (int xi = 0; xi < xtiles; xi++)
         {
+            // stop between tiles once cancelled or past the deadline
+            ret = ctx.check();
+            if (ret != 0)
+                break;
+
             const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
 
             int prepadding_right = prepadding;
@@ -2746,17 +5630,17 @@ int RealCUGAN::process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector
                 if (channels == 3)
                 {
 #if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGR2RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
+                    in = ncnn::Mat::from_pixels_roi(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, in_tile_y1 - in_tile_y0, in_tile_x0, 0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
 #else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
+                    in = ncnn::Mat::from_pixels_roi(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, in_tile_y1 - in_tile_y0, in_tile_x0, 0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
 #endif
                 }
                 if (channels == 4)
                 {
 #if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGRA2RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
+                    in = ncnn::Mat::from_pixels_roi(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, in_tile_y1 - in_tile_y0, in_tile_x0, 0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
 #else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
+                    in = ncnn::Mat::from_pixels_roi(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, in_tile_y1 - in_tile_y0, in_tile_x0, 0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
 #endif
                 }
             }
@@ -2769,7 +5653,7 @@ int RealCUGAN::process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector
                 ncnn::Mat in_tile[8];
                 ncnn::Mat in_alpha_tile;
                 {
-                    in_tile[0].create(in.w, in.h, 3);
+                    in_tile[0].create(in.w, in.h, 3, (size_t)4u, ctx.tile_allocator);
                     for (int q = 0; q < 3; q++)
                     {
                         const float* ptr = in.channel(q);
@@ -2804,13 +5688,13 @@ int RealCUGAN::process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector
 
                 // the other 7 directions
                 {
-                    in_tile[1].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[2].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[3].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[4].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[5].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[6].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[7].create(in_tile[0].h, in_tile[0].w, 3);
+                    in_tile[1].create(in_tile[0].w, in_tile[0].h, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[2].create(in_tile[0].w, in_tile[0].h, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[3].create(in_tile[0].w, in_tile[0].h, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[4].create(in_tile[0].h, in_tile[0].w, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[5].create(in_tile[0].h, in_tile[0].w, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[6].create(in_tile[0].h, in_tile[0].w, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[7].create(in_tile[0].h, in_tile[0].w, 3, (size_t)4u, ctx.tile_allocator);
 
                     for (int q = 0; q < 3; q++)
                     {
@@ -2857,6 +5741,9 @@ int RealCUGAN::process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    ex.set_blob_allocator(ctx.blob_allocator);
+                    ex.set_workspace_allocator(ctx.workspace_allocator);
+
                     ex.input("in0", in_tile[ti]);
 
                     for (size_t i = 0; i < names.size(); i++)
@@ -2882,7 +5769,7 @@ int RealCUGAN::process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector
                 ncnn::Mat in_tile;
                 ncnn::Mat in_alpha_tile;
                 {
-                    in_tile.create(in.w, in.h, 3);
+                    in_tile.create(in.w, in.h, 3, (size_t)4u, ctx.tile_allocator);
                     for (int q = 0; q < 3; q++)
                     {
                         const float* ptr = in.channel(q);
@@ -2915,6 +5802,9 @@ int RealCUGAN::process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    ex.set_blob_allocator(ctx.blob_allocator);
+                    ex.set_workspace_allocator(ctx.workspace_allocator);
+
                     ex.input("in0", in_tile);
 
                     for (size_t i = 0; i < names.size(); i++)
@@ -2935,13 +5825,26 @@ int RealCUGAN::process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector
                 }
             }
         }
+
+        if (ret != 0)
+            break;
     }
 
-    return 0;
+    return ret;
 }
 
-int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector<std::string>& names, ncnn::Mat& outimage, FeatureCache& cache) const
+int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector<std::string>& names, ncnn::Mat& outimage, FeatureCache& cache, ProcessContext& ctx) const
 {
+    if (ctx.gapfeats_out)
+    {
+        // hand out the synced gap features this pass consumes
+        ctx.gapfeats_out->resize(names.size());
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            cache.load_gap(names[i], (*ctx.gapfeats_out)[i]);
+        }
+    }
+
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
     const int h = inimage.h;
@@ -2952,11 +5855,20 @@ int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector
 
     ncnn::Option opt = net.opt;
 
-    // each tile 400x400
-    const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
-    const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
+    // SE output also depends on the synced gap features
+    uint64_t gaphash = 0;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        ncnn::Mat feat;
+        cache.load_gap(names[i], feat);
+        gaphash = mat_hash(feat, gaphash);
+    }
 
-    for (int yi = 0; yi < ytiles; yi++)
+    StageTimer timer(ctx.stagestats, trace);
+
+    int ret = 0;
+
+    for (int yi = ctx.yi0; yi < ctx.yi1; yi++)
     {
         const int tile_h_nopad = std::min((yi + 1) * TILE_SIZE_Y, h) - yi * TILE_SIZE_Y;
 
@@ -2973,10 +5885,32 @@ int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector
         int in_tile_y0 = std::max(yi * TILE_SIZE_Y - prepadding, 0);
         int in_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom, h);
 
-        for (int xi = 0; xi < xtiles; xi++)
+        // tiles produced earlier in this image or by an earlier request
+        reuse_band(inimage, outimage, yi, gaphash, ctx);
+
+        for (int xi = ctx.xi0; xi < ctx.xi1; xi++)
         {
+            // stop between tiles once cancelled or past the deadline
+            ret = ctx.check();
+            if (ret != 0)
+                break;
+
             const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
 
+            if (ctx.slots[xi - ctx.xi0].skip())
+                continue;
+
+            // a time budget may drop tta or fall back to bicubic for this tile
+            const int tile_mode = ctx.tile_policy ? ctx.tile_policy(xi, yi) : TILE_FULL;
+            if (tile_mode != TILE_FULL)
+                ctx.slots[xi - ctx.xi0].degraded = true;
+            if (tile_mode == TILE_BICUBIC)
+            {
+                bicubic_tile(inimage, xi, yi, ctx.slots[xi - ctx.xi0]);
+                ctx.tilestats.bicubic++;
+                continue;
+            }
+
             int prepadding_right = prepadding;
             if (scale == 1 || scale == 3)
             {
@@ -2990,36 +5924,44 @@ int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector
             int in_tile_x0 = std::max(xi * TILE_SIZE_X - prepadding, 0);
             int in_tile_x1 = std::min((xi + 1) * TILE_SIZE_X + prepadding_right, w);
 
+            timer.tile(xi, yi);
+            timer.skip();
+
             // crop tile
             ncnn::Mat in;
             {
                 if (channels == 3)
                 {
 #if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGR2RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
+                    in = ncnn::Mat::from_pixels_roi(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, in_tile_y1 - in_tile_y0, in_tile_x0, 0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
 #else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
+                    in = ncnn::Mat::from_pixels_roi(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, in_tile_y1 - in_tile_y0, in_tile_x0, 0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
 #endif
                 }
                 if (channels == 4)
                 {
 #if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGRA2RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
+                    in = ncnn::Mat::from_pixels_roi(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, in_tile_y1 - in_tile_y0, in_tile_x0, 0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
 #else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
+                    in = ncnn::Mat::from_pixels_roi(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, in_tile_y1 - in_tile_y0, in_tile_x0, 0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
 #endif
                 }
             }
 
+            timer.mark(&RealCUGANStageStats::pixel_ms);
+
             ncnn::Mat out;
 
             if (tta_mode)
             {
+                // se features are synced over all 8 orientations, no adaptive tta here
+                ctx.tilestats.tta++;
+
                 // split alpha and preproc
                 ncnn::Mat in_tile[8];
                 ncnn::Mat in_alpha_tile;
                 {
-                    in_tile[0].create(in.w, in.h, 3);
+                    in_tile[0].create(in.w, in.h, 3, (size_t)4u, ctx.tile_allocator);
                     for (int q = 0; q < 3; q++)
                     {
                         const float* ptr = in.channel(q);
@@ -3054,13 +5996,13 @@ int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector
 
                 // the other 7 directions
                 {
-                    in_tile[1].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[2].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[3].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[4].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[5].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[6].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[7].create(in_tile[0].h, in_tile[0].w, 3);
+                    in_tile[1].create(in_tile[0].w, in_tile[0].h, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[2].create(in_tile[0].w, in_tile[0].h, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[3].create(in_tile[0].w, in_tile[0].h, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[4].create(in_tile[0].h, in_tile[0].w, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[5].create(in_tile[0].h, in_tile[0].w, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[6].create(in_tile[0].h, in_tile[0].w, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[7].create(in_tile[0].h, in_tile[0].w, 3, (size_t)4u, ctx.tile_allocator);
 
                     for (int q = 0; q < 3; q++)
                     {
@@ -3101,12 +6043,17 @@ int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector
                     }
                 }
 
+                timer.mark(&RealCUGANStageStats::preproc_ms);
+
                 // realcugan
                 ncnn::Mat out_tile[8];
                 for (int ti = 0; ti < 8; ti++)
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    ex.set_blob_allocator(ctx.blob_allocator);
+                    ex.set_workspace_allocator(ctx.workspace_allocator);
+
                     ex.input("in0", in_tile[ti]);
 
                     for (size_t i = 0; i < names.size(); i++)
@@ -3118,8 +6065,12 @@ int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector
                     }
 
                     ex.extract("out0", out_tile[ti]);
+
+                    timer.mark(&RealCUGANStageStats::net_ms, 0, ti);
                 }
 
+                timer.inferences(8);
+
                 ncnn::Mat out_alpha_tile;
                 if (channels == 4)
                 {
@@ -3141,9 +6092,11 @@ int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector
                     }
                 }
 
+                timer.mark(&RealCUGANStageStats::alpha_ms);
+
                 // postproc and merge alpha
                 {
-                    out.create(tile_w_nopad * scale, tile_h_nopad * scale, channels);
+                    out.create(tile_w_nopad * scale, tile_h_nopad * scale, channels, (size_t)4u, ctx.tile_allocator);
                     if (scale == 4)
                     {
                         for (int q = 0; q < 3; q++)
@@ -3228,7 +6181,7 @@ int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector
                 ncnn::Mat in_tile;
                 ncnn::Mat in_alpha_tile;
                 {
-                    in_tile.create(in.w, in.h, 3);
+                    in_tile.create(in.w, in.h, 3, (size_t)4u, ctx.tile_allocator);
                     for (int q = 0; q < 3; q++)
                     {
                         const float* ptr = in.channel(q);
@@ -3258,11 +6211,16 @@ int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector
                     in_tile = in_tile_padded;
                 }
 
+                timer.mark(&RealCUGANStageStats::preproc_ms);
+
                 // realcugan
                 ncnn::Mat out_tile;
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    ex.set_blob_allocator(ctx.blob_allocator);
+                    ex.set_workspace_allocator(ctx.workspace_allocator);
+
                     ex.input("in0", in_tile);
 
                     for (size_t i = 0; i < names.size(); i++)
@@ -3276,6 +6234,9 @@ int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector
                     ex.extract("out0", out_tile);
                 }
 
+                timer.mark(&RealCUGANStageStats::net_ms);
+                timer.inferences(1);
+
                 ncnn::Mat out_alpha_tile;
                 if (channels == 4)
                 {
@@ -3297,9 +6258,11 @@ int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector
                     }
                 }
 
+                timer.mark(&RealCUGANStageStats::alpha_ms);
+
                 // postproc and merge alpha
                 {
-                    out.create(tile_w_nopad * scale, tile_h_nopad * scale, channels);
+                    out.create(tile_w_nopad * scale, tile_h_nopad * scale, channels, (size_t)4u, ctx.tile_allocator);
                     if (scale == 4)
                     {
                         for (int q = 0; q < 3; q++)
@@ -3343,28 +6306,37 @@ int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector
                 }
             }
 
+            timer.mark(&RealCUGANStageStats::postproc_ms);
+
             {
                 if (channels == 3)
                 {
 #if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGB2BGR, w * scale * channels);
+                    out.to_pixels((unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels + (xi - ctx.xi0) * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGB2BGR, outimage.w * channels);
 #else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGB, w * scale * channels);
+                    out.to_pixels((unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels + (xi - ctx.xi0) * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGB, outimage.w * channels);
 #endif
                 }
                 if (channels == 4)
                 {
 #if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGBA2BGRA, w * scale * channels);
+                    out.to_pixels((unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels + (xi - ctx.xi0) * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGBA2BGRA, outimage.w * channels);
 #else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGBA, w * scale * channels);
+                    out.to_pixels((unsigned char*)outimage.data + (size_t)(yi - ctx.yi0) * scale * TILE_SIZE_Y * outimage.w * channels + (xi - ctx.xi0) * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGBA, outimage.w * channels);
 #endif
                 }
             }
+
+            timer.mark(&RealCUGANStageStats::pixel_ms);
         }
+
+        if (ret != 0)
+            break;
+
+        keep_band(inimage, outimage, yi, ctx);
     }
 
-    return 0;
+    return ret;
 }
 
 int RealCUGAN::process_cpu_se_sync_gap(const ncnn::Mat& inimage, const std::vector<std::string>& names, FeatureCache& cache) const
@@ -3443,6 +6415,10 @@ int RealCUGAN::process_cpu_se_sync_gap(const ncnn::Mat& inimage, const std::vect
             }
 
             avgfeats[i] = avgfeat;
+
+            ncnn::Mat avgfeat_unpacked;
+            ncnn::convert_packing(avgfeat, avgfeat_unpacked, 1, net.opt);
+            cache.save_gap(names[i], avgfeat_unpacked);
         }
     }
 
@@ -3472,7 +6448,7 @@ int RealCUGAN::process_cpu_se_sync_gap(const ncnn::Mat& inimage, const std::vect
     return 0;
 }
 
-int RealCUGAN::process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, FeatureCache& cache) const
+int RealCUGAN::process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, FeatureCache& cache, const ProcessContext& ctx) const
 {
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
@@ -3488,6 +6464,8 @@ int RealCUGAN::process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const
     const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
     const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
 
+    int ret = 0;
+
     for (int yi = 0; yi + 2 < ytiles; yi += 3)
     {
         const int tile_h_nopad = std::min((yi + 1) * TILE_SIZE_Y, h) - yi * TILE_SIZE_Y;
@@ -3507,6 +6485,11 @@ int RealCUGAN::process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const
 
         for (int xi = 0; xi + 2 < xtiles; xi += 3)
         {
+            // stop between tiles once cancelled or past the deadline
+            ret = ctx.check();
+            if (ret != 0)
+                break;
+
             const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
 
             int prepadding_right = prepadding;
@@ -3528,17 +6511,17 @@ int RealCUGAN::process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const
                 if (channels == 3)
                 {
 #if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGR2RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
+                    in = ncnn::Mat::from_pixels_roi(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, in_tile_y1 - in_tile_y0, in_tile_x0, 0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
 #else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
+                    in = ncnn::Mat::from_pixels_roi(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, in_tile_y1 - in_tile_y0, in_tile_x0, 0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
 #endif
                 }
                 if (channels == 4)
                 {
 #if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGRA2RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
+                    in = ncnn::Mat::from_pixels_roi(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, in_tile_y1 - in_tile_y0, in_tile_x0, 0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
 #else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
+                    in = ncnn::Mat::from_pixels_roi(pixeldata + (size_t)in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, in_tile_y1 - in_tile_y0, in_tile_x0, 0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
 #endif
                 }
             }
@@ -3551,7 +6534,7 @@ int RealCUGAN::process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const
                 ncnn::Mat in_tile[8];
                 ncnn::Mat in_alpha_tile;
                 {
-                    in_tile[0].create(in.w, in.h, 3);
+                    in_tile[0].create(in.w, in.h, 3, (size_t)4u, ctx.tile_allocator);
                     for (int q = 0; q < 3; q++)
                     {
                         const float* ptr = in.channel(q);
@@ -3586,13 +6569,13 @@ int RealCUGAN::process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const
 
                 // the other 7 directions
                 {
-                    in_tile[1].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[2].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[3].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[4].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[5].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[6].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[7].create(in_tile[0].h, in_tile[0].w, 3);
+                    in_tile[1].create(in_tile[0].w, in_tile[0].h, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[2].create(in_tile[0].w, in_tile[0].h, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[3].create(in_tile[0].w, in_tile[0].h, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[4].create(in_tile[0].h, in_tile[0].w, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[5].create(in_tile[0].h, in_tile[0].w, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[6].create(in_tile[0].h, in_tile[0].w, 3, (size_t)4u, ctx.tile_allocator);
+                    in_tile[7].create(in_tile[0].h, in_tile[0].w, 3, (size_t)4u, ctx.tile_allocator);
 
                     for (int q = 0; q < 3; q++)
                     {
@@ -3639,6 +6622,9 @@ int RealCUGAN::process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    ex.set_blob_allocator(ctx.blob_allocator);
+                    ex.set_workspace_allocator(ctx.workspace_allocator);
+
                     ex.input("in0", in_tile[ti]);
 
                     for (size_t i = 0; i < names.size(); i++)
@@ -3664,7 +6650,7 @@ int RealCUGAN::process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const
                 ncnn::Mat in_tile;
                 ncnn::Mat in_alpha_tile;
                 {
-                    in_tile.create(in.w, in.h, 3);
+                    in_tile.create(in.w, in.h, 3, (size_t)4u, ctx.tile_allocator);
                     for (int q = 0; q < 3; q++)
                     {
                         const float* ptr = in.channel(q);
@@ -3697,6 +6683,9 @@ int RealCUGAN::process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    ex.set_blob_allocator(ctx.blob_allocator);
+                    ex.set_workspace_allocator(ctx.workspace_allocator);
+
                     ex.input("in0", in_tile);
 
                     for (size_t i = 0; i < names.size(); i++)
@@ -3717,9 +6706,12 @@ int RealCUGAN::process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const
                 }
             }
         }
+
+        if (ret != 0)
+            break;
     }
 
-    return 0;
+    return ret;
 }
 
 int RealCUGAN::process_cpu_se_very_rough_sync_gap(const ncnn::Mat& inimage, const std::vector<std::string>& names, FeatureCache& cache) const
@@ -3798,6 +6790,10 @@ int RealCUGAN::process_cpu_se_very_rough_sync_gap(const ncnn::Mat& inimage, cons
             }
 
             avgfeats[i] = avgfeat;
+
+            ncnn::Mat avgfeat_unpacked;
+            ncnn::convert_packing(avgfeat, avgfeat_unpacked, 1, net.opt);
+            cache.save_gap(names[i], avgfeat_unpacked);
         }
     }
 
@@ -3842,3 +6838,547 @@ int RealCUGAN::process_cpu_se_very_rough_sync_gap(const ncnn::Mat& inimage, cons
 
     return 0;
 }
+
+// padded input rect of tile xi,yi, same as the crop in process_cpu
+static void tile_input_rect(int w, int h, int xi, int yi, int tilesize, int prepadding, int scale, int& x0, int& x1, int& y0, int& y1)
+{
+    const int tile_w_nopad = std::min((xi + 1) * tilesize, w) - xi * tilesize;
+    const int tile_h_nopad = std::min((yi + 1) * tilesize, h) - yi * tilesize;
+
+    int prepadding_right = prepadding;
+    int prepadding_bottom = prepadding;
+    if (scale == 1 || scale == 3)
+    {
+        prepadding_right += (tile_w_nopad + 3) / 4 * 4 - tile_w_nopad;
+        prepadding_bottom += (tile_h_nopad + 3) / 4 * 4 - tile_h_nopad;
+    }
+    if (scale == 2 || scale == 4)
+    {
+        prepadding_right += (tile_w_nopad + 1) / 2 * 2 - tile_w_nopad;
+        prepadding_bottom += (tile_h_nopad + 1) / 2 * 2 - tile_h_nopad;
+    }
+
+    x0 = std::max(xi * tilesize - prepadding, 0);
+    x1 = std::min((xi + 1) * tilesize + prepadding_right, w);
+    y0 = std::max(yi * tilesize - prepadding, 0);
+    y1 = std::min((yi + 1) * tilesize + prepadding_bottom, h);
+}
+
+RealCUGANSession::RealCUGANSession(const RealCUGAN& _realcugan) : realcugan(_realcugan)
+{
+    resync_threshold = 0.05f;
+    memset(&tilestats, 0, sizeof(tilestats));
+    resynced = false;
+    tilesize = 0;
+    pending_changed = 0;
+}
+
+void RealCUGANSession::reset()
+{
+    previn.release();
+    output.release();
+    gapfeats.clear();
+    tilesize = 0;
+    pending_changed = 0;
+}
+
+int RealCUGANSession::process(const ncnn::Mat& inimage, ncnn::Mat& outimage)
+{
+    const unsigned char* pixeldata = (const unsigned char*)inimage.data;
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int channels = inimage.elempack;
+    const int scale = realcugan.scale;
+
+    ProcessContext ctx(w, h, realcugan.tilesize);
+
+    const int xtiles = ctx.xi1;
+    const int ytiles = ctx.yi1;
+
+    const bool syncgap_needed = realcugan.syncgap && realcugan.tilesize < std::max(w, h);
+
+    bool fresh = previn.empty() || previn.w != w || previn.h != h || previn.elempack != channels || tilesize != realcugan.tilesize || output.w != w * scale || output.h != h * scale;
+    if (syncgap_needed && gapfeats.empty())
+        fresh = true;
+
+    resynced = false;
+
+    std::vector<unsigned char> clean;
+    if (!fresh)
+    {
+        const unsigned char* prevdata = (const unsigned char*)previn.data;
+
+        // changed pixels against the previous version
+        size_t changed = 0;
+        for (int y = 0; y < h; y++)
+        {
+            const unsigned char* ptr = pixeldata + (size_t)y * w * channels;
+            const unsigned char* prevptr = prevdata + (size_t)y * w * channels;
+
+            if (memcmp(ptr, prevptr, (size_t)w * channels) == 0)
+                continue;
+
+            for (int x = 0; x < w; x++)
+            {
+                if (memcmp(ptr + x * channels, prevptr + x * channels, channels) != 0)
+                    changed++;
+            }
+        }
+
+        pending_changed += changed;
+
+        if (syncgap_needed && pending_changed > resync_threshold * w * h)
+        {
+            // gap features drifted too far, every tile depends on them
+            fresh = true;
+            resynced = true;
+        }
+        else
+        {
+            // a tile is clean when nothing in its padded input changed
+            clean.resize(xtiles * ytiles);
+            for (int yi = 0; yi < ytiles; yi++)
+            {
+                for (int xi = 0; xi < xtiles; xi++)
+                {
+                    int x0, x1, y0, y1;
+                    tile_input_rect(w, h, xi, yi, realcugan.tilesize, realcugan.prepadding, scale, x0, x1, y0, y1);
+
+                    bool same = true;
+                    for (int y = y0; y < y1 && same; y++)
+                    {
+                        size_t offset = ((size_t)y * w + x0) * channels;
+                        same = memcmp(pixeldata + offset, prevdata + offset, (size_t)(x1 - x0) * channels) == 0;
+                    }
+
+                    clean[yi * xtiles + xi] = same ? 1 : 0;
+                }
+            }
+
+            ctx.clean = &clean;
+
+            if (syncgap_needed)
+                ctx.gapfeats = &gapfeats;
+        }
+    }
+
+    if (fresh)
+    {
+        output.create(w * scale, h * scale, (size_t)channels, channels);
+        if (output.empty())
+            return -100;
+
+        gapfeats.clear();
+        pending_changed = 0;
+
+        if (syncgap_needed)
+        {
+            ctx.gapfeats_out = &gapfeats;
+            resynced = true;
+        }
+    }
+
+    int ret = realcugan.process(inimage, output, ctx);
+
+    tilestats = ctx.tilestats;
+
+    if (ret != 0)
+    {
+        reset();
+        return ret;
+    }
+
+    if (previn.w == w && previn.h == h && previn.elempack == channels)
+    {
+        memcpy(previn.data, inimage.data, (size_t)w * h * channels);
+    }
+    else
+    {
+        previn = inimage.clone();
+    }
+    tilesize = realcugan.tilesize;
+
+    // a copy, the session buffer is patched in place by the next call
+    outimage = output.clone();
+
+    return 0;
+}
+
+static const char checkpoint_magic[8] = {'R', 'C', 'G', 'C', 'K', 'P', 'T', '1'};
+
+RealCUGANCheckpoint::RealCUGANCheckpoint(const RealCUGAN& _realcugan, const std::string& _path) : realcugan(_realcugan), path(_path)
+{
+    interval = 5.0;
+    cancel = 0;
+    resumed_band = 0;
+    saves = 0;
+    save_ms = 0;
+    memset(&tilestats, 0, sizeof(tilestats));
+}
+
+uint64_t RealCUGANCheckpoint::job_key(const ncnn::Mat& inimage) const
+{
+    int desc[12];
+    desc[0] = inimage.w;
+    desc[1] = inimage.h;
+    desc[2] = inimage.elempack;
+    desc[3] = realcugan.noise;
+    desc[4] = realcugan.scale;
+    desc[5] = realcugan.tilesize;
+    desc[6] = realcugan.prepadding;
+    desc[7] = realcugan.syncgap;
+    desc[8] = realcugan.tta_mode ? 1 : 0;
+    desc[9] = 0;
+    if (realcugan.tta_mode)
+        memcpy(&desc[9], &realcugan.tta_threshold, sizeof(float));
+    desc[10] = realcugan.tta_mode && realcugan.tta_batch ? 1 : 0;
+    desc[11] = realcugan.vkdev ? 1 : 0;
+
+    uint64_t key = tile_cache_hash(desc, sizeof(desc), realcugan.model_hash);
+    return tile_cache_hash(inimage.data, (size_t)inimage.w * inimage.h * inimage.elempack, key);
+}
+
+// first unfinished band recorded for key, 0 without a matching checkpoint
+int RealCUGANCheckpoint::load(uint64_t key, std::vector<ncnn::Mat>& gapfeats) const
+{
+    gapfeats.clear();
+
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return 0;
+
+    char magic[8];
+    uint64_t filekey = 0;
+    int next_band = 0;
+    int ngaps = 0;
+    bool ok = fread(magic, 1, 8, fp) == 8 && memcmp(magic, checkpoint_magic, 8) == 0
+              && fread(&filekey, sizeof(filekey), 1, fp) == 1 && filekey == key
+              && fread(&next_band, sizeof(int), 1, fp) == 1 && next_band >= 0
+              && fread(&ngaps, sizeof(int), 1, fp) == 1 && ngaps >= 0 && ngaps <= 16;
+
+    for (int i = 0; ok && i < ngaps; i++)
+    {
+        int shape[7];
+        ok = fread(shape, sizeof(int), 7, fp) == 7;
+        if (!ok)
+            break;
+
+        // dims w h d c elemsize elempack
+        ncnn::Mat m;
+        if (shape[0] == 1)
+            m.create(shape[1], (size_t)shape[5], shape[6]);
+        else if (shape[0] == 2)
+            m.create(shape[1], shape[2], (size_t)shape[5], shape[6]);
+        else if (shape[0] == 3)
+            m.create(shape[1], shape[2], shape[4], (size_t)shape[5], shape[6]);
+        else if (shape[0] == 4)
+            m.create(shape[1], shape[2], shape[3], shape[4], (size_t)shape[5], shape[6]);
+
+        ok = !m.empty();
+        for (int q = 0; ok && q < m.c; q++)
+        {
+            const size_t size = (size_t)m.w * m.h * m.d * m.elemsize;
+            ok = fread(m.channel(q).data, 1, size, fp) == size;
+        }
+
+        gapfeats.push_back(m);
+    }
+
+    fclose(fp);
+
+    if (!ok)
+    {
+        gapfeats.clear();
+        return 0;
+    }
+
+    return next_band;
+}
+
+// written aside and renamed, a kill during the save keeps the previous checkpoint
+int RealCUGANCheckpoint::save(uint64_t key, int next_band, const std::vector<ncnn::Mat>& gapfeats) const
+{
+    const std::string tmppath = path + ".tmp";
+
+    FILE* fp = fopen(tmppath.c_str(), "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "open checkpoint %s failed\n", tmppath.c_str());
+        return -1;
+    }
+
+    const int ngaps = (int)gapfeats.size();
+    bool ok = fwrite(checkpoint_magic, 1, 8, fp) == 8
+              && fwrite(&key, sizeof(key), 1, fp) == 1
+              && fwrite(&next_band, sizeof(int), 1, fp) == 1
+              && fwrite(&ngaps, sizeof(int), 1, fp) == 1;
+
+    for (int i = 0; ok && i < ngaps; i++)
+    {
+        const ncnn::Mat& m = gapfeats[i];
+
+        int shape[7] = {m.dims, m.w, m.h, m.d, m.c, (int)m.elemsize, m.elempack};
+        ok = fwrite(shape, sizeof(int), 7, fp) == 7;
+
+        for (int q = 0; ok && q < m.c; q++)
+        {
+            const size_t size = (size_t)m.w * m.h * m.d * m.elemsize;
+            ok = fwrite(m.channel(q).data, 1, size, fp) == size;
+        }
+    }
+
+    if (fclose(fp) != 0)
+        ok = false;
+
+    if (!ok || rename(tmppath.c_str(), path.c_str()) != 0)
+    {
+        fprintf(stderr, "write checkpoint %s failed\n", path.c_str());
+        remove(tmppath.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+int RealCUGANCheckpoint::process(const ncnn::Mat& inimage, ncnn::Mat& outimage)
+{
+    typedef std::chrono::steady_clock clock;
+
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int channels = inimage.elempack;
+    const int scale = realcugan.scale;
+    const int tilesize = realcugan.tilesize;
+
+    ProcessContext ctx(w, h, tilesize);
+
+    saves = 0;
+    save_ms = 0;
+
+    const uint64_t key = job_key(inimage);
+
+    std::vector<ncnn::Mat> gapfeats;
+    int next_band = load(key, gapfeats);
+
+    // stage2 of a resumed SE job needs the features the finished bands were made with
+    const bool syncgap_needed = realcugan.syncgap && tilesize < std::max(w, h);
+    if (next_band > ctx.yi1 || (syncgap_needed && next_band > 0 && gapfeats.empty()))
+    {
+        next_band = 0;
+        gapfeats.clear();
+    }
+
+    resumed_band = next_band;
+
+    if (next_band == ctx.yi1)
+    {
+        memset(&tilestats, 0, sizeof(tilestats));
+        remove(path.c_str());
+        return 0;
+    }
+
+    ctx.yi0 = next_band;
+    if (syncgap_needed)
+    {
+        if (gapfeats.empty())
+            ctx.gapfeats_out = &gapfeats;
+        else
+            ctx.gapfeats = &gapfeats;
+    }
+
+    ctx.cancel = cancel;
+
+    // first band not yet finished and first band not yet in the checkpoint
+    int next_done = next_band;
+    int next_saved = next_band;
+
+    clock::time_point last_save = clock::now();
+    auto checkpoint = [&]() {
+        clock::time_point t0 = clock::now();
+
+        if (!flush || flush() == 0)
+        {
+            if (save(key, next_done, gapfeats) == 0)
+            {
+                next_saved = next_done;
+                saves++;
+            }
+        }
+
+        last_save = clock::now();
+        save_ms += std::chrono::duration<double, std::milli>(last_save - t0).count();
+    };
+
+    ctx.band_done = [&](int yi) {
+        next_done = yi + 1;
+
+        // the finished image needs no checkpoint
+        if (next_done == ctx.yi1)
+            return;
+
+        if (std::chrono::duration<double>(clock::now() - last_save).count() < interval)
+            return;
+
+        checkpoint();
+    };
+
+    // outimage rows from band yi0 on
+    const size_t offset = (size_t)next_band * tilesize * scale * outimage.w * channels;
+    ncnn::Mat window(outimage.w, outimage.h - next_band * tilesize * scale, (unsigned char*)outimage.data + offset, (size_t)channels, channels);
+
+    int ret = realcugan.process(inimage, window, ctx);
+
+    tilestats = ctx.tilestats;
+
+    // keep what a stopped job got done, stage2 has filled gapfeats once a band is finished
+    if ((ret == REALCUGAN_CANCELLED || ret == REALCUGAN_DEADLINE_EXCEEDED) && next_done > next_saved)
+        checkpoint();
+
+    if (ret != 0)
+        return ret;
+
+    remove(path.c_str());
+
+    return 0;
+}
+
+// exponential average of per tile timings, the first sample is taken as is
+static void update_timing(double& avg, double sample)
+{
+    avg = avg > 0 ? avg * 0.7 + sample * 0.3 : sample;
+}
+
+RealCUGANBudget::RealCUGANBudget(const RealCUGAN& _realcugan) : realcugan(_realcugan)
+{
+    single_ms = 0;
+    tta_ms = 0;
+    for (int i = 0; i < 4; i++)
+        gap_ms[i] = 0;
+    cancel = 0;
+    memset(&used, 0, sizeof(used));
+    memset(&tilestats, 0, sizeof(tilestats));
+}
+
+double RealCUGANBudget::predict(int syncgap_mode, bool tta, double tiles) const
+{
+    // without a measurement of one, guess from the other
+    const double tta_ratio = realcugan.tta_batch ? 4.0 : 8.0;
+    const double single = single_ms > 0 ? single_ms : tta_ms / tta_ratio;
+    const double full = tta_ms > 0 ? tta_ms : single_ms * tta_ratio;
+
+    const double gap = syncgap_mode > 0 && syncgap_mode < 4 ? gap_ms[syncgap_mode] : 0;
+
+    return (gap + (tta ? full : single)) * tiles;
+}
+
+int RealCUGANBudget::process(const ncnn::Mat& inimage, ncnn::Mat& outimage, double budget_ms)
+{
+    typedef std::chrono::steady_clock clock;
+
+    const clock::time_point t0 = clock::now();
+
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int tilesize = realcugan.tilesize;
+
+    ProcessContext ctx(w, h, tilesize);
+    ctx.cancel = cancel;
+
+    memset(&used, 0, sizeof(used));
+
+    // work in full tiles, edge tiles count with their area
+    const double tiles = (double)w * h / ((double)tilesize * tilesize);
+
+    const bool se = realcugan.syncgap && tilesize < std::max(w, h);
+
+    // SE stage2 runs every tile with the orientations of the stage0 passes
+    const bool tta_fixed = realcugan.tta_mode && se;
+
+    int mode = 0;
+    if (se)
+    {
+        for (mode = realcugan.syncgap; mode < 3; mode++)
+        {
+            if (predict(mode, realcugan.tta_mode, tiles) <= budget_ms)
+                break;
+        }
+
+        ctx.syncgap = mode;
+        used.syncgap = mode;
+    }
+
+    used.predicted_ms = predict(mode, realcugan.tta_mode, tiles);
+
+    bool drop_tta = false;
+    bool fallback = false;
+
+    bool started = false;
+    clock::time_point last = t0;
+    int last_mode = TILE_BICUBIC;
+    double last_weight = 0;
+    double done_weight = 0;
+
+    ctx.tile_policy = [&](int xi, int yi) {
+        const clock::time_point now = clock::now();
+
+        if (!started)
+        {
+            // everything up to the first output tile is the SE passes
+            started = true;
+            if (se)
+                update_timing(gap_ms[mode], std::chrono::duration<double, std::milli>(now - t0).count() / tiles);
+        }
+        else if (last_mode != TILE_BICUBIC && last_weight > 0)
+        {
+            const double ms = std::chrono::duration<double, std::milli>(now - last).count() / last_weight;
+            update_timing(last_mode == TILE_FULL ? tta_ms : single_ms, ms);
+        }
+
+        const int tile_w = std::min((xi + 1) * tilesize, w) - xi * tilesize;
+        const int tile_h = std::min((yi + 1) * tilesize, h) - yi * tilesize;
+        const double weight = (double)tile_w * tile_h / ((double)tilesize * tilesize);
+
+        done_weight += weight;
+        const double rest = std::max(tiles - done_weight, 0.0);
+        const double elapsed = std::chrono::duration<double, std::milli>(now - t0).count();
+
+        // adaptive tta may run this tile with one orientation anyway
+        const bool tta_tile = realcugan.tta_mode && (tta_fixed || (!drop_tta && realcugan.tile_tta(inimage, xi, yi)));
+
+        const double single = predict(0, false, 1.0);
+        const double full = predict(0, true, 1.0);
+
+        // tta only while a single orientation for the rest still fits
+        if (tta_tile && !tta_fixed && single > 0 && elapsed + full * weight + single * rest > budget_ms)
+            drop_tta = true;
+
+        const bool run_tta = tta_tile && !drop_tta;
+        const double cost = run_tta ? full : single;
+        if (!fallback && cost > 0 && elapsed + cost * weight > budget_ms)
+            fallback = true;
+
+        last = now;
+        last_weight = weight;
+        last_mode = fallback ? TILE_BICUBIC : run_tta ? TILE_FULL : TILE_SINGLE;
+
+        if (last_mode == TILE_BICUBIC)
+            used.bicubic++;
+        else if (last_mode == TILE_FULL)
+            used.tta++;
+        else
+            used.single++;
+
+        if (fallback)
+            return (int)TILE_BICUBIC;
+
+        // one orientation is the configured setting of an instance without tta
+        return drop_tta ? (int)TILE_SINGLE : (int)TILE_FULL;
+    };
+
+    int ret = realcugan.process(inimage, outimage, ctx);
+
+    tilestats = ctx.tilestats;
+    used.elapsed_ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+
+    return ret;
+}
@@ -0,0 +1,539 @@
+// instance registry behind the JNI functions
+
+#include "realcugan_api.h"
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+// ncnn
+#include "gpu.h"
+
+#include "filesystem_utils.h"
+#include "metrics.h"
+
+#if __ANDROID__
+#include <android/log.h>
+#define LOG_TAG "RealCUGAN_NCNN_ANDROID_NATIVE"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#else
+// the host tools call in at a rate where per call info lines would drown the output
+#define LOGI(...) ((void)0)
+#define LOGW(...) (fprintf(stderr, __VA_ARGS__), fprintf(stderr, "\n"))
+#define LOGE(...) (fprintf(stderr, __VA_ARGS__), fprintf(stderr, "\n"))
+#endif
+
+static std::atomic<bool> g_verbose(false);
+#define LOGV(...) do { if (g_verbose.load(std::memory_order_relaxed)) LOGI(__VA_ARGS__); } while (0)
+
+// std::mutex counting how often and how long callers waited for it
+class TimedMutex
+{
+public:
+    explicit TimedMutex(const char* _name) : name(_name), acquisitions(0), contended(0), wait_ns(0)
+    {
+    }
+
+    void lock()
+    {
+        acquisitions++;
+
+        if (m.try_lock())
+            return;
+
+        const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        m.lock();
+        wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+        contended++;
+    }
+
+    void unlock()
+    {
+        m.unlock();
+    }
+
+    RealCUGANLockStats stats() const
+    {
+        RealCUGANLockStats s;
+        s.name = name;
+        s.acquisitions = acquisitions;
+        s.contended = contended;
+        s.wait_ms = wait_ns / 1e6;
+        return s;
+    }
+
+    void reset()
+    {
+        acquisitions = 0;
+        contended = 0;
+        wait_ns = 0;
+    }
+
+private:
+    std::mutex m;
+    const char* name;
+    std::atomic<uint64_t> acquisitions;
+    std::atomic<uint64_t> contended;
+    std::atomic<uint64_t> wait_ns;
+};
+
+struct CUGANParams
+{
+    int noise;
+    int scale;
+    int syncgap;
+    bool tta_mode;
+    float tta_threshold;
+    bool tta_batch;
+    int gpuid;
+    int cpu_precision;
+    std::string model_dir;
+
+    bool operator==(const CUGANParams& o) const
+    {
+        return noise == o.noise && scale == o.scale && syncgap == o.syncgap && tta_mode == o.tta_mode && tta_threshold == o.tta_threshold && tta_batch == o.tta_batch && gpuid == o.gpuid && cpu_precision == o.cpu_precision && model_dir == o.model_dir;
+    }
+};
+
+struct CUGANParamsHash
+{
+    size_t operator()(const CUGANParams& p) const
+    {
+        size_t h = std::hash<int>()(p.noise);
+        mix(h, std::hash<int>()(p.scale));
+        mix(h, std::hash<int>()(p.syncgap));
+        mix(h, std::hash<bool>()(p.tta_mode));
+        mix(h, std::hash<float>()(p.tta_threshold));
+        mix(h, std::hash<bool>()(p.tta_batch));
+        mix(h, std::hash<int>()(p.gpuid));
+        mix(h, std::hash<int>()(p.cpu_precision));
+        mix(h, std::hash<std::string>()(p.model_dir));
+        return h;
+    }
+
+    static void mix(size_t& h, size_t v)
+    {
+        h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    }
+};
+
+struct CUGANEntry
+{
+    int64_t handle;
+    std::shared_ptr<RealCUGAN> inst;
+};
+
+// the gpu instance is created once and destroyed with the last cpu or gpu instance
+static TimedMutex gpu_mutex("gpu");
+static bool gpu_initialized = false;
+
+static TimedMutex g_cache_mutex("cache");
+static std::unordered_map<CUGANParams, CUGANEntry, CUGANParamsHash> g_cache;
+
+// released instances still held by calls in flight, the gpu instance waits for them
+static int g_draining = 0;
+
+static TimedMutex handler_mutex("handle");
+static int64_t next_handle = 1;
+
+static void ensure_ncnn_gpu()
+{
+    std::lock_guard<TimedMutex> lg(gpu_mutex);
+    if (!gpu_initialized)
+    {
+        ncnn::create_gpu_instance();
+        gpu_initialized = true;
+    }
+}
+
+// never called with g_cache_mutex held, the lock order is gpu then cache
+static void release_ncnn_gpu()
+{
+    std::lock_guard<TimedMutex> lg(gpu_mutex);
+    std::lock_guard<TimedMutex> lg2(g_cache_mutex);
+    if (g_cache.empty() && g_draining == 0 && gpu_initialized)
+    {
+        ncnn::destroy_gpu_instance();
+        gpu_initialized = false;
+    }
+}
+
+// tile size from the vulkan heap budget of the device
+static int gpu_tilesize(int gpuid, int scale)
+{
+    ncnn::VulkanDevice* vkdev = ncnn::get_gpu_device(gpuid);
+    const ncnn::GpuInfo& props = vkdev->info;
+
+    int tilesize = 200;
+    uint32_t heap;
+
+    // qualcomm is vendor 0x5143 or an Adreno device name
+    const bool qualcomm = props.vendor_id() == 0x5143 || std::string(props.device_name()).find("Adreno") != std::string::npos;
+    if (qualcomm)
+    {
+        float heap_mb = 0.f;
+        if (props.support_VK_EXT_memory_priority() && props.support_VK_EXT_memory_budget())
+        {
+            // the real budget from the extension
+            VkPhysicalDeviceMemoryProperties2 mem2 = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2};
+            VkPhysicalDeviceMemoryBudgetPropertiesEXT bud = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT};
+            mem2.pNext = &bud;
+            ncnn::vkGetPhysicalDeviceMemoryProperties(props.physical_device(), &mem2.memoryProperties);
+            heap_mb = bud.heapBudget[0] / float(1024 * 1024);
+        }
+        else
+        {
+            // 80% of the device local heap otherwise
+            VkPhysicalDeviceMemoryProperties mp = {};
+            ncnn::vkGetPhysicalDeviceMemoryProperties(props.physical_device(), &mp);
+            for (uint32_t i = 0; i < mp.memoryHeapCount; i++)
+            {
+                if (mp.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+                {
+                    heap_mb = (mp.memoryHeaps[i].size * 0.8f) / float(1024 * 1024 * 8);
+                    break;
+                }
+            }
+        }
+        heap = heap_mb;
+        tilesize = (int)(heap / scale);
+    }
+    else
+    {
+        heap = vkdev->get_heap_budget();
+        if (scale == 2)
+        {
+            if (heap > 1300) tilesize = 400;
+            else if (heap > 800) tilesize = 300;
+            else if (heap > 400) tilesize = 200;
+            else if (heap > 200) tilesize = 100;
+            else tilesize = 32;
+        }
+        else if (scale == 3)
+        {
+            if (heap > 3300) tilesize = 400;
+            else if (heap > 1900) tilesize = 300;
+            else if (heap > 950) tilesize = 200;
+            else if (heap > 320) tilesize = 100;
+            else tilesize = 32;
+        }
+        else
+        {
+            if (heap > 1690) tilesize = 400;
+            else if (heap > 980) tilesize = 300;
+            else if (heap > 530) tilesize = 200;
+            else if (heap > 240) tilesize = 100;
+            else tilesize = 32;
+        }
+    }
+    LOGI("heap=%u", heap);
+
+    return tilesize;
+}
+
+// deleter of the registry entries, runs on whichever thread drops the last reference
+static void destroy_instance(RealCUGAN* inst)
+{
+    Metrics* metrics = inst->metrics;
+
+    delete inst;
+
+    if (metrics)
+        metrics->gauge_add(METRIC_INSTANCES, -1);
+
+    {
+        std::lock_guard<TimedMutex> lk(g_cache_mutex);
+        g_draining--;
+    }
+
+    // takes g_cache_mutex itself
+    release_ncnn_gpu();
+}
+
+int64_t realcugan_initialize(const std::string& model_root, const RealCUGANConfig& config)
+{
+    {
+        std::lock_guard<TimedMutex> lk(g_cache_mutex);
+        if (!g_cache.empty())
+            LOGW("initialize: more than one RealCUGAN instance loaded, too many models can grow the heap into an OOM");
+    }
+
+    int syncgap = config.syncgap;
+    const int scale = config.scale;
+    const int noise = config.noise;
+    const std::string& model_dir = config.model_dir;
+
+    ensure_ncnn_gpu();
+
+    int gpuid = config.gpuid;
+    if (gpuid < -1)
+    {
+        gpuid = ncnn::get_default_gpu_index();
+    }
+    else if (gpuid >= ncnn::get_gpu_count())
+    {
+        LOGE("invalid gpu device id %d", gpuid);
+        return -1;
+    }
+    if (gpuid == -1)
+        release_ncnn_gpu();
+    LOGV("initialize: using GPU %d", gpuid);
+
+    if (config.cpu_precision < 0 || config.cpu_precision >= REALCUGAN_PRECISION_COUNT)
+    {
+        LOGE("initialize: invalid cpu precision %d", config.cpu_precision);
+        release_ncnn_gpu();
+        return -1;
+    }
+
+    // the gpu always stores fp16, the cpu precision does not make a different instance there
+    const int cpu_precision = gpuid == -1 ? config.cpu_precision : REALCUGAN_PRECISION_FP32;
+
+    const CUGANParams key = {noise, scale, syncgap, config.tta_mode, config.tta_mode ? config.tta_threshold : 0.f, config.tta_mode && config.tta_batch, gpuid, cpu_precision, model_dir};
+    {
+        std::lock_guard<TimedMutex> lk(g_cache_mutex);
+        auto it = g_cache.find(key);
+        if (it != g_cache.end())
+        {
+            if (config.metrics)
+                config.metrics->add(METRIC_INSTANCE_HITS);
+            return it->second.handle;
+        }
+    }
+
+    if (syncgap < 0 || syncgap > 3)
+    {
+        LOGE("initialize: invalid syncgap %d", syncgap);
+        release_ncnn_gpu();
+        return -1;
+    }
+
+    // <dir>-int8 holds the models of <dir> quantized by realcugan-quantize, cpu only
+    const bool int8 = model_dir.size() > 5 && model_dir.compare(model_dir.size() - 5, 5, "-int8") == 0;
+    const std::string base_dir = int8 ? model_dir.substr(0, model_dir.size() - 5) : model_dir;
+    if (int8 && gpuid != -1)
+    {
+        LOGE("initialize: int8 models only run on the cpu, use gpuid -1");
+        release_ncnn_gpu();
+        return -1;
+    }
+
+    // models-nose has no se blocks
+    if (base_dir == "models-nose")
+        syncgap = 0;
+
+    if (base_dir == "models-nose")
+    {
+        // only up2x-no-denoise
+        if (scale != 2 || noise != 0)
+        {
+            LOGE("initialize: models-nose only supports scale=2, noise=0");
+            release_ncnn_gpu();
+            return -1;
+        }
+    }
+    else if (base_dir == "models-pro")
+    {
+        // up{2,3}x-{conservative,no-denoise,denoise3x}
+        if (!(scale == 2 || scale == 3) || !(noise == -1 || noise == 0 || noise == 3))
+        {
+            LOGE("initialize: models-pro supports scale=2..3, noise in {-1,0,3}");
+            release_ncnn_gpu();
+            return -1;
+        }
+    }
+    else if (base_dir == "models-se")
+    {
+        // up{2,3,4}x-{conservative,no-denoise,denoise1x..3x}
+        if (scale < 2 || scale > 4 || noise < -1 || noise > 3)
+        {
+            LOGE("initialize: models-se supports scale=2..4, noise in -1..3");
+            release_ncnn_gpu();
+            return -1;
+        }
+    }
+    else
+    {
+        LOGE("initialize: unknown model dir '%s'", model_dir.c_str());
+        release_ncnn_gpu();
+        return -1;
+    }
+
+    const int prepadding = scale == 2 ? 18 : scale == 3 ? 14 : 19;
+    const int tilesize = gpuid == -1 ? 200 : gpu_tilesize(gpuid, scale);
+
+    char modelname[128];
+    if (noise == -1)
+        sprintf(modelname, "%s/up%dx-conservative", model_dir.c_str(), scale);
+    else if (noise == 0)
+        sprintf(modelname, "%s/up%dx-no-denoise", model_dir.c_str(), scale);
+    else
+        sprintf(modelname, "%s/up%dx-denoise%dx", model_dir.c_str(), scale, noise);
+
+    const std::string parampath = model_root + "/" + modelname + ".param";
+    const std::string modelpath = model_root + "/" + modelname + ".bin";
+
+    path_t paramfull = sanitize_filepath(parampath);
+    path_t modelfull = sanitize_filepath(modelpath);
+    if (access(paramfull.c_str(), F_OK) || access(modelfull.c_str(), F_OK))
+    {
+        LOGE("model file not found: %s / %s", paramfull.c_str(), modelfull.c_str());
+        release_ncnn_gpu();
+        return -1;
+    }
+
+    RealCUGAN* inst = new RealCUGAN(gpuid, config.tta_mode, 1);
+    inst->noise = noise;
+    inst->scale = scale;
+    inst->syncgap = syncgap;
+    inst->prepadding = prepadding;
+    inst->tilesize = tilesize;
+    inst->tile_cache = config.tile_cache;
+    inst->trace = config.trace;
+    inst->memory_tracker = config.memory_tracker;
+    inst->metrics = config.metrics;
+    inst->model_name = modelname;
+    inst->tta_threshold = config.tta_mode ? config.tta_threshold : 0.f;
+    inst->tta_batch = config.tta_mode && config.tta_batch;
+    inst->cpu_precision = cpu_precision;
+
+    try
+    {
+        int ret = inst->load(paramfull, modelfull);
+        if (ret != 0)
+        {
+            LOGE("initialize: RealCUGAN::load failed (%d)", ret);
+            delete inst;
+            release_ncnn_gpu();
+            return ret < 0 ? ret : -1;
+        }
+    }
+    catch (...)
+    {
+        delete inst;
+        release_ncnn_gpu();
+        throw;
+    }
+
+    if (inst->precision_used != cpu_precision)
+        LOGW("initialize: %s off fp32 by %.2f dB on %s, using fp32", realcugan_precision_name(cpu_precision), inst->precision_psnr, modelname);
+
+    const int64_t handle = realcugan_next_handle();
+
+    // a concurrent caller may have loaded the same config meanwhile, keep the first one
+    RealCUGAN* loser = 0;
+    int64_t winner = handle;
+    {
+        std::lock_guard<TimedMutex> lk(g_cache_mutex);
+        auto it = g_cache.find(key);
+        if (it != g_cache.end())
+        {
+            loser = inst;
+            winner = it->second.handle;
+        }
+        else
+        {
+            CUGANEntry entry = {handle, std::shared_ptr<RealCUGAN>(inst, destroy_instance)};
+            g_cache[key] = entry;
+        }
+    }
+
+    if (!loser && config.metrics)
+        config.metrics->gauge_add(METRIC_INSTANCES, 1);
+
+    delete loser;
+
+    return winner;
+}
+
+std::shared_ptr<RealCUGAN> realcugan_find(int64_t handle)
+{
+    std::lock_guard<TimedMutex> lk(g_cache_mutex);
+    for (auto it = g_cache.begin(); it != g_cache.end(); ++it)
+    {
+        if (it->second.handle == handle)
+        {
+            LOGV("found realcugan: handle=%lld inst=%p model=%s", (long long)handle, it->second.inst.get(), it->first.model_dir.c_str());
+            return it->second.inst;
+        }
+    }
+
+    return std::shared_ptr<RealCUGAN>();
+}
+
+void realcugan_release(int64_t handle)
+{
+    // the last reference may be this one, it must not drop under g_cache_mutex as the deleter takes it
+    std::shared_ptr<RealCUGAN> inst;
+    {
+        std::lock_guard<TimedMutex> lk(g_cache_mutex);
+        for (auto it = g_cache.begin(); it != g_cache.end(); ++it)
+        {
+            if (it->second.handle == handle)
+            {
+                inst.swap(it->second.inst);
+                g_cache.erase(it);
+                g_draining++;
+                break;
+            }
+        }
+    }
+}
+
+int realcugan_instance_count()
+{
+    std::lock_guard<TimedMutex> lk(g_cache_mutex);
+    return (int)g_cache.size();
+}
+
+int64_t realcugan_next_handle()
+{
+    std::lock_guard<TimedMutex> lg(handler_mutex);
+    return next_handle++;
+}
+
+int realcugan_process(const RealCUGAN* inst, const ncnn::Mat& inimage, ncnn::Mat& outimage, ncnn::Allocator* output_allocator, RealCUGANStageStats* stagestats, const RealCUGANCancel* cancel)
+{
+    outimage.create(inimage.w * inst->scale, inimage.h * inst->scale, inimage.elemsize, inimage.elempack, output_allocator);
+    if (outimage.empty())
+    {
+        if (inst->metrics)
+            inst->metrics->add(METRIC_OOM);
+        return -100;
+    }
+
+    if (stagestats)
+        return inst->process(inimage, outimage, *stagestats, cancel);
+
+    return cancel ? inst->process(inimage, outimage, *cancel) : inst->process(inimage, outimage);
+}
+
+void realcugan_set_verbose_logging(bool enabled)
+{
+    g_verbose.store(enabled);
+}
+
+bool realcugan_verbose_logging()
+{
+    return g_verbose.load(std::memory_order_relaxed);
+}
+
+void realcugan_lock_stats(std::vector<RealCUGANLockStats>& stats)
+{
+    stats.clear();
+    stats.push_back(gpu_mutex.stats());
+    stats.push_back(g_cache_mutex.stats());
+    stats.push_back(handler_mutex.stats());
+}
+
+void realcugan_reset_lock_stats()
+{
+    gpu_mutex.reset();
+    g_cache_mutex.reset();
+    handler_mutex.reset();
+}
@@ -1,122 +1,89 @@
 #include <jni.h>
 #include <string>
 #include <sstream>
+#include <memory>
 #include <android/log.h>
 #include <android/bitmap.h>
 #include "realcugan.h"
+#include "realcugan_api.h"
 #include "filesystem_utils.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 
 #include "stb_image.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+
 #include "stb_image_write.h"
 #include "webp_image.h"
+#include "mapped_image.h"
+#include "tile_cache.h"
+#include "batch_pipeline.h"
+#include "trace.h"
+#include "memory_tracker.h"
+#include "metrics.h"
 
 #define LOG_TAG "RealCUGAN_NCNN_ANDROID_NATIVE"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO,  LOG_TAG, __VA_ARGS__)
 #define LOGW(...) __android_log_print(ANDROID_LOG_WARN,  LOG_TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+// 每个请求都会打的日志，默认关闭，关闭时连格式化都不做，由 setVerboseLogging 打开
+#define LOGV(...) do { if (realcugan_verbose_logging()) LOGI(__VA_ARGS__); } while (0)
 
-struct CUGANParams {
-    int noise;
-    int scale;
-    int syncgap;
-    bool ttaMode;
-    int gpuId;
-    std::string modelDir;
-
-    bool operator==(const CUGANParams &o) const noexcept {
-        return noise == o.noise
-               && scale == o.scale
-               && syncgap == o.syncgap
-               && ttaMode == o.ttaMode
-               && gpuId == o.gpuId
-               && modelDir == o.modelDir;
-    }
-
-    std::string toString() const {
-        std::ostringstream oss;
-        oss << "CUGANParams{"
-            << "noise=" << noise << ", "
-            << "scale=" << scale << ", "
-            << "syncgap=" << syncgap << ", "
-            << "ttaMode=" << (ttaMode ? "true" : "false") << ", "
-            << "gpuId=" << gpuId << ", "
-            << "modelDir=\"" << modelDir << "\""
-            << "}";
-        return oss.str();
-    }
-};
-
-namespace std {
-    template<>
-    struct hash<CUGANParams> {
-        size_t operator()(CUGANParams const &p) const noexcept {
-            size_t h = std::hash<int>()(p.noise);
-            auto mix = [&](auto v) {
-                h ^= std::hash<decltype(v)>()(v)
-                     + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
-            };
-            mix(p.scale);
-            mix(p.syncgap);
-            mix(p.ttaMode);
-            mix(p.gpuId);
-            mix(p.modelDir);
-            return h;
-        }
-    };
-}
+// 所有实例共用的输出分块缓存，默认关闭
+static TileCache g_tile_cache;
 
-struct CUGANEntry {
-    jlong handle;
-    RealCUGAN *inst;
-};
+// 所有实例共用的执行时间线（环形缓冲），默认关闭
+static TraceBuffer g_trace;
 
-// ncnn初始化锁
-static std::mutex gpu_mutex;
-static bool gpu_initialized = false;
+// 所有实例共用的内存统计：每次 process 在自己的统计上计数（含输出图像），结束时整体写入这里，
+// 因此这里始终是最近完成的那一次调用，并发调用的数字不会混在一起
+static MemoryTracker g_memory;
 
-// realcugan序列锁
-static std::mutex g_cache_mutex;
-static std::unordered_map<CUGANParams, CUGANEntry> g_cache;
+// 所有实例共用的计数器、实例数和按模型/模式分的耗时直方图，常开，由 metricsJson() 导出
+static Metrics g_metrics;
 
-// handler
-static std::mutex handler_mutex;
-static jlong next_handle = 1;
+// 增量会话：同一张图反复编辑时只重算变化的分块
+struct SessionEntry {
+    jlong owner;
+    // 会话引用着实例，持有它直到会话删除，release 之后才建的会话也不会悬空
+    std::shared_ptr<RealCUGAN> inst;
+    RealCUGANSession *session = nullptr;
+    std::mutex lock;
 
-// 确保ncnn gpu只初始化一次
-void ensure_ncnn_gpu() {
-    std::lock_guard<std::mutex> lg(gpu_mutex);
-    if (!gpu_initialized) {
-        ncnn::create_gpu_instance();
-        gpu_initialized = true;
+    ~SessionEntry() {
+        delete session;
     }
-}
+};
+static std::mutex g_session_mutex;
+static std::unordered_map<jlong, std::shared_ptr<SessionEntry>> g_sessions;
 
-// 如果空了，就销毁 GPU 并允许下次 re-init
-void release_ncnn_gpu() {
-    std::lock_guard<std::mutex> lg(gpu_mutex);
-    std::lock_guard<std::mutex> lg2(g_cache_mutex);
-    if (g_cache.empty() && gpu_initialized) {
-        ncnn::destroy_gpu_instance();
-        gpu_initialized = false;
-    }
-}
+// 限时处理：每个实例一份，记住各档位的分块耗时供之后的调用预测
+struct BudgetEntry {
+    std::shared_ptr<RealCUGAN> inst;
+    RealCUGANBudget *budget = nullptr;
+    std::mutex lock;
 
-RealCUGAN *find_realcugan(jlong handle) {
-    RealCUGAN *inst = nullptr;
-    {
-        std::lock_guard<std::mutex> lk(g_cache_mutex);
-        for (auto &kv: g_cache) {
-            if (kv.second.handle == handle) {
-                LOGI("found realcugan: handle=%lld inst=%p options=%s", handle, inst,
-                     kv.first.toString().c_str());
-                inst = kv.second.inst;
-                break;
-            }
-        }
+    ~BudgetEntry() {
+        delete budget;
     }
-    return inst;
+};
+static std::mutex g_budget_mutex;
+static std::unordered_map<jlong, std::shared_ptr<BudgetEntry>> g_budgets;
+
+// 代价模型的标定结果由 calibrate() 写入实例，与 estimate() 的读取互斥
+static std::mutex g_calibrate_mutex;
+
+// 取消令牌：Kotlin 协程取消时置位，native 的分块循环每个分块前检查一次
+static std::mutex g_cancel_mutex;
+static std::unordered_map<jlong, std::shared_ptr<RealCUGANCancel>> g_cancels;
+
+// 0 表示不可取消
+static std::shared_ptr<RealCUGANCancel> find_cancel(jlong cancelHandle) {
+    if (cancelHandle == 0) return nullptr;
+    std::lock_guard<std::mutex> lk(g_cancel_mutex);
+    auto it = g_cancels.find(cancelHandle);
+    return it == g_cancels.end() ? nullptr : it->second;
 }
 
 extern "C" JNIEXPORT jlong JNICALL
@@ -128,239 +95,127 @@ Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeInitialize(
         jobject syncgapObj,
         jstring modelNameJ,
         jobject ttaModeObj,
-        jobject gpuidObj
+        jfloat ttaThreshold,
+        jboolean ttaBatch,
+        jobject gpuidObj,
+        jint cpuPrecision
 ) {
-    if (!g_cache.empty()) {
-        LOGW("nativeInitialize: You have loaded more than one RealCUGAN instance. Too many RealCUGAN model being loaded can cause the heap to grow too large, leading to OOM.");
-    }
     // 1. 异常类
     jclass runtimeExc = env->FindClass("java/lang/RuntimeException");
     if (!runtimeExc) return -1;
 
-    // 2. 拆箱 Integer/Boolean
+    // 2. 拆箱 Integer/Boolean，gpuId 为空时用默认 GPU
     jclass integerCls = env->FindClass("java/lang/Integer");
     jmethodID intValueID = env->GetMethodID(integerCls, "intValue", "()I");
     jclass booleanCls = env->FindClass("java/lang/Boolean");
     jmethodID boolValueID = env->GetMethodID(booleanCls, "booleanValue", "()Z");
 
-    int noise = noiseObj ? env->CallIntMethod(noiseObj, intValueID) : -1;
-    int scale = scaleObj ? env->CallIntMethod(scaleObj, intValueID) : 2;
-    int syncgap = syncgapObj ? env->CallIntMethod(syncgapObj, intValueID) : 3;
-    bool ttaMode = ttaModeObj && env->CallBooleanMethod(ttaModeObj, boolValueID);
-    int numThreads = 1;
-    std::string modelDir;
+    RealCUGANConfig config;
+    config.noise = noiseObj ? env->CallIntMethod(noiseObj, intValueID) : -1;
+    config.scale = scaleObj ? env->CallIntMethod(scaleObj, intValueID) : 2;
+    config.syncgap = syncgapObj ? env->CallIntMethod(syncgapObj, intValueID) : 3;
+    config.tta_mode = ttaModeObj && env->CallBooleanMethod(ttaModeObj, boolValueID);
+    config.tta_threshold = ttaThreshold;
+    config.tta_batch = ttaBatch;
+    config.gpuid = gpuidObj ? env->CallIntMethod(gpuidObj, intValueID) : -2;
+    config.cpu_precision = cpuPrecision;
     if (modelNameJ) {
         const char *tmp = env->GetStringUTFChars(modelNameJ, nullptr);
-        if (tmp && *tmp) modelDir = tmp;
+        if (tmp && *tmp) config.model_dir = tmp;
         env->ReleaseStringUTFChars(modelNameJ, tmp);
     }
-
-    // 3. GPU 初始化
-    int gpuId;
-    ensure_ncnn_gpu();
-    if (gpuidObj) {
-        int gpu_count = ncnn::get_gpu_count();
-        gpuId = env->CallIntMethod(gpuidObj, intValueID);
-        if (gpuId < -1 || gpuId >= gpu_count) {
-            LOGE("invalid gpu device id %d", gpuId);
-            return -1;
-        }
-    } else {
-        gpuId = ncnn::get_default_gpu_index();
+    if (config.gpuid < -1 && gpuidObj) {
+        LOGE("invalid gpu device id %d", config.gpuid);
+        return -1;
     }
-    if (gpuId == -1) release_ncnn_gpu();
-    LOGI("initialize(): using GPU %d", gpuId);
+    config.tile_cache = &g_tile_cache;
+    config.trace = &g_trace;
+    config.memory_tracker = &g_memory;
+    config.metrics = &g_metrics;
 
-    CUGANParams key{noise, scale, syncgap, ttaMode, gpuId, modelDir};
-    {
-        std::lock_guard<std::mutex> lk(g_cache_mutex);
-        auto it = g_cache.find(key);
-        if (it != g_cache.end()) {
-            return it->second.handle;
-        }
-    }
+    const char *root = env->GetStringUTFChars(modelRootDir, nullptr);
+    std::string modelRoot = root ? root : "";
+    env->ReleaseStringUTFChars(modelRootDir, root);
 
-    // 4. 基本边界检查（syncgap, gpuId 先行）
-    if (syncgap < 0 || syncgap > 3) {
-        LOGE("initialize(): invalid syncgap %d", syncgap);
-        release_ncnn_gpu();
+    // 3. 同样参数的实例共用，校验、选 tilesize、加载都在 realcugan_api.cpp
+    try {
+        return realcugan_initialize(modelRoot, config);
+    } catch (const std::exception &e) {
+        env->ThrowNew(runtimeExc, e.what());
         return -1;
     }
+}
 
-    // 5. nose 模型强制关 syncgap
-    if (modelDir == "models-nose") {
-        syncgap = 0;
-    }
 
-    // 6. 分模型校验 scale/noise
-    if (modelDir == "models-nose") {
-        // 只允许 up2x-no-denoise
-        if (scale != 2 || noise != 0) {
-            LOGE("initialize(): models-nose only supports scale=2, noise=0");
-            release_ncnn_gpu();
-            return -1;
-        }
-    } else if (modelDir == "models-pro") {
-        // 允许 up{2,3}x-{conservative,no-denoise,denoise3x}
-        bool okScale = (scale == 2 || scale == 3);
-        bool okNoise = (noise == -1 || noise == 0 || noise == 3);
-        if (!okScale || !okNoise) {
-            LOGE("initialize(): models-pro supports scale=2..3, noise in {-1,0,3}");
-            release_ncnn_gpu();
-            return -1;
-        }
-    } else if (modelDir == "models-se") {
-        // 允许 up{2,3,4}x-{conservative,no-denoise,denoise1x..3x}
-        bool okScale = (scale >= 2 && scale <= 4);
-        bool okNoise = (noise >= -1 && noise <= 3);
-        if (!okScale || !okNoise) {
-            LOGE("initialize(): models-se supports scale=2..4, noise in -1..3");
-            release_ncnn_gpu();
-            return -1;
-        }
-    } else {
-        LOGE("initialize(): unknown modelDir '%s'", modelDir.c_str());
-        release_ncnn_gpu();
-        return -1;
-    }
+// 解码内存中的 PNG/JPEG/WebP，灰度图统一扩成 3/4 通道；返回 malloc 的像素，失败返回 nullptr
+static unsigned char *decode_image_memory(const unsigned char *buffer, int length, int *w, int *h, int *c) {
+    unsigned char *pixeldata = nullptr;
 
-    // 7. 计算 prepadding
-    int prepadding = 0;
-    if (scale == 2) prepadding = 18;
-    else if (scale == 3) prepadding = 14;
-    else if (scale == 4) prepadding = 19;
+    // 1) 先尝试 WebP
+    pixeldata = webp_load(buffer, length, w, h, c);
 
-    // 8. 计算 tilesize (不变)
+    // 2) 回退到 PNG/JPEG
+    if (!pixeldata) {
+        pixeldata = stbi_load_from_memory(buffer, length, w, h, c, 0);
+        if (!pixeldata) {
+            LOGE("processImage: not webp nor png/jpeg");
+            return nullptr;
+        }
+    }
 
-    int tilesize = 200;
-    if (gpuId == -1) {
-        tilesize = 200;
-    } else {
-        ncnn::VulkanDevice *vkdev = ncnn::get_gpu_device(gpuId);
-
-        // 读取 Vulkan 物理设备属性
-        const ncnn::GpuInfo &props = vkdev->info;
-
-        uint32_t heap;
-        // Qualcomm 的 vendorID 通常是 0x5143，或者 deviceName 中包含 "Adreno"
-        bool isQualcomm = props.vendor_id() == 0x5143
-                          || std::string(props.device_name()).find("Adreno") != std::string::npos;
-        if (isQualcomm) {
-            // … 前面初始化 VulkanDevice vkdev …
-            float heapMB = 0.f;
-            if (props.support_VK_EXT_memory_priority() && props.support_VK_EXT_memory_budget()) {
-                // 使用扩展取真实预算
-                VkPhysicalDeviceMemoryProperties2 mem2{
-                        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2};
-                VkPhysicalDeviceMemoryBudgetPropertiesEXT bud{
-                        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT};
-                mem2.pNext = &bud;
-                ncnn::vkGetPhysicalDeviceMemoryProperties(props.physical_device(),
-                                                          &mem2.memoryProperties);
-                heapMB = bud.heapBudget[0] / float(1024 * 1024);
-            } else {
-                // Fallback：用总显存的 80%
-                VkPhysicalDeviceMemoryProperties mp{};
-                ncnn::vkGetPhysicalDeviceMemoryProperties(props.physical_device(), &mp);
-                for (uint32_t i = 0; i < mp.memoryHeapCount; i++) {
-                    if (mp.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
-                        heapMB = (mp.memoryHeaps[i].size * 0.8f) / float(1024 * 1024 * 8);
-                        break;
-                    }
-                }
-            }
-            heap = heapMB;
-            tilesize = (int) (heap / scale);
-        } else {
-            heap = vkdev->get_heap_budget();
-            if (scale == 2) {
-                if (heap > 1300) tilesize = 400;
-                else if (heap > 800) tilesize = 300;
-                else if (heap > 400) tilesize = 200;
-                else if (heap > 200) tilesize = 100;
-                else tilesize = 32;
-            } else if (scale == 3) {
-                if (heap > 3300) tilesize = 400;
-                else if (heap > 1900) tilesize = 300;
-                else if (heap > 950) tilesize = 200;
-                else if (heap > 320) tilesize = 100;
-                else tilesize = 32;
-            } else {
-                if (heap > 1690) tilesize = 400;
-                else if (heap > 980) tilesize = 300;
-                else if (heap > 530) tilesize = 200;
-                else if (heap > 240) tilesize = 100;
-                else tilesize = 32;
-            }
+    // —— 强制把灰度/灰度+Alpha 转成 3/4 通道 ————————————
+    if (*c == 1 || *c == 2) {
+        // free 上一次的解码结果
+        free(pixeldata);
+        // 重新走一次 stb_image，指定通道数
+        int want_chan = (*c == 1 ? 3 : 4);
+        pixeldata = stbi_load_from_memory(buffer, length, w, h, c, want_chan);
+        *c = want_chan; // 更新 c
+        if (!pixeldata) {
+            LOGE("processImage: re-stbi_load_from_memory failed");
+            return nullptr;
         }
-        LOGI("heap=%u", heap);
     }
 
+    return pixeldata;
+}
 
-    // 9. 构造 param/bin 路径 & load 模型 … (不变)
-    const char *root = env->GetStringUTFChars(modelRootDir, nullptr);
-    char parampath[256], modelpath[256];
-    if (noise == -1) {
-        sprintf(parampath, "%s/%s/up%dx-conservative.param", root, modelDir.c_str(), scale);
-        sprintf(modelpath, "%s/%s/up%dx-conservative.bin", root, modelDir.c_str(), scale);
-    } else if (noise == 0) {
-        sprintf(parampath, "%s/%s/up%dx-no-denoise.param", root, modelDir.c_str(), scale);
-        sprintf(modelpath, "%s/%s/up%dx-no-denoise.bin", root, modelDir.c_str(), scale);
-    } else {
-        sprintf(parampath, "%s/%s/up%dx-denoise%dx.param", root, modelDir.c_str(), scale, noise);
-        sprintf(modelpath, "%s/%s/up%dx-denoise%dx.bin", root, modelDir.c_str(), scale, noise);
-    }
-    env->ReleaseStringUTFChars(modelRootDir, root);
+// 解码 Java 传入的 PNG/JPEG/WebP 字节；返回 malloc 的像素，失败返回 nullptr
+static unsigned char *decode_image(JNIEnv *env, jbyteArray imageData, int *w, int *h, int *c) {
+    // 从 Java 拿到压缩后的字节，用完即释放
+    jsize length = env->GetArrayLength(imageData);
+    jbyte *buffer = env->GetByteArrayElements(imageData, nullptr);
 
-    path_t paramFull = sanitize_filepath(parampath);
-    path_t modelFull = sanitize_filepath(modelpath);
-    if (access(paramFull.c_str(), F_OK) || access(modelFull.c_str(), F_OK)) {
-        LOGE("model file not found: %s / %s", paramFull.c_str(), modelFull.c_str());
-        release_ncnn_gpu();
-        return -1;
-    }
+    unsigned char *pixeldata = decode_image_memory(reinterpret_cast<unsigned char *>(buffer), length, w, h, c);
 
-    // 10. 实例化 RealCUGAN 并 load
-    auto *inst = new RealCUGAN(gpuId, ttaMode, numThreads);
-    inst->noise = noise;
-    inst->scale = scale;
-    inst->syncgap = syncgap;
-    inst->prepadding = prepadding;
-    inst->tilesize = tilesize;
+    env->ReleaseByteArrayElements(imageData, buffer, JNI_ABORT);
 
-    try {
-        int ret = inst->load(paramFull, modelFull);
-        if (ret != 0) {
-            LOGE("initialize: RealCUGAN::load failed (%d)", ret);
-            delete inst;
-            release_ncnn_gpu();
-            return ret;
-        }
-    }
-    catch (const std::exception &e) {
-        env->ThrowNew(runtimeExc, e.what());
-        return -1;
-    }
+    return pixeldata;
+}
 
-    // 11. 注册实例并返回 handle
-    jlong handle;
-    {
-        std::lock_guard<std::mutex> lg(handler_mutex);
-        handle = next_handle++;
-    }
-    {
-        std::lock_guard<std::mutex> lk2(g_cache_mutex);
-        g_cache[key] = CUGANEntry{handle, inst};
+// 按扩展名编码写盘：.webp / .jpg / .jpeg，其余一律 PNG；成功返回 0
+static int encode_image(const std::string &path, int w, int h, int c, const unsigned char *pixeldata) {
+    std::string ext = path.substr(path.find_last_of('.') + 1);
+    for (char &ch: ext) ch = (char) tolower(ch);
+
+    int ok;
+    if (ext == "webp") {
+        ok = webp_save(path.c_str(), w, h, c, pixeldata);
+    } else if (ext == "jpg" || ext == "jpeg") {
+        ok = stbi_write_jpg(path.c_str(), w, h, c, pixeldata, 95);
+    } else {
+        ok = stbi_write_png(path.c_str(), w, h, c, pixeldata, 0);
     }
-    return handle;
+    return ok ? 0 : -1;
 }
 
-
 extern "C" JNIEXPORT jbyteArray JNICALL
 Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeProcessImage(
         JNIEnv *env, jclass /*clazz*/,
         jlong handle,
-        jbyteArray imageData) {
+        jbyteArray imageData,
+        jlong cancelHandle,
+        jdoubleArray stats) {
     // —— 1) 找到对应的 RealCUGAN 实例 —————————————
     // 1) Find the right instance under lock
     // 先声明要抛出的异常类
@@ -368,110 +223,731 @@ Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeProcessImage(
     if (!runtimeExc) {
         return nullptr; // 如果连 RuntimeException 都找不到，直接回
     }
-    RealCUGAN *inst = find_realcugan(handle);
+    std::shared_ptr<RealCUGAN> inst = realcugan_find(handle);
     if (!inst) {
         LOGE("processImage: instance of handle %lld not found", handle);
         return nullptr;
     }
-    LOGI("processImage realcugan instance: handle = %lld noise=%d scale=%d syncgap=%d prepadding=%d tilesize=%d",
+    LOGV("processImage realcugan instance: handle = %lld noise=%d scale=%d syncgap=%d prepadding=%d tilesize=%d",
          handle, inst->noise, inst->scale, inst->syncgap, inst->prepadding, inst->tilesize);
 
-    // 1) 从 Java 拿到压缩后的字节
-    jsize length = env->GetArrayLength(imageData);
-    jbyte *buffer = env->GetByteArrayElements(imageData, nullptr);
+    // stats 非空时统计各阶段耗时，GPU 每个阶段单独提交等待，会比不统计时慢
+    RealCUGANStageStats stagestats = {};
+    int64_t t_start = TraceBuffer::now_ns();
 
+    // 2) 解码
     int w = 0, h = 0, c = 0;
-    unsigned char *pixeldata = nullptr;
-
-    // 2) 先尝试 WebP
-    pixeldata = webp_load(reinterpret_cast<unsigned char *>(buffer), length, &w, &h, &c);
-
-    // 3) 回退到 PNG/JPEG
+    unsigned char *pixeldata = decode_image(env, imageData, &w, &h, &c);
     if (!pixeldata) {
-        pixeldata = stbi_load_from_memory(
-                reinterpret_cast<unsigned char *>(buffer),
-                length, &w, &h, &c, 0
-        );
-        if (!pixeldata) {
-            LOGE("processImage: not webp nor png/jpeg");
-            env->ReleaseByteArrayElements(imageData, buffer, JNI_ABORT);
-            return nullptr;
-        }
+        return nullptr;
     }
+    int64_t t_decoded = TraceBuffer::now_ns();
+    g_trace.record("decode", t_start, t_decoded);
 
-    // —— 强制把灰度/灰度+Alpha 转成 3/4 通道 ————————————
-    if (c == 1 || c == 2) {
-        // free 上一次的解码结果
+    int scale = inst->scale;
+
+    // 3) Java byte[] 最大 2^31-1，超出的输出只能走 nativeProcessImageToFile
+    size_t outBytes = (size_t) w * scale * h * scale * c;
+    if (outBytes > (size_t) INT32_MAX) {
         free(pixeldata);
-        // 重新走一次 stb_image，指定通道数
-        int want_chan = (c == 1 ? 3 : 4);
-        pixeldata = stbi_load_from_memory(
-                reinterpret_cast<unsigned char *>(buffer),
-                length, &w, &h, &c, want_chan
-        );
-        c = want_chan; // 更新 c
-        if (!pixeldata) {
-            LOGE("processImage: re-stbi_load_from_memory failed");
-            env->ReleaseByteArrayElements(imageData, buffer, JNI_ABORT);
-            return nullptr;
-        }
+        env->ThrowNew(runtimeExc, "output exceeds 2 GiB, use processToFile instead");
+        return nullptr;
     }
 
-    // 4) 现在可以释放 Java 的 byte[]
-    env->ReleaseByteArrayElements(imageData, buffer, JNI_ABORT);
-
-    // 5) 构造输入 Mat
+    // 4) 构造输入 Mat
     ncnn::Mat in_mat(w, h, (void *) pixeldata, (size_t) c, c);
 
-    int scale = inst->scale;
-    // 6) 构造输出 Mat
-    ncnn::Mat out_mat(w * scale, h * scale, (size_t) in_mat.elemsize, (int) in_mat.elemsize);
-
-    // 7) 运行模型
+    // 5) 分配输出 Mat 并运行模型
+    ncnn::Mat out_mat;
+    std::shared_ptr<RealCUGANCancel> cancel = find_cancel(cancelHandle);
     try {
-        LOGI("processImage: processing");
-        if (inst->process(in_mat, out_mat) != 0) {
+        LOGV("processImage: processing");
+        int ret = realcugan_process(inst.get(), in_mat, out_mat, nullptr, stats ? &stagestats : nullptr, cancel.get());
+        if (ret == -100) {
+            free(pixeldata);
+            env->ThrowNew(runtimeExc, "out of memory allocating output image");
+            return nullptr;
+        }
+        if (ret == REALCUGAN_CANCELLED) {
+            LOGV("processImage: cancelled");
+            free(pixeldata);
+            return nullptr;
+        }
+        if (ret != 0) {
             LOGE("processImage: model process failed");
-            free(in_mat);
-            free(out_mat);
+            free(pixeldata);
             return nullptr;
         }
         free(pixeldata);
-        LOGI("processImage: process ends");
+        LOGV("processImage: process ends");
     } catch (const std::exception &e) {
         // C++ 异常
+        free(pixeldata);
         env->ThrowNew(runtimeExc, e.what());
         return nullptr;
     } catch (...) {
         // 任何其他崩溃
+        free(pixeldata);
         env->ThrowNew(runtimeExc, "Unknown native error in RealCUGAN");
         return nullptr;
     }
 
-    // 8) 打包成 Java byte[]
+    // 7) 打包成 Java byte[]
     int out_w = out_mat.w;
     int out_h = out_mat.h;
     int out_c = out_mat.elempack;
-    jsize outLen = out_w * out_h * out_c;
+    jsize outLen = (jsize) outBytes;
+
+    int64_t t_copyout = TraceBuffer::now_ns();
 
     jbyteArray outArray = env->NewByteArray(outLen);
     env->SetByteArrayRegion(outArray, 0, outLen, reinterpret_cast<jbyte *>(out_mat.data));
 
-    LOGI("processImage: complete. output size: %d x %d elempack: %d", out_w, out_h, out_c);
+    int64_t t_end = TraceBuffer::now_ns();
+    g_trace.record("copyout", t_copyout, t_end);
+
+    LOGV("processImage: complete. output size: %d x %d elempack: %d", out_w, out_h, out_c);
+
+    // 依次填入解码、像素转换、上传、预处理、推理、alpha、后处理、下载、SE 同步、拷回、总耗时（毫秒），
+    // 推理次数、上传字节、下载字节、分块总数、实际推理的分块数
+    if (stats && env->GetArrayLength(stats) >= 16) {
+        stagestats.decode_ms = (t_decoded - t_start) / 1e6;
+        stagestats.copyout_ms = (t_end - t_copyout) / 1e6;
+        stagestats.total_ms = (t_end - t_start) / 1e6;
+
+        jdouble values[16] = {
+                stagestats.decode_ms,
+                stagestats.pixel_ms,
+                stagestats.upload_ms,
+                stagestats.preproc_ms,
+                stagestats.net_ms,
+                stagestats.alpha_ms,
+                stagestats.postproc_ms,
+                stagestats.download_ms,
+                stagestats.se_sync_ms,
+                stagestats.copyout_ms,
+                stagestats.total_ms,
+                (jdouble) stagestats.inferences,
+                (jdouble) stagestats.upload_bytes,
+                (jdouble) stagestats.download_bytes,
+                (jdouble) stagestats.tilestats.total,
+                (jdouble) stagestats.tilestats.computed};
+        env->SetDoubleArrayRegion(stats, 0, 16, values);
+    }
+
+    return outArray;
+}
+
+// 限时处理：在 budgetMs 内选能完成的最高档（TTA、syncgap 1/2/3），跑慢了剩下的分块降档，最后退到双三次
+// report 依次填入 syncgap、TTA 分块数、单方向分块数、双三次分块数、预测耗时、实际耗时
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeProcessImageWithin(
+        JNIEnv *env, jclass /*clazz*/,
+        jlong handle,
+        jbyteArray imageData,
+        jdouble budgetMs,
+        jlong cancelHandle,
+        jdoubleArray report) {
+    jclass runtimeExc = env->FindClass("java/lang/RuntimeException");
+    if (!runtimeExc) {
+        return nullptr;
+    }
+    std::shared_ptr<RealCUGAN> inst = realcugan_find(handle);
+    if (!inst) {
+        LOGE("processImageWithin: instance of handle %lld not found", handle);
+        return nullptr;
+    }
+
+    std::shared_ptr<BudgetEntry> entry;
+    {
+        std::lock_guard<std::mutex> lk(g_budget_mutex);
+        std::shared_ptr<BudgetEntry> &slot = g_budgets[handle];
+        if (!slot) {
+            slot = std::make_shared<BudgetEntry>();
+            slot->inst = inst;
+            slot->budget = new RealCUGANBudget(*inst);
+        }
+        entry = slot;
+    }
+
+    // 1) 解码
+    int w = 0, h = 0, c = 0;
+    unsigned char *pixeldata = decode_image(env, imageData, &w, &h, &c);
+    if (!pixeldata) {
+        return nullptr;
+    }
 
+    int scale = inst->scale;
+    size_t outBytes = (size_t) w * scale * h * scale * c;
+    if (outBytes > (size_t) INT32_MAX) {
+        free(pixeldata);
+        env->ThrowNew(runtimeExc, "output exceeds 2 GiB, use processToFile instead");
+        return nullptr;
+    }
+
+    ncnn::Mat in_mat(w, h, (void *) pixeldata, (size_t) c, c);
+    ncnn::Mat out_mat(w * scale, h * scale, (size_t) c, c);
+    if (out_mat.empty()) {
+        g_metrics.add(METRIC_OOM);
+        free(pixeldata);
+        env->ThrowNew(runtimeExc, "out of memory allocating output image");
+        return nullptr;
+    }
+
+    // 2) 同一实例的限时调用串行，耗时统计不被并发的调用打乱
+    std::shared_ptr<RealCUGANCancel> cancel = find_cancel(cancelHandle);
+    std::lock_guard<std::mutex> lg(entry->lock);
+    RealCUGANBudget *budget = entry->budget;
+    if (!budget) {
+        free(pixeldata);
+        LOGE("processImageWithin: instance of handle %lld released", handle);
+        return nullptr;
+    }
+    int ret;
+    try {
+        budget->cancel = cancel.get();
+        ret = budget->process(in_mat, out_mat, budgetMs);
+        budget->cancel = nullptr;
+    } catch (const std::exception &e) {
+        budget->cancel = nullptr;
+        free(pixeldata);
+        env->ThrowNew(runtimeExc, e.what());
+        return nullptr;
+    }
+    free(pixeldata);
+    if (ret != 0) {
+        if (ret == REALCUGAN_CANCELLED) LOGV("processImageWithin: cancelled");
+        else LOGE("processImageWithin: model process failed (%d)", ret);
+        return nullptr;
+    }
+
+    const RealCUGANQuality &used = budget->used;
+    LOGV("processImageWithin: budget %.0f ms, syncgap=%d tta=%d single=%d bicubic=%d, predicted %.0f ms took %.0f ms",
+         budgetMs, used.syncgap, used.tta, used.single, used.bicubic, used.predicted_ms, used.elapsed_ms);
+
+    if (report && env->GetArrayLength(report) >= 6) {
+        jdouble values[6] = {(jdouble) used.syncgap, (jdouble) used.tta, (jdouble) used.single,
+                             (jdouble) used.bicubic, used.predicted_ms, used.elapsed_ms};
+        env->SetDoubleArrayRegion(report, 0, 6, values);
+    }
+
+    // 3) 打包成 Java byte[]
+    jbyteArray outArray = env->NewByteArray((jsize) outBytes);
+    if (!outArray) return nullptr;
+    env->SetByteArrayRegion(outArray, 0, (jsize) outBytes, reinterpret_cast<jbyte *>(out_mat.data));
     return outArray;
 }
 
+// 结果直接写进 outputPath 的 mmap 映射（逐行 RGB/RGBA 原始像素，无文件头），输出不经过 Java 堆也不占常驻内存
+// resumable 时每隔几秒在 outputPath.ckpt 记下已完成的行带，进程被杀后同参数重跑从第一个未完成的行带继续
+// 返回 [w, h, c]，失败返回 nullptr
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeProcessImageToFile(
+        JNIEnv *env, jclass /*clazz*/,
+        jlong handle,
+        jbyteArray imageData,
+        jstring outputPath,
+        jboolean resumable,
+        jlong cancelHandle) {
+    jclass runtimeExc = env->FindClass("java/lang/RuntimeException");
+    if (!runtimeExc) {
+        return nullptr;
+    }
+    std::shared_ptr<RealCUGAN> inst = realcugan_find(handle);
+    if (!inst) {
+        LOGE("processImageToFile: instance of handle %lld not found", handle);
+        return nullptr;
+    }
+
+    std::string outPath;
+    {
+        const char *tmp = env->GetStringUTFChars(outputPath, nullptr);
+        if (tmp) outPath = tmp;
+        env->ReleaseStringUTFChars(outputPath, tmp);
+    }
+
+    // 1) 解码
+    int w = 0, h = 0, c = 0;
+    unsigned char *pixeldata = decode_image(env, imageData, &w, &h, &c);
+    if (!pixeldata) {
+        return nullptr;
+    }
+
+    int scale = inst->scale;
+
+    // 2) 输出文件映射，process 的分块循环按原来的偏移直接写入映射区
+    // 续跑时保留上次已写入的行带
+    MappedImage mapped;
+    if (mapped.create(outPath, w * scale, h * scale, c, resumable) != 0) {
+        LOGE("processImageToFile: cannot map %s for %d x %d x %d", outPath.c_str(), w * scale, h * scale, c);
+        free(pixeldata);
+        return nullptr;
+    }
+
+    ncnn::Mat in_mat(w, h, (void *) pixeldata, (size_t) c, c);
+    ncnn::Mat out_mat = mapped.mat();
+
+    // 3) 运行模型
+    std::shared_ptr<RealCUGANCancel> cancel = find_cancel(cancelHandle);
+    try {
+        LOGV("processImageToFile: processing %d x %d -> %s", w, h, outPath.c_str());
+        int ret;
+        if (resumable) {
+            // 检查点落盘前先把映射区刷回文件，检查点记录的行带一定已在文件里
+            // 被取消时先存下已完成的行带，下次调用接着做
+            RealCUGANCheckpoint job(*inst, outPath + ".ckpt");
+            job.flush = [&mapped]() { return mapped.sync(); };
+            job.cancel = cancel.get();
+            ret = job.process(in_mat, out_mat);
+            LOGV("processImageToFile: resumed from band %d, %d checkpoints %.1f ms",
+                 job.resumed_band, job.saves, job.save_ms);
+        } else {
+            ret = cancel ? inst->process(in_mat, out_mat, *cancel) : inst->process(in_mat, out_mat);
+        }
+        free(pixeldata);
+        if (ret == REALCUGAN_CANCELLED) {
+            LOGV("processImageToFile: cancelled");
+            return nullptr;
+        }
+        if (ret != 0) {
+            LOGE("processImageToFile: model process failed");
+            return nullptr;
+        }
+    } catch (const std::exception &e) {
+        free(pixeldata);
+        env->ThrowNew(runtimeExc, e.what());
+        return nullptr;
+    } catch (...) {
+        free(pixeldata);
+        env->ThrowNew(runtimeExc, "Unknown native error in RealCUGAN");
+        return nullptr;
+    }
+
+    // 4) 刷盘并解除映射
+    if (mapped.close() != 0) {
+        LOGE("processImageToFile: msync %s failed", outPath.c_str());
+        return nullptr;
+    }
+
+    jint dims[3] = {w * scale, h * scale, c};
+    jintArray outDims = env->NewIntArray(3);
+    env->SetIntArrayRegion(outDims, 0, 3, dims);
+
+    LOGV("processImageToFile: complete. output size: %d x %d channels: %d", dims[0], dims[1], dims[2]);
+
+    return outDims;
+}
+
+// 批量处理：inputs[i] 解码 → 推理 → 按 outputs[i] 的扩展名编码写盘
+// 解码、推理、编码三段各有线程，段间是有界队列，解码第 N+1 张和编码第 N-1 张与第 N 张的推理重叠
+// 返回每张图的结果，0 为成功
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeProcessBatch(
+        JNIEnv *env, jclass /*clazz*/,
+        jlong handle,
+        jobjectArray inputs,
+        jobjectArray outputs,
+        jlong cancelHandle) {
+    std::shared_ptr<RealCUGAN> inst = realcugan_find(handle);
+    if (!inst) {
+        LOGE("processBatch: instance of handle %lld not found", handle);
+        return nullptr;
+    }
+
+    jsize count = env->GetArrayLength(inputs);
+    if (env->GetArrayLength(outputs) != count) {
+        LOGE("processBatch: %d inputs but %d outputs", count, env->GetArrayLength(outputs));
+        return nullptr;
+    }
+
+    // JNIEnv 不能跨线程，先把压缩字节和路径拷到 native（压缩数据不大）
+    std::vector<std::vector<unsigned char>> encoded(count);
+    std::vector<std::string> paths(count);
+    for (jsize i = 0; i < count; i++) {
+        auto data = (jbyteArray) env->GetObjectArrayElement(inputs, i);
+        auto path = (jstring) env->GetObjectArrayElement(outputs, i);
+        if (data) {
+            encoded[i].resize(env->GetArrayLength(data));
+            env->GetByteArrayRegion(data, 0, (jsize) encoded[i].size(), reinterpret_cast<jbyte *>(encoded[i].data()));
+            env->DeleteLocalRef(data);
+        }
+        if (path) {
+            const char *tmp = env->GetStringUTFChars(path, nullptr);
+            if (tmp) paths[i] = tmp;
+            env->ReleaseStringUTFChars(path, tmp);
+            env->DeleteLocalRef(path);
+        }
+    }
+
+    // 取消后剩下的图不再解码，结果为 REALCUGAN_CANCELLED
+    std::shared_ptr<RealCUGANCancel> cancel = find_cancel(cancelHandle);
+
+    auto load = [&](BatchTask &task) {
+        if (cancel && cancel->check() != 0) return cancel->check();
+
+        const std::vector<unsigned char> &buf = encoded[task.index];
+        int w = 0, h = 0, c = 0;
+        unsigned char *pixeldata = buf.empty() ? nullptr : decode_image_memory(buf.data(), (int) buf.size(), &w, &h, &c);
+        if (!pixeldata) return -1;
+
+        task.inimage.create(w, h, (size_t) c, c);
+        if (!task.inimage.empty()) memcpy(task.inimage.data, pixeldata, (size_t) w * h * c);
+        free(pixeldata);
+
+        // 解码完就不再需要压缩数据
+        std::vector<unsigned char>().swap(encoded[task.index]);
+        if (task.inimage.empty()) {
+            g_metrics.add(METRIC_OOM);
+            return -100;
+        }
+        return 0;
+    };
+
+    auto save = [&](BatchTask &task) {
+        const ncnn::Mat &out = task.outimage;
+        if (encode_image(paths[task.index], out.w, out.h, out.elempack, (const unsigned char *) out.data) != 0) {
+            LOGE("processBatch: write %s failed", paths[task.index].c_str());
+            return -1;
+        }
+        return 0;
+    };
+
+    // 推理独占一条线程，编码（尤其是放大后的 PNG）比解码慢，给两条
+    BatchPipeline pipeline;
+    pipeline.load_threads = 1;
+    pipeline.proc_threads = 1;
+    pipeline.save_threads = 2;
+    pipeline.queue_size = 2;
+    pipeline.trace = &g_trace;
+
+    std::vector<int> status;
+    try {
+        pipeline.run(count, load, BatchPipeline::process_stage(*inst, cancel.get()), save, status);
+    } catch (const std::exception &e) {
+        jclass runtimeExc = env->FindClass("java/lang/RuntimeException");
+        if (runtimeExc) env->ThrowNew(runtimeExc, e.what());
+        return nullptr;
+    }
+
+    const BatchStats &st = pipeline.stats;
+    LOGV("processBatch: %d ok %d failed in %.1f ms, busy load=%.1f proc=%.1f save=%.1f ms",
+         st.succeeded, st.failed, st.wall_ms, st.load_ms, st.proc_ms, st.save_ms);
+
+    jintArray result = env->NewIntArray(count);
+    env->SetIntArrayRegion(result, 0, count, reinterpret_cast<const jint *>(status.data()));
+    return result;
+}
+
 extern "C" JNIEXPORT void JNICALL
 Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeRelease(
         JNIEnv * /*env*/, jclass, jlong handle) {
-    std::lock_guard<std::mutex> lk(g_cache_mutex);
-    for (auto it = g_cache.begin(); it != g_cache.end(); ++it) {
-        if (it->second.handle == handle) {
-            delete it->second.inst;
-            g_cache.erase(it);
-            release_ncnn_gpu();
-            break;
+    // 摘掉挂在这个实例上的会话和限时状态；它们与正在进行的调用都持有实例，
+    // 不必等这些调用结束，实例随最后一个引用释放
+    std::vector<std::shared_ptr<SessionEntry>> sessions;
+    {
+        std::lock_guard<std::mutex> lk(g_session_mutex);
+        for (auto it = g_sessions.begin(); it != g_sessions.end();) {
+            if (it->second->owner == handle) {
+                sessions.push_back(it->second);
+                it = g_sessions.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    std::shared_ptr<BudgetEntry> budget;
+    {
+        std::lock_guard<std::mutex> lk(g_budget_mutex);
+        auto it = g_budgets.find(handle);
+        if (it != g_budgets.end()) {
+            budget = it->second;
+            g_budgets.erase(it);
         }
     }
+    realcugan_release(handle);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeConfigureTileCache(
+        JNIEnv *env, jclass,
+        jlong maxMemoryBytes,
+        jstring spillDir,
+        jlong maxSpillBytes) {
+    std::string dir;
+    if (spillDir) {
+        const char *tmp = env->GetStringUTFChars(spillDir, nullptr);
+        if (tmp) dir = tmp;
+        env->ReleaseStringUTFChars(spillDir, tmp);
+    }
+    g_tile_cache.configure((size_t) std::max<jlong>(maxMemoryBytes, 0), dir,
+                           (size_t) std::max<jlong>(maxSpillBytes, 0));
+    LOGI("tile cache: memory=%lld spill=%lld dir=%s", maxMemoryBytes, maxSpillBytes, dir.c_str());
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeGetTileCacheStats(
+        JNIEnv *env, jclass) {
+    TileCacheStats st = g_tile_cache.stats();
+    // 顺序与 Kotlin 侧 TileCacheStats 构造参数一致
+    jlong values[10] = {
+            (jlong) st.hits,
+            (jlong) st.misses,
+            (jlong) st.hit_bytes,
+            (jlong) st.insertions,
+            (jlong) st.evictions,
+            (jlong) st.spills,
+            (jlong) st.spill_hits,
+            (jlong) st.memory_bytes,
+            (jlong) st.spill_bytes,
+            (jlong) st.entries,
+    };
+    jlongArray result = env->NewLongArray(10);
+    if (!result) return nullptr;
+    env->SetLongArrayRegion(result, 0, 10, values);
+    return result;
+}
+
+// 最近完成的一次 process 的内存统计：先是合计，再按 MemoryTag 顺序，每项依次为当前、峰值、分配次数（字节）
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeGetMemoryStats(
+        JNIEnv *env, jclass) {
+    jlong values[(MEMORY_TAG_COUNT + 1) * 3];
+    for (int i = 0; i <= MEMORY_TAG_COUNT; i++) {
+        MemoryUsage u = i == 0 ? g_memory.total() : g_memory.usage(i - 1);
+        values[i * 3 + 0] = (jlong) u.current;
+        values[i * 3 + 1] = (jlong) u.peak;
+        values[i * 3 + 2] = (jlong) u.count;
+    }
+    jlongArray result = env->NewLongArray((MEMORY_TAG_COUNT + 1) * 3);
+    if (!result) return nullptr;
+    env->SetLongArrayRegion(result, 0, (MEMORY_TAG_COUNT + 1) * 3, values);
+    return result;
+}
+
+// 计数器、实例数/进行中的调用数和耗时直方图的 JSON 快照，格式见 metrics.h
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeGetMetrics(
+        JNIEnv *env, jclass) {
+    return env->NewStringUTF(g_metrics.to_json().c_str());
+}
+
+// 计数器和直方图清零，实例数等仪表值保留
+extern "C" JNIEXPORT void JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeResetMetrics(
+        JNIEnv *, jclass) {
+    g_metrics.reset();
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeSetVerboseLogging(
+        JNIEnv *, jclass,
+        jboolean enabled) {
+    realcugan_set_verbose_logging(enabled);
+}
+
+// capacity 为保留的最近事件数，0 关闭并清空
+extern "C" JNIEXPORT void JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeConfigureTrace(
+        JNIEnv *, jclass,
+        jint capacity) {
+    g_trace.configure((size_t) std::max<jint>(capacity, 0));
+    LOGI("trace: capacity=%d", capacity);
+}
+
+// 写出 Chrome trace_event JSON，可在 ui.perfetto.dev 打开
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeWriteTrace(
+        JNIEnv *env, jclass,
+        jstring outputPath) {
+    const char *tmp = env->GetStringUTFChars(outputPath, nullptr);
+    if (!tmp) return JNI_FALSE;
+    std::string path = tmp;
+    env->ReleaseStringUTFChars(outputPath, tmp);
+
+    int ret = g_trace.write(path);
+    LOGI("trace: %d events written to %s, %llu dropped", (int) g_trace.size(), path.c_str(),
+         (unsigned long long) g_trace.dropped());
+    return ret == 0 ? JNI_TRUE : JNI_FALSE;
+}
+
+// 跑一个整块和一个半块，拟合吞吐和每次推理的固定开销
+extern "C" JNIEXPORT jint JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeCalibrate(
+        JNIEnv * /*env*/, jclass, jlong handle) {
+    std::shared_ptr<RealCUGAN> inst = realcugan_find(handle);
+    if (!inst) {
+        LOGE("calibrate: instance of handle %lld not found", handle);
+        return -1;
+    }
+    std::lock_guard<std::mutex> lg(g_calibrate_mutex);
+    int ret = inst->calibrate();
+    if (ret != 0) {
+        LOGE("calibrate: failed (%d)", ret);
+        return ret;
+    }
+    LOGI("calibrate: %.2f GFLOPS, %.2f ms per inference", inst->flops_per_ms * 1e-6, inst->pass_ms);
+    return 0;
+}
+
+// 不跑模型，按分块规划和各层 FLOPs 预测 w×h 图的耗时与峰值内存
+extern "C" JNIEXPORT jdoubleArray JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeEstimate(
+        JNIEnv *env, jclass, jlong handle, jint width, jint height, jint channels) {
+    std::shared_ptr<RealCUGAN> inst = realcugan_find(handle);
+    if (!inst) {
+        LOGE("estimate: instance of handle %lld not found", handle);
+        return nullptr;
+    }
+    RealCUGANEstimate e;
+    {
+        std::lock_guard<std::mutex> lg(g_calibrate_mutex);
+        e = inst->estimate(width, height, channels);
+    }
+    // 顺序与 Kotlin 侧 CostEstimate 构造参数一致
+    jdouble values[6] = {
+            (jdouble) e.tiles,
+            (jdouble) e.passes,
+            e.flops,
+            e.time_ms,
+            (jdouble) e.host_bytes,
+            (jdouble) e.device_bytes,
+    };
+    jdoubleArray result = env->NewDoubleArray(6);
+    if (!result) return nullptr;
+    env->SetDoubleArrayRegion(result, 0, 6, values);
+    return result;
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeCreateCancel(
+        JNIEnv * /*env*/, jclass) {
+    jlong cancelHandle = realcugan_next_handle();
+    std::lock_guard<std::mutex> lk(g_cancel_mutex);
+    g_cancels[cancelHandle] = std::make_shared<RealCUGANCancel>();
+    return cancelHandle;
+}
+
+// 任意线程调用，正在运行的 process 在当前分块结束后返回
+extern "C" JNIEXPORT void JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeCancel(
+        JNIEnv * /*env*/, jclass, jlong cancelHandle) {
+    std::shared_ptr<RealCUGANCancel> cancel = find_cancel(cancelHandle);
+    if (cancel) cancel->cancel();
+}
+
+// 仍在运行的 process 持有 shared_ptr，释放不会让它悬空
+extern "C" JNIEXPORT void JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeReleaseCancel(
+        JNIEnv * /*env*/, jclass, jlong cancelHandle) {
+    std::lock_guard<std::mutex> lk(g_cancel_mutex);
+    g_cancels.erase(cancelHandle);
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGAN_nativeCreateSession(
+        JNIEnv * /*env*/, jclass,
+        jlong handle,
+        jfloat resyncThreshold) {
+    std::shared_ptr<RealCUGAN> inst = realcugan_find(handle);
+    if (!inst) {
+        LOGE("createSession: instance of handle %lld not found", handle);
+        return -1;
+    }
+
+    auto entry = std::make_shared<SessionEntry>();
+    entry->owner = handle;
+    entry->inst = inst;
+    entry->session = new RealCUGANSession(*inst);
+    entry->session->resync_threshold = resyncThreshold;
+
+    jlong sessionHandle = realcugan_next_handle();
+    {
+        std::lock_guard<std::mutex> lk(g_session_mutex);
+        g_sessions[sessionHandle] = entry;
+    }
+    return sessionHandle;
+}
+
+extern "C" JNIEXPORT jbyteArray JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGANSession_nativeProcess(
+        JNIEnv *env, jclass,
+        jlong sessionHandle,
+        jbyteArray imageData) {
+    jclass runtimeExc = env->FindClass("java/lang/RuntimeException");
+    if (!runtimeExc) {
+        return nullptr;
+    }
+
+    std::shared_ptr<SessionEntry> entry;
+    {
+        std::lock_guard<std::mutex> lk(g_session_mutex);
+        auto it = g_sessions.find(sessionHandle);
+        if (it != g_sessions.end()) entry = it->second;
+    }
+    if (!entry) {
+        LOGE("sessionProcess: session %lld not found", sessionHandle);
+        return nullptr;
+    }
+
+    // 1) 解码
+    int w = 0, h = 0, c = 0;
+    unsigned char *pixeldata = decode_image(env, imageData, &w, &h, &c);
+    if (!pixeldata) {
+        return nullptr;
+    }
+
+    // 2) 同一会话串行执行，上一版的输入/输出都在会话里
+    std::lock_guard<std::mutex> lg(entry->lock);
+    RealCUGANSession *session = entry->session;
+    if (!session) {
+        free(pixeldata);
+        LOGE("sessionProcess: instance of session %lld released", sessionHandle);
+        return nullptr;
+    }
+
+    ncnn::Mat in_mat(w, h, (void *) pixeldata, (size_t) c, c);
+    ncnn::Mat out_mat;
+    int ret;
+    try {
+        ret = session->process(in_mat, out_mat);
+    } catch (const std::exception &e) {
+        free(pixeldata);
+        env->ThrowNew(runtimeExc, e.what());
+        return nullptr;
+    }
+    free(pixeldata);
+    if (ret != 0) {
+        LOGE("sessionProcess: process failed (%d)", ret);
+        return nullptr;
+    }
+
+    const RealCUGANTileStats &st = session->tilestats;
+    LOGV("sessionProcess: tiles=%d computed=%d unchanged=%d duplicate=%d cached=%d resynced=%d",
+         st.total, st.computed, st.unchanged, st.duplicate, st.cached, session->resynced ? 1 : 0);
+
+    // 3) 打包成 Java byte[]
+    size_t outBytes = (size_t) out_mat.w * out_mat.h * out_mat.elempack;
+    if (outBytes > (size_t) INT32_MAX) {
+        env->ThrowNew(runtimeExc, "output exceeds 2 GiB, use processToFile instead");
+        return nullptr;
+    }
+    jbyteArray outArray = env->NewByteArray((jsize) outBytes);
+    if (!outArray) return nullptr;
+    env->SetByteArrayRegion(outArray, 0, (jsize) outBytes, reinterpret_cast<jbyte *>(out_mat.data));
+    return outArray;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_akari_realcugan_1ncnn_1android_RealCUGANSession_nativeRelease(
+        JNIEnv * /*env*/, jclass, jlong sessionHandle) {
+    std::shared_ptr<SessionEntry> entry;
+    {
+        std::lock_guard<std::mutex> lk(g_session_mutex);
+        auto it = g_sessions.find(sessionHandle);
+        if (it == g_sessions.end()) return;
+        entry = it->second;
+        g_sessions.erase(it);
+    }
+    // 等正在进行的 process 结束
+    std::lock_guard<std::mutex> lg(entry->lock);
 }
@@ -0,0 +1,303 @@
+// content-addressed output tile cache
+
+#include "tile_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+uint64_t tile_cache_hash(const void* data, size_t size, uint64_t seed)
+{
+    const unsigned char* ptr = (const unsigned char*)data;
+
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+    uint64_t h = seed ^ (size * c1);
+
+    const size_t nblocks = size / 8;
+    for (size_t i = 0; i < nblocks; i++)
+    {
+        uint64_t k;
+        memcpy(&k, ptr + i * 8, 8);
+
+        k *= c1;
+        k = rotl64(k, 31);
+        k *= c2;
+
+        h ^= k;
+        h = rotl64(h, 27);
+        h = h * 5 + 0x52dce729;
+    }
+
+    // tail
+    {
+        uint64_t k = 0;
+        memcpy(&k, ptr + nblocks * 8, size - nblocks * 8);
+
+        k *= c1;
+        k = rotl64(k, 31);
+        k *= c2;
+
+        h ^= k;
+    }
+
+    return fmix64(h);
+}
+
+TileCache::TileCache()
+{
+    max_memory_bytes = 0;
+    max_spill_bytes = 0;
+
+    memset(&st, 0, sizeof(st));
+}
+
+TileCache::~TileCache()
+{
+    clear();
+}
+
+void TileCache::configure(size_t _max_memory_bytes, const std::string& _spill_dir, size_t _max_spill_bytes)
+{
+    std::lock_guard<std::mutex> lg(lock);
+
+    max_memory_bytes = _max_memory_bytes;
+    spill_dir = _spill_dir;
+    max_spill_bytes = _spill_dir.empty() ? 0 : _max_spill_bytes;
+
+    if (max_memory_bytes == 0)
+    {
+        while (!lru.empty())
+            drop(lru.begin());
+        return;
+    }
+
+    evict();
+}
+
+bool TileCache::enabled() const
+{
+    std::lock_guard<std::mutex> lg(lock);
+
+    return max_memory_bytes != 0;
+}
+
+bool TileCache::get(uint64_t key, unsigned char* outptr, int w, int h, int c, size_t outstride)
+{
+    std::lock_guard<std::mutex> lg(lock);
+
+    std::unordered_map<uint64_t, EntryList::iterator>::iterator mit = index.find(key);
+    if (mit == index.end() || mit->second->w != w || mit->second->h != h || mit->second->c != c)
+    {
+        st.misses++;
+        return false;
+    }
+
+    EntryList::iterator it = mit->second;
+    const size_t size = (size_t)w * h * c;
+
+    if (!it->spillpath.empty())
+    {
+        // bring it back to memory
+        std::vector<unsigned char> data(size);
+
+        FILE* fp = fopen(it->spillpath.c_str(), "rb");
+        size_t nread = fp ? fread(data.data(), 1, size, fp) : 0;
+        if (fp)
+            fclose(fp);
+
+        if (nread != size)
+        {
+            fprintf(stderr, "read spilled tile %s failed\n", it->spillpath.c_str());
+            drop(it);
+            st.misses++;
+            return false;
+        }
+
+        unlink(it->spillpath.c_str());
+        it->spillpath.clear();
+        it->data.swap(data);
+
+        st.spill_bytes -= size;
+        st.memory_bytes += size;
+        st.spill_hits++;
+    }
+
+    lru.splice(lru.begin(), lru, it);
+
+    const unsigned char* ptr = it->data.data();
+    for (int y = 0; y < h; y++)
+    {
+        memcpy(outptr + y * outstride, ptr + (size_t)y * w * c, (size_t)w * c);
+    }
+
+    st.hits++;
+    st.hit_bytes += size;
+
+    evict();
+
+    return true;
+}
+
+void TileCache::put(uint64_t key, const unsigned char* ptr, int w, int h, int c, size_t stride)
+{
+    std::lock_guard<std::mutex> lg(lock);
+
+    const size_t size = (size_t)w * h * c;
+    if (size == 0 || size > max_memory_bytes)
+        return;
+
+    std::unordered_map<uint64_t, EntryList::iterator>::iterator mit = index.find(key);
+    if (mit != index.end())
+    {
+        lru.splice(lru.begin(), lru, mit->second);
+        return;
+    }
+
+    lru.push_front(Entry());
+
+    Entry& e = lru.front();
+    e.key = key;
+    e.w = w;
+    e.h = h;
+    e.c = c;
+    e.data.resize(size);
+
+    for (int y = 0; y < h; y++)
+    {
+        memcpy(e.data.data() + (size_t)y * w * c, ptr + y * stride, (size_t)w * c);
+    }
+
+    index[key] = lru.begin();
+
+    st.memory_bytes += size;
+    st.insertions++;
+
+    evict();
+}
+
+void TileCache::clear()
+{
+    std::lock_guard<std::mutex> lg(lock);
+
+    while (!lru.empty())
+        drop(lru.begin());
+}
+
+TileCacheStats TileCache::stats() const
+{
+    std::lock_guard<std::mutex> lg(lock);
+
+    TileCacheStats s = st;
+    s.entries = index.size();
+    return s;
+}
+
+void TileCache::evict()
+{
+    // least recently used in-memory tiles go to disk, or away when there is no room
+    EntryList::iterator it = lru.end();
+    while (st.memory_bytes > max_memory_bytes && it != lru.begin())
+    {
+        --it;
+
+        if (!it->spillpath.empty())
+            continue;
+
+        if (spill(*it))
+            continue;
+
+        EntryList::iterator next = it;
+        ++next;
+        drop(it);
+        st.evictions++;
+        it = next;
+    }
+
+    // spill budget may have shrunk
+    it = lru.end();
+    while (st.spill_bytes > max_spill_bytes && it != lru.begin())
+    {
+        --it;
+
+        if (it->spillpath.empty())
+            continue;
+
+        EntryList::iterator next = it;
+        ++next;
+        drop(it);
+        st.evictions++;
+        it = next;
+    }
+}
+
+bool TileCache::spill(Entry& e)
+{
+    const size_t size = e.data.size();
+    if (spill_dir.empty() || st.spill_bytes + size > max_spill_bytes)
+        return false;
+
+    char name[32];
+    sprintf(name, "/%016llx.tile", (unsigned long long)e.key);
+    std::string path = spill_dir + name;
+
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "open spill file %s failed\n", path.c_str());
+        return false;
+    }
+
+    size_t nwrite = fwrite(e.data.data(), 1, size, fp);
+    fclose(fp);
+
+    if (nwrite != size)
+    {
+        fprintf(stderr, "write spill file %s failed\n", path.c_str());
+        unlink(path.c_str());
+        return false;
+    }
+
+    e.spillpath = path;
+    std::vector<unsigned char>().swap(e.data);
+
+    st.memory_bytes -= size;
+    st.spill_bytes += size;
+    st.spills++;
+
+    return true;
+}
+
+void TileCache::drop(EntryList::iterator it)
+{
+    const size_t size = (size_t)it->w * it->h * it->c;
+
+    if (!it->spillpath.empty())
+    {
+        unlink(it->spillpath.c_str());
+        st.spill_bytes -= size;
+    }
+    else
+    {
+        st.memory_bytes -= size;
+    }
+
+    index.erase(it->key);
+    lru.erase(it);
+}
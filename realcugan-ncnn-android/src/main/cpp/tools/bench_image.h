@@ -0,0 +1,251 @@
+#ifndef BENCH_IMAGE_H
+#define BENCH_IMAGE_H
+
+// deterministic test images shared by the benchmark tools
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "stb_image.h"
+
+struct BenchImage
+{
+    std::string name;
+    int w;
+    int h;
+    int c;
+    std::vector<unsigned char> pixels;
+};
+
+static inline void fill_rect(BenchImage& im, int x0, int y0, int x1, int y1, unsigned char r, unsigned char g, unsigned char b)
+{
+    for (int y = std::max(y0, 0); y < std::min(y1, im.h); y++)
+    {
+        for (int x = std::max(x0, 0); x < std::min(x1, im.w); x++)
+        {
+            unsigned char* p = &im.pixels[((size_t)y * im.w + x) * im.c];
+            p[0] = r;
+            p[1] = g;
+            p[2] = b;
+        }
+    }
+}
+
+// fake glyph rows, deterministic
+static inline void fill_text(BenchImage& im, int x0, int y0, int x1, int y1, int lineh, unsigned int seed)
+{
+    for (int y = y0; y + lineh <= y1; y += lineh * 2)
+    {
+        int x = x0;
+        while (x < x1)
+        {
+            seed = seed * 1103515245 + 12345;
+            int gw = 4 + (seed >> 16) % 10;
+            fill_rect(im, x, y, std::min(x + gw, x1), y + lineh, 0, 0, 0);
+            x += gw + 3 + (seed >> 24) % 4;
+        }
+    }
+}
+
+static inline BenchImage make_manga_page()
+{
+    BenchImage im;
+    im.name = "synthetic-manga-1200x1700";
+    im.w = 1200;
+    im.h = 1700;
+    im.c = 3;
+    im.pixels.assign((size_t)im.w * im.h * im.c, 255);
+
+    // panel borders
+    fill_rect(im, 40, 40, 1160, 46, 0, 0, 0);
+    fill_rect(im, 40, 600, 1160, 606, 0, 0, 0);
+    fill_rect(im, 40, 1100, 1160, 1106, 0, 0, 0);
+    fill_rect(im, 40, 1660, 1160, 1666, 0, 0, 0);
+    fill_rect(im, 40, 40, 46, 1666, 0, 0, 0);
+    fill_rect(im, 1154, 40, 1160, 1666, 0, 0, 0);
+    fill_rect(im, 600, 606, 606, 1100, 0, 0, 0);
+
+    // screentone, 4px dot period
+    for (int y = 606; y < 1100; y++)
+    {
+        for (int x = 606; x < 1154; x++)
+        {
+            if (x % 4 == 0 && y % 4 == 0)
+                fill_rect(im, x, y, x + 2, y + 2, 60, 60, 60);
+        }
+    }
+
+    // black night sky panel
+    fill_rect(im, 46, 1106, 1154, 1400, 0, 0, 0);
+
+    // speech bubbles
+    fill_text(im, 100, 120, 500, 400, 12, 1);
+    fill_text(im, 120, 700, 560, 900, 12, 2);
+    fill_text(im, 700, 1450, 1100, 1620, 12, 3);
+
+    return im;
+}
+
+static inline BenchImage make_screenshot()
+{
+    BenchImage im;
+    im.name = "synthetic-screenshot-1080x1920";
+    im.w = 1080;
+    im.h = 1920;
+    im.c = 3;
+    im.pixels.assign((size_t)im.w * im.h * im.c, 250);
+
+    // status bar and toolbar
+    fill_rect(im, 0, 0, 1080, 72, 33, 33, 33);
+    fill_rect(im, 0, 72, 1080, 240, 98, 0, 238);
+
+    // list items with a divider and a line of text each
+    for (int y = 240; y + 200 <= 1760; y += 200)
+    {
+        fill_rect(im, 0, y + 198, 1080, y + 200, 220, 220, 220);
+        fill_text(im, 60, y + 70, 700, y + 100, 14, y);
+    }
+
+    // navigation bar
+    fill_rect(im, 0, 1760, 1080, 1920, 0, 0, 0);
+
+    return im;
+}
+
+// sky gradient over grainy ground with some foliage-like texture
+static inline BenchImage make_photo()
+{
+    BenchImage im;
+    im.name = "synthetic-photo-1600x1200";
+    im.w = 1600;
+    im.h = 1200;
+    im.c = 3;
+    im.pixels.resize((size_t)im.w * im.h * im.c);
+
+    unsigned int seed = 7;
+    for (int y = 0; y < im.h; y++)
+    {
+        for (int x = 0; x < im.w; x++)
+        {
+            unsigned char* p = &im.pixels[((size_t)y * im.w + x) * im.c];
+
+            if (y < 700)
+            {
+                // smooth sky
+                p[0] = (unsigned char)(90 + y * 100 / 700);
+                p[1] = (unsigned char)(140 + y * 80 / 700);
+                p[2] = (unsigned char)(230 - y * 30 / 700);
+                continue;
+            }
+
+            seed = seed * 1103515245 + 12345;
+            int n = (int)((seed >> 16) % 48) - 24;
+
+            // leaves, high frequency stripes modulated by noise
+            int leaf = ((x / 3 + y / 5) % 7 < 3) ? 40 : 0;
+
+            p[0] = (unsigned char)std::min(std::max(70 + n + leaf / 2, 0), 255);
+            p[1] = (unsigned char)std::min(std::max(110 + n + leaf, 0), 255);
+            p[2] = (unsigned char)std::min(std::max(50 + n, 0), 255);
+        }
+    }
+
+    return im;
+}
+
+// the synthetic photo repeated over w x h
+static inline BenchImage make_photo_sized(int w, int h)
+{
+    BenchImage photo = make_photo();
+
+    BenchImage im;
+    im.name = "synthetic-photo-" + std::to_string(w) + "x" + std::to_string(h);
+    im.w = w;
+    im.h = h;
+    im.c = photo.c;
+    im.pixels.resize((size_t)w * h * im.c);
+
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            const unsigned char* p = &photo.pixels[((size_t)(y % photo.h) * photo.w + x % photo.w) * photo.c];
+            std::copy(p, p + photo.c, &im.pixels[((size_t)y * w + x) * im.c]);
+        }
+    }
+
+    return im;
+}
+
+// small flat-shaded icon with a soft gradient and grain, transparent corners when c is 4
+static inline BenchImage make_sticker(int w, int h, int c, unsigned int seed)
+{
+    BenchImage im;
+    im.name = "synthetic-sticker-" + std::to_string(w) + "x" + std::to_string(h);
+    im.w = w;
+    im.h = h;
+    im.c = c;
+    im.pixels.resize((size_t)w * h * c);
+
+    const int r0 = (int)(seed * 37 % 200) + 30;
+    const int g0 = (int)(seed * 71 % 200) + 30;
+    const int b0 = (int)(seed * 113 % 200) + 30;
+
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            unsigned char* p = &im.pixels[((size_t)y * w + x) * c];
+
+            seed = seed * 1103515245 + 12345;
+            int n = (int)((seed >> 16) % 16) - 8;
+            int shade = (x + y) * 40 / (w + h);
+
+            // a dark outlined disc in the middle
+            int dx = x * 2 - w;
+            int dy = y * 2 - h;
+            int d2 = dx * dx + dy * dy;
+            int r2 = std::min(w, h) * std::min(w, h) / 2;
+            bool outline = d2 > r2 * 8 / 10 && d2 < r2;
+
+            p[0] = (unsigned char)std::min(std::max(outline ? 20 : r0 + shade + n, 0), 255);
+            p[1] = (unsigned char)std::min(std::max(outline ? 20 : g0 - shade + n, 0), 255);
+            p[2] = (unsigned char)std::min(std::max(outline ? 20 : b0 + n, 0), 255);
+            if (c == 4)
+                p[3] = d2 < r2 ? 255 : 0;
+        }
+    }
+
+    return im;
+}
+
+static inline int load_image(const char* path, BenchImage& im)
+{
+    int w, h, c;
+    unsigned char* pixeldata = stbi_load(path, &w, &h, &c, 0);
+    if (!pixeldata)
+    {
+        fprintf(stderr, "decode %s failed\n", path);
+        return -1;
+    }
+
+    if (c == 1 || c == 2)
+    {
+        stbi_image_free(pixeldata);
+        int want = c == 1 ? 3 : 4;
+        pixeldata = stbi_load(path, &w, &h, &c, want);
+        c = want;
+    }
+
+    im.name = path;
+    im.w = w;
+    im.h = h;
+    im.c = c;
+    im.pixels.assign(pixeldata, pixeldata + (size_t)w * h * c);
+
+    stbi_image_free(pixeldata);
+    return 0;
+}
+
+#endif // BENCH_IMAGE_H
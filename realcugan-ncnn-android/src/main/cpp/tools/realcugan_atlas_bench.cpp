@@ -0,0 +1,201 @@
+// atlas batching benchmark on many small images, throughput against one process() call per image
+//
+// realcugan-atlas-bench -p up2x-no-denoise.param -b up2x-no-denoise.bin [-s 2] [-n 0] [-g 0] [-t 200] [-a 0] [-N 256]
+//
+// a quarter of the generated stickers carry alpha
+// models without SE blocks are not packed and get no speedup, the atlas row then only reports the bit for bit check
+// and every output has to match process(), the bench fails otherwise
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+
+#include "bench_image.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// ncnn
+#include "gpu.h"
+
+#include "realcugan.h"
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: realcugan-atlas-bench -p param -b bin [options]\n");
+    fprintf(stderr, "  -s scale       upscale ratio (2, 3, 4, default=2)\n");
+    fprintf(stderr, "  -n noise       denoise level (-1/0/1/2/3, default=0)\n");
+    fprintf(stderr, "  -g gpu-id      gpu device to use (-1=cpu, default=0)\n");
+    fprintf(stderr, "  -t tile-size   tile size (>=32, default=200)\n");
+    fprintf(stderr, "  -a atlas-size  atlas side before padding (0=tile size, default=0)\n");
+    fprintf(stderr, "  -N count       number of images (default=256)\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* parampath = 0;
+    const char* modelpath = 0;
+    int scale = 2;
+    int noise = 0;
+    int gpuid = 0;
+    int tilesize = 200;
+    int atlas_size = 0;
+    int count = 256;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:b:s:n:g:t:a:N:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            parampath = optarg;
+            break;
+        case 'b':
+            modelpath = optarg;
+            break;
+        case 's':
+            scale = atoi(optarg);
+            break;
+        case 'n':
+            noise = atoi(optarg);
+            break;
+        case 'g':
+            gpuid = atoi(optarg);
+            break;
+        case 't':
+            tilesize = atoi(optarg);
+            break;
+        case 'a':
+            atlas_size = atoi(optarg);
+            break;
+        case 'N':
+            count = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (!parampath || !modelpath || scale < 2 || scale > 4 || tilesize < 32 || atlas_size < 0 || count <= 0)
+    {
+        print_usage();
+        return -1;
+    }
+
+    // 32 to 127 pixels per side
+    std::vector<BenchImage> images;
+    for (int i = 0; i < count; i++)
+    {
+        unsigned int seed = i * 2654435761u + 1;
+        int w = 32 + (int)((seed >> 8) % 96);
+        int h = 32 + (int)((seed >> 16) % 96);
+        images.push_back(make_sticker(w, h, i % 4 == 3 ? 4 : 3, seed));
+    }
+
+    if (gpuid != -1)
+        ncnn::create_gpu_instance();
+
+    int ret = 0;
+    {
+        RealCUGAN realcugan(gpuid, false);
+        realcugan.noise = noise;
+        realcugan.scale = scale;
+        realcugan.tilesize = tilesize;
+        realcugan.syncgap = 0;
+        realcugan.prepadding = scale == 2 ? 18 : scale == 3 ? 14 : 19;
+        // measure inference, not tile reuse
+        realcugan.tile_dedup = false;
+
+        if (realcugan.load(parampath, modelpath) != 0)
+        {
+            fprintf(stderr, "load %s %s failed\n", parampath, modelpath);
+            ret = -1;
+        }
+
+        std::vector<ncnn::Mat> inimages;
+        std::vector<ncnn::Mat> outsingle;
+        std::vector<ncnn::Mat> outatlas;
+        size_t outpixels = 0;
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            const BenchImage& im = images[i];
+            inimages.push_back(ncnn::Mat(im.w, im.h, (void*)im.pixels.data(), (size_t)im.c, im.c));
+            outsingle.push_back(ncnn::Mat(im.w * scale, im.h * scale, (size_t)im.c, im.c));
+            outatlas.push_back(ncnn::Mat(im.w * scale, im.h * scale, (size_t)im.c, im.c));
+            outpixels += (size_t)im.w * scale * im.h * scale;
+        }
+
+        if (ret == 0)
+        {
+            // warm up pipelines and allocators
+            realcugan.process(inimages[0], outsingle[0]);
+            realcugan.process_atlas(inimages, outatlas, atlas_size);
+
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < inimages.size() && ret == 0; i++)
+            {
+                ret = realcugan.process(inimages[i], outsingle[i]);
+            }
+            std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+            if (ret == 0)
+                ret = realcugan.process_atlas(inimages, outatlas, atlas_size);
+            std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+            double single_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+            double atlas_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+
+            // largest per pixel difference and how many images match bit for bit
+            int maxdiff = 0;
+            int identical = 0;
+            for (size_t i = 0; i < images.size(); i++)
+            {
+                const BenchImage& im = images[i];
+                const unsigned char* pa = (const unsigned char*)outsingle[i].data;
+                const unsigned char* pb = (const unsigned char*)outatlas[i].data;
+                const size_t size = (size_t)im.w * scale * im.h * scale * im.c;
+
+                int diff = 0;
+                for (size_t k = 0; k < size; k++)
+                {
+                    diff = std::max(diff, abs((int)pa[k] - (int)pb[k]));
+                }
+
+                maxdiff = std::max(maxdiff, diff);
+                if (diff == 0)
+                    identical++;
+            }
+
+            fprintf(stdout, "%-8s %6s %10s %10s %10s %8s %9s %8s\n", "mode", "images", "total ms", "images/s", "Mpix/s", "speedup", "identical", "maxdiff");
+            fprintf(stdout, "%-8s %6d %10.1f %10.1f %10.2f %7.2fx %9s %8s\n", "single", count, single_ms,
+                    single_ms > 0 ? count * 1000.0 / single_ms : 0.0, single_ms > 0 ? outpixels / single_ms / 1000.0 : 0.0, 1.0, "ref", "ref");
+            if (realcugan.atlas_packs())
+            {
+                fprintf(stdout, "%-8s %6d %10.1f %10.1f %10.2f %7.2fx %5d/%-3d %8d\n", "atlas", count, atlas_ms,
+                        atlas_ms > 0 ? count * 1000.0 / atlas_ms : 0.0, atlas_ms > 0 ? outpixels / atlas_ms / 1000.0 : 0.0,
+                        atlas_ms > 0 ? single_ms / atlas_ms : 0.0, identical, count, maxdiff);
+            }
+            else
+            {
+                // one process() per image all the same, any timing difference is noise
+                fprintf(stdout, "%-8s %6d %10s %10s %10s %8s %5d/%-3d %8d\n", "atlas", count, "-", "-", "-", "no pack", identical, count, maxdiff);
+            }
+
+            if (!realcugan.atlas_packs() && identical != count)
+            {
+                fprintf(stderr, "%d of %d outputs differ from process() without packing\n", count - identical, count);
+                ret = -1;
+            }
+        }
+    }
+
+    if (gpuid != -1)
+        ncnn::destroy_gpu_instance();
+
+    return ret;
+}
@@ -0,0 +1,228 @@
+// load / proc / save pipeline benchmark, png decode and encode in memory around the inference
+//
+// realcugan-batch-bench -p up2x-no-denoise.param -b up2x-no-denoise.bin [-s 2] [-n 0] [-g 0] [-t 200] [-j 1:1:2] [-N 32] [-S 256]
+//
+// the pipelined run must produce the same encoded bytes as the sequential one
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+
+#include "bench_image.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+// ncnn
+#include "gpu.h"
+
+#include "realcugan.h"
+#include "batch_pipeline.h"
+
+static void append_bytes(void* context, void* data, int size)
+{
+    std::vector<unsigned char>* buf = (std::vector<unsigned char>*)context;
+    buf->insert(buf->end(), (unsigned char*)data, (unsigned char*)data + size);
+}
+
+static int decode_png(const std::vector<unsigned char>& buf, ncnn::Mat& image)
+{
+    int w, h, c;
+    unsigned char* pixeldata = stbi_load_from_memory(buf.data(), (int)buf.size(), &w, &h, &c, 0);
+    if (!pixeldata)
+        return -1;
+
+    image.create(w, h, (size_t)c, c);
+    memcpy(image.data, pixeldata, (size_t)w * h * c);
+    stbi_image_free(pixeldata);
+    return 0;
+}
+
+static int encode_png(const ncnn::Mat& image, std::vector<unsigned char>& buf)
+{
+    buf.clear();
+    return stbi_write_png_to_func(append_bytes, &buf, image.w, image.h, image.elempack, image.data, 0) ? 0 : -1;
+}
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: realcugan-batch-bench -p param -b bin [options]\n");
+    fprintf(stderr, "  -s scale           upscale ratio (2, 3, 4, default=2)\n");
+    fprintf(stderr, "  -n noise           denoise level (-1/0/1/2/3, default=0)\n");
+    fprintf(stderr, "  -g gpu-id          gpu device to use (-1=cpu, default=0)\n");
+    fprintf(stderr, "  -t tile-size       tile size (>=32, default=200)\n");
+    fprintf(stderr, "  -j load:proc:save  thread count for load/proc/save (default=1:1:2)\n");
+    fprintf(stderr, "  -N count           number of images (default=32)\n");
+    fprintf(stderr, "  -S size            image side (default=256)\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* parampath = 0;
+    const char* modelpath = 0;
+    int scale = 2;
+    int noise = 0;
+    int gpuid = 0;
+    int tilesize = 200;
+    int jobs_load = 1;
+    int jobs_proc = 1;
+    int jobs_save = 2;
+    int count = 32;
+    int size = 256;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:b:s:n:g:t:j:N:S:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            parampath = optarg;
+            break;
+        case 'b':
+            modelpath = optarg;
+            break;
+        case 's':
+            scale = atoi(optarg);
+            break;
+        case 'n':
+            noise = atoi(optarg);
+            break;
+        case 'g':
+            gpuid = atoi(optarg);
+            break;
+        case 't':
+            tilesize = atoi(optarg);
+            break;
+        case 'j':
+            sscanf(optarg, "%d:%d:%d", &jobs_load, &jobs_proc, &jobs_save);
+            break;
+        case 'N':
+            count = atoi(optarg);
+            break;
+        case 'S':
+            size = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (!parampath || !modelpath || scale < 2 || scale > 4 || tilesize < 32 || jobs_load < 1 || jobs_proc < 1 || jobs_save < 1 || count <= 0 || size < 32)
+    {
+        print_usage();
+        return -1;
+    }
+
+    std::vector<std::vector<unsigned char> > inputs(count);
+    for (int i = 0; i < count; i++)
+    {
+        BenchImage im = make_sticker(size, size, i % 4 == 3 ? 4 : 3, i * 2654435761u + 1);
+        stbi_write_png_to_func(append_bytes, &inputs[i], im.w, im.h, im.c, im.pixels.data(), 0);
+    }
+
+    if (gpuid != -1)
+        ncnn::create_gpu_instance();
+
+    int ret = 0;
+    {
+        RealCUGAN realcugan(gpuid, false);
+        realcugan.noise = noise;
+        realcugan.scale = scale;
+        realcugan.tilesize = tilesize;
+        realcugan.syncgap = 0;
+        realcugan.prepadding = scale == 2 ? 18 : scale == 3 ? 14 : 19;
+        // measure inference, not tile reuse
+        realcugan.tile_dedup = false;
+
+        if (realcugan.load(parampath, modelpath) != 0)
+        {
+            fprintf(stderr, "load %s %s failed\n", parampath, modelpath);
+            ret = -1;
+        }
+
+        std::vector<std::vector<unsigned char> > seqout(count);
+        std::vector<std::vector<unsigned char> > pipeout(count);
+
+        BatchPipeline::StageFunc proc = BatchPipeline::process_stage(realcugan);
+
+        if (ret == 0)
+        {
+            // warm up pipelines and allocators
+            BatchTask task;
+            task.index = 0;
+            decode_png(inputs[0], task.inimage);
+            proc(task);
+
+            // one image after another
+            double seq_load_ms = 0;
+            double seq_proc_ms = 0;
+            double seq_save_ms = 0;
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            for (int i = 0; i < count && ret == 0; i++)
+            {
+                task.index = i;
+
+                std::chrono::steady_clock::time_point s0 = std::chrono::steady_clock::now();
+                ret = decode_png(inputs[i], task.inimage);
+                std::chrono::steady_clock::time_point s1 = std::chrono::steady_clock::now();
+                if (ret == 0)
+                    ret = proc(task);
+                std::chrono::steady_clock::time_point s2 = std::chrono::steady_clock::now();
+                if (ret == 0)
+                    ret = encode_png(task.outimage, seqout[i]);
+                std::chrono::steady_clock::time_point s3 = std::chrono::steady_clock::now();
+
+                seq_load_ms += std::chrono::duration<double, std::milli>(s1 - s0).count();
+                seq_proc_ms += std::chrono::duration<double, std::milli>(s2 - s1).count();
+                seq_save_ms += std::chrono::duration<double, std::milli>(s3 - s2).count();
+            }
+            double seq_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+            BatchPipeline pipeline;
+            pipeline.load_threads = jobs_load;
+            pipeline.proc_threads = jobs_proc;
+            pipeline.save_threads = jobs_save;
+
+            BatchPipeline::StageFunc load = [&inputs](BatchTask& t) {
+                return decode_png(inputs[t.index], t.inimage);
+            };
+            BatchPipeline::StageFunc save = [&pipeout](BatchTask& t) {
+                return encode_png(t.outimage, pipeout[t.index]);
+            };
+
+            std::vector<int> status;
+            if (ret == 0)
+                ret = pipeline.run(count, load, proc, save, status);
+
+            const BatchStats& st = pipeline.stats;
+
+            int identical = 0;
+            for (int i = 0; i < count; i++)
+            {
+                if (seqout[i] == pipeout[i])
+                    identical++;
+            }
+
+            fprintf(stdout, "%-10s %6s %10s %10s %10s %10s %10s %8s %9s\n", "mode", "images", "total ms", "load ms", "proc ms", "save ms", "images/s", "speedup", "identical");
+            fprintf(stdout, "%-10s %6d %10.1f %10.1f %10.1f %10.1f %10.1f %7.2fx %9s\n", "sequential", count, seq_ms, seq_load_ms, seq_proc_ms, seq_save_ms,
+                    seq_ms > 0 ? count * 1000.0 / seq_ms : 0.0, 1.0, "ref");
+            fprintf(stdout, "%-10s %6d %10.1f %10.1f %10.1f %10.1f %10.1f %7.2fx %5d/%-3d\n", "pipelined", st.succeeded, st.wall_ms, st.load_ms, st.proc_ms, st.save_ms,
+                    st.wall_ms > 0 ? st.succeeded * 1000.0 / st.wall_ms : 0.0, st.wall_ms > 0 ? seq_ms / st.wall_ms : 0.0, identical, count);
+
+            if (identical != count)
+                ret = -1;
+        }
+    }
+
+    if (gpuid != -1)
+        ncnn::destroy_gpu_instance();
+
+    return ret;
+}
@@ -0,0 +1,220 @@
+// time budget benchmark, settings picked by RealCUGANBudget and the quality they cost
+//
+// budgets are fractions of the time of a full quality run, every row reports the syncgap mode,
+// the tiles per quality level, the elapsed time against the budget and the psnr against the full run
+//
+// realcugan-budget-bench -p up2x-no-denoise.param -b up2x-no-denoise.bin [-s 2] [-n 0] [-g 0] [-t 200] [-x] [-f 1,0.5,0.25,0.1] [image.png ...]
+//
+// without images a synthetic photo, manga page and screenshot are generated
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+
+#include "bench_image.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// ncnn
+#include "gpu.h"
+
+#include "realcugan.h"
+
+// psnr of b against reference a over all channels, inf when identical
+static double psnr(const ncnn::Mat& a, const ncnn::Mat& b, size_t size)
+{
+    const unsigned char* pa = (const unsigned char*)a.data;
+    const unsigned char* pb = (const unsigned char*)b.data;
+
+    double sse = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        double d = (double)pa[i] - pb[i];
+        sse += d * d;
+    }
+
+    if (sse == 0)
+        return INFINITY;
+
+    return 10.0 * log10(255.0 * 255.0 * size / sse);
+}
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: realcugan-budget-bench -p param -b bin [options] [image ...]\n");
+    fprintf(stderr, "  -s scale      upscale ratio (2, 3, 4, default=2)\n");
+    fprintf(stderr, "  -n noise      denoise level (-1/0/1/2/3, default=0)\n");
+    fprintf(stderr, "  -g gpu-id     gpu device to use (-1=cpu, default=0)\n");
+    fprintf(stderr, "  -t tile-size  tile size (>=32, default=200)\n");
+    fprintf(stderr, "  -x            full quality is tta\n");
+    fprintf(stderr, "  -f fractions  comma separated budgets relative to the full quality run (default=1,0.5,0.25,0.1)\n");
+}
+
+int main(int argc, char** argv)
+{
+    typedef std::chrono::steady_clock clock;
+
+    const char* parampath = 0;
+    const char* modelpath = 0;
+    int scale = 2;
+    int noise = 0;
+    int gpuid = 0;
+    int tilesize = 200;
+    bool tta_mode = false;
+    std::vector<double> fractions;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:b:s:n:g:t:xf:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            parampath = optarg;
+            break;
+        case 'b':
+            modelpath = optarg;
+            break;
+        case 's':
+            scale = atoi(optarg);
+            break;
+        case 'n':
+            noise = atoi(optarg);
+            break;
+        case 'g':
+            gpuid = atoi(optarg);
+            break;
+        case 't':
+            tilesize = atoi(optarg);
+            break;
+        case 'x':
+            tta_mode = true;
+            break;
+        case 'f':
+        {
+            const char* p = optarg;
+            while (*p)
+            {
+                char* end = 0;
+                double v = strtod(p, &end);
+                if (end == p || v <= 0.0)
+                {
+                    print_usage();
+                    return -1;
+                }
+                fractions.push_back(v);
+                p = *end == ',' ? end + 1 : end;
+            }
+            break;
+        }
+        case 'h':
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (!parampath || !modelpath || scale < 2 || scale > 4 || tilesize < 32)
+    {
+        print_usage();
+        return -1;
+    }
+
+    if (fractions.empty())
+    {
+        fractions.push_back(1.0);
+        fractions.push_back(0.5);
+        fractions.push_back(0.25);
+        fractions.push_back(0.1);
+    }
+
+    std::vector<BenchImage> images;
+    for (int i = optind; i < argc; i++)
+    {
+        BenchImage im;
+        if (load_image(argv[i], im) != 0)
+            return -1;
+        images.push_back(im);
+    }
+    if (images.empty())
+    {
+        images.push_back(make_photo());
+        images.push_back(make_manga_page());
+        images.push_back(make_screenshot());
+    }
+
+    if (gpuid != -1)
+        ncnn::create_gpu_instance();
+
+    int ret = 0;
+    {
+        RealCUGAN realcugan(gpuid, tta_mode);
+        realcugan.noise = noise;
+        realcugan.scale = scale;
+        realcugan.tilesize = tilesize;
+        realcugan.syncgap = 0;
+        realcugan.prepadding = scale == 2 ? 18 : scale == 3 ? 14 : 19;
+        // measure inference, not tile reuse
+        realcugan.tile_dedup = false;
+
+        if (realcugan.load(parampath, modelpath) != 0)
+        {
+            fprintf(stderr, "load %s %s failed\n", parampath, modelpath);
+            ret = -1;
+        }
+
+        RealCUGANBudget budget(realcugan);
+
+        fprintf(stdout, "%-32s %8s %10s %7s %13s %10s %10s %10s\n", "image", "budget", "budget ms", "syncgap", "tta/1/bicubic", "predicted", "ms", "psnr dB");
+
+        for (size_t i = 0; i < images.size() && ret == 0; i++)
+        {
+            const BenchImage& im = images[i];
+            const size_t outsize = (size_t)im.w * scale * im.h * scale * im.c;
+
+            ncnn::Mat inimage(im.w, im.h, (void*)im.pixels.data(), (size_t)im.c, im.c);
+            ncnn::Mat reference(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+            ncnn::Mat out(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+
+            // warm up pipelines and allocators, then time the full quality reference
+            realcugan.process(inimage, reference);
+
+            clock::time_point t0 = clock::now();
+            realcugan.process(inimage, reference);
+            const double full_ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+
+            fprintf(stdout, "%-32s %8s %10.1f %7d %13s %10s %10.1f %10s\n", im.name.c_str(), "full", full_ms, 0, "-", "-", full_ms, "ref");
+
+            // one unlimited call so the first budget already has timings to predict with
+            budget.process(inimage, out, 1e9);
+
+            for (size_t j = 0; j < fractions.size() && ret == 0; j++)
+            {
+                const double budget_ms = full_ms * fractions[j];
+
+                if (budget.process(inimage, out, budget_ms) != 0)
+                {
+                    fprintf(stderr, "budget process failed\n");
+                    ret = -1;
+                    break;
+                }
+
+                const RealCUGANQuality& used = budget.used;
+
+                char levels[32];
+                snprintf(levels, sizeof(levels), "%d/%d/%d", used.tta, used.single, used.bicubic);
+
+                fprintf(stdout, "%-32s %7.0f%% %10.1f %7d %13s %10.1f %10.1f %10.2f%s\n", im.name.c_str(), fractions[j] * 100, budget_ms, used.syncgap, levels, used.predicted_ms, used.elapsed_ms, psnr(reference, out, outsize), used.elapsed_ms > budget_ms ? "  over" : "");
+            }
+        }
+    }
+
+    if (gpuid != -1)
+        ncnn::destroy_gpu_instance();
+
+    return ret;
+}
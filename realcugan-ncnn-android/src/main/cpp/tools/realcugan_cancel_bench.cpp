@@ -0,0 +1,213 @@
+// cancellation latency benchmark, time from RealCUGANCancel::cancel() to the return of process()
+//
+// the latency should stay below the time of one tile, a plain run after every cancelled one
+// checks that the allocators were handed back and the output is still exact
+//
+// realcugan-cancel-bench -p up2x-no-denoise.param -b up2x-no-denoise.bin [-s 2] [-n 0] [-g 0] [-t 200] [-c 3] [-N 8] [image.png ...]
+//
+// without images a synthetic 2048x2048 photo is generated
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "bench_image.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// ncnn
+#include "gpu.h"
+
+#include "realcugan.h"
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: realcugan-cancel-bench -p param -b bin [options] [image ...]\n");
+    fprintf(stderr, "  -s scale     upscale ratio (2, 3, 4, default=2)\n");
+    fprintf(stderr, "  -n noise     denoise level (-1/0/1/2/3, default=0)\n");
+    fprintf(stderr, "  -g gpu-id    gpu device to use (-1=cpu, default=0)\n");
+    fprintf(stderr, "  -t tile-size tile size (>=32, default=200)\n");
+    fprintf(stderr, "  -c syncgap   sync gap mode (0/1/2/3, default=3)\n");
+    fprintf(stderr, "  -N count     cancellations per image, spread over the run (default=8)\n");
+}
+
+int main(int argc, char** argv)
+{
+    typedef std::chrono::steady_clock clock;
+
+    const char* parampath = 0;
+    const char* modelpath = 0;
+    int scale = 2;
+    int noise = 0;
+    int gpuid = 0;
+    int tilesize = 200;
+    int syncgap = 3;
+    int count = 8;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:b:s:n:g:t:c:N:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            parampath = optarg;
+            break;
+        case 'b':
+            modelpath = optarg;
+            break;
+        case 's':
+            scale = atoi(optarg);
+            break;
+        case 'n':
+            noise = atoi(optarg);
+            break;
+        case 'g':
+            gpuid = atoi(optarg);
+            break;
+        case 't':
+            tilesize = atoi(optarg);
+            break;
+        case 'c':
+            syncgap = atoi(optarg);
+            break;
+        case 'N':
+            count = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (!parampath || !modelpath || scale < 2 || scale > 4 || tilesize < 32 || count < 1)
+    {
+        print_usage();
+        return -1;
+    }
+
+    std::vector<BenchImage> images;
+    for (int i = optind; i < argc; i++)
+    {
+        BenchImage im;
+        if (load_image(argv[i], im) != 0)
+            return -1;
+        images.push_back(im);
+    }
+    if (images.empty())
+    {
+        // tile the photo up to a size with many tiles
+        BenchImage photo = make_photo();
+        BenchImage im;
+        im.name = "photo 2048x2048";
+        im.w = 2048;
+        im.h = 2048;
+        im.c = photo.c;
+        im.pixels.resize((size_t)im.w * im.h * im.c);
+        for (int y = 0; y < im.h; y++)
+        {
+            for (int x = 0; x < im.w; x++)
+            {
+                memcpy(&im.pixels[((size_t)y * im.w + x) * im.c], &photo.pixels[((size_t)(y % photo.h) * photo.w + x % photo.w) * photo.c], photo.c);
+            }
+        }
+        images.push_back(im);
+    }
+
+    if (gpuid != -1)
+        ncnn::create_gpu_instance();
+
+    int ret = 0;
+    {
+        RealCUGAN realcugan(gpuid, false);
+        realcugan.noise = noise;
+        realcugan.scale = scale;
+        realcugan.tilesize = tilesize;
+        realcugan.syncgap = syncgap;
+        realcugan.prepadding = scale == 2 ? 18 : scale == 3 ? 14 : 19;
+        // every run computes every tile
+        realcugan.tile_dedup = false;
+
+        if (realcugan.load(parampath, modelpath) != 0)
+        {
+            fprintf(stderr, "load %s %s failed\n", parampath, modelpath);
+            ret = -1;
+        }
+
+        fprintf(stdout, "%-24s %6s %10s %10s %9s %10s %10s %9s\n", "image", "tiles", "run ms", "tile ms", "cancelled", "mean ms", "max ms", "identical");
+
+        for (size_t i = 0; i < images.size() && ret == 0; i++)
+        {
+            const BenchImage& im = images[i];
+            const size_t outsize = (size_t)im.w * scale * im.h * scale * im.c;
+
+            ncnn::Mat inimage(im.w, im.h, (void*)im.pixels.data(), (size_t)im.c, im.c);
+            ncnn::Mat reference(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+            ncnn::Mat out(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+
+            // warm up pipelines and allocators
+            realcugan.process(inimage, reference);
+
+            RealCUGANTileStats stats;
+            clock::time_point t0 = clock::now();
+            realcugan.process(inimage, reference, stats);
+            const double run_ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+
+            // whole run per output tile, SE stage passes over a tile are shorter than this
+            const double tile_ms = stats.total > 0 ? run_ms / stats.total : run_ms;
+
+            int cancelled = 0;
+            double sum_ms = 0;
+            double max_ms = 0;
+            bool identical = true;
+
+            for (int k = 0; k < count && ret == 0; k++)
+            {
+                RealCUGANCancel cancel;
+
+                int result = 0;
+                std::thread worker([&]() {
+                    result = realcugan.process(inimage, out, cancel);
+                });
+
+                std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(run_ms * (k + 0.5) / count));
+
+                clock::time_point tc = clock::now();
+                cancel.cancel();
+                worker.join();
+                double latency_ms = std::chrono::duration<double, std::milli>(clock::now() - tc).count();
+
+                if (result != REALCUGAN_CANCELLED)
+                {
+                    // finished before the cancel arrived
+                    continue;
+                }
+
+                cancelled++;
+                sum_ms += latency_ms;
+                max_ms = std::max(max_ms, latency_ms);
+
+                // the next call must find its allocators and produce the same output
+                realcugan.process(inimage, out);
+                if (memcmp(reference.data, out.data, outsize) != 0)
+                    identical = false;
+            }
+
+            fprintf(stdout, "%-24s %6d %10.1f %10.1f %5d/%-3d %10.1f %10.1f %9s\n", im.name.c_str(), stats.total, run_ms, tile_ms, cancelled, count, cancelled ? sum_ms / cancelled : 0.0, max_ms, identical ? "yes" : "NO");
+
+            if (!identical)
+                ret = -1;
+        }
+    }
+
+    if (gpuid != -1)
+        ncnn::destroy_gpu_instance();
+
+    return ret;
+}
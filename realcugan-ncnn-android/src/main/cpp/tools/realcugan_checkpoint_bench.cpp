@@ -0,0 +1,261 @@
+// checkpoint overhead and resume exactness benchmark for long single-image jobs
+//
+// the output goes into a MappedImage like processToFile, checkpoints sync the mapping before every save
+//
+// realcugan-checkpoint-bench -p up2x-no-denoise.param -b up2x-no-denoise.bin [-s 2] [-n 0] [-g 0] [-t 200] [-c 3] [-o out.raw] [image.png ...]
+//
+// without images a synthetic 2048x2048 photo is generated
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "bench_image.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// ncnn
+#include "gpu.h"
+
+#include "realcugan.h"
+#include "mapped_image.h"
+
+static int copy_file(const std::string& from, const std::string& to)
+{
+    FILE* fi = fopen(from.c_str(), "rb");
+    if (!fi)
+        return -1;
+
+    FILE* fo = fopen(to.c_str(), "wb");
+    if (!fo)
+    {
+        fclose(fi);
+        return -1;
+    }
+
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fi)) > 0)
+        fwrite(buf, 1, n, fo);
+
+    fclose(fi);
+    return fclose(fo) == 0 ? 0 : -1;
+}
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: realcugan-checkpoint-bench -p param -b bin [options] [image ...]\n");
+    fprintf(stderr, "  -s scale     upscale ratio (2, 3, 4, default=2)\n");
+    fprintf(stderr, "  -n noise     denoise level (-1/0/1/2/3, default=0)\n");
+    fprintf(stderr, "  -g gpu-id    gpu device to use (-1=cpu, default=0)\n");
+    fprintf(stderr, "  -t tile-size tile size (>=32, default=200)\n");
+    fprintf(stderr, "  -c syncgap   sync gap mode (0/1/2/3, default=3)\n");
+    fprintf(stderr, "  -o out-path  mapped output file (default=checkpoint-bench.raw)\n");
+}
+
+int main(int argc, char** argv)
+{
+    typedef std::chrono::steady_clock clock;
+
+    const char* parampath = 0;
+    const char* modelpath = 0;
+    int scale = 2;
+    int noise = 0;
+    int gpuid = 0;
+    int tilesize = 200;
+    int syncgap = 3;
+    std::string outpath = "checkpoint-bench.raw";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:b:s:n:g:t:c:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            parampath = optarg;
+            break;
+        case 'b':
+            modelpath = optarg;
+            break;
+        case 's':
+            scale = atoi(optarg);
+            break;
+        case 'n':
+            noise = atoi(optarg);
+            break;
+        case 'g':
+            gpuid = atoi(optarg);
+            break;
+        case 't':
+            tilesize = atoi(optarg);
+            break;
+        case 'c':
+            syncgap = atoi(optarg);
+            break;
+        case 'o':
+            outpath = optarg;
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (!parampath || !modelpath || scale < 2 || scale > 4 || tilesize < 32)
+    {
+        print_usage();
+        return -1;
+    }
+
+    std::vector<BenchImage> images;
+    for (int i = optind; i < argc; i++)
+    {
+        BenchImage im;
+        if (load_image(argv[i], im) != 0)
+            return -1;
+        images.push_back(im);
+    }
+    if (images.empty())
+    {
+        // tile the photo up to a size worth checkpointing
+        BenchImage photo = make_photo();
+        BenchImage im;
+        im.name = "photo 2048x2048";
+        im.w = 2048;
+        im.h = 2048;
+        im.c = photo.c;
+        im.pixels.resize((size_t)im.w * im.h * im.c);
+        for (int y = 0; y < im.h; y++)
+        {
+            for (int x = 0; x < im.w; x++)
+            {
+                memcpy(&im.pixels[((size_t)y * im.w + x) * im.c], &photo.pixels[((size_t)(y % photo.h) * photo.w + x % photo.w) * photo.c], photo.c);
+            }
+        }
+        images.push_back(im);
+    }
+
+    if (gpuid != -1)
+        ncnn::create_gpu_instance();
+
+    const std::string ckptpath = outpath + ".ckpt";
+    const std::string killpath = outpath + ".ckpt.kill";
+
+    int ret = 0;
+    {
+        RealCUGAN realcugan(gpuid, false);
+        realcugan.noise = noise;
+        realcugan.scale = scale;
+        realcugan.tilesize = tilesize;
+        realcugan.syncgap = syncgap;
+        realcugan.prepadding = scale == 2 ? 18 : scale == 3 ? 14 : 19;
+        // every band is recomputed, resume must not lean on the tile cache
+        realcugan.tile_dedup = false;
+
+        if (realcugan.load(parampath, modelpath) != 0)
+        {
+            fprintf(stderr, "load %s %s failed\n", parampath, modelpath);
+            ret = -1;
+        }
+
+        fprintf(stdout, "%-24s %9s %10s %6s %10s %9s %8s %9s\n", "image", "interval", "ms", "saves", "save ms", "overhead", "resumed", "identical");
+
+        for (size_t i = 0; i < images.size() && ret == 0; i++)
+        {
+            const BenchImage& im = images[i];
+            const size_t outsize = (size_t)im.w * scale * im.h * scale * im.c;
+
+            ncnn::Mat inimage(im.w, im.h, (void*)im.pixels.data(), (size_t)im.c, im.c);
+            ncnn::Mat reference(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+
+            // warm up pipelines and allocators
+            realcugan.process(inimage, reference);
+
+            MappedImage mapped;
+            if (mapped.create(outpath, im.w * scale, im.h * scale, im.c) != 0)
+            {
+                ret = -1;
+                break;
+            }
+            ncnn::Mat out = mapped.mat();
+
+            clock::time_point t0 = clock::now();
+            realcugan.process(inimage, out);
+            double plain_ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+            memcpy(reference.data, out.data, outsize);
+
+            fprintf(stdout, "%-24s %9s %10.1f %6d %10.1f %9s %8s %9s\n", im.name.c_str(), "off", plain_ms, 0, 0.0, "ref", "-", "ref");
+
+            // every band and the app default, nothing fails so the checkpoint is pure overhead
+            const double intervals[2] = {0.0, 5.0};
+            for (int j = 0; j < 2; j++)
+            {
+                RealCUGANCheckpoint job(realcugan, ckptpath);
+                job.interval = intervals[j];
+                job.flush = [&mapped]() { return mapped.sync(); };
+
+                // keep the checkpoint of the second save to resume from below
+                int flushes = 0;
+                if (j == 0)
+                {
+                    job.flush = [&]() {
+                        if (++flushes == 3)
+                            copy_file(ckptpath, killpath);
+                        return mapped.sync();
+                    };
+                }
+
+                t0 = clock::now();
+                job.process(inimage, out);
+                double ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+
+                bool identical = memcmp(reference.data, out.data, outsize) == 0;
+
+                fprintf(stdout, "%-24s %8.1fs %10.1f %6d %10.1f %8.2f%% %8s %9s\n", im.name.c_str(), intervals[j], ms, job.saves, job.save_ms, plain_ms > 0 ? 100.0 * (ms - plain_ms) / plain_ms : 0.0, "-", identical ? "yes" : "NO");
+
+                if (!identical)
+                    ret = -1;
+            }
+
+            // simulate a kill after the second save, the bands past it never reached the file
+            if (ret == 0 && copy_file(killpath, ckptpath) == 0)
+            {
+                RealCUGANCheckpoint job(realcugan, ckptpath);
+                job.flush = [&mapped]() { return mapped.sync(); };
+
+                memset(out.data, 0x5a, outsize);
+
+                t0 = clock::now();
+                job.process(inimage, out);
+                double ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+
+                // a real kill leaves the bands before the resume point in the file, put them back
+                const size_t kept = (size_t)job.resumed_band * tilesize * scale * im.w * scale * im.c;
+                memcpy(out.data, reference.data, std::min(kept, outsize));
+
+                bool identical = memcmp(reference.data, out.data, outsize) == 0;
+
+                fprintf(stdout, "%-24s %9s %10.1f %6d %10.1f %9s %8d %9s\n", im.name.c_str(), "resume", ms, job.saves, job.save_ms, "-", job.resumed_band, identical ? "yes" : "NO");
+
+                if (job.resumed_band == 0 || !identical)
+                    ret = -1;
+            }
+
+            remove(killpath.c_str());
+            remove(ckptpath.c_str());
+            mapped.close();
+        }
+    }
+
+    if (gpuid != -1)
+        ncnn::destroy_gpu_instance();
+
+    return ret;
+}
@@ -0,0 +1,434 @@
+// command line upscaler for single images and whole directories, as the desktop realcugan-ncnn-vulkan
+//
+// realcugan-ncnn -i input-dir -o output-dir -m models-se [-n -1] [-s 2] [-t 0] [-c 3] [-g 0] [-j 1:2:2] [-f png] [-T trace.json]
+//
+// directory mode skips outputs that already exist, an interrupted run continues where it stopped
+// -T writes the timeline of the last tiles and stages of the run as chrome trace_event json
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_NO_PSD
+#define STBI_NO_TGA
+#define STBI_NO_GIF
+#define STBI_NO_HDR
+#define STBI_NO_PIC
+#define STBI_NO_STDIO
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#include "webp_image.h"
+
+// ncnn
+#include "gpu.h"
+
+#include "realcugan.h"
+#include "batch_pipeline.h"
+#include "filesystem_utils.h"
+#include "trace.h"
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: realcugan-ncnn -i infile -o outfile [options]...\n\n");
+    fprintf(stderr, "  -h                   show this help\n");
+    fprintf(stderr, "  -v                   verbose output\n");
+    fprintf(stderr, "  -i input-path        input image path (jpg/png/webp) or directory\n");
+    fprintf(stderr, "  -o output-path       output image path (jpg/png/webp) or directory\n");
+    fprintf(stderr, "  -n noise-level       denoise level (-1/0/1/2/3, default=-1)\n");
+    fprintf(stderr, "  -s scale             upscale ratio (2/3/4, default=2)\n");
+    fprintf(stderr, "  -t tile-size         tile size (>=32/0=auto, default=0)\n");
+    fprintf(stderr, "  -c syncgap-mode      sync gap mode (0/1/2/3, default=3)\n");
+    fprintf(stderr, "  -m model-path        realcugan model path (default=models-se)\n");
+    fprintf(stderr, "  -g gpu-id            gpu device to use (-1=cpu, default=auto)\n");
+    fprintf(stderr, "  -j load:proc:save    thread count for load/proc/save (default=1:2:2)\n");
+    fprintf(stderr, "  -x                   enable tta mode\n");
+    fprintf(stderr, "  -f format            output image format (jpg/png/webp, default=ext/png)\n");
+    fprintf(stderr, "  -T trace-path        write a chrome trace_event timeline, open in ui.perfetto.dev\n");
+}
+
+// webp first, then whatever stb understands, gray images expanded to 3/4 channels
+static int load_image(const path_t& path, ncnn::Mat& image)
+{
+    std::vector<unsigned char> buf;
+    {
+        FILE* fp = fopen(path.c_str(), "rb");
+        if (!fp)
+        {
+            fprintf(stderr, "open %s failed\n", path.c_str());
+            return -1;
+        }
+
+        fseek(fp, 0, SEEK_END);
+        long length = ftell(fp);
+        rewind(fp);
+
+        buf.resize(length > 0 ? length : 0);
+        size_t nread = fread(buf.data(), 1, buf.size(), fp);
+        fclose(fp);
+
+        if (buf.empty() || nread != buf.size())
+        {
+            fprintf(stderr, "read %s failed\n", path.c_str());
+            return -1;
+        }
+    }
+
+    int w = 0;
+    int h = 0;
+    int c = 0;
+    unsigned char* pixeldata = webp_load(buf.data(), (int)buf.size(), &w, &h, &c);
+    if (!pixeldata)
+    {
+        pixeldata = stbi_load_from_memory(buf.data(), (int)buf.size(), &w, &h, &c, 0);
+        if (pixeldata && (c == 1 || c == 2))
+        {
+            int want = c == 1 ? 3 : 4;
+            stbi_image_free(pixeldata);
+            pixeldata = stbi_load_from_memory(buf.data(), (int)buf.size(), &w, &h, &c, want);
+            c = want;
+        }
+    }
+    if (!pixeldata)
+    {
+        fprintf(stderr, "decode image %s failed\n", path.c_str());
+        return -1;
+    }
+
+    image.create(w, h, (size_t)c, c);
+    if (!image.empty())
+        memcpy(image.data, pixeldata, (size_t)w * h * c);
+    free(pixeldata);
+
+    return image.empty() ? -100 : 0;
+}
+
+// written under a temporary name and renamed, a killed run never leaves a half written output behind
+static int save_image(const path_t& path, const path_t& format, const ncnn::Mat& image)
+{
+    const path_t partpath = path + PATHSTR(".part");
+    const int c = image.elempack;
+
+    int success = 0;
+    if (format == PATHSTR("webp"))
+    {
+        success = webp_save(partpath.c_str(), image.w, image.h, c, (const unsigned char*)image.data);
+    }
+    else if (format == PATHSTR("png"))
+    {
+        success = stbi_write_png(partpath.c_str(), image.w, image.h, c, image.data, 0);
+    }
+    else if (format == PATHSTR("jpg"))
+    {
+        success = stbi_write_jpg(partpath.c_str(), image.w, image.h, c, image.data, 100);
+    }
+
+    if (!success || rename(partpath.c_str(), path.c_str()) != 0)
+    {
+        fprintf(stderr, "encode image %s failed\n", path.c_str());
+        unlink(partpath.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+static bool output_done(const path_t& path)
+{
+    struct stat s;
+    return stat(path.c_str(), &s) == 0 && S_ISREG(s.st_mode) && s.st_size > 0;
+}
+
+int main(int argc, char** argv)
+{
+    path_t inputpath;
+    path_t outputpath;
+    int noise = -1;
+    int scale = 2;
+    int tilesize = 0;
+    int syncgap = 3;
+    path_t model = PATHSTR("models-se");
+    int gpuid = -2;
+    int jobs_load = 1;
+    int jobs_proc = 2;
+    int jobs_save = 2;
+    int verbose = 0;
+    int tta_mode = 0;
+    path_t format = PATHSTR("png");
+    const char* tracepath = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:o:n:s:t:c:m:g:j:f:T:vxh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            inputpath = optarg;
+            break;
+        case 'o':
+            outputpath = optarg;
+            break;
+        case 'n':
+            noise = atoi(optarg);
+            break;
+        case 's':
+            scale = atoi(optarg);
+            break;
+        case 't':
+            tilesize = atoi(optarg);
+            break;
+        case 'c':
+            syncgap = atoi(optarg);
+            break;
+        case 'm':
+            model = optarg;
+            break;
+        case 'g':
+            gpuid = atoi(optarg);
+            break;
+        case 'j':
+            sscanf(optarg, "%d:%d:%d", &jobs_load, &jobs_proc, &jobs_save);
+            break;
+        case 'f':
+            format = optarg;
+            break;
+        case 'T':
+            tracepath = optarg;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'x':
+            tta_mode = 1;
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (inputpath.empty() || outputpath.empty())
+    {
+        print_usage();
+        return -1;
+    }
+
+    if (noise < -1 || noise > 3 || scale < 2 || scale > 4 || syncgap < 0 || syncgap > 3)
+    {
+        fprintf(stderr, "invalid noise, scale or syncgap argument\n");
+        return -1;
+    }
+
+    if (tilesize != 0 && tilesize < 32)
+    {
+        fprintf(stderr, "invalid tilesize argument\n");
+        return -1;
+    }
+
+    if (jobs_load < 1 || jobs_proc < 1 || jobs_save < 1)
+    {
+        fprintf(stderr, "invalid thread count argument\n");
+        return -1;
+    }
+
+    // collect input and output path pairs
+    std::vector<path_t> input_files;
+    std::vector<path_t> output_files;
+    int skipped = 0;
+    if (path_is_directory(inputpath))
+    {
+        if (!path_is_directory(outputpath))
+        {
+            fprintf(stderr, "output path %s must be an existing directory\n", outputpath.c_str());
+            return -1;
+        }
+
+        if (format != PATHSTR("png") && format != PATHSTR("webp") && format != PATHSTR("jpg"))
+        {
+            fprintf(stderr, "invalid format argument\n");
+            return -1;
+        }
+
+        std::vector<path_t> filenames;
+        if (list_directory(inputpath, filenames) != 0)
+            return -1;
+
+        for (size_t i = 0; i < filenames.size(); i++)
+        {
+            const path_t out = outputpath + PATHSTR('/') + get_file_name_without_extension(filenames[i]) + PATHSTR('.') + format;
+
+            // finished by an earlier run
+            if (output_done(out))
+            {
+                skipped++;
+                continue;
+            }
+
+            input_files.push_back(inputpath + PATHSTR('/') + filenames[i]);
+            output_files.push_back(out);
+        }
+    }
+    else
+    {
+        path_t ext = get_file_extension(outputpath);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (ext == PATHSTR("png") || ext == PATHSTR("webp"))
+            format = ext;
+        else if (ext == PATHSTR("jpg") || ext == PATHSTR("jpeg"))
+            format = PATHSTR("jpg");
+        else
+        {
+            fprintf(stderr, "invalid outputpath extension type\n");
+            return -1;
+        }
+
+        input_files.push_back(inputpath);
+        output_files.push_back(outputpath);
+    }
+
+    char parampath[256];
+    char modelpath[256];
+    if (noise == -1)
+    {
+        sprintf(parampath, "%s/up%dx-conservative.param", model.c_str(), scale);
+        sprintf(modelpath, "%s/up%dx-conservative.bin", model.c_str(), scale);
+    }
+    else if (noise == 0)
+    {
+        sprintf(parampath, "%s/up%dx-no-denoise.param", model.c_str(), scale);
+        sprintf(modelpath, "%s/up%dx-no-denoise.bin", model.c_str(), scale);
+    }
+    else
+    {
+        sprintf(parampath, "%s/up%dx-denoise%dx.param", model.c_str(), scale, noise);
+        sprintf(modelpath, "%s/up%dx-denoise%dx.bin", model.c_str(), scale, noise);
+    }
+
+    // the nose model has no SE blocks
+    if (model.find(PATHSTR("models-nose")) != path_t::npos)
+        syncgap = 0;
+
+    const int prepadding = scale == 2 ? 18 : scale == 3 ? 14 : 19;
+
+    ncnn::create_gpu_instance();
+
+    if (gpuid == -2)
+        gpuid = ncnn::get_default_gpu_index();
+
+    if (gpuid < -1 || gpuid >= ncnn::get_gpu_count())
+    {
+        fprintf(stderr, "invalid gpu device\n");
+        ncnn::destroy_gpu_instance();
+        return -1;
+    }
+
+    if (tilesize == 0)
+    {
+        tilesize = 200;
+        if (gpuid != -1)
+        {
+            uint32_t heap_budget = ncnn::get_gpu_device(gpuid)->get_heap_budget();
+            if (scale == 2)
+                tilesize = heap_budget > 1300 ? 400 : heap_budget > 800 ? 300 : heap_budget > 400 ? 200 : heap_budget > 200 ? 100 : 32;
+            else if (scale == 3)
+                tilesize = heap_budget > 3300 ? 400 : heap_budget > 1900 ? 300 : heap_budget > 950 ? 200 : heap_budget > 320 ? 100 : 32;
+            else
+                tilesize = heap_budget > 1690 ? 400 : heap_budget > 980 ? 300 : heap_budget > 530 ? 200 : heap_budget > 240 ? 100 : 32;
+        }
+    }
+
+    // the last million events, about 40 MB
+    TraceBuffer trace;
+    if (tracepath)
+        trace.configure(1 << 20);
+
+    int ret = 0;
+    {
+        RealCUGAN realcugan(gpuid, tta_mode);
+        realcugan.noise = noise;
+        realcugan.scale = scale;
+        realcugan.tilesize = tilesize;
+        realcugan.prepadding = prepadding;
+        realcugan.syncgap = syncgap;
+        realcugan.trace = tracepath ? &trace : 0;
+
+        if (realcugan.load(sanitize_filepath(parampath), sanitize_filepath(modelpath)) != 0)
+        {
+            fprintf(stderr, "load %s %s failed\n", parampath, modelpath);
+            ret = -1;
+        }
+
+        const int total = (int)input_files.size();
+        fprintf(stderr, "%d images to process, %d already done, tilesize %d, threads %d:%d:%d\n", total, skipped, tilesize, jobs_load, jobs_proc, jobs_save);
+
+        std::mutex progress_lock;
+        int done = 0;
+        double outpixels = 0;
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+        BatchPipeline::StageFunc load = [&](BatchTask& task) {
+            return load_image(input_files[task.index], task.inimage);
+        };
+
+        BatchPipeline::StageFunc save = [&](BatchTask& task) {
+            int r = save_image(output_files[task.index], format, task.outimage);
+            if (r != 0)
+                return r;
+
+            std::lock_guard<std::mutex> lg(progress_lock);
+            done++;
+            outpixels += (double)task.outimage.w * task.outimage.h;
+
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            double rate = elapsed > 0 ? done / elapsed : 0;
+            if (verbose)
+            {
+                fprintf(stderr, "[%d/%d] %s -> %s %d x %d\n", done, total, input_files[task.index].c_str(), output_files[task.index].c_str(), task.outimage.w, task.outimage.h);
+            }
+            fprintf(stderr, "[%d/%d] %.2f images/s %.2f Mpix/s eta %.0fs\n", done, total, rate, elapsed > 0 ? outpixels / elapsed / 1e6 : 0.0, rate > 0 ? (total - done) / rate : 0.0);
+            return 0;
+        };
+
+        if (ret == 0 && total > 0)
+        {
+            BatchPipeline pipeline;
+            pipeline.load_threads = jobs_load;
+            pipeline.proc_threads = jobs_proc;
+            pipeline.save_threads = jobs_save;
+            pipeline.trace = tracepath ? &trace : 0;
+
+            std::vector<int> status;
+            ret = pipeline.run(total, load, BatchPipeline::process_stage(realcugan), save, status);
+
+            for (int i = 0; i < total; i++)
+            {
+                if (status[i] != 0)
+                    fprintf(stderr, "failed %s (%d)\n", input_files[i].c_str(), status[i]);
+            }
+
+            const BatchStats& st = pipeline.stats;
+            fprintf(stderr, "%d done %d failed %d skipped in %.1fs, %.2f images/s, busy load %.1fs proc %.1fs save %.1fs\n",
+                    st.succeeded, st.failed, skipped, st.wall_ms / 1000, st.wall_ms > 0 ? st.succeeded * 1000.0 / st.wall_ms : 0.0,
+                    st.load_ms / 1000, st.proc_ms / 1000, st.save_ms / 1000);
+        }
+    }
+
+    ncnn::destroy_gpu_instance();
+
+    if (tracepath)
+    {
+        if (trace.write(tracepath) != 0)
+            ret = -1;
+        else
+            fprintf(stderr, "trace of %d events written to %s, %d dropped\n", (int)trace.size(), tracepath, (int)trace.dropped());
+    }
+
+    return ret;
+}
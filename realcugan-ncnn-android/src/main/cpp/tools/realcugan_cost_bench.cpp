@@ -0,0 +1,206 @@
+// cost model benchmark, RealCUGAN::estimate() against measured runs
+//
+// calibrates on one full and one half tile, then predicts and times images of several sizes
+// in the configured syncgap mode, the time error shows how well flops and per inference overhead explain the runs
+// the measured peaks of the tracking allocators are printed next to the estimated memory
+//
+// realcugan-cost-bench -p up2x-no-denoise.param -b up2x-no-denoise.bin [-s 2] [-n 0] [-g 0] [-t 200] [-c 3] [-x] [-S 256,512,1024,2048] [image.png ...]
+//
+// without images synthetic photos of the -S sizes are generated
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+
+#include "bench_image.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// ncnn
+#include "gpu.h"
+
+#include "memory_tracker.h"
+#include "realcugan.h"
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: realcugan-cost-bench -p param -b bin [options] [image ...]\n");
+    fprintf(stderr, "  -s scale      upscale ratio (2, 3, 4, default=2)\n");
+    fprintf(stderr, "  -n noise      denoise level (-1/0/1/2/3, default=0)\n");
+    fprintf(stderr, "  -g gpu-id     gpu device to use (-1=cpu, default=0)\n");
+    fprintf(stderr, "  -t tile-size  tile size (>=32, default=200)\n");
+    fprintf(stderr, "  -c syncgap    sync gap mode (0/1/2/3, default=3)\n");
+    fprintf(stderr, "  -x            tta mode\n");
+    fprintf(stderr, "  -S sizes      comma separated sides of the synthetic images (default=256,512,1024,2048)\n");
+}
+
+int main(int argc, char** argv)
+{
+    typedef std::chrono::steady_clock clock;
+
+    const char* parampath = 0;
+    const char* modelpath = 0;
+    int scale = 2;
+    int noise = 0;
+    int gpuid = 0;
+    int tilesize = 200;
+    int syncgap = 3;
+    bool tta_mode = false;
+    std::vector<int> sizes;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:b:s:n:g:t:c:xS:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            parampath = optarg;
+            break;
+        case 'b':
+            modelpath = optarg;
+            break;
+        case 's':
+            scale = atoi(optarg);
+            break;
+        case 'n':
+            noise = atoi(optarg);
+            break;
+        case 'g':
+            gpuid = atoi(optarg);
+            break;
+        case 't':
+            tilesize = atoi(optarg);
+            break;
+        case 'c':
+            syncgap = atoi(optarg);
+            break;
+        case 'x':
+            tta_mode = true;
+            break;
+        case 'S':
+        {
+            const char* p = optarg;
+            while (*p)
+            {
+                char* end = 0;
+                long v = strtol(p, &end, 10);
+                if (end == p || v < 16)
+                {
+                    print_usage();
+                    return -1;
+                }
+                sizes.push_back((int)v);
+                p = *end == ',' ? end + 1 : end;
+            }
+            break;
+        }
+        case 'h':
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (!parampath || !modelpath || scale < 2 || scale > 4 || tilesize < 32 || syncgap < 0 || syncgap > 3)
+    {
+        print_usage();
+        return -1;
+    }
+
+    if (sizes.empty())
+    {
+        sizes.push_back(256);
+        sizes.push_back(512);
+        sizes.push_back(1024);
+        sizes.push_back(2048);
+    }
+
+    std::vector<BenchImage> images;
+    for (int i = optind; i < argc; i++)
+    {
+        BenchImage im;
+        if (load_image(argv[i], im) != 0)
+            return -1;
+        images.push_back(im);
+    }
+    if (images.empty())
+    {
+        for (size_t i = 0; i < sizes.size(); i++)
+            images.push_back(make_photo_sized(sizes[i], sizes[i]));
+    }
+
+    if (gpuid != -1)
+        ncnn::create_gpu_instance();
+
+    int ret = 0;
+    {
+        RealCUGAN realcugan(gpuid, tta_mode);
+        realcugan.noise = noise;
+        realcugan.scale = scale;
+        realcugan.tilesize = tilesize;
+        realcugan.syncgap = syncgap;
+        realcugan.prepadding = scale == 2 ? 18 : scale == 3 ? 14 : 19;
+        // the model counts every tile
+        realcugan.tile_dedup = false;
+
+        if (realcugan.load(parampath, modelpath) != 0)
+        {
+            fprintf(stderr, "load %s %s failed\n", parampath, modelpath);
+            ret = -1;
+        }
+
+        if (ret == 0)
+        {
+            clock::time_point t0 = clock::now();
+            ret = realcugan.calibrate();
+            const double calib_ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+
+            if (ret != 0)
+                fprintf(stderr, "calibrate failed %d\n", ret);
+            else
+                fprintf(stdout, "calibrated in %.0f ms, %.2f GFLOPS, %.2f ms per inference\n\n", calib_ms, realcugan.flops_per_ms * 1e-6, realcugan.pass_ms);
+        }
+
+        fprintf(stdout, "%-32s %6s %7s %10s %10s %10s %8s %10s %10s %10s %10s\n", "image", "tiles", "passes", "GFLOP", "predicted", "ms", "error", "host MB", "peak MB", "device MB", "peak MB");
+
+        for (size_t i = 0; i < images.size() && ret == 0; i++)
+        {
+            const BenchImage& im = images[i];
+
+            ncnn::Mat inimage(im.w, im.h, (void*)im.pixels.data(), (size_t)im.c, im.c);
+            ncnn::Mat outimage(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+
+            const RealCUGANEstimate e = realcugan.estimate(im.w, im.h, im.c);
+
+            // warm up the shapes of this image
+            realcugan.process(inimage, outimage);
+
+            MemoryStats memory;
+            clock::time_point t0 = clock::now();
+            ret = realcugan.process(inimage, outimage, memory);
+            const double ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+
+            if (ret != 0)
+            {
+                fprintf(stderr, "process %s failed %d\n", im.name.c_str(), ret);
+                break;
+            }
+
+            // peaks of the timed call, summed over the tags of each side
+            const size_t host_peak = memory.tags[MEMORY_CPU_BLOB].peak + memory.tags[MEMORY_CPU_TILE].peak + memory.tags[MEMORY_OUTPUT].peak;
+            const size_t device_peak = memory.tags[MEMORY_VK_BLOB].peak + memory.tags[MEMORY_VK_STAGING].peak;
+
+            fprintf(stdout, "%-32s %6d %7d %10.1f %10.1f %10.1f %7.1f%% %10.1f %10.1f %10.1f %10.1f\n", im.name.c_str(), e.tiles, e.passes, e.flops * 1e-9, e.time_ms, ms, ms > 0 ? (e.time_ms - ms) * 100 / ms : 0.0, e.host_bytes / 1048576.0, host_peak / 1048576.0, e.device_bytes / 1048576.0, device_peak / 1048576.0);
+        }
+    }
+
+    if (gpuid != -1)
+        ncnn::destroy_gpu_instance();
+
+    return ret;
+}
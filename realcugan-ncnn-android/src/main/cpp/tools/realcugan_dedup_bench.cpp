@@ -0,0 +1,162 @@
+// duplicate tile elimination benchmark on document-like images
+//
+// realcugan-dedup-bench -p up2x-no-denoise.param -b up2x-no-denoise.bin [-s 2] [-n 0] [-g 0] [-t 200] [-x] [image.png ...]
+//
+// without images a synthetic manga page and a screenshot are generated
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+
+#include "bench_image.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// ncnn
+#include "gpu.h"
+
+#include "realcugan.h"
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: realcugan-dedup-bench -p param -b bin [options] [image ...]\n");
+    fprintf(stderr, "  -s scale     upscale ratio (2, 3, 4, default=2)\n");
+    fprintf(stderr, "  -n noise     denoise level (-1/0/1/2/3, default=0)\n");
+    fprintf(stderr, "  -g gpu-id    gpu device to use (-1=cpu, default=0)\n");
+    fprintf(stderr, "  -t tile-size tile size (>=32, default=200)\n");
+    fprintf(stderr, "  -c syncgap   sync gap mode (0/1/2/3, default=0)\n");
+    fprintf(stderr, "  -x           enable tta mode\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* parampath = 0;
+    const char* modelpath = 0;
+    int scale = 2;
+    int noise = 0;
+    int gpuid = 0;
+    int tilesize = 200;
+    int syncgap = 0;
+    bool tta_mode = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:b:s:n:g:t:c:xh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            parampath = optarg;
+            break;
+        case 'b':
+            modelpath = optarg;
+            break;
+        case 's':
+            scale = atoi(optarg);
+            break;
+        case 'n':
+            noise = atoi(optarg);
+            break;
+        case 'g':
+            gpuid = atoi(optarg);
+            break;
+        case 't':
+            tilesize = atoi(optarg);
+            break;
+        case 'c':
+            syncgap = atoi(optarg);
+            break;
+        case 'x':
+            tta_mode = true;
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (!parampath || !modelpath || scale < 2 || scale > 4 || tilesize < 32)
+    {
+        print_usage();
+        return -1;
+    }
+
+    std::vector<BenchImage> images;
+    for (int i = optind; i < argc; i++)
+    {
+        BenchImage im;
+        if (load_image(argv[i], im) != 0)
+            return -1;
+        images.push_back(im);
+    }
+    if (images.empty())
+    {
+        images.push_back(make_manga_page());
+        images.push_back(make_screenshot());
+    }
+
+    if (gpuid != -1)
+        ncnn::create_gpu_instance();
+
+    int ret = 0;
+    {
+        RealCUGAN realcugan(gpuid, tta_mode);
+        realcugan.noise = noise;
+        realcugan.scale = scale;
+        realcugan.tilesize = tilesize;
+        realcugan.syncgap = syncgap;
+        realcugan.prepadding = scale == 2 ? 18 : scale == 3 ? 14 : 19;
+
+        if (realcugan.load(parampath, modelpath) != 0)
+        {
+            fprintf(stderr, "load %s %s failed\n", parampath, modelpath);
+            ret = -1;
+        }
+
+        fprintf(stdout, "%-32s %6s %8s %9s %7s %7s %10s %10s %8s %9s\n", "image", "tiles", "computed", "duplicate", "uniform", "skipped", "base ms", "dedup ms", "speedup", "identical");
+
+        for (size_t i = 0; i < images.size() && ret == 0; i++)
+        {
+            const BenchImage& im = images[i];
+
+            ncnn::Mat inimage(im.w, im.h, (void*)im.pixels.data(), (size_t)im.c, im.c);
+            ncnn::Mat outbase(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+            ncnn::Mat outdedup(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+
+            // warm up pipelines and allocators
+            RealCUGANTileStats stats;
+            realcugan.tile_dedup = false;
+            realcugan.process(inimage, outbase, stats);
+
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            realcugan.process(inimage, outbase, stats);
+            std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+            realcugan.tile_dedup = true;
+            realcugan.process(inimage, outdedup, stats);
+            std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+            double base_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+            double dedup_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+
+            bool identical = memcmp(outbase.data, outdedup.data, (size_t)im.w * scale * im.h * scale * im.c) == 0;
+
+            fprintf(stdout, "%-32s %6d %8d %9d %7d %6.1f%% %10.1f %10.1f %7.2fx %9s\n",
+                    im.name.c_str(), stats.total, stats.computed, stats.duplicate, stats.uniform,
+                    stats.total ? 100.0 * (stats.total - stats.computed) / stats.total : 0.0,
+                    base_ms, dedup_ms, dedup_ms > 0 ? base_ms / dedup_ms : 0.0, identical ? "yes" : "NO");
+
+            if (!identical && syncgap == 0)
+                ret = -1;
+        }
+    }
+
+    if (gpuid != -1)
+        ncnn::destroy_gpu_instance();
+
+    return ret;
+}
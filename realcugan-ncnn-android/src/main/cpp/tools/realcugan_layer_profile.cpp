@@ -0,0 +1,256 @@
+// per layer profile of the models, roofline style
+//
+// times the forward of every layer on its own over one padded tile and relates it to the layer flops and the bytes
+// of its weights and blobs, the roof is given with -P and -B or taken from the best layers of each model
+//
+// realcugan-layer-profile [-g 0] [-t 200] [-l 5] [-P gflops] [-B gbps] models-dir|model.param ...
+//
+// a directory is searched for .param files one level deep, so assets/models covers models-se, models-nose and models-pro
+// with vulkan the time of a layer is the wall time of its own submit and wait less an empty one, not a device timestamp,
+// so dispatch and sync overhead stay in it and the small layers look slower than they run inside the whole net
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+// ncnn
+#include "gpu.h"
+
+#include "realcugan.h"
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: realcugan-layer-profile [options] models-dir|model.param ...\n");
+    fprintf(stderr, "  -g gpu-id     gpu device to use (-1=cpu, default=0)\n");
+    fprintf(stderr, "  -t tile-size  tile size (>=32, default=200), the network input adds the prepadding\n");
+    fprintf(stderr, "  -l loops      timed runs per layer, the best counts (default=5)\n");
+    fprintf(stderr, "  -P gflops     peak compute of the roof (default=best layer of the model)\n");
+    fprintf(stderr, "  -B gbps       peak bandwidth of the roof (default=best layer of the model)\n");
+}
+
+static bool has_suffix(const std::string& s, const char* suffix)
+{
+    const size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+static bool is_directory(const std::string& path)
+{
+    struct stat s;
+    return stat(path.c_str(), &s) == 0 && S_ISDIR(s.st_mode);
+}
+
+static void collect_params(const std::string& path, std::vector<std::string>& params, int depth)
+{
+    if (!is_directory(path))
+    {
+        if (has_suffix(path, ".param"))
+            params.push_back(path);
+        return;
+    }
+
+    DIR* dir = opendir(path.c_str());
+    if (!dir)
+    {
+        fprintf(stderr, "opendir failed %s\n", path.c_str());
+        return;
+    }
+
+    std::vector<std::string> names;
+    struct dirent* ent = 0;
+    while ((ent = readdir(dir)))
+    {
+        if (ent->d_name[0] != '.')
+            names.push_back(ent->d_name);
+    }
+    closedir(dir);
+
+    std::sort(names.begin(), names.end());
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        const std::string sub = path + "/" + names[i];
+        if (has_suffix(names[i], ".param"))
+            params.push_back(sub);
+        else if (depth > 0 && is_directory(sub))
+            collect_params(sub, params, depth - 1);
+    }
+}
+
+static int profile_model(const std::string& parampath, int gpuid, int tilesize, int loops, double peak_gflops, double peak_gbps)
+{
+    const std::string modelpath = parampath.substr(0, parampath.size() - 6) + ".bin";
+
+    // up2x-no-denoise.param
+    int scale = 2;
+    const size_t pos = parampath.rfind("up");
+    if (pos != std::string::npos)
+        sscanf(parampath.c_str() + pos, "up%dx", &scale);
+    if (scale < 1 || scale > 4)
+        scale = 2;
+
+    RealCUGAN realcugan(gpuid, false);
+    realcugan.noise = 0;
+    realcugan.scale = scale;
+    realcugan.tilesize = tilesize;
+    realcugan.prepadding = scale == 2 ? 18 : scale == 3 ? 14 : 19;
+
+    if (realcugan.load(parampath, modelpath) != 0)
+    {
+        fprintf(stderr, "load %s %s failed\n", parampath.c_str(), modelpath.c_str());
+        return -1;
+    }
+
+    const int in_size = tilesize + realcugan.prepadding * 2;
+
+    std::vector<RealCUGANLayerProfile> profile;
+    int ret = realcugan.profile_layers(in_size, profile, loops);
+    if (ret != 0)
+    {
+        fprintf(stderr, "profile %s failed %d\n", parampath.c_str(), ret);
+        return ret;
+    }
+
+    double total_ms = 0;
+    double total_flops = 0;
+    double total_bytes = 0;
+    double best_gflops = 0;
+    double best_gbps = 0;
+    for (size_t i = 0; i < profile.size(); i++)
+    {
+        const RealCUGANLayerProfile& p = profile[i];
+        total_ms += p.time_ms;
+        total_flops += p.flops;
+        total_bytes += p.bytes;
+
+        if (p.time_ms > 0)
+        {
+            best_gflops = std::max(best_gflops, p.flops / p.time_ms * 1e-6);
+            best_gbps = std::max(best_gbps, p.bytes / p.time_ms * 1e-6);
+        }
+    }
+
+    const double roof_gflops = peak_gflops > 0 ? peak_gflops : best_gflops;
+    const double roof_gbps = peak_gbps > 0 ? peak_gbps : best_gbps;
+
+    fprintf(stdout, "%s  %s, %d x %d input, roof %.1f GFLOPS %.1f GB/s, ridge %.1f FLOP/B\n", parampath.c_str(), gpuid == -1 ? "cpu" : "gpu, per layer submit wall time", in_size, in_size, roof_gflops, roof_gbps, roof_gbps > 0 ? roof_gflops / roof_gbps : 0.0);
+    fprintf(stdout, "%4s %-22s %-14s %16s %9s %8s %9s %6s %8s %8s %7s %6s %s\n", "#", "type", "name", "output", "MFLOP", "MB", gpuid == -1 ? "ms" : "wall ms", "time", "GFLOPS", "GB/s", "FLOP/B", "roof", "bound");
+
+    std::map<std::string, double> type_ms;
+    std::map<std::string, double> type_flops;
+    for (size_t i = 0; i < profile.size(); i++)
+    {
+        const RealCUGANLayerProfile& p = profile[i];
+        if (p.type == "Input")
+            continue;
+
+        type_ms[p.type] += p.time_ms;
+        type_flops[p.type] += p.flops;
+
+        const double gflops = p.time_ms > 0 ? p.flops / p.time_ms * 1e-6 : 0.0;
+        const double gbps = p.time_ms > 0 ? p.bytes / p.time_ms * 1e-6 : 0.0;
+        const double intensity = p.bytes > 0 ? p.flops / p.bytes : 0.0;
+
+        // attainable flops at this intensity, layers without flops are judged by bandwidth
+        double roof = 0;
+        if (p.flops > 0)
+        {
+            const double attainable = std::min(roof_gflops, intensity * roof_gbps);
+            roof = attainable > 0 ? gflops / attainable : 0.0;
+        }
+        else
+        {
+            roof = roof_gbps > 0 ? gbps / roof_gbps : 0.0;
+        }
+
+        const bool memory_bound = p.flops == 0 || intensity * roof_gbps < roof_gflops;
+
+        char shape[64];
+        sprintf(shape, "%dx%dx%d", p.out_w, p.out_h, p.out_c);
+
+        fprintf(stdout, "%4d %-22s %-14s %16s %9.1f %8.2f %9.3f %5.1f%% %8.1f %8.1f %7.1f %5.0f%% %s\n", (int)i, p.type.c_str(), p.name.c_str(), shape,
+                p.flops * 1e-6, p.bytes / 1048576.0, p.time_ms, total_ms > 0 ? p.time_ms * 100 / total_ms : 0.0,
+                gflops, gbps, intensity, roof * 100, memory_bound ? "memory" : "compute");
+    }
+
+    fprintf(stdout, "%4s %-22s %-14s %16s %9.1f %8.2f %9.3f %5.1f%% %8.1f\n", "", "total", "", "", total_flops * 1e-6, total_bytes / 1048576.0, total_ms, 100.0, total_ms > 0 ? total_flops / total_ms * 1e-6 : 0.0);
+
+    fprintf(stdout, "by type:");
+    for (std::map<std::string, double>::const_iterator it = type_ms.begin(); it != type_ms.end(); ++it)
+    {
+        fprintf(stdout, "  %s %.1f%% %.1f GFLOPS", it->first.c_str(), total_ms > 0 ? it->second * 100 / total_ms : 0.0, it->second > 0 ? type_flops[it->first] / it->second * 1e-6 : 0.0);
+    }
+    fprintf(stdout, "\n\n");
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int gpuid = 0;
+    int tilesize = 200;
+    int loops = 5;
+    double peak_gflops = 0;
+    double peak_gbps = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "g:t:l:P:B:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'g':
+            gpuid = atoi(optarg);
+            break;
+        case 't':
+            tilesize = atoi(optarg);
+            break;
+        case 'l':
+            loops = atoi(optarg);
+            break;
+        case 'P':
+            peak_gflops = atof(optarg);
+            break;
+        case 'B':
+            peak_gbps = atof(optarg);
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (optind >= argc || tilesize < 32 || loops < 1)
+    {
+        print_usage();
+        return -1;
+    }
+
+    std::vector<std::string> params;
+    for (int i = optind; i < argc; i++)
+        collect_params(argv[i], params, 1);
+
+    if (params.empty())
+    {
+        fprintf(stderr, "no .param found\n");
+        return -1;
+    }
+
+    if (gpuid != -1)
+        ncnn::create_gpu_instance();
+
+    int ret = 0;
+    for (size_t i = 0; i < params.size() && ret == 0; i++)
+        ret = profile_model(params[i], gpuid, tilesize, loops, peak_gflops, peak_gbps);
+
+    if (gpuid != -1)
+        ncnn::destroy_gpu_instance();
+
+    return ret;
+}
@@ -0,0 +1,356 @@
+// concurrent load generator for the entry points behind the JNI functions
+//
+// every client thread looks its instance up by config as nativeInitialize does, then finds and runs it as
+// nativeProcessImage does, over a random mix of models and image sizes; all instances are released after each round
+// while the clients run, another thread releases instances as nativeRelease does, so calls holding them finish on a
+// released instance and the next lookup loads it again
+//
+// realcugan-load-bench -m models-root [-c 1,2,4,8] [-N 16] [-S 64,128,256] [-M models-se:2:0,models-pro:2:0,models-nose:2:0] [-s 3] [-g -1] [-r 1] [-R 4]
+//
+// reports throughput, latency percentiles, the slowest release under load and the time spent waiting for the gpu,
+// cache and handle locks
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_image.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "realcugan_api.h"
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: realcugan-load-bench -m models-root [options]\n");
+    fprintf(stderr, "  -m models-root  directory holding models-se, models-pro and models-nose\n");
+    fprintf(stderr, "  -c clients      comma separated client counts, one round each (default=1,2,4,8)\n");
+    fprintf(stderr, "  -N requests     requests per client and round (default=16)\n");
+    fprintf(stderr, "  -S sizes        comma separated image sides picked at random (default=64,128,256)\n");
+    fprintf(stderr, "  -M models       comma separated dir:scale:noise picked at random (default=models-se:2:0,models-pro:2:0,models-nose:2:0)\n");
+    fprintf(stderr, "  -s syncgap      sync gap mode (0/1/2/3, default=3)\n");
+    fprintf(stderr, "  -g gpu-id       gpu device to use (-1=cpu, default=-1)\n");
+    fprintf(stderr, "  -r seed         seed of the request mix (default=1)\n");
+    fprintf(stderr, "  -R releases     instances released while the clients run, per round (default=4)\n");
+}
+
+static int parse_ints(const char* s, std::vector<int>& values)
+{
+    values.clear();
+    while (*s)
+    {
+        char* end = 0;
+        long v = strtol(s, &end, 10);
+        if (end == s)
+            return -1;
+        values.push_back((int)v);
+        s = *end == ',' ? end + 1 : end;
+    }
+    return values.empty() ? -1 : 0;
+}
+
+static int parse_models(const char* s, std::vector<RealCUGANConfig>& models)
+{
+    models.clear();
+    while (*s)
+    {
+        char dir[64];
+        RealCUGANConfig config;
+        int n = 0;
+        if (sscanf(s, "%63[^:]:%d:%d%n", dir, &config.scale, &config.noise, &n) != 3)
+            return -1;
+
+        config.model_dir = dir;
+        config.syncgap = 3;
+        config.tta_mode = false;
+        config.tta_threshold = 0.f;
+        config.tta_batch = false;
+        config.gpuid = -1;
+        config.cpu_precision = 0;
+        config.tile_cache = 0;
+        config.trace = 0;
+        config.memory_tracker = 0;
+        config.metrics = 0;
+        models.push_back(config);
+
+        s += n;
+        if (*s == ',')
+            s++;
+    }
+    return models.empty() ? -1 : 0;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+
+    return sorted[(size_t)(p * (sorted.size() - 1) + 0.5)];
+}
+
+struct ClientResult
+{
+    std::vector<double> latency_ms;
+    double init_ms;
+    double pixels;
+    int failed;
+    // lookups that found the instance released after initialize, retried
+    int lost;
+};
+
+int main(int argc, char** argv)
+{
+    typedef std::chrono::steady_clock clock;
+
+    std::string model_root;
+    std::vector<int> clients;
+    int requests = 16;
+    std::vector<int> sizes;
+    std::vector<RealCUGANConfig> models;
+    int syncgap = 3;
+    int gpuid = -1;
+    unsigned int seed = 1;
+    int releases = 4;
+
+    parse_ints("1,2,4,8", clients);
+    parse_ints("64,128,256", sizes);
+    parse_models("models-se:2:0,models-pro:2:0,models-nose:2:0", models);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:c:N:S:M:s:g:r:R:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            model_root = optarg;
+            break;
+        case 'c':
+            if (parse_ints(optarg, clients) != 0)
+            {
+                print_usage();
+                return -1;
+            }
+            break;
+        case 'N':
+            requests = atoi(optarg);
+            break;
+        case 'S':
+            if (parse_ints(optarg, sizes) != 0)
+            {
+                print_usage();
+                return -1;
+            }
+            break;
+        case 'M':
+            if (parse_models(optarg, models) != 0)
+            {
+                print_usage();
+                return -1;
+            }
+            break;
+        case 's':
+            syncgap = atoi(optarg);
+            break;
+        case 'g':
+            gpuid = atoi(optarg);
+            break;
+        case 'r':
+            seed = (unsigned int)atoi(optarg);
+            break;
+        case 'R':
+            releases = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (model_root.empty() || requests <= 0 || syncgap < 0 || syncgap > 3 || releases < 0)
+    {
+        print_usage();
+        return -1;
+    }
+
+    for (size_t i = 0; i < models.size(); i++)
+    {
+        models[i].syncgap = syncgap;
+        models[i].gpuid = gpuid;
+    }
+
+    std::vector<BenchImage> images;
+    for (size_t i = 0; i < sizes.size(); i++)
+        images.push_back(make_photo_sized(sizes[i], sizes[i]));
+
+    fprintf(stdout, "%7s %8s %9s %8s %8s %8s %8s %8s %9s %9s %6s %9s %9s  %s\n", "clients", "requests", "wall ms", "req/s", "MPix/s", "p50 ms", "p95 ms", "p99 ms", "init ms", "release", "lost", "drops", "drop ms", "lock waits");
+
+    int ret = 0;
+    for (size_t round = 0; round < clients.size() && ret == 0; round++)
+    {
+        const int nclients = std::max(clients[round], 1);
+
+        // load every model before the clock starts, the round measures steady state lookups and inference
+        for (size_t i = 0; i < models.size(); i++)
+        {
+            if (realcugan_initialize(model_root, models[i]) < 0)
+            {
+                fprintf(stderr, "initialize %s up%dx noise %d failed\n", models[i].model_dir.c_str(), models[i].scale, models[i].noise);
+                ret = -1;
+            }
+        }
+        if (ret != 0)
+            break;
+
+        realcugan_reset_lock_stats();
+
+        std::vector<ClientResult> results(nclients);
+        std::vector<std::thread> threads;
+
+        const int total = nclients * requests;
+        std::atomic<int> done(0);
+
+        clock::time_point t0 = clock::now();
+
+        for (int c = 0; c < nclients; c++)
+        {
+            threads.push_back(std::thread([&, c]() {
+                ClientResult& r = results[c];
+                r.init_ms = 0;
+                r.pixels = 0;
+                r.failed = 0;
+                r.lost = 0;
+
+                unsigned int state = seed * 2654435761u + c * 40503u + 1;
+
+                for (int i = 0; i < requests; i++)
+                {
+                    state = state * 1103515245 + 12345;
+                    const RealCUGANConfig& config = models[(state >> 16) % models.size()];
+                    state = state * 1103515245 + 12345;
+                    const BenchImage& im = images[(state >> 16) % images.size()];
+
+                    clock::time_point r0 = clock::now();
+
+                    // nativeInitialize, again when the releaser dropped the instance in between
+                    std::shared_ptr<RealCUGAN> inst;
+                    for (int attempt = 0; attempt < 3 && !inst; attempt++)
+                    {
+                        clock::time_point i0 = clock::now();
+                        const int64_t handle = realcugan_initialize(model_root, config);
+                        r.init_ms += std::chrono::duration<double, std::milli>(clock::now() - i0).count();
+
+                        if (handle < 0)
+                            break;
+
+                        // nativeProcessImage, the reference keeps the instance alive across a release
+                        inst = realcugan_find(handle);
+                        if (!inst)
+                            r.lost++;
+                    }
+
+                    int pret = -1;
+                    if (inst)
+                    {
+                        ncnn::Mat inimage(im.w, im.h, (void*)im.pixels.data(), (size_t)im.c, im.c);
+                        ncnn::Mat outimage;
+                        pret = realcugan_process(inst.get(), inimage, outimage, 0, 0, 0);
+                    }
+                    inst.reset();
+                    done++;
+
+                    r.latency_ms.push_back(std::chrono::duration<double, std::milli>(clock::now() - r0).count());
+
+                    if (pret == 0)
+                        r.pixels += (double)im.w * im.h;
+                    else
+                        r.failed++;
+                }
+            }));
+        }
+
+        // nativeRelease of the models in turn, spread over the round so calls on the instance are in flight
+        int drops = 0;
+        double drop_ms = 0;
+        std::thread releaser([&]() {
+            for (int k = 0; k < releases; k++)
+            {
+                const int at = (int)((long long)total * (k + 1) / (releases + 1));
+                while (done.load() < at)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+                const int64_t handle = realcugan_initialize(model_root, models[k % models.size()]);
+                if (handle < 0)
+                    continue;
+
+                clock::time_point d0 = clock::now();
+                realcugan_release(handle);
+                drop_ms = std::max(drop_ms, std::chrono::duration<double, std::milli>(clock::now() - d0).count());
+                drops++;
+            }
+        });
+
+        for (size_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+        releaser.join();
+
+        const double wall_ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+
+        std::vector<RealCUGANLockStats> locks;
+        realcugan_lock_stats(locks);
+
+        // nativeRelease of every instance, the last one takes the gpu instance down
+        clock::time_point t1 = clock::now();
+        for (size_t i = 0; i < models.size(); i++)
+        {
+            const int64_t handle = realcugan_initialize(model_root, models[i]);
+            if (handle >= 0)
+                realcugan_release(handle);
+        }
+        const double release_ms = std::chrono::duration<double, std::milli>(clock::now() - t1).count();
+
+        std::vector<double> latency;
+        double init_ms = 0;
+        double pixels = 0;
+        int failed = 0;
+        int lost = 0;
+        for (int c = 0; c < nclients; c++)
+        {
+            latency.insert(latency.end(), results[c].latency_ms.begin(), results[c].latency_ms.end());
+            init_ms += results[c].init_ms;
+            pixels += results[c].pixels;
+            failed += results[c].failed;
+            lost += results[c].lost;
+        }
+        std::sort(latency.begin(), latency.end());
+
+        fprintf(stdout, "%7d %8d %9.1f %8.2f %8.3f %8.2f %8.2f %8.2f %9.3f %9.2f %6d %9d %9.3f ", nclients, total, wall_ms, wall_ms > 0 ? total * 1000 / wall_ms : 0.0, wall_ms > 0 ? pixels / wall_ms * 1e-3 : 0.0,
+                percentile(latency, 0.50), percentile(latency, 0.95), percentile(latency, 0.99), total > 0 ? init_ms / total : 0.0, release_ms, lost, drops, drop_ms);
+
+        for (size_t i = 0; i < locks.size(); i++)
+            fprintf(stdout, " %s %llu/%llu %.2f ms", locks[i].name, (unsigned long long)locks[i].contended, (unsigned long long)locks[i].acquisitions, locks[i].wait_ms);
+        fprintf(stdout, "\n");
+
+        if (failed)
+        {
+            fprintf(stderr, "%d requests failed\n", failed);
+            ret = -1;
+        }
+
+        // every reference is gone with the clients, nothing may stay behind
+        if (realcugan_instance_count() != 0)
+        {
+            fprintf(stderr, "%d instances left after release\n", realcugan_instance_count());
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,264 @@
+// speed, quality and memory of the cpu precision modes of one model
+//
+// realcugan-precision-bench -p models-se/up2x-no-denoise.param -b models-se/up2x-no-denoise.bin [-s 2] [-t 200] [-r 3] [-P 40] [image.png ...]
+//
+// the model runs on the cpu in fp32, fp16 storage, fp16 arithmetic and bf16 storage over the same images
+// every mode reports its best time, the psnr of its output against fp32, whether that passes the load time gate,
+// the peak bytes of the network blobs and the bytes the layers read and write as estimated by the cost model
+// modes the cpu has no instructions for still run, ncnn takes the fp32 kernels for them and the speedup stays near 1
+// without images a synthetic photo, manga page and screenshot are used
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "bench_image.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// ncnn
+#include "cpu.h"
+#include "net.h"
+
+#include "memory_tracker.h"
+#include "realcugan.h"
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: realcugan-precision-bench -p param -b bin [options] [image ...]\n");
+    fprintf(stderr, "  -s scale       upscale ratio of the model (2, 3, 4, default=from the param name)\n");
+    fprintf(stderr, "  -n noise       denoise level of the model (default=0)\n");
+    fprintf(stderr, "  -t tile-size   tile size (>=32, default=200)\n");
+    fprintf(stderr, "  -r runs        timed runs per image, the best is reported (default=3)\n");
+    fprintf(stderr, "  -P min-psnr    psnr against fp32 a mode needs to pass the gate (default=40)\n");
+    fprintf(stderr, "  -j threads     cpu threads (default=big cores)\n");
+}
+
+static double psnr(const ncnn::Mat& a, const ncnn::Mat& b, size_t size)
+{
+    const unsigned char* pa = (const unsigned char*)a.data;
+    const unsigned char* pb = (const unsigned char*)b.data;
+
+    double sse = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        double d = (double)pa[i] - pb[i];
+        sse += d * d;
+    }
+
+    if (sse == 0)
+        return INFINITY;
+
+    return 10.0 * log10(255.0 * 255.0 * size / sse);
+}
+
+static double best_process_ms(const RealCUGAN& realcugan, const ncnn::Mat& inimage, ncnn::Mat& outimage, int runs)
+{
+    double best = DBL_MAX;
+    for (int r = 0; r < runs; r++)
+    {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        realcugan.process(inimage, outimage);
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+        best = std::min(best, std::chrono::duration<double, std::milli>(t1 - t0).count());
+    }
+
+    return best;
+}
+
+static std::string basename_noext(const char* path)
+{
+    std::string s = path;
+    const size_t slash = s.find_last_of("/\\");
+    if (slash != std::string::npos)
+        s = s.substr(slash + 1);
+    const size_t dot = s.rfind('.');
+    if (dot != std::string::npos)
+        s = s.substr(0, dot);
+    return s;
+}
+
+int main(int argc, char** argv)
+{
+    const char* parampath = 0;
+    const char* modelpath = 0;
+    int scale = 0;
+    int noise = 0;
+    int tilesize = 200;
+    int runs = 3;
+    double min_psnr = 40.0;
+    int num_threads = ncnn::get_big_cpu_count();
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:b:s:n:t:r:P:j:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            parampath = optarg;
+            break;
+        case 'b':
+            modelpath = optarg;
+            break;
+        case 's':
+            scale = atoi(optarg);
+            break;
+        case 'n':
+            noise = atoi(optarg);
+            break;
+        case 't':
+            tilesize = atoi(optarg);
+            break;
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 'P':
+            min_psnr = atof(optarg);
+            break;
+        case 'j':
+            num_threads = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (!parampath || !modelpath || tilesize < 32 || runs < 1 || num_threads < 1)
+    {
+        print_usage();
+        return -1;
+    }
+
+    const std::string model = basename_noext(parampath);
+    if (scale == 0 && sscanf(model.c_str(), "up%dx", &scale) != 1)
+    {
+        fprintf(stderr, "no upNx in %s, pass -s\n", model.c_str());
+        return -1;
+    }
+    if (scale < 2 || scale > 4)
+    {
+        print_usage();
+        return -1;
+    }
+    const int prepadding = scale == 2 ? 18 : scale == 3 ? 14 : 19;
+
+    std::vector<BenchImage> images;
+    for (int i = optind; i < argc; i++)
+    {
+        BenchImage im;
+        if (load_image(argv[i], im) != 0)
+            return -1;
+        images.push_back(im);
+    }
+    if (images.empty())
+    {
+        images.push_back(make_photo());
+        images.push_back(make_manga_page());
+        images.push_back(make_screenshot());
+    }
+
+    fprintf(stderr, "cpu fp16 arithmetic %s, bf16 dot product %s\n",
+            ncnn::cpu_support_arm_asimdhp() ? "armv8.2 asimdhp" : ncnn::cpu_support_x86_avx512_fp16() ? "avx512-fp16" : "no",
+            ncnn::cpu_support_arm_bf16() ? "armv8.6 bf16" : ncnn::cpu_support_x86_avx512_bf16() ? "avx512-bf16" : "no");
+
+    // every mode loads without the gate, the gate is what this compares
+    MemoryTracker tracker;
+    std::vector<RealCUGAN*> nets(REALCUGAN_PRECISION_COUNT);
+    for (int p = 0; p < REALCUGAN_PRECISION_COUNT; p++)
+    {
+        nets[p] = new RealCUGAN(-1, false, num_threads);
+        nets[p]->noise = noise;
+        nets[p]->scale = scale;
+        nets[p]->tilesize = tilesize;
+        nets[p]->syncgap = 3;
+        nets[p]->prepadding = prepadding;
+        nets[p]->tile_dedup = false;
+        nets[p]->memory_tracker = &tracker;
+        nets[p]->cpu_precision = p;
+        nets[p]->precision_min_psnr = 0;
+
+        if (nets[p]->load(parampath, modelpath) != 0)
+        {
+            fprintf(stderr, "load %s as %s failed\n", parampath, realcugan_precision_name(p));
+            return -1;
+        }
+    }
+
+    std::vector<double> total_ms(REALCUGAN_PRECISION_COUNT, 0.0);
+    std::vector<double> worst_psnr(REALCUGAN_PRECISION_COUNT, INFINITY);
+    std::vector<size_t> peak_blob(REALCUGAN_PRECISION_COUNT, 0);
+    std::vector<double> traffic(REALCUGAN_PRECISION_COUNT, 0.0);
+    double total_mpix = 0;
+
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        const BenchImage& im = images[i];
+        const size_t outsize = (size_t)im.w * scale * im.h * scale * im.c;
+
+        ncnn::Mat inimage(im.w, im.h, (void*)im.pixels.data(), (size_t)im.c, im.c);
+        ncnn::Mat outfp32(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+        total_mpix += (double)im.w * im.h / 1e6;
+
+        for (int p = 0; p < REALCUGAN_PRECISION_COUNT; p++)
+        {
+            ncnn::Mat outimage(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+            ncnn::Mat& out = p == REALCUGAN_PRECISION_FP32 ? outfp32 : outimage;
+
+            total_ms[p] += best_process_ms(*nets[p], inimage, out, runs);
+            peak_blob[p] = std::max(peak_blob[p], tracker.usage(MEMORY_CPU_BLOB).peak);
+            traffic[p] += nets[p]->estimate(im.w, im.h, im.c).traffic_bytes;
+
+            if (p != REALCUGAN_PRECISION_FP32)
+                worst_psnr[p] = std::min(worst_psnr[p], psnr(outfp32, out, outsize));
+        }
+    }
+
+    fprintf(stdout, "%-16s %10s %8s %8s %10s %6s %12s %12s %8s\n", "precision", "ms", "MPix/s", "speedup", "psnr dB", "gate", "peak blob MB", "traffic MB", "saving");
+
+    for (int p = 0; p < REALCUGAN_PRECISION_COUNT; p++)
+    {
+        const bool pass = p == REALCUGAN_PRECISION_FP32 || worst_psnr[p] >= min_psnr;
+
+        fprintf(stdout, "%-16s %10.1f %8.3f %7.2fx %10.2f %6s %12.1f %12.1f %7.1f%%\n",
+                realcugan_precision_name(p),
+                total_ms[p],
+                total_mpix / (total_ms[p] / 1000.0),
+                total_ms[REALCUGAN_PRECISION_FP32] / total_ms[p],
+                worst_psnr[p],
+                pass ? "pass" : "FAIL",
+                peak_blob[p] / 1024.0 / 1024.0,
+                traffic[p] / 1024.0 / 1024.0,
+                traffic[REALCUGAN_PRECISION_FP32] > 0 ? (1.0 - traffic[p] / traffic[REALCUGAN_PRECISION_FP32]) * 100.0 : 0.0);
+    }
+
+    // what load() would have picked, on its own synthetic probe
+    for (int p = 1; p < REALCUGAN_PRECISION_COUNT; p++)
+    {
+        RealCUGAN gated(-1, false, num_threads);
+        gated.noise = noise;
+        gated.scale = scale;
+        gated.tilesize = tilesize;
+        gated.prepadding = prepadding;
+        gated.cpu_precision = p;
+        gated.precision_min_psnr = min_psnr;
+        if (gated.load(parampath, modelpath) != 0)
+            return -1;
+
+        fprintf(stdout, "load gate %-16s probe %6.2f dB -> %s\n", realcugan_precision_name(p), gated.precision_psnr, realcugan_precision_name(gated.precision_used));
+    }
+
+    for (int p = 0; p < REALCUGAN_PRECISION_COUNT; p++)
+        delete nets[p];
+
+    return 0;
+}
@@ -0,0 +1,787 @@
+// post-training int8 quantisation of a CUGAN model for the cpu path
+//
+// realcugan-quantize -p models-se/up2x-no-denoise.param -b models-se/up2x-no-denoise.bin -o models-se-int8 [-t 128] [-n 8] [-M kl] [-c] [image.png ...]
+//
+// tiles of the calibration images run through the fp32 net on the cpu, the input range of every Convolution is
+// collected and <out-dir>/<model>.param/.bin/.table are written with per channel int8 weights and one activation
+// scale per convolution, the layout ncnn2int8 writes and Convolution loads with int8_scale_term 2
+// Deconvolution and InnerProduct have no int8 kernels and keep their weights
+//
+// -c then compares speed and psnr of the int8 model against the fp32 one on the same images
+// without images a synthetic photo, manga page and screenshot are used, real images calibrate much better
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "bench_image.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// ncnn
+#include "cpu.h"
+#include "net.h"
+
+#include "realcugan.h"
+
+// weight tags of ncnn::ModelBin
+#define WEIGHT_TAG_FP16 0x01306B47
+#define WEIGHT_TAG_INT8 0x000D4B38
+#define WEIGHT_TAG_FP32 0x0002C056
+
+#define HISTOGRAM_BINS 2048
+#define QUANTIZE_LEVELS 128
+
+struct QuantLayer
+{
+    std::string type;
+    std::string name;
+    std::vector<std::string> bottoms;
+    std::vector<std::string> tops;
+    std::vector<std::string> params;
+    // line as read, written back unchanged for every layer but Convolution
+    std::string line;
+
+    int num_output;
+    int weight_data_size;
+    bool bias_term;
+
+    // Convolution only
+    float absmax;
+    std::vector<uint64_t> histogram;
+    float bottom_scale;
+    std::vector<float> weight_scales;
+};
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: realcugan-quantize -p param -b bin -o out-dir [options] [image ...]\n");
+    fprintf(stderr, "  -o out-dir     directory for the int8 param, bin and table, named after the param\n");
+    fprintf(stderr, "  -s scale       upscale ratio of the model (2, 3, 4, default=from the param name)\n");
+    fprintf(stderr, "  -t tile-size   calibration tile size (>=32, default=128)\n");
+    fprintf(stderr, "  -n tiles       calibration tiles per image (default=8)\n");
+    fprintf(stderr, "  -M method      kl or minmax activation threshold (default=kl)\n");
+    fprintf(stderr, "  -c             compare the int8 model against fp32 on the cpu afterwards\n");
+    fprintf(stderr, "  -r runs        timed runs per image with -c, the best is reported (default=3)\n");
+    fprintf(stderr, "  -j threads     cpu threads (default=big cores)\n");
+}
+
+static std::string basename_noext(const char* path)
+{
+    std::string s = path;
+    const size_t slash = s.find_last_of("/\\");
+    if (slash != std::string::npos)
+        s = s.substr(slash + 1);
+    const size_t dot = s.find_last_of('.');
+    return dot == std::string::npos ? s : s.substr(0, dot);
+}
+
+static int read_param(const char* path, std::string& header, std::vector<QuantLayer>& layers)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "open %s failed\n", path);
+        return -1;
+    }
+
+    std::vector<std::string> lines;
+    {
+        std::string line;
+        for (int ch = fgetc(fp); ; ch = fgetc(fp))
+        {
+            if (ch == EOF || ch == '\n')
+            {
+                while (!line.empty() && (line[line.size() - 1] == '\r' || line[line.size() - 1] == ' '))
+                    line.erase(line.size() - 1);
+                if (!line.empty())
+                    lines.push_back(line);
+                line.clear();
+                if (ch == EOF)
+                    break;
+                continue;
+            }
+            line += (char)ch;
+        }
+    }
+    fclose(fp);
+
+    if (lines.size() < 2 || lines[0] != "7767517")
+    {
+        fprintf(stderr, "%s is not a text param\n", path);
+        return -1;
+    }
+
+    header = lines[0] + "\n" + lines[1] + "\n";
+
+    layers.clear();
+    for (size_t i = 2; i < lines.size(); i++)
+    {
+        std::vector<std::string> tokens;
+        {
+            size_t pos = 0;
+            const std::string& line = lines[i];
+            while (pos < line.size())
+            {
+                while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t'))
+                    pos++;
+                const size_t end = std::min(line.find_first_of(" \t", pos), line.size());
+                if (end > pos)
+                    tokens.push_back(line.substr(pos, end - pos));
+                pos = end;
+            }
+        }
+
+        if (tokens.size() < 4)
+        {
+            fprintf(stderr, "bad layer line %s\n", lines[i].c_str());
+            return -1;
+        }
+
+        QuantLayer l;
+        l.type = tokens[0];
+        l.name = tokens[1];
+        l.line = lines[i];
+
+        const int bottom_count = atoi(tokens[2].c_str());
+        const int top_count = atoi(tokens[3].c_str());
+        if ((int)tokens.size() < 4 + bottom_count + top_count)
+        {
+            fprintf(stderr, "bad layer line %s\n", lines[i].c_str());
+            return -1;
+        }
+        l.bottoms.assign(tokens.begin() + 4, tokens.begin() + 4 + bottom_count);
+        l.tops.assign(tokens.begin() + 4 + bottom_count, tokens.begin() + 4 + bottom_count + top_count);
+        l.params.assign(tokens.begin() + 4 + bottom_count + top_count, tokens.end());
+
+        // InnerProduct keeps bias_term in 1 and the weight count in 2
+        const bool fc = l.type == "InnerProduct";
+        l.num_output = 0;
+        l.weight_data_size = 0;
+        l.bias_term = false;
+        for (size_t j = 0; j < l.params.size(); j++)
+        {
+            const std::string& p = l.params[j];
+            const size_t eq = p.find('=');
+            if (eq == std::string::npos)
+                continue;
+
+            const int id = atoi(p.substr(0, eq).c_str());
+            const int v = atoi(p.c_str() + eq + 1);
+            if (id == 0)
+                l.num_output = v;
+            if (id == (fc ? 2 : 6))
+                l.weight_data_size = v;
+            if (id == (fc ? 1 : 5))
+                l.bias_term = v != 0;
+            if (id == 8 && l.type == "Convolution" && v != 0)
+            {
+                fprintf(stderr, "%s is already quantized\n", l.name.c_str());
+                return -1;
+            }
+        }
+
+        l.absmax = 0.f;
+        l.bottom_scale = 1.f;
+        layers.push_back(l);
+    }
+
+    return 0;
+}
+
+// weight data of one mb.load(w, 0), decoded to fp32, raw keeps the bytes as stored
+static int read_weight(FILE* fp, int w, std::vector<float>& data, std::vector<unsigned char>& raw)
+{
+    uint32_t tag = 0;
+    if (fread(&tag, 4, 1, fp) != 1)
+        return -1;
+
+    raw.assign((const unsigned char*)&tag, (const unsigned char*)&tag + 4);
+    data.resize(w);
+
+    if (tag == WEIGHT_TAG_FP16)
+    {
+        std::vector<unsigned short> half((size_t)w + 1);
+        const size_t bytes = ((size_t)w * 2 + 3) / 4 * 4;
+        if (fread(half.data(), 1, bytes, fp) != bytes)
+            return -1;
+
+        raw.insert(raw.end(), (const unsigned char*)half.data(), (const unsigned char*)half.data() + bytes);
+        for (int i = 0; i < w; i++)
+            data[i] = ncnn::float16_to_float32(half[i]);
+        return 0;
+    }
+
+    if (tag == 0 || tag == WEIGHT_TAG_FP32)
+    {
+        if (fread(data.data(), sizeof(float), w, fp) != (size_t)w)
+            return -1;
+
+        raw.insert(raw.end(), (const unsigned char*)data.data(), (const unsigned char*)(data.data() + w));
+        return 0;
+    }
+
+    fprintf(stderr, "weight tag %08x is not fp16 or fp32\n", tag);
+    return -1;
+}
+
+static int copy_bytes(FILE* in, FILE* out, size_t size)
+{
+    std::vector<unsigned char> buf(size);
+    if (size && fread(buf.data(), 1, size, in) != size)
+        return -1;
+    if (size && fwrite(buf.data(), 1, size, out) != size)
+        return -1;
+    return 0;
+}
+
+// a reflect padded tile of the image as the cpu tile loop feeds it to the net, rgb in 0..1
+static ncnn::Mat calibration_tile(const BenchImage& im, int x0, int y0, int tilesize, int scale, int prepadding)
+{
+    const int tw = std::min(tilesize, im.w - x0);
+    const int th = std::min(tilesize, im.h - y0);
+
+    ncnn::Mat in(tw, th, 3);
+    for (int q = 0; q < 3; q++)
+    {
+        float* outptr = in.channel(q);
+        for (int y = 0; y < th; y++)
+        {
+            const unsigned char* p = &im.pixels[((size_t)(y0 + y) * im.w + x0) * im.c + q];
+            for (int x = 0; x < tw; x++)
+            {
+                *outptr++ = *p * (1 / 255.f);
+                p += im.c;
+            }
+        }
+    }
+
+    const int align = scale == 3 ? 4 : 2;
+    const int pad_right = prepadding + (tw + align - 1) / align * align - tw;
+    const int pad_bottom = prepadding + (th + align - 1) / align * align - th;
+
+    ncnn::Mat padded;
+    ncnn::copy_make_border(in, padded, prepadding, pad_bottom, prepadding, pad_right, 2, 0.f);
+    return padded;
+}
+
+// run tile and hand the bottom blob of every Convolution to f
+template<typename F>
+static int for_each_conv_input(const ncnn::Net& net, const ncnn::Mat& tile, std::vector<QuantLayer>& layers, F f)
+{
+    ncnn::Extractor ex = net.create_extractor();
+    ex.input("in0", tile);
+
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        if (layers[i].type != "Convolution")
+            continue;
+
+        ncnn::Mat m;
+        if (ex.extract(layers[i].bottoms[0].c_str(), m) != 0)
+        {
+            fprintf(stderr, "extract %s failed\n", layers[i].bottoms[0].c_str());
+            return -1;
+        }
+
+        ncnn::Mat unpacked;
+        ncnn::convert_packing(m, unpacked, 1);
+
+        f(layers[i], unpacked);
+    }
+
+    return 0;
+}
+
+// tensorrt style threshold, the clip point whose 128 level quantisation loses the least kl divergence
+static int kl_threshold_bin(const std::vector<uint64_t>& histogram)
+{
+    const int nbins = (int)histogram.size();
+
+    double best_kl = DBL_MAX;
+    int best = nbins;
+    for (int t = QUANTIZE_LEVELS; t <= nbins; t++)
+    {
+        // reference, everything beyond the clip point lands in the last bin
+        std::vector<double> p(histogram.begin(), histogram.begin() + t);
+        for (int i = t; i < nbins; i++)
+            p[t - 1] += histogram[i];
+
+        // the same bins merged into 128 levels and spread back over their nonzero bins
+        std::vector<double> q(t, 0.0);
+        const double step = (double)t / QUANTIZE_LEVELS;
+        for (int j = 0; j < QUANTIZE_LEVELS; j++)
+        {
+            const int start = (int)(j * step);
+            const int end = j == QUANTIZE_LEVELS - 1 ? t : (int)((j + 1) * step);
+
+            double sum = 0;
+            int nonzero = 0;
+            for (int k = start; k < end; k++)
+            {
+                sum += p[k];
+                if (p[k] != 0)
+                    nonzero++;
+            }
+
+            for (int k = start; k < end; k++)
+            {
+                if (p[k] != 0)
+                    q[k] = sum / nonzero;
+            }
+        }
+
+        double psum = 0;
+        double qsum = 0;
+        for (int k = 0; k < t; k++)
+        {
+            psum += p[k];
+            qsum += q[k];
+        }
+        if (psum == 0 || qsum == 0)
+            continue;
+
+        double kl = 0;
+        for (int k = 0; k < t; k++)
+        {
+            if (p[k] == 0)
+                continue;
+            kl += p[k] / psum * log((p[k] / psum) / (q[k] / qsum));
+        }
+
+        if (kl < best_kl)
+        {
+            best_kl = kl;
+            best = t;
+        }
+    }
+
+    return best;
+}
+
+// psnr of b against reference a over all channels, inf when identical
+static double psnr(const ncnn::Mat& a, const ncnn::Mat& b, size_t size)
+{
+    const unsigned char* pa = (const unsigned char*)a.data;
+    const unsigned char* pb = (const unsigned char*)b.data;
+
+    double sse = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        double d = (double)pa[i] - pb[i];
+        sse += d * d;
+    }
+
+    if (sse == 0)
+        return INFINITY;
+
+    return 10.0 * log10(255.0 * 255.0 * size / sse);
+}
+
+static double best_process_ms(const RealCUGAN& realcugan, const ncnn::Mat& inimage, ncnn::Mat& outimage, int runs)
+{
+    double best = DBL_MAX;
+    for (int r = 0; r < runs; r++)
+    {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        realcugan.process(inimage, outimage);
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+        best = std::min(best, std::chrono::duration<double, std::milli>(t1 - t0).count());
+    }
+
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    const char* parampath = 0;
+    const char* modelpath = 0;
+    const char* outdir = 0;
+    int scale = 0;
+    int tilesize = 128;
+    int tiles_per_image = 8;
+    bool kl = true;
+    bool compare = false;
+    int runs = 3;
+    int num_threads = ncnn::get_big_cpu_count();
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:b:o:s:t:n:M:cr:j:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            parampath = optarg;
+            break;
+        case 'b':
+            modelpath = optarg;
+            break;
+        case 'o':
+            outdir = optarg;
+            break;
+        case 's':
+            scale = atoi(optarg);
+            break;
+        case 't':
+            tilesize = atoi(optarg);
+            break;
+        case 'n':
+            tiles_per_image = atoi(optarg);
+            break;
+        case 'M':
+            if (strcmp(optarg, "kl") != 0 && strcmp(optarg, "minmax") != 0)
+            {
+                print_usage();
+                return -1;
+            }
+            kl = strcmp(optarg, "kl") == 0;
+            break;
+        case 'c':
+            compare = true;
+            break;
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 'j':
+            num_threads = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (!parampath || !modelpath || !outdir || tilesize < 32 || tiles_per_image < 1 || runs < 1 || num_threads < 1)
+    {
+        print_usage();
+        return -1;
+    }
+
+    const std::string model = basename_noext(parampath);
+    if (scale == 0 && sscanf(model.c_str(), "up%dx", &scale) != 1)
+    {
+        fprintf(stderr, "no upNx in %s, pass -s\n", model.c_str());
+        return -1;
+    }
+    if (scale < 2 || scale > 4)
+    {
+        print_usage();
+        return -1;
+    }
+    const int prepadding = scale == 2 ? 18 : scale == 3 ? 14 : 19;
+
+    std::vector<BenchImage> images;
+    for (int i = optind; i < argc; i++)
+    {
+        BenchImage im;
+        if (load_image(argv[i], im) != 0)
+            return -1;
+        images.push_back(im);
+    }
+    if (images.empty())
+    {
+        images.push_back(make_photo());
+        images.push_back(make_manga_page());
+        images.push_back(make_screenshot());
+    }
+
+    std::string header;
+    std::vector<QuantLayer> layers;
+    if (read_param(parampath, header, layers) != 0)
+        return -1;
+
+    // fp32 everywhere and every blob kept, the statistics are of the values the fp32 model computes
+    ncnn::Net net;
+    net.opt.use_vulkan_compute = false;
+    net.opt.use_fp16_packed = false;
+    net.opt.use_fp16_storage = false;
+    net.opt.use_fp16_arithmetic = false;
+    net.opt.use_bf16_storage = false;
+    net.opt.lightmode = false;
+    net.opt.num_threads = num_threads;
+    if (net.load_param(parampath) != 0 || net.load_model(modelpath) != 0)
+    {
+        fprintf(stderr, "load %s %s failed\n", parampath, modelpath);
+        return -1;
+    }
+
+    // tiles spread evenly over each image
+    std::vector<ncnn::Mat> tiles;
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        const BenchImage& im = images[i];
+        const int xtiles = (im.w + tilesize - 1) / tilesize;
+        const int ytiles = (im.h + tilesize - 1) / tilesize;
+        const int total = xtiles * ytiles;
+        const int n = std::min(tiles_per_image, total);
+        for (int k = 0; k < n; k++)
+        {
+            const int t = (int)((long long)k * total / n);
+            const int x0 = t % xtiles * tilesize;
+            const int y0 = t / xtiles * tilesize;
+
+            // reflect padding needs tiles wider than prepadding
+            if (im.w - x0 < 32 || im.h - y0 < 32)
+                continue;
+
+            tiles.push_back(calibration_tile(im, x0, y0, tilesize, scale, prepadding));
+        }
+    }
+    if (tiles.empty())
+    {
+        fprintf(stderr, "no calibration tile, images must be at least 32 x 32\n");
+        return -1;
+    }
+
+    fprintf(stderr, "calibrating %s with %d tiles\n", model.c_str(), (int)tiles.size());
+
+    // pass 1, the range of every convolution input
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        int ret = for_each_conv_input(net, tiles[i], layers, [](QuantLayer& l, const ncnn::Mat& m) {
+            for (int q = 0; q < m.c; q++)
+            {
+                const float* ptr = m.channel(q);
+                for (int j = 0; j < m.w * m.h; j++)
+                    l.absmax = std::max(l.absmax, fabsf(ptr[j]));
+            }
+        });
+        if (ret != 0)
+            return -1;
+    }
+
+    // pass 2, histograms over that range for the kl threshold
+    if (kl)
+    {
+        for (size_t i = 0; i < layers.size(); i++)
+            layers[i].histogram.assign(HISTOGRAM_BINS, 0);
+
+        for (size_t i = 0; i < tiles.size(); i++)
+        {
+            int ret = for_each_conv_input(net, tiles[i], layers, [](QuantLayer& l, const ncnn::Mat& m) {
+                if (l.absmax == 0.f)
+                    return;
+
+                const float bin_scale = HISTOGRAM_BINS / l.absmax;
+                for (int q = 0; q < m.c; q++)
+                {
+                    const float* ptr = m.channel(q);
+                    for (int j = 0; j < m.w * m.h; j++)
+                    {
+                        // zeros quantize exactly whatever the threshold
+                        const float v = fabsf(ptr[j]);
+                        if (v == 0.f)
+                            continue;
+                        l.histogram[std::min((int)(v * bin_scale), HISTOGRAM_BINS - 1)]++;
+                    }
+                }
+            });
+            if (ret != 0)
+                return -1;
+        }
+    }
+
+    fprintf(stdout, "%-20s %10s %10s %10s %12s\n", "convolution", "absmax", "threshold", "scale", "weight scale");
+
+    // activation scales and weights, in layer order as the bin stores them
+    mkdir(outdir, 0755);
+    const std::string outprefix = std::string(outdir) + "/" + model;
+
+    FILE* in = fopen(modelpath, "rb");
+    FILE* out = fopen((outprefix + ".bin").c_str(), "wb");
+    FILE* table = fopen((outprefix + ".table").c_str(), "wb");
+    if (!in || !out || !table)
+    {
+        fprintf(stderr, "open %s or write %s failed\n", modelpath, outprefix.c_str());
+        if (in)
+            fclose(in);
+        if (out)
+            fclose(out);
+        if (table)
+            fclose(table);
+        return -1;
+    }
+
+    int ret = 0;
+    for (size_t i = 0; i < layers.size() && ret == 0; i++)
+    {
+        QuantLayer& l = layers[i];
+
+        if (l.type == "Deconvolution" || l.type == "InnerProduct")
+        {
+            std::vector<float> data;
+            std::vector<unsigned char> raw;
+            ret = read_weight(in, l.weight_data_size, data, raw);
+            if (ret == 0 && fwrite(raw.data(), 1, raw.size(), out) != raw.size())
+                ret = -1;
+            if (ret == 0 && l.bias_term)
+                ret = copy_bytes(in, out, (size_t)l.num_output * sizeof(float));
+            continue;
+        }
+
+        if (l.type != "Convolution")
+        {
+            // the layers cugan uses besides these carry no weights
+            if (l.type != "Input" && l.type != "Split" && l.type != "BinaryOp" && l.type != "Crop" && l.type != "Pooling" && l.type != "PixelShuffle" && l.type != "Eltwise" && l.type != "Concat" && l.type != "ReLU" && l.type != "Sigmoid" && l.type != "Interp")
+            {
+                fprintf(stderr, "unknown weights of %s %s\n", l.type.c_str(), l.name.c_str());
+                ret = -1;
+            }
+            continue;
+        }
+
+        std::vector<float> weights;
+        std::vector<unsigned char> raw;
+        ret = read_weight(in, l.weight_data_size, weights, raw);
+        if (ret != 0 || l.num_output <= 0)
+        {
+            ret = -1;
+            break;
+        }
+
+        std::vector<unsigned char> bias((size_t)l.num_output * sizeof(float));
+        if (l.bias_term && fread(bias.data(), 1, bias.size(), in) != bias.size())
+        {
+            ret = -1;
+            break;
+        }
+
+        float threshold = l.absmax;
+        if (kl && l.absmax > 0.f)
+            threshold = (kl_threshold_bin(l.histogram) + 0.5f) * l.absmax / HISTOGRAM_BINS;
+        l.bottom_scale = threshold > 0.f ? 127.f / threshold : 1.f;
+
+        // one scale per output channel
+        const int maxk = l.weight_data_size / l.num_output;
+        std::vector<signed char> qweights(weights.size());
+        l.weight_scales.resize(l.num_output);
+        for (int oc = 0; oc < l.num_output; oc++)
+        {
+            const float* w = &weights[(size_t)oc * maxk];
+
+            float wmax = 0.f;
+            for (int k = 0; k < maxk; k++)
+                wmax = std::max(wmax, fabsf(w[k]));
+
+            const float s = wmax > 0.f ? 127.f / wmax : 1.f;
+            l.weight_scales[oc] = s;
+
+            for (int k = 0; k < maxk; k++)
+            {
+                const int v = (int)roundf(w[k] * s);
+                qweights[(size_t)oc * maxk + k] = (signed char)std::min(std::max(v, -127), 127);
+            }
+        }
+
+        const float wmin = *std::min_element(l.weight_scales.begin(), l.weight_scales.end());
+        const float wmaxs = *std::max_element(l.weight_scales.begin(), l.weight_scales.end());
+        fprintf(stdout, "%-20s %10.4f %10.4f %10.3f %5.0f..%-6.0f\n", l.name.c_str(), l.absmax, threshold, l.bottom_scale, wmin, wmaxs);
+
+        // int8 weights, bias, weight_data_int8_scales, bottom_blob_int8_scales
+        const uint32_t tag = WEIGHT_TAG_INT8;
+        const size_t padded = (qweights.size() + 3) / 4 * 4;
+        qweights.resize(padded, 0);
+        fwrite(&tag, 4, 1, out);
+        fwrite(qweights.data(), 1, padded, out);
+        if (l.bias_term)
+            fwrite(bias.data(), 1, bias.size(), out);
+        fwrite(l.weight_scales.data(), sizeof(float), l.num_output, out);
+        fwrite(&l.bottom_scale, sizeof(float), 1, out);
+
+        // the ncnn2table layout, for ncnn2int8 or a later requantisation
+        fprintf(table, "%s_param_0", l.name.c_str());
+        for (int oc = 0; oc < l.num_output; oc++)
+            fprintf(table, " %f", l.weight_scales[oc]);
+        fprintf(table, "\n%s %f\n", l.name.c_str(), l.bottom_scale);
+    }
+
+    if (ret == 0 && fgetc(in) != EOF)
+    {
+        fprintf(stderr, "%s has data beyond the layers of %s\n", modelpath, parampath);
+        ret = -1;
+    }
+    if (ret != 0)
+        fprintf(stderr, "read %s failed\n", modelpath);
+
+    fclose(in);
+    if (fclose(out) != 0 || fclose(table) != 0)
+        ret = -1;
+    if (ret != 0)
+        return -1;
+
+    // int8_scale_term 2, per channel weight scales and no requantized output
+    {
+        FILE* fp = fopen((outprefix + ".param").c_str(), "wb");
+        if (!fp)
+        {
+            fprintf(stderr, "write %s.param failed\n", outprefix.c_str());
+            return -1;
+        }
+
+        fputs(header.c_str(), fp);
+        for (size_t i = 0; i < layers.size(); i++)
+            fprintf(fp, "%s%s\n", layers[i].line.c_str(), layers[i].type == "Convolution" ? " 8=2" : "");
+
+        if (fclose(fp) != 0)
+            return -1;
+    }
+
+    fprintf(stderr, "wrote %s.param %s.bin %s.table\n", outprefix.c_str(), outprefix.c_str(), outprefix.c_str());
+
+    if (!compare)
+        return 0;
+
+    // both models through RealCUGAN on the cpu, syncgap off so only the convolutions differ
+    RealCUGAN fp32(-1, false, num_threads);
+    RealCUGAN int8(-1, false, num_threads);
+
+    RealCUGAN* nets[2] = {&fp32, &int8};
+    const std::string parampaths[2] = {parampath, outprefix + ".param"};
+    const std::string modelpaths[2] = {modelpath, outprefix + ".bin"};
+    for (int i = 0; i < 2; i++)
+    {
+        nets[i]->noise = 0;
+        nets[i]->scale = scale;
+        nets[i]->tilesize = 200;
+        nets[i]->syncgap = 0;
+        nets[i]->prepadding = prepadding;
+        nets[i]->tile_dedup = false;
+
+        if (nets[i]->load(parampaths[i], modelpaths[i]) != 0)
+        {
+            fprintf(stderr, "load %s failed\n", parampaths[i].c_str());
+            return -1;
+        }
+    }
+
+    fprintf(stdout, "\n%-32s %10s %10s %8s %10s\n", "image", "fp32 ms", "int8 ms", "speedup", "psnr dB");
+
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        const BenchImage& im = images[i];
+        const size_t outsize = (size_t)im.w * scale * im.h * scale * im.c;
+
+        ncnn::Mat inimage(im.w, im.h, (void*)im.pixels.data(), (size_t)im.c, im.c);
+        ncnn::Mat outfp32(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+        ncnn::Mat outint8(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+
+        const double fp32_ms = best_process_ms(fp32, inimage, outfp32, runs);
+        const double int8_ms = best_process_ms(int8, inimage, outint8, runs);
+
+        fprintf(stdout, "%-32s %10.1f %10.1f %7.2fx %10.2f\n", im.name.c_str(), fp32_ms, int8_ms, fp32_ms / int8_ms, psnr(outfp32, outint8, outsize));
+    }
+
+    return 0;
+}
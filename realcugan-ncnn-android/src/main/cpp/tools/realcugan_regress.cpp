@@ -0,0 +1,577 @@
+// golden output and throughput regression suite on the cpu path
+//
+// runs every model found under the given paths in syncgap modes 0..3, without and with tta, over center crops of
+// the test images, compares each output with the golden png of the case and the time with the timing baseline
+//
+// realcugan-regress -G golden-dir [-B timing.txt] [-u|-b|-n] [-i image ...] [-t 64] [-C 128] [-j 4] [-r 3] [-P 40] [-T 10] models-dir|model.param ...
+//
+// a directory is searched for .param files one level deep, so assets/models covers models-se, models-nose and models-pro
+// the goldens, golden.txt and the pngs, are committed, times only hold on the machine that took them and stay local
+// -u writes the goldens and the timing baseline instead of checking them, run it once on a known good tree
+// -b writes only the timing baseline of this machine and checks the outputs, -n checks the outputs without timing
+// an output passes when it is bit exact or within the psnr threshold, a total time beyond the tolerance fails the run
+// nothing to compare against fails too, missing or empty goldens, a case on only one side of them or no timing
+
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "bench_image.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "realcugan.h"
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: realcugan-regress -G golden-dir [options] models-dir|model.param ...\n");
+    fprintf(stderr, "  -G golden-dir  golden outputs and golden.txt, committed\n");
+    fprintf(stderr, "  -B timing      timing baseline of this machine, not committed (default=golden-dir/timing.txt)\n");
+    fprintf(stderr, "  -u             write the goldens and the timing baseline instead of checking\n");
+    fprintf(stderr, "  -b             write the timing baseline, check the outputs against the goldens\n");
+    fprintf(stderr, "  -n             check the outputs only, no timing baseline needed\n");
+    fprintf(stderr, "  -i image       test image, repeatable (default=synthetic photo and screenshot)\n");
+    fprintf(stderr, "  -t tile-size   tile size (>=32, default=64), below the crop so that the syncgap paths run\n");
+    fprintf(stderr, "  -C crop        side of the center crop of every image (default=128, 0=whole image)\n");
+    fprintf(stderr, "  -j threads     cpu threads (default=4)\n");
+    fprintf(stderr, "  -r runs        timed runs per case after the checked one, the best counts (default=3)\n");
+    fprintf(stderr, "  -P psnr        lowest psnr in dB of an output that is not bit exact (default=40)\n");
+    fprintf(stderr, "  -T tolerance   allowed slowdown of the total time in percent (default=10)\n");
+}
+
+static bool has_suffix(const std::string& s, const char* suffix)
+{
+    const size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+static bool is_directory(const std::string& path)
+{
+    struct stat s;
+    return stat(path.c_str(), &s) == 0 && S_ISDIR(s.st_mode);
+}
+
+static void collect_params(const std::string& path, std::vector<std::string>& params, int depth)
+{
+    if (!is_directory(path))
+    {
+        if (has_suffix(path, ".param"))
+            params.push_back(path);
+        return;
+    }
+
+    DIR* dir = opendir(path.c_str());
+    if (!dir)
+    {
+        fprintf(stderr, "opendir failed %s\n", path.c_str());
+        return;
+    }
+
+    std::vector<std::string> names;
+    struct dirent* ent = 0;
+    while ((ent = readdir(dir)))
+    {
+        if (ent->d_name[0] != '.')
+            names.push_back(ent->d_name);
+    }
+    closedir(dir);
+
+    std::sort(names.begin(), names.end());
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        const std::string sub = path + "/" + names[i];
+        if (has_suffix(names[i], ".param"))
+            params.push_back(sub);
+        else if (depth > 0 && is_directory(sub))
+            collect_params(sub, params, depth - 1);
+    }
+}
+
+static std::string basename_of(const std::string& path)
+{
+    const size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// models-se/up2x-no-denoise.param -> models-se_up2x-no-denoise
+static std::string model_key(const std::string& parampath)
+{
+    std::string name = basename_of(parampath);
+    name = name.substr(0, name.size() - 6);
+
+    const size_t slash = parampath.rfind('/');
+    if (slash == std::string::npos || slash == 0)
+        return name;
+
+    return basename_of(parampath.substr(0, slash)) + "_" + name;
+}
+
+// scale from up%dx, noise -1 for conservative, 0 for no-denoise, n for denoise%dx
+static void model_config(const std::string& parampath, int& scale, int& noise)
+{
+    const std::string name = basename_of(parampath);
+
+    scale = 2;
+    sscanf(name.c_str(), "up%dx", &scale);
+    if (scale < 2 || scale > 4)
+        scale = 2;
+
+    noise = 0;
+    if (name.find("conservative") != std::string::npos)
+        noise = -1;
+    else if (name.find("denoise") != std::string::npos && name.find("no-denoise") == std::string::npos)
+        sscanf(name.c_str() + name.find("denoise"), "denoise%dx", &noise);
+}
+
+static BenchImage center_crop(const BenchImage& im, int side)
+{
+    if (side <= 0 || (im.w <= side && im.h <= side))
+        return im;
+
+    const int w = std::min(im.w, side);
+    const int h = std::min(im.h, side);
+    const int x0 = (im.w - w) / 2;
+    const int y0 = (im.h - h) / 2;
+
+    BenchImage crop;
+    crop.name = im.name;
+    crop.w = w;
+    crop.h = h;
+    crop.c = im.c;
+    crop.pixels.resize((size_t)w * h * im.c);
+
+    for (int y = 0; y < h; y++)
+    {
+        const unsigned char* p = &im.pixels[((size_t)(y0 + y) * im.w + x0) * im.c];
+        std::copy(p, p + (size_t)w * im.c, &crop.pixels[(size_t)y * w * im.c]);
+    }
+
+    return crop;
+}
+
+// file name friendly, test1.png -> test1
+static std::string image_key(const std::string& name)
+{
+    std::string key = basename_of(name);
+    const size_t dot = key.rfind('.');
+    if (dot != std::string::npos && dot > 0)
+        key = key.substr(0, dot);
+
+    for (size_t i = 0; i < key.size(); i++)
+    {
+        if (key[i] == ' ' || key[i] == '/')
+            key[i] = '-';
+    }
+
+    return key;
+}
+
+static uint64_t fnv1a(const unsigned char* data, size_t size)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        h ^= data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static double psnr(const unsigned char* a, const unsigned char* b, size_t size)
+{
+    double sse = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        const double d = (double)a[i] - b[i];
+        sse += d * d;
+    }
+
+    if (sse == 0)
+        return INFINITY;
+
+    return 10 * log10(255.0 * 255.0 * size / sse);
+}
+
+// golden.txt, one "key hash" line per case
+static int read_goldens(const std::string& path, std::map<std::string, uint64_t>& goldens)
+{
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return -1;
+
+    char key[512];
+    unsigned long long hash = 0;
+    while (fscanf(fp, "%511s %llx", key, &hash) == 2)
+        goldens[key] = hash;
+
+    fclose(fp);
+    return 0;
+}
+
+static int write_goldens(const std::string& path, const std::map<std::string, uint64_t>& goldens)
+{
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "fopen %s failed\n", path.c_str());
+        return -1;
+    }
+
+    for (std::map<std::string, uint64_t>::const_iterator it = goldens.begin(); it != goldens.end(); ++it)
+        fprintf(fp, "%s %016llx\n", it->first.c_str(), (unsigned long long)it->second);
+
+    fclose(fp);
+    return 0;
+}
+
+// timing baseline, one "key ms" line per case
+static int read_timing(const std::string& path, std::map<std::string, double>& timing)
+{
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return -1;
+
+    char key[512];
+    double ms = 0;
+    while (fscanf(fp, "%511s %lf", key, &ms) == 2)
+        timing[key] = ms;
+
+    fclose(fp);
+    return 0;
+}
+
+static int write_timing(const std::string& path, const std::map<std::string, double>& timing)
+{
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "fopen %s failed\n", path.c_str());
+        return -1;
+    }
+
+    for (std::map<std::string, double>::const_iterator it = timing.begin(); it != timing.end(); ++it)
+        fprintf(fp, "%s %.3f\n", it->first.c_str(), it->second);
+
+    fclose(fp);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    typedef std::chrono::steady_clock clock;
+
+    std::string goldendir;
+    std::string timingpath;
+    bool update = false;
+    bool update_timing = false;
+    bool check_timing = true;
+    std::vector<std::string> imagepaths;
+    int tilesize = 64;
+    int crop = 128;
+    int num_threads = 4;
+    int runs = 3;
+    double min_psnr = 40;
+    double tolerance = 10;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "G:B:ubni:t:C:j:r:P:T:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'G':
+            goldendir = optarg;
+            break;
+        case 'B':
+            timingpath = optarg;
+            break;
+        case 'u':
+            update = true;
+            break;
+        case 'b':
+            update_timing = true;
+            break;
+        case 'n':
+            check_timing = false;
+            break;
+        case 'i':
+            imagepaths.push_back(optarg);
+            break;
+        case 't':
+            tilesize = atoi(optarg);
+            break;
+        case 'C':
+            crop = atoi(optarg);
+            break;
+        case 'j':
+            num_threads = atoi(optarg);
+            break;
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 'P':
+            min_psnr = atof(optarg);
+            break;
+        case 'T':
+            tolerance = atof(optarg);
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (goldendir.empty() || optind >= argc || tilesize < 32 || crop < 0 || num_threads < 1 || runs < 0 || (update && update_timing))
+    {
+        print_usage();
+        return -1;
+    }
+
+    std::vector<std::string> params;
+    for (int i = optind; i < argc; i++)
+        collect_params(argv[i], params, 1);
+
+    if (params.empty())
+    {
+        fprintf(stderr, "no .param found\n");
+        return -1;
+    }
+
+    std::vector<BenchImage> images;
+    for (size_t i = 0; i < imagepaths.size(); i++)
+    {
+        BenchImage im;
+        if (load_image(imagepaths[i].c_str(), im) != 0)
+            return -1;
+        images.push_back(center_crop(im, crop));
+    }
+    if (images.empty())
+    {
+        images.push_back(center_crop(make_photo(), crop));
+        images.push_back(center_crop(make_screenshot(), crop));
+    }
+
+    const std::string goldenlist = goldendir + "/golden.txt";
+    if (timingpath.empty())
+        timingpath = goldendir + "/timing.txt";
+
+    // writing the timing baseline is the run that has none yet
+    if (update || update_timing)
+        check_timing = false;
+
+    std::map<std::string, uint64_t> goldens;
+    if (!update && (read_goldens(goldenlist, goldens) != 0 || goldens.empty()))
+    {
+        fprintf(stderr, "no goldens in %s, create them with -u on a known good tree\n", goldendir.c_str());
+        return -1;
+    }
+
+    std::map<std::string, double> timing;
+    if (check_timing && (read_timing(timingpath, timing) != 0 || timing.empty()))
+    {
+        fprintf(stderr, "no timing baseline in %s, take one on this machine with -b or check the outputs only with -n\n", timingpath.c_str());
+        return -1;
+    }
+
+    if (update)
+        mkdir(goldendir.c_str(), 0755);
+
+    std::map<std::string, uint64_t> measured;
+    std::map<std::string, double> measured_ms;
+    std::set<std::string> ran;
+    int cases = 0;
+    int failed = 0;
+    double total_ms = 0;
+    double total_baseline_ms = 0;
+
+    fprintf(stdout, "%-56s %10s %10s %8s  %s\n", "case", "ms", "baseline", "change", "output");
+
+    for (size_t m = 0; m < params.size(); m++)
+    {
+        const std::string& parampath = params[m];
+        const std::string modelpath = parampath.substr(0, parampath.size() - 6) + ".bin";
+
+        int scale = 2;
+        int noise = 0;
+        model_config(parampath, scale, noise);
+
+        for (int tta = 0; tta < 2; tta++)
+        {
+            RealCUGAN realcugan(-1, tta == 1, num_threads);
+            realcugan.noise = noise;
+            realcugan.scale = scale;
+            realcugan.tilesize = tilesize;
+            realcugan.prepadding = scale == 2 ? 18 : scale == 3 ? 14 : 19;
+
+            if (realcugan.load(parampath, modelpath) != 0)
+            {
+                fprintf(stderr, "load %s %s failed\n", parampath.c_str(), modelpath.c_str());
+                return -1;
+            }
+
+            for (int syncgap = 0; syncgap <= 3; syncgap++)
+            {
+                realcugan.syncgap = syncgap;
+
+                for (size_t i = 0; i < images.size(); i++)
+                {
+                    const BenchImage& im = images[i];
+
+                    char key[512];
+                    sprintf(key, "%s_c%d_tta%d_%s", model_key(parampath).c_str(), syncgap, tta, image_key(im.name).c_str());
+
+                    ncnn::Mat inimage(im.w, im.h, (void*)im.pixels.data(), (size_t)im.c, im.c);
+                    ncnn::Mat outimage(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+
+                    // the checked run warms up the shapes of the timed ones
+                    int ret = realcugan.process(inimage, outimage);
+
+                    double best_ms = 0;
+                    for (int r = 0; r < runs && ret == 0; r++)
+                    {
+                        clock::time_point t0 = clock::now();
+                        ret = realcugan.process(inimage, outimage);
+                        const double ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+                        best_ms = r == 0 ? ms : std::min(best_ms, ms);
+                    }
+
+                    cases++;
+                    ran.insert(key);
+
+                    if (ret != 0)
+                    {
+                        fprintf(stdout, "%-56s %10s %10s %8s  FAIL process %d\n", key, "-", "-", "-", ret);
+                        failed++;
+                        continue;
+                    }
+
+                    const unsigned char* out = (const unsigned char*)outimage.data;
+                    const size_t outsize = (size_t)outimage.w * outimage.h * im.c;
+                    const std::string goldenpath = goldendir + "/" + key + ".png";
+
+                    const uint64_t hash = fnv1a(out, outsize);
+                    measured[key] = hash;
+                    measured_ms[key] = best_ms;
+
+                    if (update)
+                    {
+                        if (!stbi_write_png(goldenpath.c_str(), outimage.w, outimage.h, im.c, out, outimage.w * im.c))
+                        {
+                            fprintf(stderr, "write %s failed\n", goldenpath.c_str());
+                            return -1;
+                        }
+
+                        fprintf(stdout, "%-56s %10.2f %10s %8s  written\n", key, best_ms, "-", "-");
+                        continue;
+                    }
+
+                    // output
+                    char verdict[64];
+                    bool pass = false;
+                    std::map<std::string, uint64_t>::const_iterator it = goldens.find(key);
+                    if (it == goldens.end())
+                    {
+                        strcpy(verdict, "FAIL not in goldens");
+                    }
+                    else if (it->second == hash)
+                    {
+                        strcpy(verdict, "exact");
+                        pass = true;
+                    }
+                    else
+                    {
+                        int gw = 0;
+                        int gh = 0;
+                        int gc = 0;
+                        unsigned char* golden = stbi_load(goldenpath.c_str(), &gw, &gh, &gc, im.c);
+                        if (!golden)
+                        {
+                            strcpy(verdict, "FAIL no golden");
+                        }
+                        else if (gw != outimage.w || gh != outimage.h)
+                        {
+                            sprintf(verdict, "FAIL golden is %dx%d", gw, gh);
+                        }
+                        else
+                        {
+                            const double db = psnr(out, golden, outsize);
+                            pass = db >= min_psnr;
+                            sprintf(verdict, "%s psnr %.2f dB", pass ? "ok" : "FAIL", db);
+                        }
+
+                        if (golden)
+                            stbi_image_free(golden);
+                    }
+
+                    // time, single cases are noisy and only the total fails the run
+                    std::map<std::string, double>::const_iterator t = timing.find(key);
+                    const double base_ms = t != timing.end() ? t->second : 0.0;
+                    const double change = base_ms > 0 ? (best_ms - base_ms) * 100 / base_ms : 0.0;
+                    if (base_ms > 0)
+                    {
+                        total_ms += best_ms;
+                        total_baseline_ms += base_ms;
+                    }
+
+                    if (!pass)
+                        failed++;
+
+                    fprintf(stdout, "%-56s %10.2f %10.2f %7.1f%%  %s%s\n", key, best_ms, base_ms, change, verdict, change > tolerance ? ", slow" : "");
+                }
+            }
+        }
+    }
+
+    if (update || update_timing)
+    {
+        if (update && write_goldens(goldenlist, measured) != 0)
+            return -1;
+        if (write_timing(timingpath, measured_ms) != 0)
+            return -1;
+
+        if (update)
+        {
+            fprintf(stdout, "\n%d cases written to %s, timing to %s\n", cases, goldendir.c_str(), timingpath.c_str());
+            return 0;
+        }
+
+        fprintf(stdout, "\ntiming of %d cases written to %s\n", cases, timingpath.c_str());
+    }
+
+    // cases of the goldens this run did not cover, a model or image gone missing is not a pass
+    for (std::map<std::string, uint64_t>::const_iterator it = goldens.begin(); it != goldens.end(); ++it)
+    {
+        if (ran.find(it->first) == ran.end())
+        {
+            fprintf(stdout, "%-56s %10s %10s %8s  FAIL not run\n", it->first.c_str(), "-", "-", "-");
+            failed++;
+        }
+    }
+
+    if (!check_timing)
+    {
+        fprintf(stdout, "\n%d cases, %d failed, outputs only\n", cases, failed);
+        return failed == 0 ? 0 : 1;
+    }
+
+    const double total_change = total_baseline_ms > 0 ? (total_ms - total_baseline_ms) * 100 / total_baseline_ms : 0.0;
+    // a baseline without times of these cases has nothing to hold the run against
+    const bool slow = runs > 0 && (total_baseline_ms <= 0 || total_change > tolerance);
+
+    fprintf(stdout, "\n%d cases, %d failed, total %.1f ms against %.1f ms baseline (%+.1f%%, tolerance %.0f%%)%s\n", cases, failed, total_ms, total_baseline_ms, total_change, tolerance, slow ? ", THROUGHPUT REGRESSION" : "");
+
+    return failed == 0 && !slow ? 0 : 1;
+}
@@ -0,0 +1,259 @@
+// exported SE blocks against the fused CuganSE layer
+//
+// realcugan-se-bench -p models-se/up2x-no-denoise.param -b models-se/up2x-no-denoise.bin [-g -1] [-y 3] [-t 200] [-r 3] [-P 40] [image.png ...]
+//
+// the model loads twice, once as exported and once with every SE block rewritten into CuganSE
+// each image reports the best time of both, the speedup, the psnr of the fused output against the exported one
+// and the peak bytes of the network blobs, which drop by one feature map per block as CuganSE scales in place
+// -y 0 also moves the pooling into the layer, any other syncgap keeps gap0..gap3 for the SE tiling modes
+// the bench fails when the fused output of an image falls below -P dB against the exported one
+// without images a synthetic photo, manga page and screenshot are used
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "bench_image.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// ncnn
+#include "cpu.h"
+#include "gpu.h"
+#include "net.h"
+
+#include "memory_tracker.h"
+#include "realcugan.h"
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: realcugan-se-bench -p param -b bin [options] [image ...]\n");
+    fprintf(stderr, "  -s scale       upscale ratio of the model (2, 3, 4, default=from the param name)\n");
+    fprintf(stderr, "  -n noise       denoise level of the model (default=0)\n");
+    fprintf(stderr, "  -g gpu-id      gpu device to use (-1=cpu, default=-1)\n");
+    fprintf(stderr, "  -y syncgap     syncgap mode (0-3, default=3)\n");
+    fprintf(stderr, "  -t tile-size   tile size (>=32, default=200)\n");
+    fprintf(stderr, "  -r runs        timed runs per image, the best is reported (default=3)\n");
+    fprintf(stderr, "  -P min-psnr    lowest psnr of the fused output against the exported one (default=40)\n");
+    fprintf(stderr, "  -j threads     cpu threads (default=big cores)\n");
+}
+
+static double psnr(const ncnn::Mat& a, const ncnn::Mat& b, size_t size)
+{
+    const unsigned char* pa = (const unsigned char*)a.data;
+    const unsigned char* pb = (const unsigned char*)b.data;
+
+    double sse = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        double d = (double)pa[i] - pb[i];
+        sse += d * d;
+    }
+
+    if (sse == 0)
+        return INFINITY;
+
+    return 10.0 * log10(255.0 * 255.0 * size / sse);
+}
+
+static double best_process_ms(const RealCUGAN& realcugan, const ncnn::Mat& inimage, ncnn::Mat& outimage, int runs)
+{
+    double best = DBL_MAX;
+    for (int r = 0; r < runs; r++)
+    {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        realcugan.process(inimage, outimage);
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+        best = std::min(best, std::chrono::duration<double, std::milli>(t1 - t0).count());
+    }
+
+    return best;
+}
+
+static std::string basename_noext(const char* path)
+{
+    std::string s = path;
+    const size_t slash = s.find_last_of("/\\");
+    if (slash != std::string::npos)
+        s = s.substr(slash + 1);
+    const size_t dot = s.rfind('.');
+    if (dot != std::string::npos)
+        s = s.substr(0, dot);
+    return s;
+}
+
+int main(int argc, char** argv)
+{
+    const char* parampath = 0;
+    const char* modelpath = 0;
+    int scale = 0;
+    int noise = 0;
+    int gpuid = -1;
+    int syncgap = 3;
+    int tilesize = 200;
+    int runs = 3;
+    double min_psnr = 40.0;
+    int num_threads = ncnn::get_big_cpu_count();
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:b:s:n:g:y:t:r:P:j:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            parampath = optarg;
+            break;
+        case 'b':
+            modelpath = optarg;
+            break;
+        case 's':
+            scale = atoi(optarg);
+            break;
+        case 'n':
+            noise = atoi(optarg);
+            break;
+        case 'g':
+            gpuid = atoi(optarg);
+            break;
+        case 'y':
+            syncgap = atoi(optarg);
+            break;
+        case 't':
+            tilesize = atoi(optarg);
+            break;
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 'P':
+            min_psnr = atof(optarg);
+            break;
+        case 'j':
+            num_threads = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (!parampath || !modelpath || gpuid < -1 || syncgap < 0 || syncgap > 3 || tilesize < 32 || runs < 1 || num_threads < 1)
+    {
+        print_usage();
+        return -1;
+    }
+
+    const std::string model = basename_noext(parampath);
+    if (scale == 0 && sscanf(model.c_str(), "up%dx", &scale) != 1)
+    {
+        fprintf(stderr, "no upNx in %s, pass -s\n", model.c_str());
+        return -1;
+    }
+    if (scale < 2 || scale > 4)
+    {
+        print_usage();
+        return -1;
+    }
+
+    std::vector<BenchImage> images;
+    for (int i = optind; i < argc; i++)
+    {
+        BenchImage im;
+        if (load_image(argv[i], im) != 0)
+            return -1;
+        images.push_back(im);
+    }
+    if (images.empty())
+    {
+        images.push_back(make_photo());
+        images.push_back(make_manga_page());
+        images.push_back(make_screenshot());
+    }
+
+    if (gpuid != -1)
+        ncnn::create_gpu_instance();
+
+    // blobs of the network, on the device with vulkan
+    const int blob_tag = gpuid == -1 ? MEMORY_CPU_BLOB : MEMORY_VK_BLOB;
+
+    int ret = 0;
+    {
+        MemoryTracker tracker;
+        RealCUGAN exported(gpuid, false, num_threads);
+        RealCUGAN fused(gpuid, false, num_threads);
+
+        RealCUGAN* nets[2] = {&exported, &fused};
+        for (int i = 0; i < 2 && ret == 0; i++)
+        {
+            nets[i]->noise = noise;
+            nets[i]->scale = scale;
+            nets[i]->tilesize = tilesize;
+            nets[i]->syncgap = syncgap;
+            nets[i]->prepadding = scale == 2 ? 18 : scale == 3 ? 14 : 19;
+            nets[i]->tile_dedup = false;
+            nets[i]->memory_tracker = &tracker;
+            nets[i]->fuse_se = i == 1;
+
+            if (nets[i]->load(parampath, modelpath) != 0)
+            {
+                fprintf(stderr, "load %s %s failed\n", parampath, modelpath);
+                ret = -1;
+            }
+        }
+
+        if (ret == 0 && fused.se_fused == 0)
+        {
+            fprintf(stderr, "%s has no SE block to fuse\n", parampath);
+            ret = -1;
+        }
+
+        if (ret == 0)
+        {
+            fprintf(stderr, "%d SE blocks fused, %s\n", fused.se_fused, syncgap ? "gap blobs kept for the SE tiling modes" : "pooling inside the layer");
+
+            fprintf(stdout, "%-32s %12s %10s %8s %10s %14s %12s\n", "image", "exported ms", "fused ms", "speedup", "psnr dB", "exported MB", "fused MB");
+        }
+
+        for (size_t i = 0; i < images.size() && ret == 0; i++)
+        {
+            const BenchImage& im = images[i];
+            const size_t outsize = (size_t)im.w * scale * im.h * scale * im.c;
+
+            ncnn::Mat inimage(im.w, im.h, (void*)im.pixels.data(), (size_t)im.c, im.c);
+            ncnn::Mat outexported(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+            ncnn::Mat outfused(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+
+            // warm up pipelines and allocators
+            exported.process(inimage, outexported);
+            fused.process(inimage, outfused);
+
+            const double exported_ms = best_process_ms(exported, inimage, outexported, runs);
+            const size_t exported_peak = tracker.usage(blob_tag).peak;
+            const double fused_ms = best_process_ms(fused, inimage, outfused, runs);
+            const size_t fused_peak = tracker.usage(blob_tag).peak;
+
+            const double db = psnr(outexported, outfused, outsize);
+
+            fprintf(stdout, "%-32s %12.1f %10.1f %7.2fx %10.2f %14.1f %12.1f\n", im.name.c_str(), exported_ms, fused_ms, fused_ms > 0 ? exported_ms / fused_ms : 0.0, db, exported_peak / 1024.0 / 1024.0, fused_peak / 1024.0 / 1024.0);
+
+            if (db < min_psnr)
+            {
+                fprintf(stderr, "%s: fused output %.2f dB off the exported one, below %.2f dB\n", im.name.c_str(), db, min_psnr);
+                ret = -1;
+            }
+        }
+    }
+
+    if (gpuid != -1)
+        ncnn::destroy_gpu_instance();
+
+    return ret;
+}
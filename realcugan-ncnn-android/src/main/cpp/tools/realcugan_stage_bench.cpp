@@ -0,0 +1,179 @@
+// stage timing benchmark, where the time of one process() call goes
+//
+// times a plain run, then a run with RealCUGANStageStats and prints every stage with its share of the total,
+// the difference of the two totals is the cost of waiting for every gpu stage on its own
+//
+// realcugan-stage-bench -p up2x-no-denoise.param -b up2x-no-denoise.bin [-s 2] [-n 0] [-g 0] [-t 200] [-c 3] [-x] [-S 1024] [image.png ...]
+//
+// without images a synthetic photo of side -S is generated
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+
+#include "bench_image.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// ncnn
+#include "gpu.h"
+
+#include "realcugan.h"
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: realcugan-stage-bench -p param -b bin [options] [image ...]\n");
+    fprintf(stderr, "  -s scale      upscale ratio (2, 3, 4, default=2)\n");
+    fprintf(stderr, "  -n noise      denoise level (-1/0/1/2/3, default=0)\n");
+    fprintf(stderr, "  -g gpu-id     gpu device to use (-1=cpu, default=0)\n");
+    fprintf(stderr, "  -t tile-size  tile size (>=32, default=200)\n");
+    fprintf(stderr, "  -c syncgap    sync gap mode (0/1/2/3, default=3)\n");
+    fprintf(stderr, "  -x            tta mode\n");
+    fprintf(stderr, "  -S side       side of the synthetic image (default=1024)\n");
+}
+
+static void print_stage(const char* name, double ms, double total_ms)
+{
+    fprintf(stdout, "  %-10s %10.2f ms %6.1f%%\n", name, ms, total_ms > 0 ? ms * 100 / total_ms : 0.0);
+}
+
+int main(int argc, char** argv)
+{
+    typedef std::chrono::steady_clock clock;
+
+    const char* parampath = 0;
+    const char* modelpath = 0;
+    int scale = 2;
+    int noise = 0;
+    int gpuid = 0;
+    int tilesize = 200;
+    int syncgap = 3;
+    bool tta_mode = false;
+    int side = 1024;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:b:s:n:g:t:c:xS:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            parampath = optarg;
+            break;
+        case 'b':
+            modelpath = optarg;
+            break;
+        case 's':
+            scale = atoi(optarg);
+            break;
+        case 'n':
+            noise = atoi(optarg);
+            break;
+        case 'g':
+            gpuid = atoi(optarg);
+            break;
+        case 't':
+            tilesize = atoi(optarg);
+            break;
+        case 'c':
+            syncgap = atoi(optarg);
+            break;
+        case 'x':
+            tta_mode = true;
+            break;
+        case 'S':
+            side = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (!parampath || !modelpath || scale < 2 || scale > 4 || tilesize < 32 || syncgap < 0 || syncgap > 3 || side < 16)
+    {
+        print_usage();
+        return -1;
+    }
+
+    std::vector<BenchImage> images;
+    for (int i = optind; i < argc; i++)
+    {
+        BenchImage im;
+        if (load_image(argv[i], im) != 0)
+            return -1;
+        images.push_back(im);
+    }
+    if (images.empty())
+        images.push_back(make_photo_sized(side, side));
+
+    if (gpuid != -1)
+        ncnn::create_gpu_instance();
+
+    int ret = 0;
+    {
+        RealCUGAN realcugan(gpuid, tta_mode);
+        realcugan.noise = noise;
+        realcugan.scale = scale;
+        realcugan.tilesize = tilesize;
+        realcugan.syncgap = syncgap;
+        realcugan.prepadding = scale == 2 ? 18 : scale == 3 ? 14 : 19;
+        // every tile runs the network
+        realcugan.tile_dedup = false;
+
+        if (realcugan.load(parampath, modelpath) != 0)
+        {
+            fprintf(stderr, "load %s %s failed\n", parampath, modelpath);
+            ret = -1;
+        }
+
+        for (size_t i = 0; i < images.size() && ret == 0; i++)
+        {
+            const BenchImage& im = images[i];
+
+            ncnn::Mat inimage(im.w, im.h, (void*)im.pixels.data(), (size_t)im.c, im.c);
+            ncnn::Mat outimage(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+
+            // warm up the shapes of this image
+            realcugan.process(inimage, outimage);
+
+            clock::time_point t0 = clock::now();
+            ret = realcugan.process(inimage, outimage);
+            const double plain_ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+
+            RealCUGANStageStats s;
+            if (ret == 0)
+                ret = realcugan.process(inimage, outimage, s);
+
+            if (ret != 0)
+            {
+                fprintf(stderr, "process %s failed %d\n", im.name.c_str(), ret);
+                break;
+            }
+
+            const double staged_ms = s.pixel_ms + s.upload_ms + s.preproc_ms + s.net_ms + s.alpha_ms + s.postproc_ms + s.download_ms + s.se_sync_ms;
+
+            fprintf(stdout, "%s %d x %d, %d tiles, %d inferences\n", im.name.c_str(), im.w, im.h, s.tilestats.total, s.inferences);
+            print_stage("pixel", s.pixel_ms, s.total_ms);
+            print_stage("upload", s.upload_ms, s.total_ms);
+            print_stage("preproc", s.preproc_ms, s.total_ms);
+            print_stage("net", s.net_ms, s.total_ms);
+            print_stage("alpha", s.alpha_ms, s.total_ms);
+            print_stage("postproc", s.postproc_ms, s.total_ms);
+            print_stage("download", s.download_ms, s.total_ms);
+            print_stage("se sync", s.se_sync_ms, s.total_ms);
+            print_stage("other", s.total_ms - staged_ms, s.total_ms);
+            fprintf(stdout, "  %-10s %10.2f ms, %.1f MB up, %.1f MB down\n", "total", s.total_ms, s.upload_bytes / 1048576.0, s.download_bytes / 1048576.0);
+            fprintf(stdout, "  %-10s %10.2f ms, stats overhead %.1f%%\n\n", "plain", plain_ms, plain_ms > 0 ? (s.total_ms - plain_ms) * 100 / plain_ms : 0.0);
+        }
+    }
+
+    if (gpuid != -1)
+        ncnn::destroy_gpu_instance();
+
+    return ret;
+}
@@ -0,0 +1,225 @@
+// adaptive and batched tta benchmark, speed and quality against full 8 orientation tta
+//
+// "batched" packs the orientations into 2 inferences per tile, run with -g -1 and -g 0 to compare cpu and vulkan
+//
+// realcugan-tta-bench -p up2x-no-denoise.param -b up2x-no-denoise.bin [-s 2] [-n 0] [-g 0] [-t 200] [-a 2,4,8] [image.png ...]
+//
+// without images a synthetic photo, manga page and screenshot are generated
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+
+#include "bench_image.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// ncnn
+#include "gpu.h"
+
+#include "realcugan.h"
+
+// psnr of b against reference a over all channels, inf when identical
+static double psnr(const ncnn::Mat& a, const ncnn::Mat& b, size_t size)
+{
+    const unsigned char* pa = (const unsigned char*)a.data;
+    const unsigned char* pb = (const unsigned char*)b.data;
+
+    double sse = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        double d = (double)pa[i] - pb[i];
+        sse += d * d;
+    }
+
+    if (sse == 0)
+        return INFINITY;
+
+    return 10.0 * log10(255.0 * 255.0 * size / sse);
+}
+
+static double timed_process(const RealCUGAN& realcugan, const ncnn::Mat& inimage, ncnn::Mat& outimage, RealCUGANTileStats& stats)
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    realcugan.process(inimage, outimage, stats);
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: realcugan-tta-bench -p param -b bin [options] [image ...]\n");
+    fprintf(stderr, "  -s scale       upscale ratio (2, 3, 4, default=2)\n");
+    fprintf(stderr, "  -n noise       denoise level (-1/0/1/2/3, default=0)\n");
+    fprintf(stderr, "  -g gpu-id      gpu device to use (-1=cpu, default=0)\n");
+    fprintf(stderr, "  -t tile-size   tile size (>=32, default=200)\n");
+    fprintf(stderr, "  -a thresholds  comma separated adaptive tta thresholds (default=2,4,8)\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* parampath = 0;
+    const char* modelpath = 0;
+    int scale = 2;
+    int noise = 0;
+    int gpuid = 0;
+    int tilesize = 200;
+    std::vector<float> thresholds;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:b:s:n:g:t:a:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            parampath = optarg;
+            break;
+        case 'b':
+            modelpath = optarg;
+            break;
+        case 's':
+            scale = atoi(optarg);
+            break;
+        case 'n':
+            noise = atoi(optarg);
+            break;
+        case 'g':
+            gpuid = atoi(optarg);
+            break;
+        case 't':
+            tilesize = atoi(optarg);
+            break;
+        case 'a':
+        {
+            const char* p = optarg;
+            while (*p)
+            {
+                char* end = 0;
+                float v = strtof(p, &end);
+                if (end == p || v <= 0.f)
+                {
+                    print_usage();
+                    return -1;
+                }
+                thresholds.push_back(v);
+                p = *end == ',' ? end + 1 : end;
+            }
+            break;
+        }
+        case 'h':
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (!parampath || !modelpath || scale < 2 || scale > 4 || tilesize < 32)
+    {
+        print_usage();
+        return -1;
+    }
+
+    if (thresholds.empty())
+    {
+        thresholds.push_back(2.f);
+        thresholds.push_back(4.f);
+        thresholds.push_back(8.f);
+    }
+
+    std::vector<BenchImage> images;
+    for (int i = optind; i < argc; i++)
+    {
+        BenchImage im;
+        if (load_image(argv[i], im) != 0)
+            return -1;
+        images.push_back(im);
+    }
+    if (images.empty())
+    {
+        images.push_back(make_photo());
+        images.push_back(make_manga_page());
+        images.push_back(make_screenshot());
+    }
+
+    if (gpuid != -1)
+        ncnn::create_gpu_instance();
+
+    int ret = 0;
+    {
+        // syncgap off, se modes always run full tta
+        RealCUGAN tta(gpuid, true);
+        RealCUGAN plain(gpuid, false);
+
+        RealCUGAN* nets[2] = {&tta, &plain};
+        for (int i = 0; i < 2 && ret == 0; i++)
+        {
+            nets[i]->noise = noise;
+            nets[i]->scale = scale;
+            nets[i]->tilesize = tilesize;
+            nets[i]->syncgap = 0;
+            nets[i]->prepadding = scale == 2 ? 18 : scale == 3 ? 14 : 19;
+            // measure inference, not tile reuse
+            nets[i]->tile_dedup = false;
+
+            if (nets[i]->load(parampath, modelpath) != 0)
+            {
+                fprintf(stderr, "load %s %s failed\n", parampath, modelpath);
+                ret = -1;
+            }
+        }
+
+        fprintf(stdout, "%-32s %9s %11s %10s %8s %10s\n", "image", "threshold", "tta tiles", "ms", "speedup", "psnr dB");
+
+        for (size_t i = 0; i < images.size() && ret == 0; i++)
+        {
+            const BenchImage& im = images[i];
+            const size_t outsize = (size_t)im.w * scale * im.h * scale * im.c;
+
+            ncnn::Mat inimage(im.w, im.h, (void*)im.pixels.data(), (size_t)im.c, im.c);
+            ncnn::Mat outfull(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+            ncnn::Mat out(im.w * scale, im.h * scale, (size_t)im.c, im.c);
+
+            RealCUGANTileStats stats;
+
+            // warm up pipelines and allocators
+            tta.tta_threshold = 0.f;
+            tta.process(inimage, outfull, stats);
+            plain.process(inimage, out, stats);
+
+            double full_ms = timed_process(tta, inimage, outfull, stats);
+            fprintf(stdout, "%-32s %9s %5d/%-5d %10.1f %7.2fx %10s\n", im.name.c_str(), "full", stats.tta, stats.total, full_ms, 1.0, "ref");
+
+            // packed inputs have their own shapes, warm up once more
+            tta.tta_batch = true;
+            tta.process(inimage, out, stats);
+
+            double batch_ms = timed_process(tta, inimage, out, stats);
+            fprintf(stdout, "%-32s %9s %5d/%-5d %10.1f %7.2fx %10.2f\n", im.name.c_str(), "batched", stats.tta, stats.total, batch_ms, batch_ms > 0 ? full_ms / batch_ms : 0.0, psnr(outfull, out, outsize));
+
+            tta.tta_batch = false;
+
+            for (size_t j = 0; j < thresholds.size(); j++)
+            {
+                tta.tta_threshold = thresholds[j];
+
+                double ms = timed_process(tta, inimage, out, stats);
+
+                fprintf(stdout, "%-32s %9.2f %5d/%-5d %10.1f %7.2fx %10.2f\n", im.name.c_str(), thresholds[j], stats.tta, stats.total, ms, ms > 0 ? full_ms / ms : 0.0, psnr(outfull, out, outsize));
+            }
+
+            double plain_ms = timed_process(plain, inimage, out, stats);
+            fprintf(stdout, "%-32s %9s %5d/%-5d %10.1f %7.2fx %10.2f\n", im.name.c_str(), "off", 0, stats.total, plain_ms, plain_ms > 0 ? full_ms / plain_ms : 0.0, psnr(outfull, out, outsize));
+        }
+    }
+
+    if (gpuid != -1)
+        ncnn::destroy_gpu_instance();
+
+    return ret;
+}
@@ -0,0 +1,156 @@
+// chrome trace_event ring buffer
+
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+
+TraceBuffer::TraceBuffer() : on(false)
+{
+    head = 0;
+    count = 0;
+}
+
+void TraceBuffer::configure(size_t capacity)
+{
+    std::lock_guard<std::mutex> lg(lock);
+
+    ring.clear();
+    ring.resize(capacity);
+    head = 0;
+    count = 0;
+
+    on = capacity > 0;
+}
+
+bool TraceBuffer::enabled() const
+{
+    return on;
+}
+
+void TraceBuffer::record(const char* name, int64_t begin_ns, int64_t end_ns, int xi, int yi, int ti)
+{
+    if (!on)
+        return;
+
+    TraceEvent e;
+    e.name = name;
+    e.begin_ns = begin_ns;
+    e.end_ns = end_ns;
+    e.tid = thread_id();
+    e.xi = xi;
+    e.yi = yi;
+    e.ti = ti;
+
+    std::lock_guard<std::mutex> lg(lock);
+
+    if (ring.empty())
+        return;
+
+    ring[head] = e;
+    head = (head + 1) % ring.size();
+    count++;
+}
+
+void TraceBuffer::set_thread_name(const char* name)
+{
+    const int tid = thread_id();
+
+    std::lock_guard<std::mutex> lg(lock);
+
+    thread_names[tid] = name;
+}
+
+void TraceBuffer::clear()
+{
+    std::lock_guard<std::mutex> lg(lock);
+
+    head = 0;
+    count = 0;
+}
+
+size_t TraceBuffer::size() const
+{
+    std::lock_guard<std::mutex> lg(lock);
+
+    return (size_t)std::min<uint64_t>(count, ring.size());
+}
+
+uint64_t TraceBuffer::dropped() const
+{
+    std::lock_guard<std::mutex> lg(lock);
+
+    return count > ring.size() ? count - ring.size() : 0;
+}
+
+int TraceBuffer::write(FILE* fp) const
+{
+    // copy out so tracing threads are not held up by file io
+    std::vector<TraceEvent> events;
+    std::map<int, std::string> names;
+    {
+        std::lock_guard<std::mutex> lg(lock);
+
+        const size_t n = (size_t)std::min<uint64_t>(count, ring.size());
+        events.reserve(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            // oldest first
+            events.push_back(ring[(head + ring.size() - n + i) % ring.size()]);
+        }
+
+        names = thread_names;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    bool first = true;
+    for (std::map<int, std::string>::const_iterator it = names.begin(); it != names.end(); ++it)
+    {
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", it->first, it->second.c_str());
+        first = false;
+    }
+
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        const TraceEvent& e = events[i];
+
+        // complete events, microseconds
+        fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"realcugan\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"xi\":%d,\"yi\":%d,\"ti\":%d}}", first ? "" : ",\n", e.name, e.tid, e.begin_ns / 1e3, (e.end_ns - e.begin_ns) / 1e3, e.xi, e.yi, e.ti);
+        first = false;
+    }
+
+    fprintf(fp, "\n]}\n");
+
+    return ferror(fp) ? -1 : 0;
+}
+
+int TraceBuffer::write(const std::string& path) const
+{
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "open %s failed\n", path.c_str());
+        return -1;
+    }
+
+    int ret = write(fp);
+
+    if (fclose(fp) != 0)
+        ret = -1;
+
+    return ret;
+}
+
+int64_t TraceBuffer::now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int TraceBuffer::thread_id()
+{
+    static std::atomic<int> next_tid(1);
+    static thread_local int tid = next_tid++;
+
+    return tid;
+}
@@ -0,0 +1,27 @@
+package com.akari.realcugan_ncnn_android
+
+import android.graphics.Bitmap
+
+/**
+ * 限时处理的结果，见 [RealCUGAN.processWithin]。
+ * - 分块按 TTA → 单方向 → 双三次插值的顺序降档，三个计数之和为总分块数
+ */
+data class BudgetResult(
+    /** 输出图像 */
+    val bitmap: Bitmap,
+    /** 实际使用的 syncgap 模式 */
+    val syncgap: Int,
+    /** 跑了 TTA 的分块数 */
+    val ttaTiles: Int,
+    /** 只跑单方向的分块数 */
+    val singleTiles: Int,
+    /** 退到双三次插值的分块数 */
+    val bicubicTiles: Int,
+    /** 开始前预测的耗时（毫秒） */
+    val predictedMs: Double,
+    /** 实际耗时（毫秒） */
+    val elapsedMs: Double,
+) {
+    /** 是否有分块降了档 */
+    val degraded: Boolean get() = bicubicTiles > 0
+}
@@ -0,0 +1,24 @@
+package com.akari.realcugan_ncnn_android
+
+/**
+ * 处理一张图之前预测的代价，见 [RealCUGAN.estimate]。
+ * - FLOPs 按模型 .param 中各层的权重数和分块规划计算，包括 SE 同步的各阶段和 TTA 的 8 个方向
+ * - 开启自适应 TTA 时按每个分块都跑 TTA 计算，是上界
+ */
+data class CostEstimate(
+    /** 输出分块数 */
+    val tiles: Int,
+    /** 模型推理次数 */
+    val passes: Int,
+    /** 浮点运算量 */
+    val flops: Double,
+    /** 预测耗时（毫秒），未标定时为 0 */
+    val timeMs: Double,
+    /** 峰值内存（字节），含输入和输出图像 */
+    val hostBytes: Long,
+    /** 峰值显存（字节），CPU 模式为 0 */
+    val deviceBytes: Long,
+) {
+    /** 耗时是否可用 */
+    val calibrated: Boolean get() = timeMs > 0.0
+}
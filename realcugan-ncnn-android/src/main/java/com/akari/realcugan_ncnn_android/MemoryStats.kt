@@ -0,0 +1,21 @@
+package com.akari.realcugan_ncnn_android
+
+/**
+ * 最近一次推理按来源划分的内存占用，见 [RealCUGAN.memoryStats]，用于排查 OOM。
+ * - 每次推理开始时峰值重置为当时的占用，所有实例共用同一份统计，并发推理时会混在一起
+ * - [total] 的峰值是同一时刻的合计，不等于各项峰值之和
+ */
+data class MemoryStats(
+    /** 合计 */
+    val total: MemoryUsage,
+    /** CPU 模式下模型的中间结果 */
+    val cpuBlob: MemoryUsage,
+    /** CPU 模式下的输入输出分块 */
+    val cpuTile: MemoryUsage,
+    /** GPU 上的中间结果、分块和 SE 特征缓存 */
+    val vkBlob: MemoryUsage,
+    /** GPU 上传下载用的中转缓冲 */
+    val vkStaging: MemoryUsage,
+    /** 输出图像 */
+    val output: MemoryUsage,
+)
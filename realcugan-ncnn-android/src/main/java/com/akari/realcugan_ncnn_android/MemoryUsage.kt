@@ -0,0 +1,13 @@
+package com.akari.realcugan_ncnn_android
+
+/**
+ * 一类内存在最近一次推理中的占用，见 [MemoryStats]。
+ */
+data class MemoryUsage(
+    /** 当前占用（字节） */
+    val currentBytes: Long,
+    /** 推理过程中的峰值（字节） */
+    val peakBytes: Long,
+    /** 分配次数 */
+    val allocations: Long,
+)
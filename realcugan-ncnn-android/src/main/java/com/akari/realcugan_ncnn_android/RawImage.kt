@@ -0,0 +1,17 @@
+package com.akari.realcugan_ncnn_android
+
+import java.io.File
+
+/**
+ * [RealCUGAN.processToFile] 的输出：[file] 中按行存放 [width]×[height] 个像素，
+ * 每个像素 [channels] 个字节（3 = RGB，4 = RGBA），没有文件头。
+ */
+data class RawImage(
+    val file: File,
+    val width: Int,
+    val height: Int,
+    val channels: Int,
+) {
+    /** 一行像素的字节数 */
+    val rowBytes: Long get() = width.toLong() * channels
+}
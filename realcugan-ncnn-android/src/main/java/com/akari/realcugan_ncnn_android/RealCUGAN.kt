@@ -6,9 +6,12 @@ import android.graphics.Bitmap
 import android.graphics.BitmapFactory
 import android.util.Log
 import androidx.core.graphics.createBitmap
+import kotlinx.coroutines.CancellationException
 import kotlinx.coroutines.CoroutineDispatcher
 import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.async
 import kotlinx.coroutines.asCoroutineDispatcher
+import kotlinx.coroutines.coroutineScope
 import kotlinx.coroutines.withContext
 import java.io.File
 import java.io.FileOutputStream
@@ -20,7 +23,7 @@ class RealCUGAN private constructor(
     private val scaleFactor: Int
 ) {
     // 只有调用 nativeProcessImage 部分运行在这个 dispatcher 上
-    private val gpuDispatcher: CoroutineDispatcher by lazy {
+    internal val gpuDispatcher: CoroutineDispatcher by lazy {
         Executors.newCachedThreadPool {
             Thread(it, "RealCUGAN-GPU").apply {
                 priority = Thread.MAX_PRIORITY
@@ -29,9 +32,36 @@ class RealCUGAN private constructor(
         }.asCoroutineDispatcher()
     }
 
+    // estimate() 的耗时预测需要先标定一次
+    @Volatile
+    private var calibrated = false
+
+    /**
+     * 在 gpuDispatcher 上运行一次 native 推理，[block] 收到取消令牌。
+     * - 协程被取消（包括 withTimeout 超时）时通知 native 层，正在跑的分块结束后就返回，不再白算剩下的分块
+     * - native 调用返回之前不会离开本函数，令牌随后释放
+     */
+    private suspend fun <T> runCancellable(block: (Long) -> T): T {
+        val cancelHandle = nativeCreateCancel()
+        try {
+            return coroutineScope {
+                val work = async(gpuDispatcher) { block(cancelHandle) }
+                try {
+                    work.await()
+                } catch (e: CancellationException) {
+                    nativeCancel(cancelHandle)
+                    throw e
+                }
+            }
+        } finally {
+            nativeReleaseCancel(cancelHandle)
+        }
+    }
+
     /**
      * 对一段 PNG/JPEG/WebP 的字节做推理，返回 ARGB_8888 的 Bitmap。
      * 全流程：头部解码 → JNI 计算(切到 gpuDispatcher) → 拼装输出 Bitmap
+     * 协程取消后 native 推理在当前分块结束时停止
      */
     suspend fun process(imageData: ByteArray): Bitmap = withContext(Dispatchers.IO) {
         // 1) 先解一次头，拿到原始尺寸
@@ -40,11 +70,106 @@ class RealCUGAN private constructor(
         val outH = srcBmp.height * scaleFactor
 
         // 2) 真正跑 native 推理，只在 gpuDispatcher 线程池
-        val raw = withContext(gpuDispatcher) {
-            nativeProcessImage(nativeHandle, imageData)
+        val raw = runCancellable { cancelHandle ->
+            nativeProcessImage(nativeHandle, imageData, cancelHandle, null)
         }
 
         // 3) 拼装输出 Bitmap（IO 线程）
+        val outBmp = rawToBitmap(raw, outW, outH)
+        Log.i("RealCUGAN", "process → Bitmap ready $outW×$outH")
+        outBmp
+    }
+
+    /**
+     * 同 [process]，并返回解码、上传、推理、下载等各阶段的耗时，用于定位瓶颈。
+     * - GPU 模式下每个阶段单独提交等待，耗时比 [process] 长，不要在正式处理中使用
+     */
+    suspend fun processWithStats(imageData: ByteArray): Pair<Bitmap, StageStats> = withContext(Dispatchers.IO) {
+        val srcBmp = BitmapFactory.decodeByteArray(imageData, 0, imageData.size)
+        val outW = srcBmp.width * scaleFactor
+        val outH = srcBmp.height * scaleFactor
+
+        val v = DoubleArray(16)
+        val raw = runCancellable { cancelHandle ->
+            nativeProcessImage(nativeHandle, imageData, cancelHandle, v)
+        }
+
+        val outBmp = rawToBitmap(raw, outW, outH)
+        val stats = StageStats(
+            v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], v[9], v[10],
+            v[11].toInt(), v[12].toLong(), v[13].toLong(), v[14].toInt(), v[15].toInt()
+        )
+        Log.i("RealCUGAN", "processWithStats → ${stats.totalMs} ms, net ${stats.netMs} ms")
+        outBmp to stats
+    }
+
+    /**
+     * 在 [budgetMs] 毫秒内完成推理，时间不够时自动降低质量而不是超时。
+     * - 开始前按之前测到的分块耗时选能赶上的最高档：TTA、syncgap 1/2/3
+     * - 运行中跑慢了，剩下的分块先关 TTA，再退到双三次插值
+     * - 分块耗时在同一实例的多次调用间累积，第一次调用的预测偏保守
+     *
+     * @return 输出图像及各档位实际处理的分块数
+     */
+    suspend fun processWithin(imageData: ByteArray, budgetMs: Long): BudgetResult = withContext(Dispatchers.IO) {
+        val srcBmp = BitmapFactory.decodeByteArray(imageData, 0, imageData.size)
+        val outW = srcBmp.width * scaleFactor
+        val outH = srcBmp.height * scaleFactor
+
+        val report = DoubleArray(6)
+        val raw = runCancellable { cancelHandle ->
+            nativeProcessImageWithin(nativeHandle, imageData, budgetMs.toDouble(), cancelHandle, report)
+        } ?: throw RuntimeException("RealCUGAN processWithin failed")
+
+        val outBmp = rawToBitmap(raw, outW, outH)
+        Log.i("RealCUGAN", "processWithin → ${report[5].toLong()}/$budgetMs ms, syncgap ${report[0].toInt()}")
+        BudgetResult(
+            outBmp,
+            report[0].toInt(),
+            report[1].toInt(),
+            report[2].toInt(),
+            report[3].toInt(),
+            report[4],
+            report[5]
+        )
+    }
+
+    /**
+     * 不跑模型，预测处理一张 [width]×[height] 的图需要的时间和峰值内存，供调度队列做准入和排序。
+     * - 第一次调用时先在 gpuDispatcher 上标定一次（一个整块和一个半块的推理），之后只做计算
+     *
+     * @param channels 3 为 RGB，4 为 RGBA
+     */
+    suspend fun estimate(width: Int, height: Int, channels: Int = 4): CostEstimate {
+        if (!calibrated) calibrate()
+        val v = nativeEstimate(nativeHandle, width, height, channels)
+            ?: throw RuntimeException("RealCUGAN estimate failed")
+        return CostEstimate(v[0].toInt(), v[1].toInt(), v[2], v[3], v[4].toLong(), v[5].toLong())
+    }
+
+    /**
+     * 测量本实例在当前设备上的吞吐，[estimate] 的耗时预测依赖它。
+     * 设备负载明显变化（降频、后台任务）后可以重新标定
+     */
+    suspend fun calibrate() = withContext(gpuDispatcher) {
+        val ret = nativeCalibrate(nativeHandle)
+        require(ret == 0) { "RealCUGAN nativeCalibrate failed: $ret" }
+        calibrated = true
+    }
+
+    /**
+     * 为反复编辑的同一张图创建增量会话，见 [RealCUGANSession]。
+     *
+     * @param resyncThreshold SE 模式下累计变化像素超过整图的这个比例才重新同步全局特征
+     */
+    fun createSession(resyncThreshold: Float = 0.05f): RealCUGANSession {
+        val sessionHandle = nativeCreateSession(nativeHandle, resyncThreshold)
+        require(sessionHandle >= 1L) { "RealCUGAN nativeCreateSession failed: $sessionHandle" }
+        return RealCUGANSession(this, sessionHandle, scaleFactor)
+    }
+
+    /** RGB/RGBA 原始像素 → ARGB_8888 Bitmap */
+    internal fun rawToBitmap(raw: ByteArray, outW: Int, outH: Int): Bitmap {
         val outBmp = createBitmap(outW, outH)
         when (raw.size) {
             // RGBA
@@ -71,10 +196,54 @@ class RealCUGAN private constructor(
                 "Unexpected pixel buffer size: ${raw.size}, expected ${outW * outH * 3} or ${outW * outH * 4}"
             )
         }
-        Log.i("RealCUGAN", "process → Bitmap ready $outW×$outH")
-        outBmp
+        return outBmp
+    }
+
+    /**
+     * 对一段 PNG/JPEG/WebP 的字节做推理，结果直接写入 [outputFile]，适合 Bitmap/byte[] 装不下的超大输出。
+     * - 文件内容为逐行排列的原始 RGB 或 RGBA 像素（每通道 8bit，无文件头），尺寸见返回值
+     * - native 层把文件 mmap 后按分块逐条写入，内存占用与输出尺寸无关
+     * - [resumable] 为 true 时每隔约 5 秒在 `outputFile.ckpt` 记录已完成的行带，
+     *   进程被杀或切后台后用相同输入和参数再次调用，会从第一个未完成的行带继续，完成后检查点自动删除；
+     *   协程被取消时也会先记下已完成的行带
+     *
+     * @param outputFile 输出文件，已存在时会被覆盖（可续跑时保留其中已完成的部分）
+     * @return 输出文件及其宽高、通道数
+     */
+    suspend fun processToFile(imageData: ByteArray, outputFile: File, resumable: Boolean = false): RawImage {
+        val dims = runCancellable { cancelHandle ->
+            nativeProcessImageToFile(nativeHandle, imageData, outputFile.absolutePath, resumable, cancelHandle)
+        } ?: throw RuntimeException("RealCUGAN processToFile failed: ${outputFile.absolutePath}")
+        Log.i("RealCUGAN", "processToFile → ${outputFile.name} ${dims[0]}×${dims[1]}×${dims[2]}")
+        return RawImage(outputFile, dims[0], dims[1], dims[2])
+    }
+
+    /**
+     * 批量处理多张 PNG/JPEG/WebP，结果按 [outputFiles] 的扩展名编码写盘（.webp/.jpg/.jpeg，其余为 PNG）。
+     * - native 层按解码 → 推理 → 编码三段流水线运行，段间是有界队列，
+     *   第 N+1 张的解码和第 N-1 张的编码与第 N 张的推理同时进行
+     * - 单张失败不影响其它图片
+     * - 协程取消后正在推理的图在当前分块结束时停止，剩下的图不再处理
+     *
+     * @return 每张图的结果，0 为成功
+     */
+    suspend fun processBatch(inputs: List<ByteArray>, outputFiles: List<File>): IntArray {
+        require(inputs.size == outputFiles.size) { "inputs and outputFiles differ in size" }
+        val status = runCancellable { cancelHandle ->
+            nativeProcessBatch(
+                nativeHandle,
+                inputs.toTypedArray(),
+                outputFiles.map { it.absolutePath }.toTypedArray(),
+                cancelHandle
+            )
+        } ?: throw RuntimeException("RealCUGAN processBatch failed")
+        Log.i("RealCUGAN", "processBatch → ${status.count { it == 0 }}/${status.size} done")
+        return status
     }
 
+    /**
+     * 释放句柄，不等待：正在进行的调用在原实例上做完，实例随最后一个调用释放。
+     */
     fun release() {
         nativeRelease(nativeHandle)
     }
@@ -88,18 +257,95 @@ class RealCUGAN private constructor(
             syncgap: Int?,
             modelName: String?,
             ttaMode: Boolean?,
-            gpuId: Int?
+            ttaThreshold: Float,
+            ttaBatch: Boolean,
+            gpuId: Int?,
+            cpuPrecision: Int
         ): Long
 
         @JvmStatic
         private external fun nativeProcessImage(
             handle: Long,
-            imageData: ByteArray
+            imageData: ByteArray,
+            cancelHandle: Long,
+            stats: DoubleArray?
         ): ByteArray
 
+        @JvmStatic
+        private external fun nativeProcessImageWithin(
+            handle: Long,
+            imageData: ByteArray,
+            budgetMs: Double,
+            cancelHandle: Long,
+            report: DoubleArray
+        ): ByteArray?
+
+        @JvmStatic
+        private external fun nativeProcessImageToFile(
+            handle: Long,
+            imageData: ByteArray,
+            outputPath: String,
+            resumable: Boolean,
+            cancelHandle: Long
+        ): IntArray?
+
+        @JvmStatic
+        private external fun nativeProcessBatch(
+            handle: Long,
+            inputs: Array<ByteArray>,
+            outputs: Array<String>,
+            cancelHandle: Long
+        ): IntArray?
+
+        @JvmStatic
+        private external fun nativeCalibrate(handle: Long): Int
+
+        @JvmStatic
+        private external fun nativeEstimate(handle: Long, width: Int, height: Int, channels: Int): DoubleArray?
+
+        @JvmStatic
+        private external fun nativeCreateCancel(): Long
+
+        @JvmStatic
+        private external fun nativeCancel(cancelHandle: Long)
+
+        @JvmStatic
+        private external fun nativeReleaseCancel(cancelHandle: Long)
+
         @JvmStatic
         private external fun nativeRelease(handle: Long)
 
+        @JvmStatic
+        private external fun nativeCreateSession(handle: Long, resyncThreshold: Float): Long
+
+        @JvmStatic
+        private external fun nativeConfigureTileCache(
+            maxMemoryBytes: Long,
+            spillDir: String?,
+            maxSpillBytes: Long
+        )
+
+        @JvmStatic
+        private external fun nativeGetTileCacheStats(): LongArray
+
+        @JvmStatic
+        private external fun nativeGetMemoryStats(): LongArray
+
+        @JvmStatic
+        private external fun nativeGetMetrics(): String
+
+        @JvmStatic
+        private external fun nativeResetMetrics()
+
+        @JvmStatic
+        private external fun nativeSetVerboseLogging(enabled: Boolean)
+
+        @JvmStatic
+        private external fun nativeConfigureTrace(capacity: Int)
+
+        @JvmStatic
+        private external fun nativeWriteTrace(outputPath: String): Boolean
+
         /**
          * 创建一个RealCUGAN实例。
          * - 非必要请只创建一个实例
@@ -118,14 +364,96 @@ class RealCUGAN private constructor(
                     realCUGANOption.noise,
                     realCUGANOption.scale,
                     realCUGANOption.syncgap,
-                    realCUGANOption.modelName.dir,
+                    realCUGANOption.modelDir,
                     realCUGANOption.ttaMode,
-                    realCUGANOption.gpuId
+                    realCUGANOption.ttaThreshold,
+                    realCUGANOption.ttaBatch,
+                    realCUGANOption.gpuId,
+                    realCUGANOption.cpuPrecision.ordinal
                 )
                 require(handle >= 1L) { "RealCUGAN nativeInitialize failed: $handle" }
                 return@withContext RealCUGAN(handle, realCUGANOption.scale)
             }
 
+        /**
+         * 配置所有实例共用的输出分块缓存，默认关闭。
+         * - 分块按“带边缘填充的输入像素 + 模型 + noise/scale/tta + SE 特征”做内容寻址，
+         *   重复或重叠的请求（同一张图反复查看、局部区域）直接拷贝已有结果
+         * - 内存满了按 LRU 把分块写入 [spillDir]，目录也满了才丢弃
+         *
+         * @param maxMemoryBytes 内存上限，0 关闭缓存并清空
+         * @param spillDir 溢出目录，null 表示不溢出
+         * @param maxSpillBytes 溢出目录上限
+         */
+        fun configureTileCache(maxMemoryBytes: Long, spillDir: File? = null, maxSpillBytes: Long = 0L) {
+            System.loadLibrary("realcugan_ncnn_android")
+            spillDir?.mkdirs()
+            nativeConfigureTileCache(maxMemoryBytes, spillDir?.absolutePath, maxSpillBytes)
+        }
+
+        /** 输出分块缓存的命中/未命中/字节统计 */
+        fun tileCacheStats(): TileCacheStats {
+            System.loadLibrary("realcugan_ncnn_android")
+            val v = nativeGetTileCacheStats()
+            return TileCacheStats(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], v[9])
+        }
+
+        /**
+         * 最近完成的一次推理的内存占用，按 CPU 中间结果、CPU 分块、GPU 中间结果、GPU 中转缓冲、输出图像分别统计峰值。
+         * 每次推理单独计数，并发时不会混入其它调用的分配。
+         */
+        fun memoryStats(): MemoryStats {
+            System.loadLibrary("realcugan_ncnn_android")
+            val v = nativeGetMemoryStats()
+            val u = List(v.size / 3) { MemoryUsage(v[it * 3], v[it * 3 + 1], v[it * 3 + 2]) }
+            return MemoryStats(u[0], u[1], u[2], u[3], u[4], u[5])
+        }
+
+        /**
+         * 所有实例共用的运行指标快照（JSON），可定期上报：
+         * - counters：处理的图像数、失败/取消/内存不足次数、分块总数及其中推理、TTA、重复、缓存命中、双三次的分块数、实例复用次数
+         * - gauges：已加载的实例数、正在处理的调用数
+         * - latency：按模型和模式（cpu/gpu、syncgap、tta）分的耗时直方图，桶上界见 latency_bounds_ms，最后一桶不设上界
+         */
+        fun metricsJson(): String {
+            System.loadLibrary("realcugan_ncnn_android")
+            return nativeGetMetrics()
+        }
+
+        /** 计数器和耗时直方图清零，实例数等仪表值不变 */
+        fun resetMetrics() {
+            System.loadLibrary("realcugan_ncnn_android")
+            nativeResetMetrics()
+        }
+
+        /**
+         * 开关每个请求的 logcat 信息日志（实例参数、开始/结束、输出尺寸等），默认关闭。
+         * 错误日志不受影响，统计请用 [metricsJson]。
+         */
+        fun setVerboseLogging(enabled: Boolean) {
+            System.loadLibrary("realcugan_ncnn_android")
+            nativeSetVerboseLogging(enabled)
+        }
+
+        /**
+         * 开关所有实例共用的执行时间线，记录每个分块各阶段（上传、预处理、推理、后处理、下载）、
+         * SE 各阶段以及解码/拷回的起止时间、线程、分块坐标和 TTA 方向。
+         * - 事件存在环形缓冲里，只保留最近 [capacity] 条，常开的开销很小
+         * - GPU 阶段记录的是提交命令的耗时，要看 GPU 实际耗时请配合 [processWithStats]
+         *
+         * @param capacity 保留的事件数，0 关闭并清空
+         */
+        fun configureTrace(capacity: Int = 65536) {
+            System.loadLibrary("realcugan_ncnn_android")
+            nativeConfigureTrace(capacity)
+        }
+
+        /** 把缓冲中的事件写成 Chrome trace_event JSON，可在 ui.perfetto.dev 打开 */
+        fun writeTrace(outputFile: File): Boolean {
+            System.loadLibrary("realcugan_ncnn_android")
+            return nativeWriteTrace(outputFile.absolutePath)
+        }
+
         internal fun copyModels(context: Context): File {
             val destRoot = File(context.filesDir, "models")
             if (!destRoot.exists()) {
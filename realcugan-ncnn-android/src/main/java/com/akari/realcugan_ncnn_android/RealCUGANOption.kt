@@ -13,6 +13,21 @@ enum class ModelName(val dir: String, val allowedScales: IntRange, val allowedNo
     }
 }
 
+/**
+ * CPU 推理精度，与 native 的 RealCUGANPrecision 顺序一致；GPU 始终用 fp16 存储，不受影响。
+ * 加载时会在合成分块上与 fp32 对比，PSNR 低于 40 dB 时自动退回 FP32。
+ */
+enum class CpuPrecision {
+    /** fp32 存储与计算（默认） */
+    FP32,
+    /** fp16 存储、fp32 计算，特征图带宽减半 */
+    FP16_STORAGE,
+    /** fp16 存储与计算，需要 ARMv8.2 fp16，不支持时 ncnn 退回 fp16 存储 */
+    FP16_ARITHMETIC,
+    /** bf16 存储、fp32 计算，动态范围与 fp32 相同 */
+    BF16_STORAGE,
+}
+
 /**
  * 封装调用本地 RealCUGAN 初始化所需的各项参数，并在构造时进行严格校验。
  *
@@ -48,12 +63,36 @@ enum class ModelName(val dir: String, val allowedScales: IntRange, val allowedNo
  *   - false：关闭（默认）
  *   - true ：开启
  *
+ * @param ttaThreshold
+ *   自适应 TTA 阈值，仅在 ttaMode 开启时生效。
+ *   - 0：所有分块都跑完整的 8 方向 TTA（默认）
+ *   - >0：分块的平均亮度梯度低于该值时只跑 1 个方向，纯色、渐变、大片留白不再付 8 倍开销；
+ *     建议从 4 左右开始尝试，用 tools 下的 realcugan-tta-bench 对比速度和 PSNR
+ *   边界校验：必须 >= 0，否则抛 IllegalArgumentException。
+ *
+ * @param ttaBatch
+ *   TTA 分块把 4 个正向、4 个转置方向各拼成一张图，只推理 2 次而不是 8 次，仅在 ttaMode 开启时生效。
+ *   - false：逐方向推理（默认）
+ *   - true ：拼接推理，更快；SE 的全局均值会跨方向共享，输出与逐方向推理有细微差别
+ *
  * @param gpuId
  *   GPU 设备 ID：
  *   - -1：仅 CPU
  *   - >=0：对应 ncnn 可用的 GPU 索引
  *   边界校验：必须 >= -1，否则抛 IllegalArgumentException。
  *
+ * @param int8
+ *   使用 realcugan-quantize 量化出的 INT8 模型，放在 assets/models/<modelName.dir>-int8 下，文件名与原模型相同。
+ *   - false：原 fp32 模型（默认）
+ *   - true ：卷积走 INT8 内核，在支持 dotprod 的 ARM CPU 上明显更快，画质略有损失
+ *   边界校验：只能在 CPU 上运行，gpuId 必须为 -1，否则抛 IllegalArgumentException。
+ *
+ * @param cpuPrecision
+ *   CPU 路径的推理精度，见 [CpuPrecision]，仅在 gpuId 为 -1 时生效。
+ *   - FP32：默认
+ *   - 其余模式加载时先与 fp32 对比画质，不达标会自动退回 FP32 并在 logcat 打印警告；
+ *     用 tools 下的 realcugan-precision-bench 对比速度、画质和带宽
+ *
  * 使用示例：
  * ```
  * // 双倍放大 + 保守去噪 + 序列化模型-se + 开启 TTA + 默认 GPU
@@ -75,12 +114,22 @@ class RealCUGANOption(
     val syncgap: Int? = 3,
     val modelName: ModelName = ModelName.SE,
     val ttaMode: Boolean = false,
+    val ttaThreshold: Float = 0f,
+    val ttaBatch: Boolean = false,
     val gpuId: Int? = null,
+    val int8: Boolean = false,
+    val cpuPrecision: CpuPrecision = CpuPrecision.FP32,
 ) {
 
+    /** 传给 native 的模型目录 */
+    val modelDir: String
+        get() = if (int8) "${modelName.dir}-int8" else modelName.dir
+
     init {
         require(syncgap in 0..3) { "syncgap 必须在 0..3 之间，但传入是 $syncgap" }
+        require(ttaThreshold >= 0f) { "ttaThreshold 必须 >= 0，但传入是 $ttaThreshold" }
         require(gpuId == null || gpuId >= -1) { "gpuId 必须 >= -1，但传入是 $gpuId" }
+        require(!int8 || gpuId == -1) { "INT8 模型只能在 CPU 上运行，gpuId 必须为 -1，但传入是 $gpuId" }
 
         require(scale in modelName.allowedScales) {
             "在 ${modelName.dir} 下，scale 必须在 ${modelName.allowedScales} 中，但传入的是 $scale"
@@ -0,0 +1,50 @@
+package com.akari.realcugan_ncnn_android
+
+import android.graphics.Bitmap
+import android.graphics.BitmapFactory
+import android.util.Log
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.withContext
+
+/**
+ * 同一张图反复编辑后再放大的增量会话，由 [RealCUGAN.createSession] 创建。
+ * - native 层保留上一版的输入、输出和 SE 全局特征
+ * - 新版本与上一版逐像素比较，只重算输入（含边缘填充）有变化的分块，其余分块原样保留
+ * - SE 模式下小改动沿用上一版的全局特征，累计变化超过阈值才整图重新同步
+ * - 尺寸变化时自动整图重算
+ * - 同一会话的调用按顺序执行；会话随 [RealCUGAN.release] 一起失效
+ */
+class RealCUGANSession internal constructor(
+    private val owner: RealCUGAN,
+    private val sessionHandle: Long,
+    private val scaleFactor: Int
+) {
+    /**
+     * 处理同一张图的新版本，返回 ARGB_8888 的 Bitmap。
+     */
+    suspend fun process(imageData: ByteArray): Bitmap = withContext(Dispatchers.IO) {
+        val srcBmp = BitmapFactory.decodeByteArray(imageData, 0, imageData.size)
+        val outW = srcBmp.width * scaleFactor
+        val outH = srcBmp.height * scaleFactor
+
+        val raw = withContext(owner.gpuDispatcher) {
+            nativeProcess(sessionHandle, imageData)
+        } ?: throw RuntimeException("RealCUGANSession process failed")
+
+        val outBmp = owner.rawToBitmap(raw, outW, outH)
+        Log.i("RealCUGAN", "session process → Bitmap ready $outW×$outH")
+        outBmp
+    }
+
+    fun release() {
+        nativeRelease(sessionHandle)
+    }
+
+    companion object {
+        @JvmStatic
+        private external fun nativeProcess(sessionHandle: Long, imageData: ByteArray): ByteArray?
+
+        @JvmStatic
+        private external fun nativeRelease(sessionHandle: Long)
+    }
+}
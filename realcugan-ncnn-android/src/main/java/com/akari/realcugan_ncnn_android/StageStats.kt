@@ -0,0 +1,41 @@
+package com.akari.realcugan_ncnn_android
+
+/**
+ * 一次推理各阶段的耗时（毫秒），见 [RealCUGAN.processWithStats]。
+ * - GPU 模式下每个阶段单独提交并等待，统计时整体会比 [RealCUGAN.process] 慢
+ * - 各阶段之和小于 [totalMs]，差值为分块调度、复用已有分块等开销
+ */
+data class StageStats(
+    /** 解码输入图像 */
+    val decodeMs: Double,
+    /** 像素与 Mat 之间的转换 */
+    val pixelMs: Double,
+    /** 上传到 GPU */
+    val uploadMs: Double,
+    /** 预处理 */
+    val preprocMs: Double,
+    /** 模型推理 */
+    val netMs: Double,
+    /** alpha 通道双三次放大 */
+    val alphaMs: Double,
+    /** 后处理 */
+    val postprocMs: Double,
+    /** 从 GPU 下载 */
+    val downloadMs: Double,
+    /** SE 分段同步（syncgap 1/2/3） */
+    val seSyncMs: Double,
+    /** 拷回 Java 数组 */
+    val copyoutMs: Double,
+    /** 整个调用 */
+    val totalMs: Double,
+    /** 模型推理次数 */
+    val inferences: Int,
+    /** 上传字节数 */
+    val uploadBytes: Long,
+    /** 下载字节数 */
+    val downloadBytes: Long,
+    /** 分块总数 */
+    val tiles: Int,
+    /** 实际推理的分块数 */
+    val computedTiles: Int,
+)
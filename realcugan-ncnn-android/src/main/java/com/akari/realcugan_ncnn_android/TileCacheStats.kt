@@ -0,0 +1,32 @@
+package com.akari.realcugan_ncnn_android
+
+/**
+ * 输出分块缓存的累计统计，见 [RealCUGAN.configureTileCache]。
+ * - 命中的分块直接拷贝已有结果，不再跑模型
+ * - 超出内存上限的分块先写入溢出目录，目录也满了才丢弃
+ */
+data class TileCacheStats(
+    /** 命中次数 */
+    val hits: Long,
+    /** 未命中次数 */
+    val misses: Long,
+    /** 命中时拷贝出去的字节数 */
+    val hitBytes: Long,
+    /** 写入的分块数 */
+    val insertions: Long,
+    /** 被丢弃的分块数 */
+    val evictions: Long,
+    /** 写入溢出目录的次数 */
+    val spills: Long,
+    /** 从溢出目录读回的命中次数 */
+    val spillHits: Long,
+    /** 当前内存占用（字节） */
+    val memoryBytes: Long,
+    /** 当前溢出目录占用（字节） */
+    val spillBytes: Long,
+    /** 当前分块数 */
+    val entries: Long,
+) {
+    /** 命中率，没有请求时为 0 */
+    val hitRate: Double get() = if (hits + misses == 0L) 0.0 else hits.toDouble() / (hits + misses)
+}
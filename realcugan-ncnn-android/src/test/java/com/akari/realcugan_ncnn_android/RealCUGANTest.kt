@@ -80,6 +80,17 @@ class RealCUGANOptionTest {
         RealCUGANOption(context, gpuId = -2)
     }
 
+    // —— ttaThreshold 边界测试 ——
+    @Test
+    fun `ttaThreshold defaults to full tta`() {
+        assertEquals(0f, RealCUGANOption(context, ttaMode = true).ttaThreshold, 0f)
+    }
+
+    @Test(expected = IllegalArgumentException::class)
+    fun `negative ttaThreshold should throw`() {
+        RealCUGANOption(context, ttaMode = true, ttaThreshold = -1f)
+    }
+
     // —— 针对 ModelName.NOSE 的 scale/noise 测试 ——
     @Test
     fun `ModelNameNOSE valid combo`() {